@@ -0,0 +1,478 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../render.h"
+
+// Writes images as PPM, PNG and QOI through render_write_image(), decodes the PNG and QOI with the
+// independent decoders below (a whole inflate, PNG unfiltering and chunk CRCs, QOI per its spec) and checks
+// they come out byte for byte the same as the PPM. The images are a rendered example scene and synthetic
+// ones that hit the encoders' edge cases: one pixel, one column, noise that defeats every filter and match,
+// flat runs longer than QOI's, and heights that split into several PNG bands. Exits 1 on any difference.
+// Run with make check, which writes the images into the build directory
+
+#define CHECK_THREADS 4	//PNG bands compress in parallel, so more than one thread is part of what's checked
+#define MAX_CODE_BITS 15
+
+typedef struct{	//Bytes a decoder reads, and how far it got
+	unsigned char* bytes;
+	size_t size;
+	size_t position;
+	unsigned int bits;	//Deflate reads least significant bit first
+	int bit_count;
+	int failed;	//Ran past the end
+} Reader;
+
+typedef struct{	//Canonical Huffman code, as counts of codes per length and the symbols in code order
+	short counts[MAX_CODE_BITS + 1];
+	short symbols[288];
+} Huffman;
+
+const short length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const short length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const short distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+									4097, 6145, 8193, 12289, 16385, 24577 };
+const short distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const int code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+unsigned char* read_file( const char* file_name, size_t* size ){	//NULL if it can't be read
+	FILE* input = fopen( file_name, "rb" );
+	if( input == NULL ){
+		return NULL;
+	}
+	fseek( input, 0, SEEK_END );
+	*size = ftell( input );
+	fseek( input, 0, SEEK_SET );
+	unsigned char* bytes = malloc( *size > 0 ? *size : 1 );
+	if( bytes != NULL && fread( bytes, 1, *size, input ) != *size ){
+		free( bytes );
+		bytes = NULL;
+	}
+	fclose( input );
+	return bytes;
+}
+
+unsigned int read_u32( unsigned char* bytes ){	//Big endian
+	return (unsigned int)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+int read_bits( Reader* reader, int count ){
+	while( reader->bit_count < count ){
+		if( reader->position >= reader->size ){
+			reader->failed = 1;
+			return 0;
+		}
+		reader->bits |= (unsigned int)reader->bytes[reader->position++] << reader->bit_count;
+		reader->bit_count += 8;
+	}
+	int value = reader->bits & ( ( 1u << count ) - 1 );
+	reader->bits >>= count;
+	reader->bit_count -= count;
+	return value;
+}
+
+void build_huffman( Huffman* code, unsigned char* lengths, int count ){
+	short offsets[MAX_CODE_BITS + 1];
+	memset( code->counts, 0, sizeof(code->counts) );
+	for( int i = 0; i < count; i++ ){
+		code->counts[lengths[i]]++;
+	}
+	code->counts[0] = 0;
+	offsets[1] = 0;
+	for( int length = 1; length < MAX_CODE_BITS; length++ ){
+		offsets[length + 1] = offsets[length] + code->counts[length];
+	}
+	for( int i = 0; i < count; i++ ){
+		if( lengths[i] != 0 ){
+			code->symbols[offsets[lengths[i]]++] = i;
+		}
+	}
+}
+
+int decode_symbol( Reader* reader, Huffman* code ){	//-1 for a code that isn't in the table
+	int value = 0;
+	int first = 0;
+	int index = 0;
+	for( int length = 1; length <= MAX_CODE_BITS; length++ ){
+		value |= read_bits( reader, 1 );
+		int count = code->counts[length];
+		if( value - first < count ){
+			return code->symbols[index + value - first];
+		}
+		index += count;
+		first = ( first + count ) << 1;
+		value <<= 1;
+	}
+	return -1;
+}
+
+// Decodes one compressed block onto output, which has room for capacity bytes. 0 if it's malformed
+int inflate_codes( Reader* reader, Huffman* literals, Huffman* distances, unsigned char* output, size_t* size, size_t capacity ){
+	while( !reader->failed ){
+		int symbol = decode_symbol( reader, literals );
+		if( symbol < 0 || symbol > 285 ){
+			return 0;
+		}
+		if( symbol < 256 ){
+			if( *size >= capacity ){
+				return 0;
+			}
+			output[( *size )++] = symbol;
+		}else if( symbol == 256 ){
+			return 1;
+		}else{
+			int length = length_base[symbol - 257] + read_bits( reader, length_extra[symbol - 257] );
+			int distance_symbol = decode_symbol( reader, distances );
+			if( distance_symbol < 0 || distance_symbol > 29 ){
+				return 0;
+			}
+			size_t distance = distance_base[distance_symbol] + read_bits( reader, distance_extra[distance_symbol] );
+			if( distance > *size || *size + length > capacity ){
+				return 0;
+			}
+			for( int i = 0; i < length; i++, ( *size )++ ){
+				output[*size] = output[*size - distance];
+			}
+		}
+	}
+	return 0;
+}
+
+// Inflates a raw deflate stream into output. Returns the bytes written, or -1 if it's malformed or too big
+long inflate( Reader* reader, unsigned char* output, size_t capacity ){
+	size_t size = 0;
+	int last = 0;
+	while( !last ){
+		last = read_bits( reader, 1 );
+		int type = read_bits( reader, 2 );
+		if( type == 0 ){	//Stored, starts on a byte boundary
+			reader->bits = 0;
+			reader->bit_count = 0;
+			if( reader->position + 4 > reader->size ){
+				return -1;
+			}
+			unsigned char* header = reader->bytes + reader->position;
+			size_t length = header[0] | header[1] << 8;
+			if( ( length ^ 0xFFFF ) != (size_t)( header[2] | header[3] << 8 ) || reader->position + 4 + length > reader->size || size + length > capacity ){
+				return -1;
+			}
+			memcpy( output + size, header + 4, length );
+			size += length;
+			reader->position += 4 + length;
+			continue;
+		}
+		Huffman literals;
+		Huffman distances;
+		unsigned char lengths[320];
+		if( type == 1 ){	//Fixed codes
+			for( int i = 0; i < 288; i++ ){
+				lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+			}
+			build_huffman( &literals, lengths, 288 );
+			for( int i = 0; i < 30; i++ ){
+				lengths[i] = 5;
+			}
+			build_huffman( &distances, lengths, 30 );
+		}else if( type == 2 ){	//Dynamic codes, sent as code lengths under a code of their own
+			int literal_count = read_bits( reader, 5 ) + 257;
+			int distance_count = read_bits( reader, 5 ) + 1;
+			int length_count = read_bits( reader, 4 ) + 4;
+			if( literal_count > 286 || distance_count > 30 ){
+				return -1;
+			}
+			memset( lengths, 0, 19 );
+			for( int i = 0; i < length_count; i++ ){
+				lengths[code_length_order[i]] = read_bits( reader, 3 );
+			}
+			Huffman length_code;
+			build_huffman( &length_code, lengths, 19 );
+			int count = 0;
+			while( count < literal_count + distance_count ){
+				int symbol = decode_symbol( reader, &length_code );
+				int repeat;
+				unsigned char value = 0;
+				if( symbol < 0 ){
+					return -1;
+				}else if( symbol < 16 ){
+					lengths[count++] = symbol;
+					continue;
+				}else if( symbol == 16 ){
+					if( count == 0 ){
+						return -1;
+					}
+					value = lengths[count - 1];
+					repeat = 3 + read_bits( reader, 2 );
+				}else if( symbol == 17 ){
+					repeat = 3 + read_bits( reader, 3 );
+				}else{
+					repeat = 11 + read_bits( reader, 7 );
+				}
+				if( count + repeat > literal_count + distance_count ){
+					return -1;
+				}
+				while( repeat-- > 0 ){
+					lengths[count++] = value;
+				}
+			}
+			build_huffman( &literals, lengths, literal_count );
+			build_huffman( &distances, lengths + literal_count, distance_count );
+		}else{
+			return -1;
+		}
+		if( !inflate_codes( reader, &literals, &distances, output, &size, capacity ) ){
+			return -1;
+		}
+	}
+	return reader->failed ? -1 : (long)size;
+}
+
+unsigned int check_crc32( unsigned char* bytes, size_t size ){	//Not encode.c's, a mistake there can't cancel itself out
+	unsigned int crc = 0xFFFFFFFF;
+	for( size_t i = 0; i < size; i++ ){
+		crc ^= bytes[i];
+		for( int bit = 0; bit < 8; bit++ ){
+			crc = crc & 1 ? 0xEDB88320 ^ ( crc >> 1 ) : crc >> 1;
+		}
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+unsigned int check_adler32( unsigned char* bytes, size_t size ){
+	unsigned int a = 1;
+	unsigned int b = 0;
+	for( size_t i = 0; i < size; i++ ){
+		a = ( a + bytes[i] ) % 65521;
+		b = ( b + a ) % 65521;
+	}
+	return b << 16 | a;
+}
+
+int paeth( int left, int up, int up_left ){	//As the PNG spec writes it
+	int estimate = left + up - up_left;
+	int to_left = abs( estimate - left );
+	int to_up = abs( estimate - up );
+	int to_up_left = abs( estimate - up_left );
+	return to_left <= to_up && to_left <= to_up_left ? left : to_up <= to_up_left ? up : up_left;
+}
+
+// 8 bit RGB, non-interlaced PNG into rgb, which holds width x height pixels. Returns a reason it isn't one, or NULL
+const char* decode_png( unsigned char* bytes, size_t size, unsigned char* rgb, int width, int height ){
+	if( size < 8 || memcmp( bytes, "\x89PNG\r\n\x1a\n", 8 ) != 0 ){
+		return "no PNG signature";
+	}
+	unsigned char* idat = malloc( size );
+	size_t idat_size = 0;
+	int ended = 0;
+	for( size_t position = 8; !ended; ){
+		if( position + 12 > size ){
+			free( idat );
+			return "chunk past the end of the file";
+		}
+		size_t length = read_u32( bytes + position );
+		unsigned char* type = bytes + position + 4;
+		if( position + 12 + length > size ){
+			free( idat );
+			return "chunk past the end of the file";
+		}
+		if( check_crc32( type, length + 4 ) != read_u32( type + 4 + length ) ){
+			free( idat );
+			return "chunk CRC mismatch";
+		}
+		if( memcmp( type, "IHDR", 4 ) == 0 && ( length != 13 || (int)read_u32( type + 4 ) != width || (int)read_u32( type + 8 ) != height ||
+												type[12] != 8 || type[13] != 2 || type[16] != 0 ) ){
+			free( idat );
+			return "IHDR isn't an 8 bit RGB image of the right size";
+		}
+		if( memcmp( type, "IDAT", 4 ) == 0 ){
+			memcpy( idat + idat_size, type + 4, length );
+			idat_size += length;
+		}
+		ended = memcmp( type, "IEND", 4 ) == 0;
+		position += 12 + length;
+	}
+	size_t stride = (size_t)width * 3;
+	size_t filtered_size = ( stride + 1 ) * height;
+	unsigned char* filtered = malloc( filtered_size );
+	Reader reader = { idat + 2, idat_size > 6 ? idat_size - 6 : 0, 0, 0, 0, 0 };
+	const char* error = NULL;
+	if( idat_size < 6 || ( idat[0] & 0x0F ) != 8 || ( idat[0] << 8 | idat[1] ) % 31 != 0 ){
+		error = "bad zlib header";
+	}else if( inflate( &reader, filtered, filtered_size ) != (long)filtered_size ){
+		error = "deflate stream is malformed or the wrong size";
+	}else if( check_adler32( filtered, filtered_size ) != read_u32( idat + idat_size - 4 ) ){
+		error = "Adler-32 mismatch";
+	}
+	for( int y = 0; error == NULL && y < height; y++ ){
+		unsigned char* line = filtered + y * ( stride + 1 );
+		unsigned char* row = rgb + y * stride;
+		unsigned char* above = y > 0 ? row - stride : NULL;
+		for( size_t i = 0; i < stride; i++ ){
+			int left = i >= 3 ? row[i - 3] : 0;
+			int up = above != NULL ? above[i] : 0;
+			int up_left = i >= 3 && above != NULL ? above[i - 3] : 0;
+			int predicted = line[0] == 0 ? 0 : line[0] == 1 ? left : line[0] == 2 ? up : line[0] == 3 ? ( left + up ) / 2 : paeth( left, up, up_left );
+			row[i] = line[1 + i] + predicted;
+		}
+		if( line[0] > 4 ){
+			error = "unknown filter type";
+		}
+	}
+	free( filtered );
+	free( idat );
+	return error;
+}
+
+// QOI with 3 channels into rgb, as in the spec at qoiformat.org. Returns a reason it isn't one, or NULL
+const char* decode_qoi( unsigned char* bytes, size_t size, unsigned char* rgb, int width, int height ){
+	if( size < 22 || memcmp( bytes, "qoif", 4 ) != 0 || (int)read_u32( bytes + 4 ) != width || (int)read_u32( bytes + 8 ) != height || bytes[12] != 3 ){
+		return "header isn't a 3 channel QOI of the right size";
+	}
+	unsigned char index[64][4];
+	unsigned char pixel[4] = { 0, 0, 0, 255 };
+	memset( index, 0, sizeof(index) );
+	size_t position = 14;
+	int run = 0;
+	for( size_t i = 0; i < (size_t)width * height; i++ ){
+		if( run > 0 ){
+			run--;
+		}else{
+			if( position >= size - 8 ){
+				return "pixels past the end marker";
+			}
+			int op = bytes[position++];
+			if( op == 0xFE ){
+				memcpy( pixel, bytes + position, 3 );
+				position += 3;
+			}else if( op == 0xFF ){
+				memcpy( pixel, bytes + position, 4 );
+				position += 4;
+			}else if( ( op & 0xC0 ) == 0x00 ){
+				memcpy( pixel, index[op], 4 );
+			}else if( ( op & 0xC0 ) == 0x40 ){
+				pixel[0] += ( ( op >> 4 ) & 3 ) - 2;
+				pixel[1] += ( ( op >> 2 ) & 3 ) - 2;
+				pixel[2] += ( op & 3 ) - 2;
+			}else if( ( op & 0xC0 ) == 0x80 ){
+				int green = ( op & 0x3F ) - 32;
+				int next = bytes[position++];
+				pixel[0] += green + ( next >> 4 ) - 8;
+				pixel[1] += green;
+				pixel[2] += green + ( next & 0x0F ) - 8;
+			}else{
+				run = op & 0x3F;
+			}
+			if( position > size - 8 ){
+				return "pixels past the end marker";
+			}
+			memcpy( index[( pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11 ) % 64], pixel, 4 );
+		}
+		memcpy( rgb + i * 3, pixel, 3 );
+	}
+	if( position + 8 != size || memcmp( bytes + position, "\0\0\0\0\0\0\0\1", 8 ) != 0 ){
+		return "no end marker right after the pixels";
+	}
+	return NULL;
+}
+
+// Writes the framebuffer as all three formats and compares the decoded PNG and QOI with the PPM's pixels
+int check_image( RenderContext* context, double* framebuffer, int width, int height, const char* name, const char* directory ){
+	char file_name[3][1024];
+	const char* extensions[3] = { "ppm", "png", "qoi" };
+	unsigned char* files[3];
+	size_t sizes[3];
+	int failed = 0;
+	for( int i = 0; i < 3; i++ ){
+		snprintf( file_name[i], sizeof(file_name[i]), "%s/encode_check_%s.%s", directory, name, extensions[i] );
+		files[i] = NULL;
+		if( render_write_image( context, framebuffer, width, height, file_name[i] ) != RENDER_OK ||
+			( files[i] = read_file( file_name[i], &sizes[i] ) ) == NULL ){
+			printf( "%-10s %4dx%-4d could not write and read back %s: %s\n", name, width, height, file_name[i], render_error( context ) );
+			failed = 1;
+		}
+	}
+	char header[64];
+	int header_size = snprintf( header, sizeof(header), "P6\n%d %d\n255\n", width, height );
+	size_t pixel_bytes = (size_t)width * height * 3;
+	if( !failed && ( sizes[0] != header_size + pixel_bytes || memcmp( files[0], header, header_size ) != 0 ) ){
+		printf( "%-10s %4dx%-4d PPM isn't a P6 of the right size\n", name, width, height );
+		failed = 1;
+	}
+	unsigned char* decoded = malloc( pixel_bytes );
+	int written = !failed;
+	for( int i = 1; written && i < 3; i++ ){
+		const char* error = i == 1 ? decode_png( files[1], sizes[1], decoded, width, height ) : decode_qoi( files[2], sizes[2], decoded, width, height );
+		if( error == NULL && memcmp( decoded, files[0] + header_size, pixel_bytes ) != 0 ){
+			error = "pixels differ from the PPM";
+		}
+		printf( "%-10s %4dx%-4d %s %8zu bytes  %s\n", name, width, height, extensions[i], sizes[i], error == NULL ? "ok" : error );
+		failed |= error != NULL;
+	}
+	free( decoded );
+	for( int i = 0; i < 3; i++ ){
+		free( files[i] );
+	}
+	return failed;
+}
+
+double noise( unsigned int* state ){	//xorshift, the same images on every platform
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return ( *state & 0xFFFF ) / 65535.0;
+}
+
+int check_synthetic( RenderContext* context, const char* name, int width, int height, int pattern, const char* directory ){
+	double* framebuffer = malloc( sizeof(double) * 3 * width * height );
+	unsigned int state = 2463534242u;
+	for( int y = 0; y < height; y++ ){
+		for( int x = 0; x < width; x++ ){
+			double* color = framebuffer + ( (size_t)y * width + x ) * 3;
+			for( int k = 0; k < 3; k++ ){
+				if( pattern == 0 ){	//Noise, nothing to predict or match
+					color[k] = noise( &state );
+				}else if( pattern == 1 ){	//Flat, runs far longer than QOI's 62
+					color[k] = 0.25;
+				}else{	//Smooth gradients with a few steps, small differences for QOI's diff and luma ops
+					color[k] = fmod( ( x * ( k + 1 ) + y * 2 ) / 300.0 + ( ( x / 17 + y / 13 ) % 3 ) * 0.1, 1.0 );
+				}
+			}
+		}
+	}
+	int failed = check_image( context, framebuffer, width, height, name, directory );
+	free( framebuffer );
+	return failed;
+}
+
+int main( int c, char** argv ){
+	const char* directory = c > 1 ? argv[1] : ".";
+	int failed = 0;
+	RenderContext* context = render_create();
+	if( context == NULL ){
+		printf( "Error: Out of memory\n" );
+		return 1;
+	}
+	render_options( context )->threads = CHECK_THREADS;
+
+	failed |= check_synthetic( context, "pixel", 1, 1, 0, directory );
+	failed |= check_synthetic( context, "column", 1, 300, 2, directory );
+	failed |= check_synthetic( context, "noise", 97, 71, 0, directory );
+	failed |= check_synthetic( context, "flat", 256, 129, 1, directory );
+	failed |= check_synthetic( context, "gradient", 301, 200, 2, directory );
+
+	int width = 200;
+	int height = 130;	//Three PNG bands, the last one short
+	double* framebuffer = malloc( sizeof(double) * 3 * width * height );
+	if( render_load_scene( context, "ExampleScenes/ComplexScene.json" ) != RENDER_OK || render_image( context, framebuffer, width, height ) != RENDER_OK ){
+		printf( "Error: Could not render ExampleScenes/ComplexScene.json: %s\n", render_error( context ) );
+		failed = 1;
+	}else{
+		failed |= check_image( context, framebuffer, width, height, "scene", directory );
+	}
+	free( framebuffer );
+	render_destroy( context );
+	if( failed ){
+		printf( "Error: a PNG or QOI didn't decode to the PPM's pixels\n" );
+	}
+	return failed;
+}
@@ -0,0 +1,192 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../Math/fast_math.h"
+
+// Times every Math/fast_math.h tier against libm over the inputs the renderer feeds it, and reports the
+// largest absolute, relative and ulp error of each tier. Exits 1 if a tier is past its bound in
+// tier_bounds, on the absolute error for most functions and the relative error for exp and pow. Run with
+// make bench, or make check to only check the errors without timing them
+
+#define SAMPLES (1 << 16)
+#define REPEATS 200
+
+typedef struct{	//Inputs for one function, second is only used by two argument functions
+	double first[SAMPLES];
+	double second[SAMPLES];
+} BenchInputs;
+
+typedef double (*BenchKernel)( BenchInputs* inputs, double* outputs );	//Fills outputs, returns ns per call
+
+int repeats;	//Passes over the inputs per kernel, REPEATS unless we're only checking errors
+
+double seconds(){
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// The calls have to be inlined into the timing loop or we would only be measuring call overhead
+#define BENCH_UNARY( name, function ) \
+double name( BenchInputs* inputs, double* outputs ){ \
+	double start = seconds(); \
+	for( int r = 0; r < repeats; r++ ){ \
+		for( int i = 0; i < SAMPLES; i++ ){ \
+			outputs[i] = function( inputs->first[i] ); \
+		} \
+		__asm__ volatile( "" : : "r"( outputs ) : "memory" ); \
+	} \
+	return ( seconds() - start ) * 1e9 / ( (double)repeats * SAMPLES ); \
+}
+
+#define BENCH_BINARY( name, function ) \
+double name( BenchInputs* inputs, double* outputs ){ \
+	double start = seconds(); \
+	for( int r = 0; r < repeats; r++ ){ \
+		for( int i = 0; i < SAMPLES; i++ ){ \
+			outputs[i] = function( inputs->first[i], inputs->second[i] ); \
+		} \
+		__asm__ volatile( "" : : "r"( outputs ) : "memory" ); \
+	} \
+	return ( seconds() - start ) * 1e9 / ( (double)repeats * SAMPLES ); \
+}
+
+double pow_tier_fast( double x, double y ){
+	return exp_tier_fast( y * log_tier_fast( x ) );
+}
+
+double pow_tier_balanced( double x, double y ){
+	return exp_tier_balanced( y * log_tier_balanced( x ) );
+}
+
+BENCH_UNARY( bench_libm_sin, sin )
+BENCH_UNARY( bench_fast_sin, sin_tier_fast )
+BENCH_UNARY( bench_balanced_sin, sin_tier_balanced )
+BENCH_UNARY( bench_libm_cos, cos )
+BENCH_UNARY( bench_fast_cos, cos_tier_fast )
+BENCH_UNARY( bench_balanced_cos, cos_tier_balanced )
+BENCH_UNARY( bench_libm_acos, acos )
+BENCH_UNARY( bench_fast_acos, acos_tier_fast )
+BENCH_UNARY( bench_balanced_acos, acos_tier_balanced )
+BENCH_BINARY( bench_libm_atan2, atan2 )
+BENCH_BINARY( bench_fast_atan2, atan2_tier_fast )
+BENCH_BINARY( bench_balanced_atan2, atan2_tier_balanced )
+BENCH_UNARY( bench_libm_log, log )
+BENCH_UNARY( bench_fast_log, log_tier_fast )
+BENCH_UNARY( bench_balanced_log, log_tier_balanced )
+BENCH_UNARY( bench_libm_exp, exp )
+BENCH_UNARY( bench_fast_exp, exp_tier_fast )
+BENCH_UNARY( bench_balanced_exp, exp_tier_balanced )
+BENCH_BINARY( bench_libm_pow, pow )
+BENCH_BINARY( bench_fast_pow, pow_tier_fast )
+BENCH_BINARY( bench_balanced_pow, pow_tier_balanced )
+
+typedef struct{	//Largest error a tier is allowed, absolute, or relative where the values span many magnitudes
+	double fast;
+	double balanced;
+	int relative;
+} ErrorBound;
+
+// Bounds over the ranges fill_inputs() samples, a few times what the tiers reach so rounding
+// differences between compilers don't trip them. Order as in names[]
+const ErrorBound tier_bounds[] = {
+	{ 1e-6, 1e-15, 0 },	//sin
+	{ 1e-6, 1e-15, 0 },	//cos
+	{ 1e-4, 1e-7, 0 },	//acos
+	{ 1e-5, 1e-7, 0 },	//atan2
+	{ 1e-7, 1e-13, 0 },	//log
+	{ 1e-6, 1e-13, 1 },	//exp, relative, the results go up to e^50
+	{ 1e-5, 1e-11, 1 },	//pow, relative, the results go up to 2^64
+};
+
+double uniform( double low, double high ){
+	return low + ( high - low ) * ( rand() / (double)RAND_MAX );
+}
+
+long long ordered_bits( double x ){	//Doubles mapped onto integers that count up by one per ulp
+	long long bits = fast_math_bits( x );
+	return bits < 0 ? (long long)0x8000000000000000ULL - bits : bits;
+}
+
+double ulp_distance( double a, double b ){
+	return fabs( (double)( ordered_bits( a ) - ordered_bits( b ) ) );
+}
+
+void fill_inputs( BenchInputs* inputs, const char* name ){	//Ranges the renderer actually calls these with
+	for( int i = 0; i < SAMPLES; i++ ){
+		if( name[0] == 's' || name[0] == 'c' ){	//sin, cos: Mandelbulb angles reach 8 * pi
+			inputs->first[i] = uniform( -8 * M_PI, 8 * M_PI );
+		}else if( name[0] == 'a' && name[1] == 'c' ){
+			inputs->first[i] = uniform( -1.0, 1.0 );
+		}else if( name[0] == 'a' ){
+			inputs->first[i] = uniform( -10.0, 10.0 );
+			inputs->second[i] = uniform( -10.0, 10.0 );
+		}else if( name[0] == 'l' ){	//log: log-uniform over twelve decades
+			inputs->first[i] = pow( 10.0, uniform( -6.0, 6.0 ) );
+		}else if( name[0] == 'e' ){
+			inputs->first[i] = uniform( -50.0, 50.0 );
+		}else{	//pow: Mandelbulb radii to the 7th and 8th, specular highlights
+			inputs->first[i] = uniform( 0.0, 2.0 );
+			inputs->second[i] = uniform( 0.0, 64.0 );
+		}
+	}
+}
+
+// Prints a row of the table and returns 1 if the error is past bound
+int report( const char* name, const char* tier, double ns, double libm_ns, double* outputs, double* reference, double bound, int relative ){
+	double max_abs = 0.0;
+	double max_relative = 0.0;
+	double max_ulp = 0.0;
+	for( int i = 0; i < SAMPLES; i++ ){
+		max_abs = fmax( max_abs, fabs( outputs[i] - reference[i] ) );
+		if( fabs( reference[i] ) > 1e-3 ){	//Relative error blows up around zero crossings, abs error covers those
+			max_relative = fmax( max_relative, fabs( outputs[i] - reference[i] ) / fabs( reference[i] ) );
+		}
+		max_ulp = fmax( max_ulp, ulp_distance( outputs[i], reference[i] ) );
+	}
+	int failed = ( relative ? max_relative : max_abs ) > bound;
+	printf( "%-6s %-9s %8.2f ns %7.2fx %12.3e %12.3e %14.0f %s\n", name, tier, ns, libm_ns / ns, max_abs, max_relative, max_ulp,
+			failed ? "FAILED" : "" );
+	return failed;
+}
+
+int main( int c, char** argv ){
+	const char* names[] = { "sin", "cos", "acos", "atan2", "log", "exp", "pow" };
+	BenchKernel kernels[][3] = {
+		{ bench_libm_sin, bench_fast_sin, bench_balanced_sin },
+		{ bench_libm_cos, bench_fast_cos, bench_balanced_cos },
+		{ bench_libm_acos, bench_fast_acos, bench_balanced_acos },
+		{ bench_libm_atan2, bench_fast_atan2, bench_balanced_atan2 },
+		{ bench_libm_log, bench_fast_log, bench_balanced_log },
+		{ bench_libm_exp, bench_fast_exp, bench_balanced_exp },
+		{ bench_libm_pow, bench_fast_pow, bench_balanced_pow },
+	};
+	BenchInputs* inputs = malloc( sizeof(BenchInputs) );
+	double* reference = malloc( sizeof(double) * SAMPLES );
+	double* outputs = malloc( sizeof(double) * SAMPLES );
+
+	int failed = 0;
+
+	repeats = c > 1 && strcmp( argv[1], "--check" ) == 0 ? 1 : REPEATS;	//One pass is enough for the errors
+	srand( 1 );
+	printf( "%-6s %-9s %11s %8s %12s %12s %14s\n", "func", "tier", "time/call", "speedup", "max abs err", "max rel err", "max ulp err" );
+	for( int f = 0; f < 7; f++ ){
+		fill_inputs( inputs, names[f] );
+		double libm_ns = kernels[f][0]( inputs, reference );
+		report( names[f], "exact", libm_ns, libm_ns, reference, reference, 0.0, 0 );
+		failed |= report( names[f], "fast", kernels[f][1]( inputs, outputs ), libm_ns, outputs, reference, tier_bounds[f].fast, tier_bounds[f].relative );
+		failed |= report( names[f], "balanced", kernels[f][2]( inputs, outputs ), libm_ns, outputs, reference,
+						tier_bounds[f].balanced, tier_bounds[f].relative );
+	}
+	if( failed ){
+		printf( "Error: a tier is past its error bound in tier_bounds\n" );
+	}
+
+	free( inputs );
+	free( reference );
+	free( outputs );
+	return failed;
+}
@@ -0,0 +1,462 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../Math/vec3.h"
+#include "../Math/vector_math.h"
+#include "../raymarch.h"
+#include "../sdf.h"
+
+// Times every primitive SDF, apply_transformations(), intersect_normal() and the vec3.h helpers the march
+// loop runs on, next to plain double* and libm reference versions of the same math, and checks that the
+// two agree. Each kernel runs over the same fixed pseudo-random points, a few untimed warmup trials first,
+// then TRIALS timed ones whose median, fastest and spread are reported per evaluation. Exits 1 if a kernel
+// is further from its reference than its tolerance. Run with make sdf_bench
+
+#define SAMPLES (1 << 12)
+#define WARMUP_TRIALS 3
+#define TRIALS 21
+#define TRIAL_SECONDS 0.02	//Repeats per trial are picked so a trial takes about this long
+#define MANDELBULB_BENCH_ITERATIONS 10	//What lod_iterations() hands a close up pixel
+#define MENGER_BENCH_ITERATIONS 5
+#define MANDELBOX_BENCH_ITERATIONS 12
+#define MANDELBOX_BENCH_UNITS 4.0	//Spreads the points over the scale 2 box
+#define JULIA_BENCH_ITERATIONS 10
+#define NORMAL_DETAIL 1e-3
+#define NORMAL_SAMPLING_INTERVAL 1e-4	//Same as intersect_normal()
+
+typedef void (*SdfKernel)( double* outputs, int repeats );	//Writes width doubles per point
+
+typedef struct{
+	const char* name;
+	int width;	//Outputs per point
+	SdfKernel optimized;
+	SdfKernel reference;
+	double tolerance;	//Largest absolute difference from the reference that still passes
+} SdfBench;
+
+Vec3 points[SAMPLES];
+double point_arrays[SAMPLES][3];	//The same points for the double* kernels
+Vec3 folded_points[SAMPLES];	//Spread over many tiles for infinite_shape()
+double folded_arrays[SAMPLES][3];
+double normal_arrays[2][SAMPLES][3];	//Around the first object of each normal scene
+Object transformed;	//A rotated, moved object for apply_transformations()
+double cone_cos_sin[2];
+const double julia_constant[4] = { JULIA_DEFAULT_CONSTANT };
+RenderContext* normal_scenes[2];
+
+double seconds(){
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+double uniform( double low, double high ){
+	return low + ( high - low ) * ( rand() / (double)RAND_MAX );
+}
+
+// The kernel has to be inlined into the timing loop or we would only be measuring call overhead
+#define BENCH_KERNEL( name, width, ... ) \
+void name( double* outputs, int repeats ){ \
+	for( int r = 0; r < repeats; r++ ){ \
+		for( int i = 0; i < SAMPLES; i++ ){ \
+			double* output = outputs + i * width; \
+			__VA_ARGS__; \
+		} \
+		__asm__ volatile( "" : : "r"( outputs ) : "memory" ); \
+	} \
+}
+
+// References, the double* and libm versions the kernels in sdf.h and Math/vec3.h replaced
+
+double reference_magnitude( double* v ){
+	return sqrt( v[0]*v[0] + v[1]*v[1] + v[2]*v[2] );
+}
+
+double reference_magnitude_2D( double x, double y ){
+	return sqrt( x*x + y*y );
+}
+
+double reference_dot( double* a, double* b ){
+	return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+void reference_normalize( double* v, double* result ){
+	double length = reference_magnitude( v );
+	result[0] = v[0] / length;
+	result[1] = v[1] / length;
+	result[2] = v[2] / length;
+}
+
+void reference_rotate( double* v, double m[3][3] ){	//Row vector times matrix, like matrix_cross_mult_sp()
+	double x = v[0] * m[0][0] + v[1] * m[1][0] + v[2] * m[2][0];
+	double y = v[0] * m[0][1] + v[1] * m[1][1] + v[2] * m[2][1];
+	double z = v[0] * m[0][2] + v[1] * m[1][2] + v[2] * m[2][2];
+	v[0] = x;
+	v[1] = y;
+	v[2] = z;
+}
+
+void reference_xyz_rotation( double* v, double* angles ){	//One matrix per axis, rebuilt with libm every call
+	double x[3][3] = { { 1, 0, 0 }, { 0, cos( angles[0] ), -sin( angles[0] ) }, { 0, sin( angles[0] ), cos( angles[0] ) } };
+	double y[3][3] = { { cos( angles[1] ), 0, sin( angles[1] ) }, { 0, 1, 0 }, { -sin( angles[1] ), 0, cos( angles[1] ) } };
+	double z[3][3] = { { cos( angles[2] ), -sin( angles[2] ), 0 }, { sin( angles[2] ), cos( angles[2] ), 0 }, { 0, 0, 1 } };
+	reference_rotate( v, x );
+	reference_rotate( v, y );
+	reference_rotate( v, z );
+}
+
+void reference_transformations( double* position, Object* object, double* result ){
+	result[0] = position[0] - object->position[0];
+	result[1] = position[1] - object->position[1];
+	result[2] = position[2] - object->position[2];
+	reference_xyz_rotation( result, object->rotation );
+}
+
+double reference_sphere_sdf( double* position, double radius ){
+	return reference_magnitude( position ) - radius;
+}
+
+double reference_plane_sdf( double* position, double* normal ){
+	return reference_dot( position, normal );
+}
+
+double reference_box_sdf( double* position, double* dimensions ){
+	double outside[3];
+	double inside = -INFINITY;
+	for( int i = 0; i < 3; i++ ){
+		double distance = fabs( position[i] ) - dimensions[i];
+		outside[i] = fmax( distance, 0.0 );
+		inside = fmax( inside, distance );
+	}
+	return reference_magnitude( outside ) + fmin( inside, 0.0 );
+}
+
+double reference_donut_sdf( double* position, double radius, double thickness ){
+	return reference_magnitude_2D( reference_magnitude_2D( position[0], position[2] ) - radius * 2, position[1] ) - thickness;
+}
+
+double reference_cone_sdf( double* position, double* cos_sin, double height ){
+	double q = reference_magnitude_2D( position[0], position[2] );
+	return fmax( cos_sin[0] * q + cos_sin[1] * position[1], -height - position[1] );
+}
+
+double reference_eternal_cylinder_sdf( double* position, double radius ){
+	return reference_magnitude_2D( position[0], position[2] ) - radius;
+}
+
+double reference_mandelbulb_sdf( double* position, int iterations ){
+	double z[3] = { position[0], position[1], position[2] };
+	double dr = 1.0;
+	double r = 0.0;
+	double power = 8.0;
+	for( int i = 0; i < iterations; i++ ){
+		r = reference_magnitude( z );
+		if( r > 2.0 ){ break; }
+		double theta = acos( z[2] / r ) * power;
+		double phi = atan2( z[1], z[0] ) * power;
+		dr = pow( r, power - 1 ) * power * dr + 1.0;
+		double zr = pow( r, power );
+		z[0] = position[0] + zr * sin( theta ) * cos( phi );
+		z[1] = position[1] + zr * sin( theta ) * sin( phi );
+		z[2] = position[2] + zr * cos( theta );
+	}
+	return 0.5 * log( r ) * r / dr;
+}
+
+double reference_menger_sdf( double* position, int iterations ){
+	double distance = reference_box_sdf( position, (double[3]){ 1.0, 1.0, 1.0 } );
+	double scale = 1.0;
+	for( int i = 0; i < iterations; i++ ){
+		double cross[3];
+		for( int axis = 0; axis < 3; axis++ ){
+			double folded = fmod( position[axis] * scale, 2.0 );
+			folded = ( folded < 0 ? folded + 2.0 : folded ) - 1.0;
+			cross[axis] = fabs( 1.0 - 3.0 * fabs( folded ) );
+		}
+		scale *= 3.0;
+		double hole = ( fmin( fmax( cross[0], cross[1] ), fmin( fmax( cross[1], cross[2] ), fmax( cross[2], cross[0] ) ) ) - 1.0 ) / scale;
+		distance = fmax( distance, hole );
+	}
+	return distance;
+}
+
+double reference_mandelbox_sdf( double* position, double scale, int iterations ){
+	double z[3] = { position[0], position[1], position[2] };
+	double dr = 1.0;
+	for( int i = 0; i < iterations; i++ ){
+		for( int axis = 0; axis < 3; axis++ ){
+			if( z[axis] > 1.0 ){ z[axis] = 2.0 - z[axis]; }
+			else if( z[axis] < -1.0 ){ z[axis] = -2.0 - z[axis]; }
+		}
+		double r2 = reference_dot( z, z );
+		double fold = 1.0;
+		if( r2 < MANDELBOX_MIN_RADIUS2 ){ fold = MANDELBOX_FIXED_RADIUS2 / MANDELBOX_MIN_RADIUS2; }
+		else if( r2 < MANDELBOX_FIXED_RADIUS2 ){ fold = MANDELBOX_FIXED_RADIUS2 / r2; }
+		for( int axis = 0; axis < 3; axis++ ){
+			z[axis] = z[axis] * fold * scale + position[axis];
+		}
+		dr = dr * fold * fabs( scale ) + 1.0;
+		if( reference_dot( z, z ) > MANDELBOX_BAILOUT ){ break; }
+	}
+	return reference_magnitude( z ) / dr;
+}
+
+double reference_julia_sdf( double* position, const double* constant, int iterations ){
+	double z[4] = { position[0], position[1], position[2], 0.0 };
+	double dz[4] = { 1.0, 0.0, 0.0, 0.0 };
+	double z2 = reference_dot( position, position );
+	for( int i = 0; i < iterations; i++ ){	//Full quaternion products, z' = 2 z z' and z = z^2 + c
+		double next_dz[4] = { 2.0 * ( z[0]*dz[0] - z[1]*dz[1] - z[2]*dz[2] - z[3]*dz[3] ),
+								2.0 * ( z[0]*dz[1] + z[1]*dz[0] + z[2]*dz[3] - z[3]*dz[2] ),
+								2.0 * ( z[0]*dz[2] - z[1]*dz[3] + z[2]*dz[0] + z[3]*dz[1] ),
+								2.0 * ( z[0]*dz[3] + z[1]*dz[2] - z[2]*dz[1] + z[3]*dz[0] ) };
+		double next_z[4] = { z[0]*z[0] - z[1]*z[1] - z[2]*z[2] - z[3]*z[3] + constant[0],
+								2.0 * z[0]*z[1] + constant[1], 2.0 * z[0]*z[2] + constant[2], 2.0 * z[0]*z[3] + constant[3] };
+		for( int k = 0; k < 4; k++ ){
+			dz[k] = next_dz[k];
+			z[k] = next_z[k];
+		}
+		z2 = z[0]*z[0] + z[1]*z[1] + z[2]*z[2] + z[3]*z[3];
+		if( z2 > JULIA_BAILOUT ){ break; }
+	}
+	double dz2 = dz[0]*dz[0] + dz[1]*dz[1] + dz[2]*dz[2] + dz[3]*dz[3];
+	return 0.25 * sqrt( z2 / dz2 ) * log( z2 );
+}
+
+void reference_infinite_shape( double* position, double* center, double tile_size, double* result ){
+	for( int i = 0; i < 3; i++ ){
+		result[i] = center[i] + ( position[i] - center[i] ) - tile_size * round( ( position[i] - center[i] ) / tile_size );
+	}
+}
+
+double reference_object_sdf( RenderContext* context, Object* object, double* position, double detail ){
+	double local[3] = { position[0], position[1], position[2] };
+	if( object->infinite_interval > 0 ){
+		reference_infinite_shape( position, object->position, object->infinite_interval, local );
+	}
+	reference_transformations( (double[3]){ local[0], local[1], local[2] }, object, local );
+	switch( object->kind ){
+		case Sphere: return reference_sphere_sdf( local, object->sphere.radius );
+		case Plane: return reference_plane_sdf( local, object->plane.normal );
+		case Box: return reference_box_sdf( local, object->box.dimensions );
+		case Donut: return reference_donut_sdf( local, object->donut.radius, object->donut.thickness );
+		case Cone: return reference_cone_sdf( local, object->cone.cos_sin, object->cone.height );
+		case EternalCylinder: return reference_eternal_cylinder_sdf( local, object->eternal_cylinder.radius );
+		case Mandelbulb:	//Outside its shell fractal_sdf() steps to the shell instead
+			if( reference_magnitude( local ) - object->shell_radius > FRACTAL_SHELL_MARGIN * object->shell_radius ){
+				return reference_magnitude( local ) - object->shell_radius;
+			}
+			return reference_mandelbulb_sdf( local, lod_iterations( detail, 1.0, MANDELBULB_MIN_ITERATIONS,
+																MANDELBULB_MAX_ITERATIONS, context->object_array[0]->camera.lod_bias ) );
+		default: return INFINITY;
+	}
+}
+
+double reference_scene_sdf( RenderContext* context, double* position, double detail ){
+	double distance = INFINITY;
+	for( int i = 0; i < context->scene_objects.count; i++ ){
+		distance = fmin( distance, reference_object_sdf( context, context->object_array[context->scene_objects.indices[i]], position, detail ) );
+	}
+	return distance;
+}
+
+void reference_normal( RenderContext* context, double* position, double* normal ){	//Central differences over the reference SDFs
+	double gradient[3];
+	for( int axis = 0; axis < 3; axis++ ){
+		double ahead[3] = { position[0], position[1], position[2] };
+		double behind[3] = { position[0], position[1], position[2] };
+		ahead[axis] += NORMAL_SAMPLING_INTERVAL;
+		behind[axis] -= NORMAL_SAMPLING_INTERVAL;
+		gradient[axis] = reference_scene_sdf( context, ahead, NORMAL_DETAIL ) - reference_scene_sdf( context, behind, NORMAL_DETAIL );
+	}
+	reference_normalize( gradient, normal );
+}
+
+BENCH_KERNEL( bench_sphere, 1, output[0] = sphere_sdf( points[i], 1.0 ) )
+BENCH_KERNEL( reference_sphere, 1, output[0] = reference_sphere_sdf( point_arrays[i], 1.0 ) )
+BENCH_KERNEL( bench_plane, 1, output[0] = plane_sdf( points[i], vec3( 0.0, 0.6, 0.8 ) ) )
+BENCH_KERNEL( reference_plane, 1, output[0] = reference_plane_sdf( point_arrays[i], (double[3]){ 0.0, 0.6, 0.8 } ) )
+BENCH_KERNEL( bench_box, 1, output[0] = box_sdf( points[i], vec3( 0.5, 1.0, 0.25 ) ) )
+BENCH_KERNEL( reference_box, 1, output[0] = reference_box_sdf( point_arrays[i], (double[3]){ 0.5, 1.0, 0.25 } ) )
+BENCH_KERNEL( bench_donut, 1, output[0] = donut_sdf( points[i], 0.5, 0.3 ) )
+BENCH_KERNEL( reference_donut, 1, output[0] = reference_donut_sdf( point_arrays[i], 0.5, 0.3 ) )
+BENCH_KERNEL( bench_cone, 1, output[0] = cone_sdf( points[i], cone_cos_sin, 1.0 ) )
+BENCH_KERNEL( reference_cone, 1, output[0] = reference_cone_sdf( point_arrays[i], cone_cos_sin, 1.0 ) )
+BENCH_KERNEL( bench_cylinder, 1, output[0] = eternal_cylinder_sdf( points[i], 0.5 ) )
+BENCH_KERNEL( reference_cylinder, 1, output[0] = reference_eternal_cylinder_sdf( point_arrays[i], 0.5 ) )
+BENCH_KERNEL( bench_mandelbulb, 1, output[0] = mandelbulb_sdf( points[i], MANDELBULB_BENCH_ITERATIONS ) )
+BENCH_KERNEL( reference_mandelbulb, 1, output[0] = reference_mandelbulb_sdf( point_arrays[i], MANDELBULB_BENCH_ITERATIONS ) )
+BENCH_KERNEL( bench_menger, 1, output[0] = menger_sdf( points[i], MENGER_BENCH_ITERATIONS ) )
+BENCH_KERNEL( reference_menger, 1, output[0] = reference_menger_sdf( point_arrays[i], MENGER_BENCH_ITERATIONS ) )
+BENCH_KERNEL( bench_mandelbox, 1, output[0] = mandelbox_sdf( vec3_scale( points[i], MANDELBOX_BENCH_UNITS ), 2.0, MANDELBOX_BENCH_ITERATIONS ) )
+BENCH_KERNEL( reference_mandelbox, 1, output[0] = reference_mandelbox_sdf( (double[3]){ point_arrays[i][0] * MANDELBOX_BENCH_UNITS,
+				point_arrays[i][1] * MANDELBOX_BENCH_UNITS, point_arrays[i][2] * MANDELBOX_BENCH_UNITS }, 2.0, MANDELBOX_BENCH_ITERATIONS ) )
+BENCH_KERNEL( bench_julia, 1, output[0] = julia_sdf( points[i], julia_constant, JULIA_BENCH_ITERATIONS ) )
+BENCH_KERNEL( reference_julia, 1, output[0] = reference_julia_sdf( point_arrays[i], julia_constant, JULIA_BENCH_ITERATIONS ) )
+BENCH_KERNEL( bench_infinite, 3, vec3_store( infinite_shape( folded_points[i], vec3_load( transformed.position ), 3.0 ), output ) )
+BENCH_KERNEL( reference_infinite, 3, reference_infinite_shape( folded_arrays[i], transformed.position, 3.0, output ) )
+BENCH_KERNEL( bench_transformations, 3, vec3_store( apply_transformations( points[i], &transformed ), output ) )
+BENCH_KERNEL( reference_transformations_kernel, 3, reference_transformations( point_arrays[i], &transformed, output ) )
+BENCH_KERNEL( bench_scene_normal, 3, intersect_normal( normal_scenes[0], output, normal_arrays[0][i], NORMAL_DETAIL ) )
+BENCH_KERNEL( reference_scene_normal, 3, reference_normal( normal_scenes[0], normal_arrays[0][i], output ) )
+BENCH_KERNEL( bench_fractal_normal, 3, intersect_normal( normal_scenes[1], output, normal_arrays[1][i], NORMAL_DETAIL ) )
+BENCH_KERNEL( reference_fractal_normal, 3, reference_normal( normal_scenes[1], normal_arrays[1][i], output ) )
+BENCH_KERNEL( bench_length, 1, output[0] = vec3_length( points[i] ) )
+BENCH_KERNEL( reference_length, 1, output[0] = reference_magnitude( point_arrays[i] ) )
+BENCH_KERNEL( bench_dot, 1, output[0] = vec3_dot( points[i], points[SAMPLES - 1 - i] ) )
+BENCH_KERNEL( reference_dot_kernel, 1, output[0] = reference_dot( point_arrays[i], point_arrays[SAMPLES - 1 - i] ) )
+BENCH_KERNEL( bench_normalize, 3, vec3_store( vec3_normalize( points[i] ), output ) )
+BENCH_KERNEL( reference_normalize_kernel, 3, reference_normalize( point_arrays[i], output ) )
+BENCH_KERNEL( bench_rotation, 3, vec3_store( mat3_apply( &transformed.rotation_matrix, points[i] ), output ) )
+BENCH_KERNEL( reference_rotation, 3, vec3_store( points[i], output ); reference_xyz_rotation( output, transformed.rotation ) )
+
+// fast_math.h trades accuracy for speed in the fractal and the rotation matrices, and finite differences
+// divide the fractal's error by the sampling interval
+#if FAST_MATH_TIER == FAST_MATH_FAST
+#define FRACTAL_TOLERANCE 1e-2
+#define FRACTAL_NORMAL_TOLERANCE 0.5
+#elif FAST_MATH_TIER == FAST_MATH_BALANCED
+#define FRACTAL_TOLERANCE 1e-5
+#define FRACTAL_NORMAL_TOLERANCE 1e-3
+#else
+#define FRACTAL_TOLERANCE 1e-9
+#define FRACTAL_NORMAL_TOLERANCE 1e-6
+#endif
+#define ROTATION_TOLERANCE 1e-6
+
+SdfBench benches[] = {
+	{ "sphere", 1, bench_sphere, reference_sphere, 1e-12 },
+	{ "plane", 1, bench_plane, reference_plane, 1e-12 },
+	{ "box", 1, bench_box, reference_box, 1e-12 },
+	{ "donut", 1, bench_donut, reference_donut, 1e-12 },
+	{ "cone", 1, bench_cone, reference_cone, 1e-12 },
+	{ "cylinder", 1, bench_cylinder, reference_cylinder, 1e-12 },
+	{ "mandelbulb", 1, bench_mandelbulb, reference_mandelbulb, FRACTAL_TOLERANCE },
+	{ "menger", 1, bench_menger, reference_menger, 1e-12 },
+	{ "mandelbox", 1, bench_mandelbox, reference_mandelbox, 1e-9 },
+	{ "julia", 1, bench_julia, reference_julia, FRACTAL_TOLERANCE },
+	{ "infinite", 3, bench_infinite, reference_infinite, 1e-12 },
+	{ "transform", 3, bench_transformations, reference_transformations_kernel, ROTATION_TOLERANCE },
+	{ "normal", 3, bench_scene_normal, reference_scene_normal, ROTATION_TOLERANCE },
+	{ "fractal normal", 3, bench_fractal_normal, reference_fractal_normal, FRACTAL_NORMAL_TOLERANCE },
+	{ "length", 1, bench_length, reference_length, 1e-12 },
+	{ "dot", 1, bench_dot, reference_dot_kernel, 1e-12 },
+	{ "normalize", 3, bench_normalize, reference_normalize_kernel, 1e-12 },
+	{ "rotation", 3, bench_rotation, reference_rotation, ROTATION_TOLERANCE },
+};
+
+int compare_doubles( const void* a, const void* b ){
+	double difference = *(double*)a - *(double*)b;
+	return ( difference > 0 ) - ( difference < 0 );
+}
+
+typedef struct{
+	double median;
+	double fastest;
+	double spread;	//Standard deviation
+} Timing;
+
+Timing time_kernel( SdfKernel kernel, double* outputs ){	//ns per evaluation
+	int repeats = 1;
+	double elapsed;
+	while( 1 ){	//Calibrate, the first runs double as warmup
+		double start = seconds();
+		kernel( outputs, repeats );
+		elapsed = seconds() - start;
+		if( elapsed >= TRIAL_SECONDS / 4 || repeats >= 1 << 20 ){
+			break;
+		}
+		repeats *= 2;
+	}
+	repeats = (int)ceil( repeats * TRIAL_SECONDS / elapsed );
+	for( int trial = 0; trial < WARMUP_TRIALS; trial++ ){
+		kernel( outputs, repeats );
+	}
+
+	double trials[TRIALS];
+	double mean = 0.0;
+	for( int trial = 0; trial < TRIALS; trial++ ){
+		double start = seconds();
+		kernel( outputs, repeats );
+		trials[trial] = ( seconds() - start ) * 1e9 / ( (double)repeats * SAMPLES );
+		mean += trials[trial] / TRIALS;
+	}
+	double variance = 0.0;
+	for( int trial = 0; trial < TRIALS; trial++ ){
+		variance += ( trials[trial] - mean ) * ( trials[trial] - mean ) / ( TRIALS - 1 );
+	}
+	qsort( trials, TRIALS, sizeof(double), compare_doubles );
+	return (Timing){ trials[TRIALS / 2], trials[0], sqrt( variance ) };
+}
+
+RenderContext* load_normal_scene( char* scene_file, double points[SAMPLES][3] ){	//Points within 2 units of the scene's first object
+	RenderContext* context = render_create();
+	if( context == NULL || render_load_scene( context, scene_file ) != RENDER_OK ){
+		fprintf( stderr, "Error: %s\n", context == NULL ? "Out of memory" : render_error( context ) );
+		exit( 1 );
+	}
+	double* center = context->object_array[context->scene_objects.indices[0]]->position;
+	for( int i = 0; i < SAMPLES; i++ ){
+		for( int axis = 0; axis < 3; axis++ ){
+			points[i][axis] = center[axis] + uniform( -2.0, 2.0 );
+		}
+	}
+	return context;
+}
+
+void fill_points(){
+	for( int i = 0; i < SAMPLES; i++ ){
+		points[i] = vec3( uniform( -1.5, 1.5 ), uniform( -1.5, 1.5 ), uniform( -1.5, 1.5 ) );	//Covers the Mandelbulb
+		vec3_store( points[i], point_arrays[i] );
+		folded_points[i] = vec3( uniform( -50.0, 50.0 ), uniform( -50.0, 50.0 ), uniform( -50.0, 50.0 ) );
+		vec3_store( folded_points[i], folded_arrays[i] );
+	}
+	transformed.position[0] = 0.5;
+	transformed.position[1] = -1.0;
+	transformed.position[2] = 3.0;
+	transformed.rotation[0] = 0.3;
+	transformed.rotation[1] = -1.1;
+	transformed.rotation[2] = 2.5;
+	transformed.rotation_matrix = mat3_rotation_xyz( vec3_load( transformed.rotation ) );
+	cone_cos_sin[0] = cos( 0.4 );
+	cone_cos_sin[1] = sin( 0.4 );
+}
+
+int main(){
+	int benches_count = sizeof( benches ) / sizeof( benches[0] );
+	double* reference = malloc( sizeof(double) * 3 * SAMPLES );
+	double* outputs = malloc( sizeof(double) * 3 * SAMPLES );
+	int failed = 0;
+
+	srand( 1 );
+	fill_points();
+	normal_scenes[0] = load_normal_scene( "ExampleScenes/ComplexScene.json", normal_arrays[0] );
+	normal_scenes[1] = load_normal_scene( "ExampleScenes/Mandelbulb.json", normal_arrays[1] );
+
+	printf( "%-14s %-9s %10s %9s %9s %8s %12s %9s\n", "kernel", "variant", "median/eval", "fastest", "stddev", "speedup", "max abs err", "tolerance" );
+	for( int b = 0; b < benches_count; b++ ){
+		SdfBench* bench = &benches[b];
+		Timing reference_time = time_kernel( bench->reference, reference );
+		Timing optimized_time = time_kernel( bench->optimized, outputs );
+		double max_abs = 0.0;
+		for( int i = 0; i < bench->width * SAMPLES; i++ ){
+			double difference = fabs( outputs[i] - reference[i] );
+			max_abs = isnan( difference ) ? INFINITY : fmax( max_abs, difference );
+		}
+		int passed = max_abs <= bench->tolerance;
+		failed |= !passed;
+		printf( "%-14s %-9s %8.2f ns %6.2f ns %6.2f ns %8s %12s %9s\n", bench->name, "reference",
+				reference_time.median, reference_time.fastest, reference_time.spread, "", "", "" );
+		printf( "%-14s %-9s %8.2f ns %6.2f ns %6.2f ns %7.2fx %12.3e %9.0e %s\n", bench->name, "optimized",
+				optimized_time.median, optimized_time.fastest, optimized_time.spread,
+				reference_time.median / optimized_time.median, max_abs, bench->tolerance, passed ? "PASS" : "FAIL" );
+	}
+
+	render_destroy( normal_scenes[0] );
+	render_destroy( normal_scenes[1] );
+	free( reference );
+	free( outputs );
+	return failed;
+}
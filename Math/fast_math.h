@@ -0,0 +1,280 @@
+#ifndef FAST_MATH
+#define FAST_MATH
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+// Approximations of the libm functions the SDFs and shading call per step. Every function comes in two
+// inlinable tiers built from polynomials, bit tricks and selects so loops over them can vectorize, plus
+// a fast_* entry point that picks the tier chosen at build time. Bench/math_bench.c measures their speed
+// and error against libm.
+//
+//   FAST_MATH_FAST      ~1e-4 absolute error (acos, the others ~1e-6), ~2e-6 relative for exp and pow,
+//                       for values that only steer a march
+//   FAST_MATH_BALANCED  ~2e-8 absolute error or better, ~1e-12 relative for exp and pow, renders only
+//                       differ on a few fractal edge pixels
+//   FAST_MATH_EXACT     libm itself
+//
+// exp and pow only keep their relative error small, the absolute error grows with the result (up to 1e14
+// for e^50 in the fast tier). Bench/math_bench.c checks each function against its bound in tier_bounds
+//
+// Pick one with make FAST_MATH_TIER=FAST_MATH_FAST (after a make clean). The tiers only pay off with the
+// optimizer on, without inlining the polynomials cost more than the libm calls
+
+#define FAST_MATH_FAST 0
+#define FAST_MATH_BALANCED 1
+#define FAST_MATH_EXACT 2
+
+#ifndef FAST_MATH_TIER
+#define FAST_MATH_TIER FAST_MATH_BALANCED
+#endif
+
+#define FAST_MATH_ROUNDER 6755399441055744.0	//1.5 * 2^52, adding and subtracting it rounds to the nearest integer
+#define FAST_MATH_PI_2_HI 1.57079632673412561417	//pi/2 split in two so the range reduction stays exact
+#define FAST_MATH_PI_2_LO 6.07710050650619224932e-11
+#define FAST_MATH_LN2_HI 6.93147180369123816490e-01
+#define FAST_MATH_LN2_LO 1.90821492927058770002e-10
+
+static inline double fast_math_round( double x ){	//Round to nearest without a libm call, |x| < 2^51
+	return ( x + FAST_MATH_ROUNDER ) - FAST_MATH_ROUNDER;
+}
+
+static inline long long fast_math_bits( double x ){
+	long long bits;
+	memcpy( &bits, &x, sizeof(bits) );
+	return bits;
+}
+
+static inline double fast_math_from_bits( long long bits ){
+	double x;
+	memcpy( &x, &bits, sizeof(x) );
+	return x;
+}
+
+// sin and cos: reduce to r in [-pi/4, pi/4] around the nearest multiple of pi/2, then Taylor polynomials
+
+static inline double sin_poly_fast( double r ){
+	double r2 = r * r;
+	return r + r * r2 * ( -1.0 / 6 + r2 * ( 1.0 / 120 + r2 * ( -1.0 / 5040 ) ) );
+}
+
+static inline double cos_poly_fast( double r ){
+	double r2 = r * r;
+	return 1.0 + r2 * ( -1.0 / 2 + r2 * ( 1.0 / 24 + r2 * ( -1.0 / 720 + r2 * ( 1.0 / 40320 ) ) ) );
+}
+
+static inline double sin_poly_balanced( double r ){
+	double r2 = r * r;
+	return r + r * r2 * ( -1.0 / 6 + r2 * ( 1.0 / 120 + r2 * ( -1.0 / 5040 + r2 * ( 1.0 / 362880
+			+ r2 * ( -1.0 / 39916800 + r2 * ( 1.0 / 6227020800.0 + r2 * ( -1.0 / 1307674368000.0 ) ) ) ) ) ) );
+}
+
+static inline double cos_poly_balanced( double r ){
+	double r2 = r * r;
+	return 1.0 + r2 * ( -1.0 / 2 + r2 * ( 1.0 / 24 + r2 * ( -1.0 / 720 + r2 * ( 1.0 / 40320 + r2 * ( -1.0 / 3628800
+			+ r2 * ( 1.0 / 479001600 + r2 * ( -1.0 / 87178291200.0 + r2 * ( 1.0 / 20922789888000.0 ) ) ) ) ) ) ) );
+}
+
+static inline double reduce_quarter_turns( double x, int* quadrant ){	//x - k*pi/2 for the nearest k, quadrant = k mod 4
+	double k = fast_math_round( x * ( 2.0 / M_PI ) );
+	*quadrant = (int)( (long long)k & 3 );
+	return ( x - k * FAST_MATH_PI_2_HI ) - k * FAST_MATH_PI_2_LO;
+}
+
+static inline double sin_tier_fast( double x ){
+	int quadrant;
+	double r = reduce_quarter_turns( x, &quadrant );
+	double value = ( quadrant & 1 ) ? cos_poly_fast( r ) : sin_poly_fast( r );
+	return ( quadrant & 2 ) ? -value : value;
+}
+
+static inline double cos_tier_fast( double x ){
+	int quadrant;
+	double r = reduce_quarter_turns( x, &quadrant );
+	double value = ( quadrant & 1 ) ? sin_poly_fast( r ) : cos_poly_fast( r );
+	return ( ( quadrant + 1 ) & 2 ) ? -value : value;
+}
+
+static inline double sin_tier_balanced( double x ){
+	int quadrant;
+	double r = reduce_quarter_turns( x, &quadrant );
+	double value = ( quadrant & 1 ) ? cos_poly_balanced( r ) : sin_poly_balanced( r );
+	return ( quadrant & 2 ) ? -value : value;
+}
+
+static inline double cos_tier_balanced( double x ){
+	int quadrant;
+	double r = reduce_quarter_turns( x, &quadrant );
+	double value = ( quadrant & 1 ) ? sin_poly_balanced( r ) : cos_poly_balanced( r );
+	return ( ( quadrant + 1 ) & 2 ) ? -value : value;
+}
+
+// acos: sqrt(1 - |x|) times a polynomial in |x| (Abramowitz & Stegun 4.4.45 and 4.4.46), mirrored for negative x
+
+static inline double acos_tier_fast( double x ){
+	double a = fabs( x );
+	double value = sqrt( 1.0 - a ) * ( 1.5707288 + a * ( -0.2121144 + a * ( 0.0742610 + a * -0.0187293 ) ) );
+	return x < 0 ? M_PI - value : value;
+}
+
+static inline double acos_tier_balanced( double x ){
+	double a = fabs( x );
+	double value = sqrt( 1.0 - a ) * ( 1.5707963050 + a * ( -0.2145988016 + a * ( 0.0889789874 + a * ( -0.0501743046
+			+ a * ( 0.0308918810 + a * ( -0.0170881256 + a * ( 0.0066700901 + a * -0.0012624911 ) ) ) ) ) ) );
+	return x < 0 ? M_PI - value : value;
+}
+
+// atan2: atan of the smaller over the larger component on [0, 1], then folded back into the right octant
+
+static inline double atan_poly_fast( double z ){
+	double z2 = z * z;
+	return z * ( 0.99997726 + z2 * ( -0.33262347 + z2 * ( 0.19354346 + z2 * ( -0.11643287
+			+ z2 * ( 0.05265332 + z2 * -0.01172120 ) ) ) ) );
+}
+
+static inline double atan_poly_balanced( double z ){	//Abramowitz & Stegun 4.4.49
+	double z2 = z * z;
+	return z * ( 1.0 + z2 * ( -0.3333314528 + z2 * ( 0.1999355085 + z2 * ( -0.1420889944 + z2 * ( 0.1065626393
+			+ z2 * ( -0.0752896400 + z2 * ( 0.0429096138 + z2 * ( -0.0161657367 + z2 * 0.0028662257 ) ) ) ) ) ) ) );
+}
+
+static inline double atan2_fold( double y, double x, double angle ){	//angle = atan(min/max) of |y| and |x|
+	angle = fabs( y ) > fabs( x ) ? M_PI / 2 - angle : angle;
+	angle = x < 0 ? M_PI - angle : angle;
+	return y < 0 ? -angle : angle;
+}
+
+static inline double atan2_tier_fast( double y, double x ){
+	double big = fabs( x ) > fabs( y ) ? fabs( x ) : fabs( y );
+	double small = fabs( x ) > fabs( y ) ? fabs( y ) : fabs( x );
+	return atan2_fold( y, x, atan_poly_fast( small / ( big > 0 ? big : 1.0 ) ) );	//Divides unconditionally so the select vectorizes
+}
+
+static inline double atan2_tier_balanced( double y, double x ){
+	double big = fabs( x ) > fabs( y ) ? fabs( x ) : fabs( y );
+	double small = fabs( x ) > fabs( y ) ? fabs( y ) : fabs( x );
+	return atan2_fold( y, x, atan_poly_balanced( small / ( big > 0 ? big : 1.0 ) ) );	//Divides unconditionally so the select vectorizes
+}
+
+// log: split x into m * 2^e with m in [sqrt(1/2), sqrt(2)), then log(m) = 2 atanh((m - 1)/(m + 1)) as a series.
+// Only for finite x > 0, the fast_* entry points send everything else to libm
+
+static inline double log_reduce( double x, double* exponent ){
+	long long bits = fast_math_bits( x ) - 0x3fe6a09e667f3bcdLL;	//Offset by sqrt(1/2) so m lands in [sqrt(1/2), sqrt(2))
+	long long e = bits >> 52;
+	*exponent = (double)e;
+	return fast_math_from_bits( fast_math_bits( x ) - e * ( 1LL << 52 ) );
+}
+
+static inline double log_tier_fast( double x ){
+	double e;
+	double m = log_reduce( x, &e );
+	double s = ( m - 1.0 ) / ( m + 1.0 );
+	double s2 = s * s;
+	return e * FAST_MATH_LN2_HI + ( e * FAST_MATH_LN2_LO + 2.0 * s * ( 1.0 + s2 * ( 1.0 / 3 + s2 * ( 1.0 / 5 + s2 * ( 1.0 / 7 ) ) ) ) );
+}
+
+static inline double log_tier_balanced( double x ){
+	double e;
+	double m = log_reduce( x, &e );
+	double s = ( m - 1.0 ) / ( m + 1.0 );
+	double s2 = s * s;
+	return e * FAST_MATH_LN2_HI + ( e * FAST_MATH_LN2_LO + 2.0 * s * ( 1.0 + s2 * ( 1.0 / 3 + s2 * ( 1.0 / 5 + s2 * ( 1.0 / 7
+			+ s2 * ( 1.0 / 9 + s2 * ( 1.0 / 11 + s2 * ( 1.0 / 13 + s2 * ( 1.0 / 15 ) ) ) ) ) ) ) ) );
+}
+
+// exp: x = k ln2 + r with |r| <= ln2/2, a Taylor polynomial for e^r, and 2^k put straight into the exponent bits.
+// Only for |x| < 708, the fast_* entry points send everything else to libm
+
+static inline double exp_scale( double value, double k ){
+	return fast_math_from_bits( fast_math_bits( value ) + (long long)k * ( 1LL << 52 ) );
+}
+
+static inline double exp_tier_fast( double x ){
+	double k = fast_math_round( x * ( 1.0 / M_LN2 ) );
+	double r = ( x - k * FAST_MATH_LN2_HI ) - k * FAST_MATH_LN2_LO;
+	double value = 1.0 + r * ( 1.0 + r * ( 1.0 / 2 + r * ( 1.0 / 6 + r * ( 1.0 / 24 + r * ( 1.0 / 120 + r * ( 1.0 / 720 ) ) ) ) ) );
+	return exp_scale( value, k );
+}
+
+static inline double exp_tier_balanced( double x ){
+	double k = fast_math_round( x * ( 1.0 / M_LN2 ) );
+	double r = ( x - k * FAST_MATH_LN2_HI ) - k * FAST_MATH_LN2_LO;
+	double value = 1.0 + r * ( 1.0 + r * ( 1.0 / 2 + r * ( 1.0 / 6 + r * ( 1.0 / 24 + r * ( 1.0 / 120 + r * ( 1.0 / 720
+			+ r * ( 1.0 / 5040 + r * ( 1.0 / 40320 + r * ( 1.0 / 362880 + r * ( 1.0 / 3628800 + r * ( 1.0 / 39916800 ) ) ) ) ) ) ) ) ) ) );
+	return exp_scale( value, k );
+}
+
+// Tier chosen at build time, with libm covering the inputs the approximations don't
+
+static inline double fast_sin( double x ){
+#if FAST_MATH_TIER == FAST_MATH_FAST
+	return fabs( x ) < 1e6 ? sin_tier_fast( x ) : sin( x );
+#elif FAST_MATH_TIER == FAST_MATH_BALANCED
+	return fabs( x ) < 1e6 ? sin_tier_balanced( x ) : sin( x );
+#else
+	return sin( x );
+#endif
+}
+
+static inline double fast_cos( double x ){
+#if FAST_MATH_TIER == FAST_MATH_FAST
+	return fabs( x ) < 1e6 ? cos_tier_fast( x ) : cos( x );
+#elif FAST_MATH_TIER == FAST_MATH_BALANCED
+	return fabs( x ) < 1e6 ? cos_tier_balanced( x ) : cos( x );
+#else
+	return cos( x );
+#endif
+}
+
+static inline double fast_acos( double x ){
+#if FAST_MATH_TIER == FAST_MATH_FAST
+	return fabs( x ) <= 1.0 ? acos_tier_fast( x ) : acos( x );
+#elif FAST_MATH_TIER == FAST_MATH_BALANCED
+	return fabs( x ) <= 1.0 ? acos_tier_balanced( x ) : acos( x );
+#else
+	return acos( x );
+#endif
+}
+
+static inline double fast_atan2( double y, double x ){
+#if FAST_MATH_TIER == FAST_MATH_FAST
+	return isfinite( x ) && isfinite( y ) ? atan2_tier_fast( y, x ) : atan2( y, x );
+#elif FAST_MATH_TIER == FAST_MATH_BALANCED
+	return isfinite( x ) && isfinite( y ) ? atan2_tier_balanced( y, x ) : atan2( y, x );
+#else
+	return atan2( y, x );
+#endif
+}
+
+static inline double fast_log( double x ){
+#if FAST_MATH_TIER == FAST_MATH_FAST
+	return x >= DBL_MIN && x <= DBL_MAX ? log_tier_fast( x ) : log( x );
+#elif FAST_MATH_TIER == FAST_MATH_BALANCED
+	return x >= DBL_MIN && x <= DBL_MAX ? log_tier_balanced( x ) : log( x );
+#else
+	return log( x );
+#endif
+}
+
+static inline double fast_exp( double x ){
+#if FAST_MATH_TIER == FAST_MATH_FAST
+	return fabs( x ) < 708.0 ? exp_tier_fast( x ) : exp( x );
+#elif FAST_MATH_TIER == FAST_MATH_BALANCED
+	return fabs( x ) < 708.0 ? exp_tier_balanced( x ) : exp( x );
+#else
+	return exp( x );
+#endif
+}
+
+static inline double fast_pow( double x, double y ){	//exp(y log x) for positive x, libm for the sign and zero cases
+#if FAST_MATH_TIER == FAST_MATH_EXACT
+	return pow( x, y );
+#else
+	double exponent = x > 0 ? y * fast_log( x ) : 0.0;
+	return x > 0 && fabs( exponent ) < 708.0 ? fast_exp( exponent ) : pow( x, y );
+#endif
+}
+
+#endif
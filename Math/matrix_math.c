@@ -1,6 +1,8 @@
 #include <math.h>
 #include "vector_math.h"
 #include "matrix_math.h"
+#include "fast_math.h"
+#include "vec3.h"
 
 void matrix_mult( double input[][3], double num, double result[][3] ){
 	vector_mult_sp( input[0], num, result[0] );
@@ -47,35 +49,35 @@ void get_rotation_matrix_X( double matrix[][3], double theta ){
 	matrix[0][2] = 0;
 
 	matrix[1][0] = 0;
-	matrix[1][1] = cos( theta );
-	matrix[1][2] = -sin( theta );
+	matrix[1][1] = fast_cos( theta );
+	matrix[1][2] = -fast_sin( theta );
 
 	matrix[2][0] = 0;
-	matrix[2][1] = sin( theta );
-	matrix[2][2] = cos( theta );
+	matrix[2][1] = fast_sin( theta );
+	matrix[2][2] = fast_cos( theta );
 }
 
 void get_rotation_matrix_Y( double matrix[][3], double theta ){
-	matrix[0][0] = cos( theta );
+	matrix[0][0] = fast_cos( theta );
 	matrix[0][1] = 0;
-	matrix[0][2] = sin( theta );
+	matrix[0][2] = fast_sin( theta );
 
 	matrix[1][0] = 0;
 	matrix[1][1] = 1;
 	matrix[1][2] = 0;
 
-	matrix[2][0] = -sin( theta );
+	matrix[2][0] = -fast_sin( theta );
 	matrix[2][1] = 0;
-	matrix[2][2] = cos( theta );
+	matrix[2][2] = fast_cos( theta );
 }
 
 void get_rotation_matrix_Z( double matrix[][3], double theta ){
-	matrix[0][0] = cos( theta );
-	matrix[0][1] = -sin( theta );
+	matrix[0][0] = fast_cos( theta );
+	matrix[0][1] = -fast_sin( theta );
 	matrix[0][2] = 0;
 
-	matrix[1][0] = sin( theta );
-	matrix[1][1] = cos( theta );
+	matrix[1][0] = fast_sin( theta );
+	matrix[1][1] = fast_cos( theta );
 	matrix[1][2] = 0;
 
 	matrix[2][0] = 0;
@@ -83,26 +85,11 @@ void get_rotation_matrix_Z( double matrix[][3], double theta ){
 	matrix[2][2] = 1;
 }
 
+// Rebuilds the matrix on every call, code that rotates the same way over and over should keep
+// the Mat3 from mat3_rotation_xyz() around like the objects do
 void apply_xyz_rotation( double* input, double* direction ){
-	double x_axis[3] = {1.0, 0.0, 0.0};
-	double y_axis[3] = {0.0, 1.0, 0.0};
-	double z_axis[3] = {0.0, 0.0, 1.0};
-
-	double rotation_matrix[3][3];
-	if( direction[0] != 0.0 ){
-		get_rotation_matrix_X(rotation_matrix, direction[0] );
-		matrix_cross_mult_sp( input, rotation_matrix );
-	}
-
-	if( direction[1] != 0.0 ){
-		get_rotation_matrix_Y(rotation_matrix, direction[1] );
-		matrix_cross_mult_sp( input, rotation_matrix );
-	}
-
-	if( direction[2] != 0.0 ){
-		get_rotation_matrix_Z(rotation_matrix, direction[2] );
-		matrix_cross_mult_sp( input, rotation_matrix );
-	}
+	Mat3 rotation_matrix = mat3_rotation_xyz( vec3_load( direction ) );
+	vec3_store( mat3_apply( &rotation_matrix, vec3_load( input ) ), input );
 }
 
 // Rodrigues/Euler's matrix rotations are very cool, but slow, the below are unused for now
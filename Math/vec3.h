@@ -0,0 +1,110 @@
+#ifndef VEC3
+#define VEC3
+
+#include <math.h>
+
+#include "fast_math.h"
+
+// Value type vectors and matrices for the SDF loop. Everything is inline and passed by value, so the
+// compiler keeps the components in registers instead of reloading them through double* arguments.
+// vector_math.h and matrix_math.h wrap these for code that still works on double arrays
+
+typedef struct{
+	double x;
+	double y;
+	double z;
+} Vec3;
+
+typedef struct{	//Applied to row vectors like matrix_cross_mult_sp(), v' = v * m
+	double m[3][3];
+} Mat3;
+
+static inline Vec3 vec3( double x, double y, double z ){
+	Vec3 v = { x, y, z };
+	return v;
+}
+
+static inline Vec3 vec3_load( const double* array ){
+	return vec3( array[0], array[1], array[2] );
+}
+
+static inline void vec3_store( Vec3 v, double* array ){
+	array[0] = v.x;
+	array[1] = v.y;
+	array[2] = v.z;
+}
+
+static inline Vec3 vec3_add( Vec3 a, Vec3 b ){
+	return vec3( a.x + b.x, a.y + b.y, a.z + b.z );
+}
+
+static inline Vec3 vec3_sub( Vec3 a, Vec3 b ){
+	return vec3( a.x - b.x, a.y - b.y, a.z - b.z );
+}
+
+static inline Vec3 vec3_scale( Vec3 v, double s ){
+	return vec3( v.x * s, v.y * s, v.z * s );
+}
+
+static inline Vec3 vec3_abs( Vec3 v ){
+	return vec3( fabs( v.x ), fabs( v.y ), fabs( v.z ) );
+}
+
+static inline Vec3 vec3_max( Vec3 v, double s ){	//Componentwise max against a scalar
+	return vec3( v.x > s ? v.x : s, v.y > s ? v.y : s, v.z > s ? v.z : s );
+}
+
+static inline double vec3_max_component( Vec3 v ){
+	double xy = v.x > v.y ? v.x : v.y;
+	return xy > v.z ? xy : v.z;
+}
+
+static inline double vec3_dot( Vec3 a, Vec3 b ){
+	return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+static inline double vec3_length( Vec3 v ){
+	return sqrt( vec3_dot( v, v ) );
+}
+
+static inline double vec3_length_xz( Vec3 v ){	//Distance from the y axis
+	return sqrt( v.x*v.x + v.z*v.z );
+}
+
+static inline Vec3 vec3_normalize( Vec3 v ){
+	double length = vec3_length( v );
+	return vec3( v.x / length, v.y / length, v.z / length );
+}
+
+static inline Vec3 mat3_apply( const Mat3* matrix, Vec3 v ){
+	return vec3( v.x * matrix->m[0][0] + v.y * matrix->m[1][0] + v.z * matrix->m[2][0],
+				v.x * matrix->m[0][1] + v.y * matrix->m[1][1] + v.z * matrix->m[2][1],
+				v.x * matrix->m[0][2] + v.y * matrix->m[1][2] + v.z * matrix->m[2][2] );
+}
+
+static inline Mat3 mat3_mul( const Mat3* a, const Mat3* b ){
+	Mat3 result;
+	for( int i = 0; i < 3; i++ ){
+		for( int j = 0; j < 3; j++ ){
+			result.m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j] + a->m[i][2] * b->m[2][j];
+		}
+	}
+	return result;
+}
+
+// The X, then Y, then Z rotations of apply_xyz_rotation() folded into one matrix, angles in radians
+static inline Mat3 mat3_rotation_xyz( Vec3 angles ){
+	double cx = fast_cos( angles.x );
+	double sx = fast_sin( angles.x );
+	double cy = fast_cos( angles.y );
+	double sy = fast_sin( angles.y );
+	double cz = fast_cos( angles.z );
+	double sz = fast_sin( angles.z );
+	Mat3 x = {{ { 1, 0, 0 }, { 0, cx, -sx }, { 0, sx, cx } }};
+	Mat3 y = {{ { cy, 0, sy }, { 0, 1, 0 }, { -sy, 0, cy } }};
+	Mat3 z = {{ { cz, -sz, 0 }, { sz, cz, 0 }, { 0, 0, 1 } }};
+	Mat3 xy = mat3_mul( &x, &y );
+	return mat3_mul( &xy, &z );
+}
+
+#endif
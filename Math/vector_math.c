@@ -1,9 +1,12 @@
 #include <math.h>
 #include "simple_math.h"
 #include "vector_math.h"
+#include "vec3.h"
+
+// double* wrappers around vec3.h, kept for code that works on arrays
 
 double magnitude(double* input_vector){	//Calculate the magnitude/distance of the 3D input vector
-	return sqrt(sqr(input_vector[0]) + sqr(input_vector[1]) + sqr(input_vector[2]));
+	return vec3_length( vec3_load( input_vector ) );
 }
 
 double magnitude_2D(double* input_vector){	//Calculate the magnitude/distance of the 2D input vector
@@ -11,18 +14,15 @@ double magnitude_2D(double* input_vector){	//Calculate the magnitude/distance of
 }
 
 double distance_between(double* x_array, double* y_array ){
-	return sqrt(sqr(x_array[0] - y_array[0]) + sqr(x_array[1] - y_array[1]) + sqr(x_array[2] - y_array[2]));
+	return vec3_length( vec3_sub( vec3_load( x_array ), vec3_load( y_array ) ) );
 }
 
 double dot_product( double* x_array, double* y_array ){
-	return x_array[0]*y_array[0] + x_array[1]*y_array[1] + x_array[2]*y_array[2];
+	return vec3_dot( vec3_load( x_array ), vec3_load( y_array ) );
 }
 
 void normalize(double* vector) {
-    double length = magnitude(vector);
-    vector[0] /= length;
-    vector[1] /= length;
-    vector[2] /= length;
+	vec3_store( vec3_normalize( vec3_load( vector ) ), vector );
 }
 
 void vect_degrees_to_radians( double* input ){
@@ -54,4 +54,19 @@ void reflect( double* ray, double* normal, double* result ){
 	result[0] = ray[0] - 2 * dot_ray_norm * normal[0];
 	result[1] = ray[1] - 2 * dot_ray_norm * normal[1];
 	result[2] = ray[2] - 2 * dot_ray_norm * normal[2];
+}
+
+// Bends ray through a surface by Snell's law, eta is the ratio of the indices of refraction (from / to)
+// normal must face against ray, returns 0 and leaves result untouched on total internal reflection
+int refract( double* ray, double* normal, double eta, double* result ){
+	double cos_incident = -dot_product( ray, normal );
+	double sin2_transmitted = sqr( eta ) * ( 1.0 - sqr( cos_incident ) );
+	if( sin2_transmitted > 1.0 ){
+		return 0;
+	}
+	double normal_scale = eta * cos_incident - sqrt( 1.0 - sin2_transmitted );
+	result[0] = eta * ray[0] + normal_scale * normal[0];
+	result[1] = eta * ray[1] + normal_scale * normal[1];
+	result[2] = eta * ray[2] + normal_scale * normal[2];
+	return 1;
 }
\ No newline at end of file
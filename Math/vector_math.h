@@ -12,6 +12,7 @@ void vector_mult( double* input, double num );
 void vector_mult_sp( double* input, double num, double* result );
 
 void reflect( double* ray, double* normal, double* result );
+int refract( double* ray, double* normal, double eta, double* result );
 
 void vect_degrees_to_radians( double* input );
 
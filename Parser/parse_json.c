@@ -1,4 +1,7 @@
 #include <ctype.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,21 +10,30 @@
 #include "../Math/vector_math.h"
 #include "parse_json.h"
 
-int line = 1;	//Line currently being parsed
+// Nothing here is global, so scenes can be parsed on several threads at once. Errors don't exit,
+// parse_error() writes the message into the reader and jumps back to read_scene(), which frees what it
+// parsed so far and returns -1
+
+void parse_error(JsonReader* json, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(json->error, PARSE_ERROR_SIZE, format, arguments);
+    va_end(arguments);
+    longjmp(json->failed, 1);
+}
 
 // next_c() wraps the getc() function and provides error checking and line
 // number maintenance
-int next_c(FILE* json) {
-    int c = fgetc(json);
+int next_c(JsonReader* json) {
+    int c = fgetc(json->file);
 #ifdef DEBUG
     printf("next_c: '%c'\n", c);
 #endif
     if (c == '\n') {
-        line += 1;
+        json->line += 1;
     }
     if (c == EOF) {
-        fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", line);
-        exit(1);
+        parse_error(json, "Unexpected end of file on line number %d.", json->line);
     }
     return c;
 }
@@ -29,68 +41,60 @@ int next_c(FILE* json) {
 
 // expect_c() checks that the next character is d.  If it is not it emits
 // an error.
-void expect_c(FILE* json, int d) {
+void expect_c(JsonReader* json, int d) {
     int c = next_c(json);
     if (c == d) return;
-    fprintf(stderr, "Error: Expected '%c' on line %d.\n", d, line);
-    exit(1);    
+    parse_error(json, "Expected '%c' on line %d.", d, json->line);    
 }
 
-// next_string() gets the next string from the file handle and emits an error
-// if a string can not be obtained.
-char* next_string(FILE* json) {
-    char buffer[129];
+// next_string() reads the next string into buffer, which must hold MAX_STRING_LENGTH + 1 characters,
+// and emits an error if a string can not be obtained.
+char* next_string(JsonReader* json, char* buffer) {
     int c = next_c(json);
     if (c != '"') {
-        fprintf(stderr, "Error: Expected string on line %d.\n", line);
-        exit(1);
+        parse_error(json, "Expected string on line %d.", json->line);
     }  
     c = next_c(json);
     int i = 0;
     while (c != '"') {
-        if (i >= 128) {	//Strings must be shorter than 128 characters
-        fprintf(stderr, "Error: Strings longer than 128 characters in length are not supported.\n");
-        exit(1);      
+        if (i >= MAX_STRING_LENGTH) {	//Strings must be shorter than 128 characters
+        parse_error(json, "Strings longer than 128 characters in length are not supported.");      
         }
         if (c == '\\') {	//No escape characters allowed
-        fprintf(stderr, "Error: Strings with escape codes are not supported.\n");
-        exit(1);      
+        parse_error(json, "Strings with escape codes are not supported.");      
         }
         if (c < 32 || c > 126) {	//String characters must be ascii
-        fprintf(stderr, "Error: Strings may contain only ascii characters.\n");
-        exit(1);
+        parse_error(json, "Strings may contain only ascii characters.");
         }
         buffer[i] = c;
         i += 1;
         c = next_c(json);
     }
     buffer[i] = 0;
-    return strdup(buffer);	//Return the string in a duplicated buffer
+    return buffer;
 }
 
-double next_number(FILE* json) {	//Parse the next number and return it as a double
+double next_number(JsonReader* json) {	//Parse the next number and return it as a double
 	double value;
 	int numDigits = 0;
-	numDigits = fscanf(json, "%lf", &value);
-	if(numDigits == 0){
-		fprintf(stderr, "Error: Expected number at line %d\n", line);
-		exit(1);
+	numDigits = fscanf(json->file, "%lf", &value);
+	if(numDigits != 1){
+		parse_error(json, "Expected number at line %d", json->line);
 	}
 	return value;
 }
 
 // skip_ws() skips white space in the file.
-void skip_ws(FILE* json) {
+void skip_ws(JsonReader* json) {
     int c = next_c(json);
     while (isspace(c)) {
         c = next_c(json);
     }
-    ungetc(c, json);
+    ungetc(c, json->file);
 }
 
 
-double* next_vector(FILE* json) {	//parse the next vector, and return it in double form
-    double* v = malloc(3*sizeof(double));
+double* next_vector(JsonReader* json, double* v) {	//parse the next vector into v, and return it
     expect_c(json, '[');
     skip_ws(json);
     v[0] = next_number(json);
@@ -107,7 +111,7 @@ double* next_vector(FILE* json) {	//parse the next vector, and return it in doub
     return v;
 }
 
-void store_common_fields(Object* input_object, int type_of_field, double input_value, double* input_vector){
+void store_common_fields(JsonReader* json, Object* input_object, int type_of_field, double input_value, double* input_vector){
     if( type_of_field  == Rotation ){
         input_object->rotation[0] = input_vector[0];
         input_object->rotation[1] = input_vector[1];
@@ -115,24 +119,20 @@ void store_common_fields(Object* input_object, int type_of_field, double input_v
         vect_degrees_to_radians( input_object->rotation );
     }else if(type_of_field == Diffuse_Color){
         if(input_vector[0] > 1 || input_vector[1] > 1 || input_vector[2] > 1){
-            fprintf(stderr, "Error: Diffuse color values must be between 0 and 1, line:%d\n", line);
-            exit(1);
+            parse_error(json, "Diffuse color values must be between 0 and 1, line:%d", json->line);
         }
         if(input_vector[0] < 0 || input_vector[1] < 0 || input_vector[2] < 0){
-            fprintf(stderr, "Error: Diffuse color values may not be negative, line:%d\n", line);
-            exit(1);
+            parse_error(json, "Diffuse color values may not be negative, line:%d", json->line);
         }
         input_object->diffuse_color[0] = input_vector[0];
         input_object->diffuse_color[1] = input_vector[1];
         input_object->diffuse_color[2] = input_vector[2];
     }else if(type_of_field == Specular_Color){
         if(input_vector[0] > 1 || input_vector[1] > 1 || input_vector[2] > 1){
-            fprintf(stderr, "Error: Specular color values must be between 0 and 1, line:%d\n", line);
-            exit(1);
+            parse_error(json, "Specular color values must be between 0 and 1, line:%d", json->line);
         }
         if(input_vector[0] < 0 || input_vector[1] < 0 || input_vector[2] < 0){
-            fprintf(stderr, "Error: Specular color values may not be negative, line:%d\n", line);
-            exit(1);
+            parse_error(json, "Specular color values may not be negative, line:%d", json->line);
         }
         input_object->specular_color[0] = input_vector[0];
         input_object->specular_color[1] = input_vector[1];
@@ -148,36 +148,47 @@ void store_common_fields(Object* input_object, int type_of_field, double input_v
         input_object->ior = input_value;
     }else if(type_of_field == Infinite_Interval){
         if(input_value > 0) input_object->infinite_interval = input_value;
+    }else if(type_of_field == Lipschitz){
+        if(input_value <= 0){
+            parse_error(json, "Lipschitz bounds must be greater than 0, line:%d", json->line);
+        }
+        input_object->lipschitz = input_value;
     }
 }
 
 //This function takes an input value or vector, and puts it into our object array
-void store_value(Object* input_object, int type_of_field, double input_value, double* input_vector){
+void store_value(JsonReader* json, Object* input_object, int type_of_field, double input_value, double* input_vector){
 	//if input_value or input_vector aren't used, a 0 or NULL value should be passed in
 	if( input_object->kind == Camera ){	//If the object is a camera, store the input into its width or height fields
 		if(type_of_field == Width){
 			if(input_value <= 0){
-				fprintf(stderr, "Error: Camera width must be greater than 0, line:%d\n", line);
-				exit(1);
+				parse_error(json, "Camera width must be greater than 0, line:%d", json->line);
 			}
 			input_object->camera.width = input_value;
 		}else if(type_of_field == Height){
 			if(input_value <= 0){
-				fprintf(stderr, "Error: Camera height must be greater than 0, line:%d\n", line);
-				exit(1);
+				parse_error(json, "Camera height must be greater than 0, line:%d", json->line);
 			}
 			input_object->camera.height = input_value;
+		}else if(type_of_field == Max_Steps || type_of_field == Epsilon_Scale || type_of_field == Far_Plane){
+			if(input_value <= 0){
+				parse_error(json, "Camera march limits must be greater than 0, line:%d", json->line);
+			}
+			if(type_of_field == Max_Steps) input_object->camera.max_steps = input_value;
+			if(type_of_field == Epsilon_Scale) input_object->camera.epsilon_scale = input_value;
+			if(type_of_field == Far_Plane) input_object->camera.far_plane = input_value;
+		}else if(type_of_field == Lod_Bias){
+			input_object->camera.lod_bias = input_value;
 		}else{
-			fprintf(stderr, "Error: Camera may only have 'width' or 'height' fields, line:%d\n", line);
-			exit(1);
+			parse_error(json, "Camera may only have 'width', 'height', 'max_steps', 'epsilon_scale', 'far_plane' or 'lod_bias' fields, line:%d", json->line);
 		}
 	}else if( input_object->kind == Sphere ){	//If the object is a sphere, store input into its respective fields
-        store_common_fields(input_object, type_of_field, input_value, input_vector);
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
 		if(type_of_field == Radius){
 			input_object->sphere.radius = input_value;
 		}
 	}else if( input_object->kind == Plane ){	//If the object is a plane, store input into its respective fields
-		store_common_fields(input_object, type_of_field, input_value, input_vector);
+		store_common_fields(json, input_object, type_of_field, input_value, input_vector);
 		if(type_of_field == Normal){
 			if(input_vector[2] > 0){
 				input_object->plane.normal[0] = -input_vector[0];
@@ -191,14 +202,14 @@ void store_value(Object* input_object, int type_of_field, double input_value, do
 			normalize(input_object->plane.normal);
 		}
     }else if( input_object->kind == Donut ){
-        store_common_fields(input_object, type_of_field, input_value, input_vector);
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
         if( type_of_field == Radius ){
             input_object->donut.radius = input_value;
         }else if( type_of_field == Thickness ){
             input_object->donut.thickness = input_value;
         }
     }else if ( input_object->kind == Box ){
-        store_common_fields(input_object, type_of_field, input_value, input_vector);
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
         if( type_of_field == Dimensions ){
             input_object->box.dimensions[0] = input_vector[0];
             input_object->box.dimensions[1] = input_vector[1];
@@ -209,21 +220,53 @@ void store_value(Object* input_object, int type_of_field, double input_value, do
 
         }
     }else if( input_object->kind == Cone ){
-        store_common_fields(input_object, type_of_field, input_value, input_vector);
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
         if( type_of_field == Angle ){
 			input_object->cone.angle = degrees_to_radians( input_value );
+			input_object->cone.cos_sin[0] = cos( input_object->cone.angle );
+			input_object->cone.cos_sin[1] = sin( input_object->cone.angle );
 		}else if(type_of_field == Height ){
             input_object->cone.height = input_value;
         }
     }else if( input_object->kind == EternalCylinder ){
-        store_common_fields(input_object, type_of_field, input_value, input_vector);
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
         if(type_of_field == Radius){
 			input_object->eternal_cylinder.radius = input_value;
 		}
     }else if ( input_object->kind == Mandelbulb ){
-        store_common_fields(input_object, type_of_field, input_value, input_vector);
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
+    }else if ( input_object->kind == Menger ){
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
+        if(type_of_field == Size){
+            if(input_value <= 0){
+                parse_error(json, "Menger sponge size must be greater than 0, line:%d", json->line);
+            }
+            input_object->menger.size = input_value;
+        }
+    }else if ( input_object->kind == Mandelbox ){
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
+        if(type_of_field == Size){
+            if(input_value <= 0){
+                parse_error(json, "Mandelbox size must be greater than 0, line:%d", json->line);
+            }
+            input_object->mandelbox.size = input_value;
+        }else if(type_of_field == Scale){
+            if(fabs(input_value) <= 1){	// The box only stays bounded when every fold scales it up
+                parse_error(json, "Mandelbox scale must be above 1 or below -1, line:%d", json->line);
+            }
+            input_object->mandelbox.scale = input_value;
+        }
+    }else if ( input_object->kind == Julia ){
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
+        if(type_of_field == Constant){
+            input_object->julia.constant[0] = input_vector[0];
+            input_object->julia.constant[1] = input_vector[1];
+            input_object->julia.constant[2] = input_vector[2];
+        }else if(type_of_field == Constant_W){
+            input_object->julia.constant[3] = input_value;
+        }
 	}else if(input_object->kind == Light){	//If object is a light, store input into its respective fields
-        store_common_fields(input_object, type_of_field, input_value, input_vector);
+        store_common_fields(json, input_object, type_of_field, input_value, input_vector);
 		if(type_of_field == Color){
 			input_object->light.color[0] = input_vector[0];
 			input_object->light.color[1] = input_vector[1];
@@ -245,22 +288,44 @@ void store_value(Object* input_object, int type_of_field, double input_value, do
 			input_object->light.theta = input_value;
 		}
 	}else{
-		fprintf(stderr, "Error: Undefined object type, line:%d\n", line);
-		exit(1);
+		parse_error(json, "Undefined object type, line:%d", json->line);
 	}
 }
 
-int read_scene(char* filename, Object** object_array) {	//Parses json file, and stores object information into object_array
+const char* primitive_name(Primitive kind) {
+    static const char* names[] = { "camera", "sphere", "plane", "box", "donut", "cone", "eternal_cylinder", "mandelbulb",
+                                   "menger", "mandelbox", "julia", "light" };
+    return names[kind];
+}
+
+// Parses the json file into object_array and returns the index of the last object, or -1 (SCENE_UNREADABLE if
+// the file couldn't be opened) with the reason in error, which holds PARSE_ERROR_SIZE characters. Nothing is
+// left allocated when parsing fails
+int read_scene(char* filename, Object** object_array, char* error) {
     int c;
     int num_objects = 0;
-    int object_counter = -1;
+    volatile int object_counter = -1;	//Survives the longjmp() out of a failed parse
     int height = 0, width = 0, radius = 0, diffuse_color = 0, specular_color = 0, position = 0, normal = 0;	//These will serve as boolean operators
     int radial_a2 = 0, radial_a1 = 0, radial_a0 = 0, angular_a0 = 0, color = 0, theta = 0, ior = 0;
-    FILE* json = fopen(filename, "r");	//Open our json file
+    char key[MAX_STRING_LENGTH + 1];
+    char value[MAX_STRING_LENGTH + 1];
+    double vector[3];
+    JsonReader reader;
+    JsonReader* json = &reader;
+    reader.file = fopen(filename, "r");	//Open our json file
+    reader.line = 1;
+    reader.error = error;
 
-    if (json == NULL) {	//If the file does not exist, throw an error
-        fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
-        exit(1);
+    if (reader.file == NULL) {	//If the file does not exist, throw an error
+        snprintf(error, PARSE_ERROR_SIZE, "Could not open file \"%s\"", filename);
+        return SCENE_UNREADABLE;
+    }
+    if (setjmp(reader.failed) != 0) {	//Every parse_error() lands here
+        for (int i = 0; i <= object_counter; i++) {
+            free(object_array[i]);
+        }
+        fclose(reader.file);
+        return -1;
     }
     
     skip_ws(json);
@@ -272,30 +337,25 @@ int read_scene(char* filename, Object** object_array) {	//Parses json file, and
 
     // Find the objects
     while (1) {
-        c = fgetc(json);
+        c = fgetc(json->file);
         if (c == ']' && num_objects != 0) {		//A ',' must be read before getting here, which means we are expecting more objects
-            fprintf(stderr, "Error: End of file reached when expecting more objects, line:%d\n", line);
-            exit(1);
+            parse_error(json, "End of file reached when expecting more objects, line:%d", json->line);
         }
         else if(c == ']'){	//If no objects have been parsed and a bracket is found, our file is empty, throw an error
-            fprintf(stderr, "Error: JSON file contains no objects\n");
-            fclose(json);
-            exit(1);
+            parse_error(json, "JSON file contains no objects");
         }
         
         if (c == '{') {	//Start object parsing
-        if(object_counter >= 128){	//If 128 objects have already been scanned, throw an error
-            fprintf(stderr, "Error: Maximum amount of objects allowed (not including the camera) is 128, line:%d\n", line);
-            exit(1);
+        if(object_counter >= MAX_OBJECTS){	//If MAX_OBJECTS objects have already been scanned, throw an error
+            parse_error(json, "Maximum amount of objects allowed (not including the camera) is %d, line:%d", MAX_OBJECTS, json->line);
         }
-        object_array[++object_counter] = malloc(sizeof(Object)); //Make space for the new object in object_array
+        object_array[++object_counter] = calloc(1, sizeof(Object)); //Make space for the new object in object_array, unset fields default to zero
         skip_ws(json);
         
         // Parse object type
-        char* key = next_string(json);
+        next_string(json, key);
         if (strcmp(key, "type") != 0) {
-            fprintf(stderr, "Error: Expected \"type\" key on line number %d.\n", line);
-            exit(1);
+            parse_error(json, "Expected \"type\" key on line number %d.", json->line);
         }
 
         skip_ws(json);
@@ -304,7 +364,7 @@ int read_scene(char* filename, Object** object_array) {	//Parses json file, and
 
         skip_ws(json);
 
-        char* value = next_string(json);
+        next_string(json, value);
 
         if (strcmp(value, "camera") == 0) {
             object_array[object_counter]->kind = Camera;
@@ -338,6 +398,7 @@ int read_scene(char* filename, Object** object_array) {	//Parses json file, and
             ior = 1;
         } else if (strcmp(value, "cone") == 0) {
             object_array[object_counter]->kind = Cone;
+            object_array[object_counter]->cone.cos_sin[0] = 1.0;	// cos(0) until an angle is read
             position = 1;
             specular_color = 1;
             diffuse_color = 1;
@@ -354,6 +415,28 @@ int read_scene(char* filename, Object** object_array) {	//Parses json file, and
             specular_color = 1;
             diffuse_color = 1;
             ior = 1;
+        } else if (strcmp(value, "menger") == 0) {
+            object_array[object_counter]->kind = Menger;
+            object_array[object_counter]->menger.size = 1.0;
+            position = 1;
+            specular_color = 1;
+            diffuse_color = 1;
+            ior = 1;
+        } else if (strcmp(value, "mandelbox") == 0) {
+            object_array[object_counter]->kind = Mandelbox;
+            object_array[object_counter]->mandelbox.scale = MANDELBOX_DEFAULT_SCALE;
+            object_array[object_counter]->mandelbox.size = 1.0;
+            position = 1;
+            specular_color = 1;
+            diffuse_color = 1;
+            ior = 1;
+        } else if (strcmp(value, "julia") == 0) {
+            object_array[object_counter]->kind = Julia;
+            memcpy(object_array[object_counter]->julia.constant, (double[4]){ JULIA_DEFAULT_CONSTANT }, sizeof(double) * 4);
+            position = 1;
+            specular_color = 1;
+            diffuse_color = 1;
+            ior = 1;
         } else if (strcmp(value, "light") == 0){
             object_array[object_counter]->kind = Light;
             position = 1;
@@ -364,8 +447,7 @@ int read_scene(char* filename, Object** object_array) {	//Parses json file, and
             angular_a0 = 1;
             theta = 1;
         } else {
-            fprintf(stderr, "Error: Unknown type, \"%s\", on line number %d.\n", value, line);
-            exit(1);
+            parse_error(json, "Unknown type, \"%s\", on line number %d.", value, json->line);
         }
 
         skip_ws(json);
@@ -378,107 +460,120 @@ int read_scene(char* filename, Object** object_array) {	//Parses json file, and
             //If a required field is missing from an object, throw an error
             if(height == 1 || width == 1 || position == 1 || normal == 1 || color == 1 || radius == 1 ||
             diffuse_color == 1 || specular_color == 1 || position == 1){	//If a required value was not in the json file, throw error
-                fprintf(stderr, "Error: Required field missing from object at line:%d\n", line);
-                exit(1);
+                parse_error(json, "Required field missing from object at line:%d", json->line);
             }
             if(radial_a0 == 1){	//If radial_a0 did not exist in json file, store the default value 1
-                store_value(object_array[object_counter], Radial_A0, 1, NULL);
+                store_value(json, object_array[object_counter], Radial_A0, 1, NULL);
                 radial_a0 = 0;
             }
             if(radial_a1 == 1){	//If radial_a1 did not exist in json file, store the default value 0
-                store_value(object_array[object_counter], Radial_A1, 0, NULL);
+                store_value(json, object_array[object_counter], Radial_A1, 0, NULL);
                 radial_a1 = 0;
             }
             if(radial_a2 == 1){	//If radial_a2 did not exist in json file, store the default value 0
-                store_value(object_array[object_counter], Radial_A2, 0, NULL);
+                store_value(json, object_array[object_counter], Radial_A2, 0, NULL);
                 radial_a2 = 0;
             }
             if(angular_a0 == 1){	//If angular_a0 did not exist in json file, store default value 0
-                store_value(object_array[object_counter], Angular_A0, 0, NULL);
+                store_value(json, object_array[object_counter], Angular_A0, 0, NULL);
                 angular_a0 = 0;
             }
             if(theta == 1){	//If theta did not exist in json file, store default value 0
-                store_value(object_array[object_counter], Theta, 0, NULL);
+                store_value(json, object_array[object_counter], Theta, 0, NULL);
                 theta = 0;
             }
             if(ior == 1){
-                store_value(object_array[object_counter], Ior, 1, NULL);
+                store_value(json, object_array[object_counter], Ior, 1, NULL);
                 ior = 0;
             }
             break;
             } else if (c == ',') {
                 // read another field
                 skip_ws(json);
-                char* key = next_string(json);
+                next_string(json, key);
                 skip_ws(json);
                 expect_c(json, ':');
                 skip_ws(json);
                 if (strcmp(key, "width") == 0){	//Based on the field, parse a number or vector
-                    store_value(object_array[object_counter], Width, next_number(json), NULL);	//And store the value in the object_array
+                    store_value(json, object_array[object_counter], Width, next_number(json), NULL);	//And store the value in the object_array
                     width = 0;
                 }else if(strcmp(key, "height") == 0){
-                    store_value(object_array[object_counter], Height, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Height, next_number(json), NULL);
                     height = 0;
                 }else if(strcmp(key, "radius") == 0) {
-                    store_value(object_array[object_counter], Radius, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Radius, next_number(json), NULL);
                     radius = 0;
                 }else if (strcmp(key, "color") == 0){
-                    store_value(object_array[object_counter], Color, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Color, 0, next_vector(json, vector));
                     color = 0;
                 }else if(strcmp(key, "position") == 0){
-                    store_value(object_array[object_counter], Position, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Position, 0, next_vector(json, vector));
                     position = 0;
                 }else if(strcmp(key, "normal") == 0) {
-                    store_value(object_array[object_counter], Normal, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Normal, 0, next_vector(json, vector));
                     normal = 0;
                 }else if(strcmp(key, "diffuse_color") == 0){
-                    store_value(object_array[object_counter], Diffuse_Color, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Diffuse_Color, 0, next_vector(json, vector));
                     diffuse_color = 0;
                 }else if(strcmp(key, "specular_color") == 0){
-                    store_value(object_array[object_counter], Specular_Color, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Specular_Color, 0, next_vector(json, vector));
                     specular_color = 0;
                 }else if(strcmp(key, "radial-a0") == 0){
-                    store_value(object_array[object_counter], Radial_A0, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Radial_A0, next_number(json), NULL);
                     radial_a0 = 0;
                 }else if(strcmp(key, "radial-a1") == 0){
-                    store_value(object_array[object_counter], Radial_A1, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Radial_A1, next_number(json), NULL);
                     radial_a1 = 0;
                 }else if(strcmp(key, "radial-a2") == 0){
-                    store_value(object_array[object_counter], Radial_A2, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Radial_A2, next_number(json), NULL);
                     radial_a2 = 0;
                 }else if(strcmp(key, "angular-a0") == 0){
-                    store_value(object_array[object_counter], Angular_A0, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Angular_A0, next_number(json), NULL);
                     angular_a0 = 0;
                 }else if(strcmp(key, "direction") == 0){
-                    store_value(object_array[object_counter], Direction, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Direction, 0, next_vector(json, vector));
                 }else if(strcmp(key, "rotation") == 0){
-                    store_value(object_array[object_counter], Rotation, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Rotation, 0, next_vector(json, vector));
                 }else if(strcmp(key, "dimensions") == 0){
-                    store_value(object_array[object_counter], Dimensions, 0, next_vector(json));
+                    store_value(json, object_array[object_counter], Dimensions, 0, next_vector(json, vector));
                 }else if(strcmp(key, "theta") == 0){
-                    double value = next_number(json);
-                    store_value(object_array[object_counter], Theta, degrees_to_radians(value), NULL);
+                    store_value(json, object_array[object_counter], Theta, degrees_to_radians(next_number(json)), NULL);
                     theta = 0;
                 }else if(strcmp(key, "shininess") == 0){
-                    store_value(object_array[object_counter], Shininess, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Shininess, next_number(json), NULL);
                 }else if(strcmp(key, "thickness") == 0){
-                    store_value(object_array[object_counter], Thickness, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Thickness, next_number(json), NULL);
                 }else if(strcmp(key, "angle") == 0){
-                    store_value(object_array[object_counter], Angle, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Angle, next_number(json), NULL);
                 }else if(strcmp(key, "ior") == 0){
-                    store_value(object_array[object_counter], Ior, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Ior, next_number(json), NULL);
                     ior = 0;
                 }else if(strcmp(key, "infinite_interval") == 0){
-                    store_value( object_array[object_counter], Infinite_Interval, next_number(json), NULL);
+                    store_value(json, object_array[object_counter], Infinite_Interval, next_number(json), NULL);
+                }else if(strcmp(key, "size") == 0){
+                    store_value(json, object_array[object_counter], Size, next_number(json), NULL);
+                }else if(strcmp(key, "scale") == 0){
+                    store_value(json, object_array[object_counter], Scale, next_number(json), NULL);
+                }else if(strcmp(key, "constant") == 0){
+                    store_value(json, object_array[object_counter], Constant, 0, next_vector(json, vector));
+                }else if(strcmp(key, "constant_w") == 0){
+                    store_value(json, object_array[object_counter], Constant_W, next_number(json), NULL);
+                }else if(strcmp(key, "lipschitz") == 0){
+                    store_value(json, object_array[object_counter], Lipschitz, next_number(json), NULL);
+                }else if(strcmp(key, "max_steps") == 0){
+                    store_value(json, object_array[object_counter], Max_Steps, next_number(json), NULL);
+                }else if(strcmp(key, "epsilon_scale") == 0){
+                    store_value(json, object_array[object_counter], Epsilon_Scale, next_number(json), NULL);
+                }else if(strcmp(key, "far_plane") == 0){
+                    store_value(json, object_array[object_counter], Far_Plane, next_number(json), NULL);
+                }else if(strcmp(key, "lod_bias") == 0){
+                    store_value(json, object_array[object_counter], Lod_Bias, next_number(json), NULL);
                 }else{	//If there was an invalid field, throw an error
-                        fprintf(stderr, "Error: Unknown property, \"%s\", on line %d.\n",
-                        key, line);
-                        exit(1);
+                        parse_error(json, "Unknown property, \"%s\", on line %d.", key, json->line);
                 }
                 skip_ws(json);
             } else {	//If a ',' or '}' was not received, throw an error
-                fprintf(stderr, "Error: Unexpected value on line %d\n", line);
-                exit(1);
+                parse_error(json, "Unexpected value on line %d", json->line);
             }
         }
         skip_ws(json);
@@ -488,13 +583,11 @@ int read_scene(char* filename, Object** object_array) {	//Parses json file, and
 
         skip_ws(json);
         } else if (c == ']') {	//If there is an ending bracket, it is the end JSON file
-        fclose(json);
+        fclose(json->file);
         return object_counter;
         } else {	//Throw error if we don't encounter a ',' or ']'
-            fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", line);
-            exit(1);
+            parse_error(json, "Expecting ',' or ']' on line %d.", json->line);
         }
         }
     }
-    line = 1;
 }
\ No newline at end of file
@@ -1,6 +1,25 @@
 #ifndef PARSE_JSON
 #define PARSE_JSON
 
+#include <setjmp.h>
+#include <stdio.h>
+
+#include "../Math/vec3.h"
+
+#define MAX_OBJECTS 1024	//Maximum amount of objects in a scene, not including the camera
+#define MAX_STRING_LENGTH 128	//Longest string read_scene() accepts
+#define PARSE_ERROR_SIZE 256	//Room read_scene() needs for an error message
+#define SCENE_UNREADABLE -2	//read_scene() couldn't open the file, -1 is any other error
+#define MANDELBOX_DEFAULT_SCALE 2.0
+#define JULIA_DEFAULT_CONSTANT -0.291, -0.399, 0.339, 0.437	//x y z w
+
+typedef struct {	//State of one read_scene() call
+	FILE* file;
+	int line;	//Line currently being parsed
+	char* error;	//Where parse_error() writes its message
+	jmp_buf failed;	//Where parse_error() jumps to
+} JsonReader;
+
 typedef enum {
 	Camera,
 	Sphere,
@@ -10,6 +29,9 @@ typedef enum {
 	Cone,
 	EternalCylinder,
 	Mandelbulb,
+	Menger,
+	Mandelbox,
+	Julia,
 	Light
 } Primitive;
 
@@ -19,13 +41,22 @@ typedef struct {	//Create structure to be used for our object_array
 	double specular_color[3];
 	double position[3];
 	double rotation[3]; // In degrees not radians
+	Mat3 rotation_matrix; // Computed after parsing, see setup_object_lists()
 	double shininess;
 	double ior;
 	double infinite_interval;
+	double lipschitz;	// Fastest the SDF changes per unit moved, steps are divided by it. 0 until setup_object_lists() sets the default
+	double step_scale;	// 1 / lipschitz, so all_intersections() doesn't divide every step
+	double shell_radius;	// Fractals only, radius around the position that holds all of it. Computed after parsing, see fractal_shell_radius()
+	double cull_radius;	// Outside this radius around the position the SDF is at least the distance to it. Computed after parsing, see object_cull_radius()
 	union {
 		struct {
 			double width;
 			double height;
+			double max_steps;	// Optional march limits, 0 means use the renderer's default
+			double epsilon_scale;
+			double far_plane;
+			double lod_bias;	// Extra (or fewer, if negative) fractal iterations
 		} camera;
 		struct {
 			double radius;
@@ -43,6 +74,7 @@ typedef struct {	//Create structure to be used for our object_array
 		struct {
 			double angle; // In degrees not radians
 			double height;
+			double cos_sin[2]; // Cosine and sine of the angle, so cone_sdf() doesn't recompute them every step
 		} cone;
 		struct {
 			double radius;
@@ -50,6 +82,16 @@ typedef struct {	//Create structure to be used for our object_array
 		struct {
 			// Put any mandelbulb specific fields here
 		} mandelbulb;
+		struct {
+			double size;	// Half the edge of the sponge's cube
+		} menger;
+		struct {
+			double scale;	// Negative or positive, but further from 0 than 1
+			double size;	// Half the edge of the cube that holds the box
+		} mandelbox;
+		struct {
+			double constant[4];	// Quaternion c of z^2 + c, the last component is "constant_w"
+		} julia;
 		struct {
 			double color[3];
 			double direction[3];
@@ -58,11 +100,21 @@ typedef struct {	//Create structure to be used for our object_array
 			double radial_a0;
 			double angular_a0;
 			double theta;
+			double influence_radius; // Computed after parsing, see extract_lights()
 		} light;
 	};
 } Object;
 
-int read_scene(char* filename, Object** object_array);
+int read_scene(char* filename, Object** object_array, char* error);
+const char* primitive_name(Primitive kind);	// The "type" of the kind in scene files
+
+// What read_scene() is built from, for other JSON files. Errors longjmp() to the reader's failed
+void parse_error(JsonReader* json, const char* format, ...);
+int next_c(JsonReader* json);
+void expect_c(JsonReader* json, int d);
+char* next_string(JsonReader* json, char* buffer);
+double next_number(JsonReader* json);
+void skip_ws(JsonReader* json);
 
 typedef enum {
 	Width,
@@ -85,7 +137,16 @@ typedef enum {
 	Thickness,
 	Angle,
 	Ior,
-	Infinite_Interval
+	Infinite_Interval,
+	Max_Steps,
+	Epsilon_Scale,
+	Far_Plane,
+	Lod_Bias,
+	Lipschitz,
+	Size,
+	Scale,
+	Constant,
+	Constant_W
 } FieldType;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aov.h"
+#include "trace.h"
+
+// AOVs are what the camera ray of every pixel found on its way to a color: how deep the hit is, which way
+// the surface faces, what was hit, how many steps it took and how much light got past the shadow rays.
+// The renderers hand over values they already worked out, so recording them is a few stores per pixel.
+// Floats go out as PFM, indices and counts as 16 bit PGM.
+
+const char* aov_names[AOV_COUNT] = { "depth", "normal", "object", "steps", "shadow" };
+
+int aov_channels( RenderAov aov ){	//Floats per pixel
+	return aov == AOV_NORMAL ? 3 : 1;
+}
+
+void free_aovs( RenderContext* context ){
+	for( int aov = 0; aov < AOV_COUNT; aov++ ){
+		free( context->aovs[aov] );
+		context->aovs[aov] = NULL;
+	}
+	context->aov_pixels = 0;
+}
+
+RenderStatus prepare_aovs( RenderContext* context, int pixels ){	//Buffers for the AOVs in options.aovs, drops the others
+	for( int aov = 0; aov < AOV_COUNT; aov++ ){
+		int wanted = context->options.aovs & ( 1 << aov );
+		if( context->aovs[aov] != NULL && ( !wanted || context->aov_pixels != pixels ) ){
+			free( context->aovs[aov] );
+			context->aovs[aov] = NULL;
+		}
+		if( wanted && context->aovs[aov] == NULL ){
+			context->aovs[aov] = malloc( sizeof(float) * aov_channels( aov ) * pixels );
+			if( context->aovs[aov] == NULL ){
+				free_aovs( context );
+				return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory for the %s AOV", aov_names[aov] );
+			}
+		}
+	}
+	context->aov_pixels = pixels;
+	return RENDER_OK;
+}
+
+void record_camera_aovs( RenderContext* context, int pixel, Intersect* intersection ){	//Depth, object and steps of a camera ray
+	float** aovs = context->aovs;
+	int hit = !isinf( intersection->min_distance );
+	if( aovs[AOV_DEPTH] != NULL ){
+		aovs[AOV_DEPTH][pixel] = hit ? intersection->position[2] : INFINITY;	//The camera sits at the origin looking down +z
+	}
+	if( aovs[AOV_OBJECT] != NULL ){
+		aovs[AOV_OBJECT][pixel] = hit ? intersection->best_index : 0;
+	}
+	if( aovs[AOV_STEPS] != NULL ){
+		aovs[AOV_STEPS][pixel] = intersection->steps;
+	}
+}
+
+void record_shading_aovs( RenderContext* context, int pixel, double* normal, double light_share ){
+	float** aovs = context->aovs;
+	if( aovs[AOV_NORMAL] != NULL ){
+		aovs[AOV_NORMAL][pixel*3] = normal[0];
+		aovs[AOV_NORMAL][pixel*3 + 1] = normal[1];
+		aovs[AOV_NORMAL][pixel*3 + 2] = normal[2];
+	}
+	if( aovs[AOV_SHADOW] != NULL ){
+		aovs[AOV_SHADOW][pixel] = light_share;
+	}
+}
+
+int write_pfm( FILE* file, float* values, int channels, int width, int height ){	//Returns 0 if a write failed
+	int little_endian = *(unsigned char*)&(int){ 1 };
+	fprintf( file, "%s\n%d %d\n%s\n", channels == 3 ? "PF" : "Pf", width, height, little_endian ? "-1.0" : "1.0" );	//The scale's sign is the byte order
+	for( int y = height - 1; y >= 0; y-- ){	//PFM rows go bottom to top
+		if( fwrite( values + (size_t)y * width * channels, sizeof(float), (size_t)width * channels, file ) != (size_t)width * channels ){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int write_pgm( FILE* file, float* values, int width, int height ){	//16 bit, most significant byte first
+	unsigned char* bytes = malloc( (size_t)width * height * 2 );
+	if( bytes == NULL ){
+		return 0;
+	}
+	for( int i = 0; i < width*height; i++ ){
+		int value = values[i] < AOV_PGM_LIMIT ? (int)values[i] : AOV_PGM_LIMIT;
+		bytes[i*2] = value >> 8;
+		bytes[i*2 + 1] = value & 0xff;
+	}
+	fprintf( file, "P5\n%d %d\n%d\n", width, height, AOV_PGM_LIMIT );
+	int written = fwrite( bytes, 1, (size_t)width * height * 2, file ) == (size_t)width * height * 2;
+	free( bytes );
+	return written;
+}
+
+RenderStatus write_aovs( RenderContext* context, int width, int height, char* prefix ){
+	if( width * height != context->aov_pixels ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "The last render recorded AOVs of %d pixels, not %dx%d", context->aov_pixels, width, height );
+	}
+	trace_begin( "aov write", TRACE_NO_INDEX );
+	for( int aov = 0; aov < AOV_COUNT; aov++ ){
+		if( context->aovs[aov] == NULL ){
+			continue;
+		}
+		int integer = aov == AOV_OBJECT || aov == AOV_STEPS;
+		char file_name[strlen( prefix ) + 16];
+		sprintf( file_name, "%s.%s.%s", prefix, aov_names[aov], integer ? "pgm" : "pfm" );
+		FILE* file = fopen( file_name, "wb" );
+		if( file == NULL ){
+			trace_end( "aov write" );
+			return render_fail( context, RENDER_ERROR_FILE, "Could not write AOV \"%s\"", file_name );
+		}
+		int written = integer ? write_pgm( file, context->aovs[aov], width, height ) :
+								write_pfm( file, context->aovs[aov], aov_channels( aov ), width, height );
+		if( fclose( file ) != 0 || !written ){
+			trace_end( "aov write" );
+			return render_fail( context, RENDER_ERROR_FILE, "Could not write AOV \"%s\"", file_name );
+		}
+	}
+	trace_end( "aov write" );
+	return RENDER_OK;
+}
@@ -0,0 +1,17 @@
+#ifndef AOV
+#define AOV
+
+#include "../raymarch.h"
+
+#define AOV_PGM_LIMIT 65535	//Object indices and step counts are clamped to what a 16 bit PGM holds
+
+extern const char* aov_names[AOV_COUNT];
+
+int aov_channels( RenderAov aov );
+RenderStatus prepare_aovs( RenderContext* context, int pixels );
+void free_aovs( RenderContext* context );
+void record_camera_aovs( RenderContext* context, int pixel, Intersect* intersection );
+void record_shading_aovs( RenderContext* context, int pixel, double* normal, double light_share );
+RenderStatus write_aovs( RenderContext* context, int width, int height, char* prefix );
+
+#endif
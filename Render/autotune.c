@@ -0,0 +1,272 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "autotune.h"
+#include "progressive.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// render_autotune() times a sparse, stratified sample of tiles under candidate settings and keeps the
+// fastest whose sample stays within the tolerance of the untuned one. Rather than every combination it
+// tries each setting's alternatives in turn from the best found so far, which takes a handful of sample
+// renders. Projected times scale the sample up to the whole image and add what building the shadow cache
+// cost, since that's paid once per render whatever its size.
+
+typedef struct{	//The sample every candidate is timed on
+	RenderContext* context;
+	TileJob tiles;	//pending holds the sampled tiles
+	double* framebuffer;	//The whole image, only the sampled tiles are ever traced
+	double* reference;	//Colors of the sampled tiles rendered untuned
+	int width;
+	int height;
+	double scale;	//Tiles of the image per sampled tile
+	double cache_seconds;	//What building a shadow cache took, 0 until one was built
+} TuneSample;
+
+void apply_tuning( RenderContext* context, RenderTuning* tuning ){
+	context->options.hybrid = tuning->hybrid;
+	context->options.shading_rate = tuning->shading_rate;
+	context->options.shadow_cache_resolution = tuning->shadow_cache_resolution;
+	context->object_array[0]->camera.epsilon_scale = tuning->epsilon_scale;
+}
+
+// The scene, image size, threads and everything the untuned render depends on, under which tune files keep results
+unsigned long long tuning_hash( RenderContext* context, int width, int height, double tolerance ){
+	RenderOptions* options = &context->options;
+	int settings[] = { AUTOTUNE_VERSION, width, height, options->threads, options->hybrid, options->binning, options->shading_rate,
+						options->shadow_cache_resolution, options->aovs, FAST_MATH_TIER };
+	unsigned long long hash = fnv1a( FNV_OFFSET_BASIS, settings, sizeof(settings) );
+	hash = fnv1a( hash, &tolerance, sizeof(double) );
+	for( int i = 0; i < context->object_counter + 1; i++ ){
+		hash = fnv1a( hash, context->object_array[i], sizeof(Object) );
+	}
+	for( int i = 0; i < context->light_counter; i++ ){
+		hash = fnv1a( hash, context->light_array[i], sizeof(Object) );
+	}
+	return hash;
+}
+
+// Lines of the tune file are a hash and the tuning picked for it, later lines win. 1 if hash has one
+int read_tuning( char* tune_file, unsigned long long hash, RenderTuning* tuning ){
+	FILE* input = fopen( tune_file, "r" );
+	if( input == NULL ){
+		return 0;
+	}
+	int found = 0;
+	unsigned long long line_hash;
+	RenderTuning line;
+	while( fscanf( input, "%llx %d %d %d %lf %lf %lf %lf", &line_hash, &line.hybrid, &line.shading_rate, &line.shadow_cache_resolution,
+					&line.epsilon_scale, &line.seconds, &line.untuned_seconds, &line.error ) == 8 ){
+		if( line_hash == hash && line.epsilon_scale >= 0 ){
+			*tuning = line;
+			found = 1;
+		}
+	}
+	fclose( input );
+	return found;
+}
+
+RenderStatus write_tuning( RenderContext* context, char* tune_file, unsigned long long hash, RenderTuning* tuning ){
+	FILE* output = fopen( tune_file, "a" );
+	if( output == NULL ){
+		return render_fail( context, RENDER_ERROR_FILE, "Could not write tune file \"%s\"", tune_file );
+	}
+	fprintf( output, "%016llx %d %d %d %.17g %.6f %.6f %.6g\n", hash, tuning->hybrid, tuning->shading_rate, tuning->shadow_cache_resolution,
+				tuning->epsilon_scale, tuning->seconds, tuning->untuned_seconds, tuning->error );
+	if( fclose( output ) != 0 ){
+		return render_fail( context, RENDER_ERROR_FILE, "Could not write tune file \"%s\"", tune_file );
+	}
+	return RENDER_OK;
+}
+
+// Picks the middle tile of every stratum of the tile grid, or every tile of an image with fewer tiles than strata
+RenderStatus setup_sample( TuneSample* sample, RenderContext* context, int width, int height ){
+	int pixels = width * height;
+	sample->context = context;
+	sample->width = width;
+	sample->height = height;
+	sample->cache_seconds = 0.0;
+	sample->framebuffer = calloc( (size_t)pixels * 3, sizeof(double) );
+	sample->reference = malloc( sizeof(double) * 3 * AUTOTUNE_STRATA * AUTOTUNE_STRATA * TILE_SIZE * TILE_SIZE );
+	double** pixel_buffer = sample->framebuffer != NULL ? wrap_framebuffer( sample->framebuffer, pixels ) : NULL;
+	int* pending = malloc( sizeof(int) * AUTOTUNE_STRATA * AUTOTUNE_STRATA );
+	if( sample->reference == NULL || pixel_buffer == NULL || pending == NULL ){
+		free( sample->framebuffer );
+		free( sample->reference );
+		free( pixel_buffer );
+		free( pending );
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory for a %dx%d image", width, height );
+	}
+	init_tile_job( &sample->tiles, context, pixel_buffer, width, height );
+	int strata_x = sample->tiles.tiles_x < AUTOTUNE_STRATA ? sample->tiles.tiles_x : AUTOTUNE_STRATA;
+	int strata_y = sample->tiles.tiles_y < AUTOTUNE_STRATA ? sample->tiles.tiles_y : AUTOTUNE_STRATA;
+	for( int j = 0; j < strata_y; j++ ){
+		for( int i = 0; i < strata_x; i++ ){
+			int tile_x = ( ( 2 * i + 1 ) * sample->tiles.tiles_x ) / ( 2 * strata_x );
+			int tile_y = ( ( 2 * j + 1 ) * sample->tiles.tiles_y ) / ( 2 * strata_y );
+			pending[sample->tiles.pending_count++] = tile_y * sample->tiles.tiles_x + tile_x;
+		}
+	}
+	sample->tiles.pending = pending;
+	sample->scale = (double)( sample->tiles.tiles_x * sample->tiles.tiles_y ) / sample->tiles.pending_count;
+	return RENDER_OK;
+}
+
+void free_sample( TuneSample* sample ){
+	free( sample->framebuffer );
+	free( sample->reference );
+	free( sample->tiles.pixel_buffer );
+	free( sample->tiles.pending );
+}
+
+// Walks the sampled tiles' pixels in order, copying them into the reference with store or measuring the
+// RMS difference from it otherwise
+double compare_sample( TuneSample* sample, int store ){
+	double squared = 0.0;
+	int count = 0;
+	for( int k = 0; k < sample->tiles.pending_count; k++ ){
+		int tile = sample->tiles.pending[k];
+		int x0 = ( tile % sample->tiles.tiles_x ) * TILE_SIZE;
+		int y0 = ( tile / sample->tiles.tiles_x ) * TILE_SIZE;
+		for( int y = y0; y < y0 + TILE_SIZE && y < sample->height; y++ ){
+			for( int x = x0; x < x0 + TILE_SIZE && x < sample->width; x++ ){
+				double* color = crop_pixel( &sample->tiles, x, y );
+				for( int channel = 0; channel < 3; channel++, count++ ){
+					if( store ){
+						sample->reference[count] = color[channel];
+					}else{
+						squared += ( color[channel] - sample->reference[count] ) * ( color[channel] - sample->reference[count] );
+					}
+				}
+			}
+		}
+	}
+	return count > 0 ? sqrt( squared / count ) : 0.0;
+}
+
+// Renders the sample with the candidate's settings and projects the time of the whole image. The first
+// call, with the untuned settings, keeps its colors as the reference the others are compared with
+RenderStatus measure_candidate( TuneSample* sample, RenderTuning* candidate, int reference ){
+	RenderContext* context = sample->context;
+	apply_tuning( context, candidate );
+	int builds_cache = context->options.shadow_cache_resolution > 0 && context->shadow_cache_resolution != context->options.shadow_cache_resolution;
+	double start = wall_clock();
+	RenderStatus status = prepare_render( context, sample->width, sample->height );
+	if( status != RENDER_OK ){
+		return status;
+	}
+	if( builds_cache ){
+		sample->cache_seconds = wall_clock() - start;
+	}
+	double fastest = INFINITY;
+	for( int trial = 0; trial < AUTOTUNE_TRIALS; trial++ ){
+		trace_begin( "autotune sample", trial );
+		start = wall_clock();
+		parallel_for( sample->tiles.pending_count, context->options.threads, render_tile, &sample->tiles );
+		fastest = fmin( fastest, wall_clock() - start );
+		trace_end( "autotune sample" );
+		if( render_cancelled( context ) ){
+			return render_fail( context, RENDER_CANCELLED, "Cancelled" );
+		}
+	}
+	candidate->seconds = fastest * sample->scale + ( candidate->shadow_cache_resolution > 0 ? sample->cache_seconds : 0.0 );
+	candidate->error = compare_sample( sample, reference );
+	return RENDER_OK;
+}
+
+// Tries every alternative of one setting from the best so far and keeps any that's faster and close enough
+RenderStatus try_alternatives( TuneSample* sample, RenderTuning* best, int* setting, int* values, int count, double tolerance ){
+	int best_value = *setting;
+	RenderTuning chosen = *best;
+	for( int i = 0; i < count; i++ ){
+		if( values[i] == best_value ){
+			continue;
+		}
+		*setting = values[i];
+		RenderTuning candidate = *best;
+		RenderStatus status = measure_candidate( sample, &candidate, 0 );
+		if( status != RENDER_OK ){
+			*best = chosen;
+			return status;
+		}
+		if( candidate.error <= tolerance && candidate.seconds < chosen.seconds * AUTOTUNE_MIN_GAIN ){
+			chosen = candidate;
+		}
+	}
+	*best = chosen;
+	return RENDER_OK;
+}
+
+RenderStatus autotune( RenderContext* context, int width, int height, double tolerance, char* tune_file, RenderTuning* tuning ){
+	RenderOptions* options = &context->options;
+	if( options->wavefront || options->cropped || options->checkpoint_file != NULL ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Autotuning samples tiles, it only tunes the tiled renderer on the whole image without a checkpoint" );
+	}
+	if( tolerance < 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "The autotune tolerance can't be negative" );
+	}
+	RenderTuning untuned = { options->hybrid, options->shading_rate > 1 ? options->shading_rate : 1, options->shadow_cache_resolution,
+								camera_epsilon_scale( context ), 0.0, 0.0, 0.0, 0 };
+	unsigned long long hash = tuning_hash( context, width, height, tolerance );
+	if( tune_file != NULL && read_tuning( tune_file, hash, tuning ) ){
+		tuning->cached = 1;
+		apply_tuning( context, tuning );
+		return RENDER_OK;
+	}
+
+	TuneSample sample;
+	RenderStatus status = setup_sample( &sample, context, width, height );
+	if( status != RENDER_OK ){
+		return status;
+	}
+	int aovs = options->aovs;
+	RenderProgress progress = context->progress;
+	RenderStats stats = render_get_stats( context );
+	options->aovs = 0;	//Nobody sees the sample, and its tiles aren't where the AOVs expect them
+	context->progress = NULL;
+	trace_begin( "autotune", TRACE_NO_INDEX );
+
+	RenderTuning best = untuned;
+	status = measure_candidate( &sample, &best, 1 );
+	untuned.seconds = best.seconds;
+	if( status == RENDER_OK ){
+		int switches[] = { 0, 1 };
+		status = try_alternatives( &sample, &best, &best.hybrid, switches, 2, tolerance );
+	}
+	if( status == RENDER_OK ){
+		int rates[] = { 1, 2, 4 };
+		status = try_alternatives( &sample, &best, &best.shading_rate, rates, 3, tolerance );
+	}
+	if( status == RENDER_OK && options->shadow_cache_file == NULL ){	//A cache read from a file costs nothing to build, leave it be
+		int resolutions[] = { 0, DEFAULT_SHADOW_CACHE_RESOLUTION };
+		status = try_alternatives( &sample, &best, &best.shadow_cache_resolution, resolutions, 2, tolerance );
+	}
+	double base_scale = untuned.epsilon_scale > 0 ? untuned.epsilon_scale : EPSILON_SCALE / 2;	//Scenes on the fixed threshold try EPSILON_SCALE and twice that
+	for( double factor = 2.0; status == RENDER_OK && factor <= 4.0; factor *= 2.0 ){	//Coarser hit thresholds stop rays sooner
+		RenderTuning candidate = best;
+		candidate.epsilon_scale = base_scale * factor;
+		status = measure_candidate( &sample, &candidate, 0 );
+		if( status == RENDER_OK && candidate.error <= tolerance && candidate.seconds < best.seconds * AUTOTUNE_MIN_GAIN ){
+			best = candidate;
+		}
+	}
+
+	trace_end( "autotune" );
+	options->aovs = aovs;
+	context->progress = progress;
+	pthread_mutex_lock( &context->stats_lock );	//The sample's rays aren't part of any render
+	context->stats = stats;
+	pthread_mutex_unlock( &context->stats_lock );
+	free_sample( &sample );
+	if( status != RENDER_OK ){
+		apply_tuning( context, &untuned );
+		return status;
+	}
+	best.untuned_seconds = untuned.seconds;
+	best.cached = 0;
+	*tuning = best;
+	apply_tuning( context, &best );
+	return tune_file != NULL ? write_tuning( context, tune_file, hash, &best ) : RENDER_OK;
+}
@@ -0,0 +1,13 @@
+#ifndef AUTOTUNE
+#define AUTOTUNE
+
+#include "tiles.h"
+
+#define AUTOTUNE_STRATA 4	//The sample is the middle tile of every cell of an AUTOTUNE_STRATA x AUTOTUNE_STRATA grid over the image
+#define AUTOTUNE_TRIALS 2	//Timed renders of the sample per candidate, the fastest counts
+#define AUTOTUNE_MIN_GAIN 0.95	//A candidate has to project at most this fraction of the best time so far, less is timing noise
+#define AUTOTUNE_VERSION 2	//Part of the hash, so tune files of an older tuner are ignored
+
+RenderStatus autotune( RenderContext* context, int width, int height, double tolerance, char* tune_file, RenderTuning* tuning );
+
+#endif
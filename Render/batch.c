@@ -0,0 +1,523 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../Parser/parse_json.h"
+#include "batch.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// render_batch() renders many images as one stream of tiles. Every distinct scene file is parsed once, up
+// front and in parallel, and with a shadow cache its cache is built once on every thread and shared by all
+// the scene's jobs, stereo eyes and cube faces alike since shadows don't depend on the view. Then the tiles
+// of all jobs are handed to one parallel_for() in priority order, so threads that run out of one job's
+// tiles go straight on to the next job's instead of waiting for the slowest tile. A job is set up (its own
+// copy of the scene, march limits for its size and view, its framebuffer) by the first thread to claim one
+// of its tiles and written and freed by the thread that traces its last, so only the jobs in flight hold
+// an image.
+
+typedef struct{	//Jobs read so far by read_manifest()
+	RenderJob* jobs;
+	int count;
+	int capacity;
+} JobList;
+
+typedef struct{	//Distinct scene files of a batch, parsed by load_batch_scene()
+	char** files;
+	RenderContext** scenes;
+} BatchScenes;
+
+void fail_job( BatchJob* batch_job, RenderStatus status, const char* error ){
+	batch_job->job->status = status;
+	snprintf( batch_job->job->error, RENDER_ERROR_SIZE, "%s", error );
+	batch_job->state = -1;
+}
+
+void release_job( BatchJob* batch_job ){	//Free everything setup_job() allocated
+	if( batch_job->tiles.context != NULL ){
+		free( batch_job->tiles.pixel_buffer );
+		free( batch_job->tiles.pending );
+		batch_job->tiles.context = NULL;
+	}
+	free( batch_job->framebuffer );
+	batch_job->framebuffer = NULL;
+	if( batch_job->context != NULL && batch_job->context->shadow_caches == batch_job->scene->shadow_caches ){	//The scene's, not the job's to free
+		batch_job->context->shadow_caches = NULL;
+		batch_job->context->shadow_cache_resolution = 0;
+	}
+	render_destroy( batch_job->context );
+	batch_job->context = NULL;
+}
+
+// Gives the job its own context with the batch's options, view and a copy of its scene, the scene's shadow
+// cache, and an image to trace into
+RenderStatus setup_job( Batch* batch, BatchJob* batch_job ){
+	RenderJob* job = batch_job->job;
+	RenderContext* context = render_create();
+	if( context == NULL ){
+		return render_fail( batch->context, RENDER_ERROR_MEMORY, "Out of memory while setting up the job" );
+	}
+	batch_job->context = context;
+	context->options = batch->context->options;
+	context->options.threads = 1;	//Already on one of the batch's threads, a shadow cache the scene doesn't have is built right here
+	context->options.stats = 0;
+	context->view = job->view;
+	RenderStatus status = copy_scene( context, batch_job->scene );
+	if( status == RENDER_OK && batch_job->scene->shadow_caches != NULL ){	//Shadows don't depend on the view, release_job() hands it back
+		context->shadow_caches = batch_job->scene->shadow_caches;
+		context->shadow_cache_resolution = batch_job->scene->shadow_cache_resolution;
+	}
+	if( status == RENDER_OK ){
+		status = prepare_render( context, job->width, job->height );
+	}
+	if( status != RENDER_OK ){
+		return status;
+	}
+	int pixels = job->width * job->height;
+	double** pixel_buffer;
+	int* pending;
+	batch_job->framebuffer = calloc( (size_t)pixels * 3, sizeof(double) );
+	pixel_buffer = batch_job->framebuffer != NULL ? wrap_framebuffer( batch_job->framebuffer, pixels ) : NULL;
+	pending = malloc( sizeof(int) * batch_job->tile_count );
+	if( pixel_buffer == NULL || pending == NULL ){
+		free( pixel_buffer );
+		free( pending );
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory for a %dx%d image", job->width, job->height );
+	}
+	init_tile_job( &batch_job->tiles, context, pixel_buffer, job->width, job->height );
+	for( int tile = 0; tile < batch_job->tile_count; tile++ ){	//render_tile() takes the tile through pending
+		pending[tile] = tile;
+	}
+	batch_job->tiles.pending = pending;
+	batch_job->tiles.pending_count = batch_job->tile_count;
+	return RENDER_OK;
+}
+
+void add_stats( RenderContext* context, RenderStats* stats ){	//Fold a job's totals into the batch's
+	pthread_mutex_lock( &context->stats_lock );
+	context->stats.camera_rays += stats->camera_rays;
+	context->stats.camera_steps += stats->camera_steps;
+	context->stats.shadow_rays += stats->shadow_rays;
+	context->stats.shadow_steps += stats->shadow_steps;
+	context->stats.cached_shadows += stats->cached_shadows;
+	context->stats.interpolated_pixels += stats->interpolated_pixels;
+	context->stats.oversteps += stats->oversteps;
+	context->stats.sdf_evaluations += stats->sdf_evaluations;
+	pthread_mutex_unlock( &context->stats_lock );
+}
+
+void finish_job( Batch* batch, BatchJob* batch_job, int index ){	//Write the finished image and drop the job
+	RenderJob* job = batch_job->job;
+	trace_begin( "image write", index );
+	job->status = create_image( batch_job->context, batch_job->tiles.pixel_buffer, job->output, job->width, job->height );
+	trace_end( "image write" );
+	if( job->status != RENDER_OK ){
+		snprintf( job->error, RENDER_ERROR_SIZE, "%s", render_error( batch_job->context ) );
+	}
+	add_stats( batch->context, &batch_job->context->stats );
+	release_job( batch_job );
+}
+
+void batch_task( int index, void* data ){	//Task for one tile of one job
+	Batch* batch = data;
+	int job_index = batch->task_jobs[index];
+	BatchJob* batch_job = &batch->jobs[job_index];
+	if( render_cancelled( batch->context ) ){
+		return;
+	}
+	pthread_mutex_lock( &batch_job->setup_lock );	//The job's other tiles wait here until it's set up
+	if( batch_job->state == 0 ){
+		trace_begin( "job setup", job_index );
+		RenderStatus status = setup_job( batch, batch_job );
+		trace_end( "job setup" );
+		if( status != RENDER_OK ){
+			fail_job( batch_job, status, render_error( batch_job->context != NULL ? batch_job->context : batch->context ) );
+			release_job( batch_job );
+		}else{
+			batch_job->state = 1;
+		}
+	}
+	int rendering = batch_job->state == 1;
+	pthread_mutex_unlock( &batch_job->setup_lock );
+
+	if( rendering ){
+		render_tile( batch->task_tiles[index], &batch_job->tiles );
+		if( atomic_fetch_sub( &batch_job->remaining, 1 ) == 1 ){
+			finish_job( batch, batch_job, job_index );
+		}
+	}
+	int finished = atomic_fetch_add( &batch->finished, 1 ) + 1;
+	trace_counter( "batch tiles done", finished );
+	report_progress( batch->context, finished, batch->task_count );
+}
+
+void load_batch_scene( int index, void* data ){	//Task for one distinct scene file
+	BatchScenes* scenes = data;
+	scenes->scenes[index] = render_create();
+	if( scenes->scenes[index] != NULL ){
+		load_scene( scenes->scenes[index], scenes->files[index] );
+	}
+}
+
+int compare_priorities( const void* a, const void* b ){	//Highest priority first, then in the order given
+	BatchJob* first = *(BatchJob**)a;
+	BatchJob* second = *(BatchJob**)b;
+	if( first->job->priority != second->job->priority ){
+		return first->job->priority > second->job->priority ? -1 : 1;
+	}
+	return ( first > second ) - ( first < second );
+}
+
+RenderStatus batch_render( RenderContext* context, RenderJob* jobs, int count ){
+	RenderOptions* options = &context->options;
+	RenderStatus status = RENDER_OK;
+	if( options->wavefront || options->cropped || options->checkpoint_file != NULL || options->aovs || options->shadow_cache_file != NULL ){
+		return render_fail( context, RENDER_ERROR_OPTIONS,
+							"Batches are rendered by the tiled renderer on whole images, without a checkpoint, AOVs or a shadow cache file" );
+	}
+	if( options->threads <= 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Threads can't be negative or zero" );
+	}
+	Batch batch = { .context = context, .task_count = 0 };
+	BatchScenes scenes;
+	int scene_count = 0;
+	BatchJob** order = malloc( sizeof(BatchJob*) * ( count > 0 ? count : 1 ) );
+	batch.jobs = calloc( count > 0 ? count : 1, sizeof(BatchJob) );
+	scenes.files = malloc( sizeof(char*) * ( count > 0 ? count : 1 ) );
+	scenes.scenes = calloc( count > 0 ? count : 1, sizeof(RenderContext*) );
+	int* job_scenes = malloc( sizeof(int) * ( count > 0 ? count : 1 ) );
+	if( order == NULL || batch.jobs == NULL || scenes.files == NULL || scenes.scenes == NULL || job_scenes == NULL ){
+		free( order );
+		free( batch.jobs );
+		free( scenes.files );
+		free( scenes.scenes );
+		free( job_scenes );
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory for %d jobs", count );
+	}
+	atomic_store( &context->cancelled, 0 );
+	atomic_init( &batch.finished, 0 );
+
+	for( int i = 0; i < count; i++ ){	//Every scene file is parsed once, however many jobs render it
+		job_scenes[i] = 0;
+		while( job_scenes[i] < scene_count && strcmp( scenes.files[job_scenes[i]], jobs[i].scene_file ) != 0 ){
+			job_scenes[i]++;
+		}
+		if( job_scenes[i] == scene_count ){
+			scenes.files[scene_count++] = jobs[i].scene_file;
+		}
+	}
+	parallel_for( scene_count, options->threads, load_batch_scene, &scenes );
+	for( int i = 0; i < count && options->shadow_cache_resolution > 0; i++ ){	//One shadow cache per scene, built on every thread, for all its jobs
+		RenderContext* scene = scenes.scenes[job_scenes[i]];
+		if( scene != NULL && scene->object_counter >= 0 && scene->shadow_caches == NULL && jobs[i].width > 0 && jobs[i].height > 0 ){
+			scene->options = *options;
+			if( prepare_render( scene, jobs[i].width, jobs[i].height ) == RENDER_OK ){	//A scene that failed leaves its jobs to build their own
+				add_stats( context, &scene->stats );
+			}
+		}
+	}
+
+	for( int i = 0; i < count; i++ ){
+		BatchJob* batch_job = &batch.jobs[i];
+		batch_job->job = &jobs[i];
+		batch_job->scene = scenes.scenes[job_scenes[i]];
+		jobs[i].status = RENDER_OK;
+		jobs[i].error[0] = '\0';
+		pthread_mutex_init( &batch_job->setup_lock, NULL );
+		order[i] = batch_job;
+		if( batch_job->scene == NULL ){
+			fail_job( batch_job, RENDER_ERROR_MEMORY, "Out of memory while loading the scene" );
+		}else if( batch_job->scene->object_counter < 0 ){	//Every job of the file gets its parse error
+			fail_job( batch_job, RENDER_ERROR_SCENE, render_error( batch_job->scene ) );
+		}else if( jobs[i].width <= 0 || jobs[i].height <= 0 ){
+			fail_job( batch_job, RENDER_ERROR_OPTIONS, "Image size can't be negative or zero" );
+		}else{
+			batch_job->tile_count = ( ( jobs[i].width + TILE_SIZE - 1 ) / TILE_SIZE ) * ( ( jobs[i].height + TILE_SIZE - 1 ) / TILE_SIZE );
+			batch.task_count += batch_job->tile_count;
+		}
+		atomic_init( &batch_job->remaining, batch_job->tile_count );
+	}
+	qsort( order, count, sizeof(BatchJob*), compare_priorities );
+	batch.task_jobs = malloc( sizeof(int) * ( batch.task_count > 0 ? batch.task_count : 1 ) );
+	batch.task_tiles = malloc( sizeof(int) * ( batch.task_count > 0 ? batch.task_count : 1 ) );
+	if( batch.task_jobs == NULL || batch.task_tiles == NULL ){
+		status = render_fail( context, RENDER_ERROR_MEMORY, "Out of memory for %d tiles", batch.task_count );
+	}else{
+		int task = 0;
+		for( int i = 0; i < count; i++ ){
+			for( int tile = 0; order[i]->state == 0 && tile < order[i]->tile_count; tile++ ){
+				batch.task_jobs[task] = order[i] - batch.jobs;
+				batch.task_tiles[task++] = tile;
+			}
+		}
+		trace_begin( "batch", count );
+		parallel_for( batch.task_count, options->threads, batch_task, &batch );
+		trace_end( "batch" );
+	}
+
+	int failed = 0;
+	for( int i = 0; i < count; i++ ){
+		BatchJob* batch_job = &batch.jobs[i];
+		if( batch_job->state >= 0 && atomic_load( &batch_job->remaining ) > 0 ){	//Cut short by a cancel
+			fail_job( batch_job, RENDER_CANCELLED, "Cancelled" );
+			release_job( batch_job );
+		}
+		if( jobs[i].status != RENDER_OK && failed++ == 0 && status == RENDER_OK ){
+			status = jobs[i].status;
+		}
+		pthread_mutex_destroy( &batch_job->setup_lock );
+	}
+	for( int i = 0; i < scene_count; i++ ){
+		render_destroy( scenes.scenes[i] );
+	}
+	free( order );
+	free( batch.jobs );
+	free( batch.task_jobs );
+	free( batch.task_tiles );
+	free( scenes.files );
+	free( scenes.scenes );
+	free( job_scenes );
+	if( render_cancelled( context ) ){
+		return render_fail( context, RENDER_CANCELLED, "Cancelled" );
+	}
+	if( failed > 0 && status != RENDER_ERROR_MEMORY ){
+		return render_fail( context, status, "%d of %d jobs failed", failed, count );
+	}
+	return status;
+}
+
+RenderJob* add_job( JobList* list ){	//A zeroed job at the end of the list, NULL without memory
+	if( list->count == list->capacity ){
+		int capacity = list->capacity > 0 ? list->capacity * 2 : MANIFEST_FIRST_CAPACITY;
+		RenderJob* jobs = realloc( list->jobs, sizeof(RenderJob) * capacity );
+		if( jobs == NULL ){
+			return NULL;
+		}
+		list->jobs = jobs;
+		list->capacity = capacity;
+	}
+	RenderJob* job = &list->jobs[list->count++];
+	memset( job, 0, sizeof(RenderJob) );
+	return job;
+}
+
+int whole_number( double number ){
+	return number == (int)number;
+}
+
+// Reads the key of a job in a .json manifest and the value after it, errors longjmp() out through parse_error()
+void read_json_field( JsonReader* json, RenderJob* job ){
+	char key[MAX_STRING_LENGTH + 1];
+	char value[MAX_STRING_LENGTH + 1];
+	next_string( json, key );
+	skip_ws( json );
+	expect_c( json, ':' );
+	skip_ws( json );
+	if( strcmp( key, "scene" ) == 0 || strcmp( key, "output" ) == 0 ){
+		char** field = strcmp( key, "scene" ) == 0 ? &job->scene_file : &job->output;
+		free( *field );
+		*field = strdup( next_string( json, value ) );
+		if( *field == NULL ){
+			parse_error( json, "Out of memory on line %d.", json->line );
+		}
+		return;
+	}
+	double number = next_number( json );
+	if( !whole_number( number ) ){
+		parse_error( json, "\"%s\" must be a whole number, line %d.", key, json->line );
+	}
+	if( strcmp( key, "width" ) == 0 ){
+		job->width = (int)number;
+	}else if( strcmp( key, "height" ) == 0 ){
+		job->height = (int)number;
+	}else if( strcmp( key, "priority" ) == 0 ){
+		job->priority = (int)number;
+	}else{
+		parse_error( json, "Unknown key \"%s\" on line %d, jobs have a scene, width, height, output and priority.", key, json->line );
+	}
+}
+
+void read_json_jobs( JsonReader* json, JobList* list ){	//[ { "scene": ..., }, ... ]
+	skip_ws( json );
+	expect_c( json, '[' );
+	skip_ws( json );
+	int c = next_c( json );
+	if( c == ']' ){
+		return;
+	}
+	ungetc( c, json->file );
+	while( 1 ){
+		skip_ws( json );
+		expect_c( json, '{' );
+		int line = json->line;
+		RenderJob* job = add_job( list );
+		if( job == NULL ){
+			parse_error( json, "Out of memory on line %d.", json->line );
+		}
+		skip_ws( json );
+		c = next_c( json );
+		while( c != '}' ){
+			ungetc( c, json->file );
+			read_json_field( json, job );
+			skip_ws( json );
+			c = next_c( json );
+			if( c == ',' ){
+				skip_ws( json );
+				c = next_c( json );
+			}else if( c != '}' ){
+				parse_error( json, "Expected ',' or '}' on line %d.", json->line );
+			}
+		}
+		if( job->scene_file == NULL || job->output == NULL || job->width <= 0 || job->height <= 0 ){
+			parse_error( json, "The job on line %d needs a scene, an output and a width and height greater than 0.", line );
+		}
+		skip_ws( json );
+		c = next_c( json );
+		if( c == ']' ){
+			return;
+		}
+		if( c != ',' ){
+			parse_error( json, "Expected ',' or ']' on line %d.", json->line );
+		}
+	}
+}
+
+int read_json_manifest( FILE* file, JobList* list, char* error ){	//0, or -1 with the reason in error
+	JsonReader reader;
+	reader.file = file;
+	reader.line = 1;
+	reader.error = error;
+	if( setjmp( reader.failed ) != 0 ){	//Every parse_error() lands here
+		return -1;
+	}
+	read_json_jobs( &reader, list );
+	return 0;
+}
+
+char* trim( char* text ){	//Drops the whitespace around text, in place
+	while( isspace( (unsigned char)*text ) ){
+		text++;
+	}
+	char* end = text + strlen( text );
+	while( end > text && isspace( (unsigned char)end[-1] ) ){
+		*--end = '\0';
+	}
+	return text;
+}
+
+int parse_whole_number( char* text, int* value ){	//1 if text is nothing but a whole number
+	char* end;
+	long number = strtol( text, &end, 10 );
+	*value = (int)number;
+	return end != text && *end == '\0';
+}
+
+// One scene,width,height,output[,priority] line per job. Blank lines, lines starting with # and a first
+// line starting with "scene", a header, are skipped. 0, or -1 with the reason in error
+int read_csv_manifest( FILE* file, JobList* list, char* error ){
+	char line[MANIFEST_LINE_SIZE];
+	for( int line_number = 1; fgets( line, sizeof(line), file ) != NULL; line_number++ ){
+		if( strchr( line, '\n' ) == NULL && !feof( file ) ){
+			snprintf( error, PARSE_ERROR_SIZE, "Line %d is longer than %d characters.", line_number, MANIFEST_LINE_SIZE - 2 );
+			return -1;
+		}
+		char* fields[6];
+		int field_count = 0;
+		for( char* field = line; field != NULL && field_count < 6; field_count++ ){
+			char* comma = strchr( field, ',' );
+			if( comma != NULL ){
+				*comma = '\0';
+			}
+			fields[field_count] = trim( field );
+			field = comma != NULL ? comma + 1 : NULL;
+		}
+		if( ( field_count == 1 && fields[0][0] == '\0' ) || fields[0][0] == '#' || ( line_number == 1 && strcmp( fields[0], "scene" ) == 0 ) ){
+			continue;
+		}
+		RenderJob* job = add_job( list );
+		if( job == NULL ){
+			snprintf( error, PARSE_ERROR_SIZE, "Out of memory on line %d.", line_number );
+			return -1;
+		}
+		if( field_count < 4 || field_count > 5 || fields[0][0] == '\0' || fields[3][0] == '\0' ||
+			!parse_whole_number( fields[1], &job->width ) || !parse_whole_number( fields[2], &job->height ) ||
+			job->width <= 0 || job->height <= 0 || ( field_count == 5 && !parse_whole_number( fields[4], &job->priority ) ) ){
+			snprintf( error, PARSE_ERROR_SIZE, "Line %d should be scene,width,height,output[,priority] with a width and height greater than 0.", line_number );
+			return -1;
+		}
+		job->scene_file = strdup( fields[0] );
+		job->output = strdup( fields[3] );
+		if( job->scene_file == NULL || job->output == NULL ){
+			snprintf( error, PARSE_ERROR_SIZE, "Out of memory on line %d.", line_number );
+			return -1;
+		}
+	}
+	return 0;
+}
+
+RenderStatus read_manifest( RenderContext* context, char* manifest_file, RenderJob** jobs, int* count ){
+	char error[PARSE_ERROR_SIZE];
+	char* extension = strrchr( manifest_file, '.' );
+	int csv = extension != NULL && strcmp( extension, ".csv" ) == 0;
+	if( !csv && ( extension == NULL || strcmp( extension, ".json" ) != 0 ) ){
+		return render_fail( context, RENDER_ERROR_SCENE, "Manifest \"%s\" must be a .json or .csv file", manifest_file );
+	}
+	FILE* file = fopen( manifest_file, "r" );
+	if( file == NULL ){
+		return render_fail( context, RENDER_ERROR_FILE, "Could not open manifest \"%s\"", manifest_file );
+	}
+	JobList* list = calloc( 1, sizeof(JobList) );	//Not a local, read_json_manifest() longjmp()s out of filling it
+	if( list == NULL ){
+		fclose( file );
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while reading manifest \"%s\"", manifest_file );
+	}
+	int failed = csv ? read_csv_manifest( file, list, error ) : read_json_manifest( file, list, error );
+	fclose( file );
+	if( failed == 0 && list->count == 0 ){
+		snprintf( error, PARSE_ERROR_SIZE, "It holds no jobs." );
+		failed = -1;
+	}
+	if( failed != 0 ){
+		free_jobs( list->jobs, list->count );
+		free( list );
+		return render_fail( context, RENDER_ERROR_SCENE, "Manifest \"%s\": %s", manifest_file, error );
+	}
+	*jobs = list->jobs;
+	*count = list->count;
+	free( list );
+	return RENDER_OK;
+}
+
+int view_set( const char* name, double eye_separation, RenderView* views, const char** names ){	//See render_view_set()
+	static const char* face_names[6] = { "px", "nx", "py", "ny", "pz", "nz" };
+	memset( views, 0, sizeof(RenderView) * RENDER_MAX_VIEWS );
+	if( strcmp( name, "stereo" ) == 0 ){	//Parallel eyes either side of the camera
+		views[0].eye[0] = -eye_separation / 2;
+		views[1].eye[0] = eye_separation / 2;
+		names[0] = "left";
+		names[1] = "right";
+		return 2;
+	}
+	if( strcmp( name, "cubemap" ) == 0 ){
+		for( int face = 0; face < 6; face++ ){
+			views[face].projection = PROJECTION_CUBE_FACE;
+			views[face].face = face;
+			names[face] = face_names[face];
+		}
+		return 6;
+	}
+	if( strcmp( name, "equirect" ) == 0 ){
+		views[0].projection = PROJECTION_EQUIRECTANGULAR;
+		names[0] = "equirect";
+		return 1;
+	}
+	return 0;
+}
+
+void free_jobs( RenderJob* jobs, int count ){	//Jobs read_manifest() read
+	for( int i = 0; i < count; i++ ){
+		free( jobs[i].scene_file );
+		free( jobs[i].output );
+	}
+	free( jobs );
+}
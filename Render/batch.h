@@ -0,0 +1,35 @@
+#ifndef BATCH
+#define BATCH
+
+#include "tiles.h"
+
+#define MANIFEST_LINE_SIZE 1024	//Longest line of a .csv manifest
+#define MANIFEST_FIRST_CAPACITY 64	//Jobs before the list first grows
+
+typedef struct{	//One job of a batch_render() call, set up by whichever thread claims its first tile
+	RenderJob* job;
+	RenderContext* scene;	//Parsed scene file, shared with the other jobs of the same file
+	RenderContext* context;	//The job's own copy of the scene and options, NULL until set up and once written
+	double* framebuffer;
+	TileJob tiles;
+	int tile_count;
+	atomic_int remaining;	//Tiles left to trace, whoever traces the last one writes the output
+	pthread_mutex_t setup_lock;
+	int state;	//0 until set up, 1 while rendering, -1 once it failed
+} BatchJob;
+
+typedef struct{	//Shared by every tile task of one batch_render() call
+	RenderContext* context;	//The caller's, its options are every job's and its stats add theirs up
+	BatchJob* jobs;
+	int* task_jobs;	//Job and tile of every task, highest priority job first
+	int* task_tiles;
+	int task_count;
+	atomic_int finished;
+} Batch;
+
+RenderStatus batch_render( RenderContext* context, RenderJob* jobs, int count );
+RenderStatus read_manifest( RenderContext* context, char* manifest_file, RenderJob** jobs, int* count );
+int view_set( const char* name, double eye_separation, RenderView* views, const char** names );
+void free_jobs( RenderJob* jobs, int count );
+
+#endif
@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdatomic.h>
+
+#include "../Math/vector_math.h"
+#include "binning.h"
+
+// With --binning, prepare_render() projects every object's cull_radius sphere through the camera onto the
+// image, grown by bin_margin, and keeps the pixels it covers in screen_bounds. The image is split into
+// BIN_SIZE bins from its top left corner, and camera rays only march against the objects whose pixels
+// overlap their bin, plus the unbounded ones and any the camera is inside or next to, which cover every
+// pixel. Every object left out of a bin is at least bin_margin from its rays, so a step the bin's objects
+// keep below that is the step the unbinned render takes. Longer steps go through unbinned_step(), which
+// adds any left out object that could be nearer, and binned images come out the same as unbinned ones.
+// Bins don't move with a crop window, so a crop still matches the full render. Shadow rays and normals
+// still see every object
+
+static atomic_int next_binning_id = 1;
+static _Thread_local BinCache bin_cache;
+static _Thread_local ObjectList nearby_objects;	//unbinned_step()'s, off the stack
+
+void project_interval( double offset, double depth, double radius, double* low, double* high ){	//Image plane coordinates a sphere spans along one axis, the sphere lies in front of the camera
+	double center = atan2( offset, depth );
+	double half_angle = asin( radius / sqrt( offset*offset + depth*depth ) );
+	*low = tan( center - half_angle );
+	*high = tan( center + half_angle );
+}
+
+int pixel_column( double coordinate, double size, int count ){	//Pixel whose center is nearest coordinate on an image plane size wide, clamped to -1..count
+	double pixel = round( ( coordinate + size/2 ) / ( size / count ) - .5 );
+	return (int)fmin( fmax( pixel, -1.0 ), count );
+}
+
+// Margin small enough that most steps near an object stay inside its bins, and large enough that the rays
+// of a bin without objects can't hit any or run out of steps before they pass the bounded objects
+double choose_bin_margin( RenderContext* context ){
+	MarchLimits* limits = &context->camera_limits;
+	double reach = 0;	//Furthest a bounded object reaches from the eye
+	for( int i = 1; i < context->object_counter + 1; i++ ){
+		Object* object = context->object_array[i];
+		if( !isinf( object->cull_radius ) ){
+			reach = fmax( reach, distance_between( object->position, context->view.eye ) + object->cull_radius );
+		}
+	}
+	reach = fmin( reach, limits->far_plane );
+	return fmax( hit_threshold( limits, reach ), reach / limits->max_steps );
+}
+
+// Pixels x0 y0 x1 y1, top left origin and x1, y1 exclusive, whose camera rays come within bin_margin of
+// each object, see camera_ray_direction(). Only planar views are binned
+void project_object_bounds( RenderContext* context, int N, int M ){
+	MarchLimits* limits = &context->camera_limits;
+	double w = context->object_array[0]->camera.width;
+	double h = context->object_array[0]->camera.height;
+	if( context->view.projection != PROJECTION_PLANAR ){	//Bounds on the image plane only mean something to planar views
+		context->binning_id = 0;
+		return;
+	}
+	double margin = choose_bin_margin( context );
+	context->bin_margin = margin;
+	context->empty_bins_escape = margin >= hit_threshold( limits, limits->far_plane ) && margin * limits->max_steps > limits->far_plane;
+	for( int i = 1; i < context->object_counter + 1; i++ ){
+		Object* object = context->object_array[i];
+		int* bounds = context->screen_bounds[i];
+		double center[3];
+		for( int axis = 0; axis < 3; axis++ ){
+			center[axis] = object->position[axis] - context->view.eye[axis];
+		}
+		double scale = fmax( object->lipschitz, 1.0 );	//Scaled steps are down to 1 / lipschitz of the distance
+		double radius = object->cull_radius;
+		radius += scale * margin * ( 1 + BIN_SLACK );	//Rays of bins the object is left out of stay margin away from it
+		if( center[2] + radius <= 0 ){	//Behind the camera, rays only go forward
+			bounds[0] = bounds[1] = bounds[2] = bounds[3] = 0;
+			continue;
+		}
+		if( isinf( radius ) || center[2] <= radius ){	//Around the camera, the projection has no edge
+			bounds[0] = 0;
+			bounds[1] = 0;
+			bounds[2] = N;
+			bounds[3] = M;
+			continue;
+		}
+		double left, right, bottom, top;
+		project_interval( center[0], center[2], radius, &left, &right );
+		project_interval( center[1], center[2], radius, &bottom, &top );
+		bounds[0] = pixel_column( left, w, N );	//Rounding to the nearest pixel on both sides keeps a pixel to spare
+		bounds[2] = pixel_column( right, w, N ) + 1;
+		bounds[1] = M - 1 - pixel_column( top, h, M );	//Rows count up from the bottom on the image plane
+		bounds[3] = M - pixel_column( bottom, h, M );
+	}
+	context->binning_id = atomic_fetch_add( &next_binning_id, 1 );	//Lists binned for earlier projections are stale
+}
+
+void fill_bin( RenderContext* context, ObjectList* candidates, int bin_x, int bin_y ){	//This thread's bin_cache, for the bin at bin_x, bin_y
+	ObjectList* objects = &bin_cache.objects;
+	int x0 = bin_x * BIN_SIZE;
+	int y0 = bin_y * BIN_SIZE;
+	double* center = bin_cache.omitted_center;
+	objects->count = 0;
+	bin_cache.omitted = 0;
+	center[0] = center[1] = center[2] = 0;
+	for( int i = 0; i < candidates->count; i++ ){
+		int* bounds = context->screen_bounds[candidates->indices[i]];
+		if( bounds[0] < x0 + BIN_SIZE && bounds[2] > x0 && bounds[1] < y0 + BIN_SIZE && bounds[3] > y0 ){
+			objects->indices[objects->count++] = candidates->indices[i];
+		}else{
+			double* position = context->object_array[candidates->indices[i]]->position;
+			bin_cache.omitted++;
+			for( int axis = 0; axis < 3; axis++ ){
+				center[axis] += position[axis];
+			}
+		}
+	}
+	bin_cache.omitted_radius = 0;
+	bin_cache.omitted_lipschitz = 0;
+	for( int axis = 0; bin_cache.omitted > 0 && axis < 3; axis++ ){
+		center[axis] /= bin_cache.omitted;
+	}
+	for( int i = 0, j = 0; i < candidates->count; i++ ){	//Both lists are in the same order
+		if( j < objects->count && objects->indices[j] == candidates->indices[i] ){
+			j++;
+			continue;
+		}
+		Object* object = context->object_array[candidates->indices[i]];
+		bin_cache.omitted_radius = fmax( bin_cache.omitted_radius, distance_between( object->position, center ) + object->cull_radius );
+		bin_cache.omitted_lipschitz = fmax( bin_cache.omitted_lipschitz, object->lipschitz );
+	}
+	bin_cache.id = context->binning_id;
+	bin_cache.bin_x = bin_x;
+	bin_cache.bin_y = bin_y;
+}
+
+// The objects the camera ray through pixel (x, y), top left origin, has to march against, in the order of
+// the list they come from so ties between objects break the same way. unbinned gets the list they were
+// binned from, which march_step() falls back on, NULL if the ray isn't binned
+ObjectList* binned_objects( RenderContext* context, int x, int y, ObjectList** unbinned ){
+	ObjectList* candidates = context->options.hybrid ? &context->marched_objects : &context->scene_objects;
+	*unbinned = NULL;
+	if( context->binning_id == 0 ){	//Not projected for this image
+		return context->camera_limits.objects;
+	}
+	int bin_x = x / BIN_SIZE;
+	int bin_y = y / BIN_SIZE;
+	if( bin_cache.id != context->binning_id || bin_cache.bin_x != bin_x || bin_cache.bin_y != bin_y ){
+		fill_bin( context, candidates, bin_x, bin_y );
+	}
+	if( bin_cache.objects.count == 0 && !context->empty_bins_escape ){	//raymarch() would give up on the ray before its first step
+		return context->camera_limits.objects;
+	}
+	if( bin_cache.omitted > 0 ){
+		*unbinned = candidates;
+	}
+	return &bin_cache.objects;
+}
+
+// Redoes a step the bin's own objects put at or past bin_margin, where an object left out of the bin could
+// be nearer, as the unbinned render takes it. Objects whose cull_radius sphere lies further away than the
+// bin's step can't be nearest or tie with it, so only the rest of the unbinned list is evaluated, in its
+// order. Reads the bin binned_objects() last handed this thread, the one the ray was binned into
+void unbinned_step( Intersect* intersection, double threshold, MarchLimits* limits ){
+	Object** object_array = limits->context->object_array;
+	ObjectList* unbinned = limits->unbinned;
+	Vec3 position = vec3_load( intersection->position );
+	double step = intersection->min_distance;
+	Vec3 offset = vec3_sub( position, vec3_load( bin_cache.omitted_center ) );
+	double reach = ( step * bin_cache.omitted_lipschitz + bin_cache.omitted_radius ) * ( 1 + BIN_SLACK );	//Squared against the offset, no square roots
+	if( vec3_dot( offset, offset ) > reach * reach ){	//Every left out object is further than the step, most of the steps of rays into the distance
+		return;
+	}
+	nearby_objects.count = 0;
+	for( int i = 0; i < unbinned->count; i++ ){
+		Object* object = object_array[unbinned->indices[i]];
+		offset = vec3_sub( position, vec3_load( object->position ) );
+		reach = ( step * object->lipschitz + object->cull_radius ) * ( 1 + BIN_SLACK );
+		if( !( vec3_dot( offset, offset ) > reach * reach ) ){	//Unbounded objects are always in
+			nearby_objects.indices[nearby_objects.count++] = unbinned->indices[i];
+		}
+	}
+	all_intersections( limits->context, intersection->position, intersection, threshold, &nearby_objects );
+}
@@ -0,0 +1,24 @@
+#ifndef BINNING
+#define BINNING
+
+#include "../raymarch.h"
+
+#define BIN_SIZE 32	//Pixels along each side of a bin, a tile's size so the tiles of an uncropped render march one list each
+#define BIN_SLACK 1e-6	//Relative room for rounding in the distances an object is left out of a bin or a step by
+
+typedef struct{	//Objects of the bin a thread's last camera ray was in, rebuilt once a ray lands in another
+	int id;	//binning_id of the context they're from, 0 for none yet
+	int bin_x;
+	int bin_y;
+	ObjectList objects;
+	int omitted;	//Objects left out of it, all bounded
+	double omitted_center[3];	//Sphere that holds every one of them out to its cull_radius
+	double omitted_radius;
+	double omitted_lipschitz;	//Largest lipschitz among them
+} BinCache;
+
+void project_object_bounds( RenderContext* context, int N, int M );
+ObjectList* binned_objects( RenderContext* context, int x, int y, ObjectList** unbinned );
+void unbinned_step( Intersect* intersection, double threshold, MarchLimits* limits );
+
+#endif
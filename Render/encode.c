@@ -0,0 +1,621 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// PNG and QOI output without any library. PNG rows are filtered, then every band of PNG_BAND_ROWS rows is
+// deflated on its own thread: LZ77 over hash chains and a dynamic Huffman block per DEFLATE_BLOCK_TOKENS
+// tokens. Bands end with an empty stored block, which byte aligns them, so their streams are written back
+// to back as one zlib stream and the Adler-32s of the bands are combined into the image's. Matches never
+// reach into the band before, which costs a little compression at the top of each band. QOI is one fast
+// serial pass, it compresses worse but encodes several times quicker.
+
+static const unsigned short length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+												67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+													1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const unsigned char length_code_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+ImageFormat image_format( char* file_name ){
+	char* extension = strrchr( file_name, '.' );
+	if( extension != NULL && strcmp( extension, ".png" ) == 0 ){
+		return IMAGE_PNG;
+	}
+	if( extension != NULL && strcmp( extension, ".qoi" ) == 0 ){
+		return IMAGE_QOI;
+	}
+	return IMAGE_PPM;
+}
+
+void write_byte( BitWriter* writer, unsigned char byte ){
+	if( writer->size == writer->capacity ){
+		size_t capacity = writer->capacity ? writer->capacity * 2 : 65536;
+		unsigned char* bytes = realloc( writer->bytes, capacity );
+		if( bytes == NULL ){
+			writer->failed = 1;
+			writer->size = 0;	//Keep writing into what there is, the result is thrown away
+			return;
+		}
+		writer->bytes = bytes;
+		writer->capacity = capacity;
+	}
+	writer->bytes[writer->size++] = byte;
+}
+
+void write_bits( BitWriter* writer, unsigned int value, int count ){	//Deflate packs bits from the least significant end
+	writer->bits |= (unsigned long long)value << writer->bit_count;
+	writer->bit_count += count;
+	while( writer->bit_count >= 8 ){
+		write_byte( writer, writer->bits & 0xFF );
+		writer->bits >>= 8;
+		writer->bit_count -= 8;
+	}
+}
+
+void align_bits( BitWriter* writer ){	//Pad to a byte boundary with zeros
+	if( writer->bit_count > 0 ){
+		write_bits( writer, 0, 8 - writer->bit_count );
+	}
+}
+
+typedef struct{
+	unsigned int weight;
+	int symbol;
+} HuffmanLeaf;
+
+int compare_leaves( const void* a, const void* b ){
+	const HuffmanLeaf* first = a;
+	const HuffmanLeaf* second = b;
+	if( first->weight != second->weight ){
+		return first->weight < second->weight ? -1 : 1;
+	}
+	return first->symbol - second->symbol;
+}
+
+// Huffman code lengths of at most max_bits for count symbols, 0 for the unused ones. Frequencies are halved
+// until the longest code fits. Every code gets at least two symbols, inflaters reject codes with one
+void huffman_lengths( unsigned int* frequencies, int count, int max_bits, unsigned char* lengths ){
+	HuffmanLeaf leaves[count];
+	unsigned int weights[2 * count];
+	int parents[2 * count];
+	int depths[2 * count];
+	int used = 0;
+	for( int i = 0; i < count; i++ ){
+		used += frequencies[i] > 0;
+	}
+	for( int i = 0; used < 2; i++ ){
+		if( frequencies[i] == 0 ){
+			frequencies[i] = 1;
+			used++;
+		}
+	}
+	unsigned int scaled[count];
+	memcpy( scaled, frequencies, sizeof(unsigned int) * count );
+	while( 1 ){
+		int leaf_count = 0;
+		for( int i = 0; i < count; i++ ){
+			lengths[i] = 0;
+			if( scaled[i] > 0 ){
+				leaves[leaf_count++] = (HuffmanLeaf){ scaled[i], i };
+			}
+		}
+		qsort( leaves, leaf_count, sizeof(HuffmanLeaf), compare_leaves );
+		for( int i = 0; i < leaf_count; i++ ){	//Nodes are the sorted leaves, then the merged nodes in the order they're made
+			weights[i] = leaves[i].weight;
+		}
+		int next_leaf = 0;
+		int next_node = leaf_count;
+		for( int node = leaf_count; node < 2 * leaf_count - 1; node++ ){	//Two queues, both in order of weight
+			int children[2];
+			for( int k = 0; k < 2; k++ ){
+				if( next_leaf < leaf_count && ( next_node >= node || weights[next_leaf] <= weights[next_node] ) ){
+					children[k] = next_leaf++;
+				}else{
+					children[k] = next_node++;
+				}
+			}
+			weights[node] = weights[children[0]] + weights[children[1]];
+			parents[children[0]] = node;
+			parents[children[1]] = node;
+		}
+		int root = 2 * leaf_count - 2;
+		int longest = 0;
+		depths[root] = 0;
+		for( int node = root - 1; node >= 0; node-- ){	//Parents come after their children
+			depths[node] = depths[parents[node]] + 1;
+			if( node < leaf_count ){
+				lengths[leaves[node].symbol] = depths[node];
+				longest = depths[node] > longest ? depths[node] : longest;
+			}
+		}
+		if( longest <= max_bits ){
+			return;
+		}
+		for( int i = 0; i < count; i++ ){
+			scaled[i] = scaled[i] > 0 ? ( scaled[i] + 1 ) / 2 : 0;
+		}
+	}
+}
+
+void canonical_codes( unsigned char* lengths, int count, unsigned short* codes ){	//Bit reversed, ready for write_bits()
+	int length_counts[DEFLATE_MAX_BITS + 1] = { 0 };
+	int next_code[DEFLATE_MAX_BITS + 1];
+	for( int i = 0; i < count; i++ ){
+		length_counts[lengths[i]]++;
+	}
+	length_counts[0] = 0;
+	int code = 0;
+	for( int bits = 1; bits <= DEFLATE_MAX_BITS; bits++ ){
+		code = ( code + length_counts[bits - 1] ) << 1;
+		next_code[bits] = code;
+	}
+	for( int i = 0; i < count; i++ ){
+		int reversed = 0;
+		int value = lengths[i] ? next_code[lengths[i]]++ : 0;
+		for( int bit = 0; bit < lengths[i]; bit++ ){
+			reversed = ( reversed << 1 ) | ( ( value >> bit ) & 1 );
+		}
+		codes[i] = reversed;
+	}
+}
+
+int length_symbol( int length ){	//Index into length_base
+	int code = 28;
+	while( length_base[code] > length ){
+		code--;
+	}
+	return code;
+}
+
+int distance_symbol( int distance ){
+	int code = 29;
+	while( distance_base[code] > distance ){
+		code--;
+	}
+	return code;
+}
+
+// One dynamic Huffman block of the tokens, never the final one
+void write_block( BitWriter* writer, DeflateToken* tokens, int count ){
+	unsigned int literal_frequencies[286] = { 0 };
+	unsigned int distance_frequencies[30] = { 0 };
+	unsigned char lengths[286 + 30];
+	unsigned short literal_codes[286];
+	unsigned short distance_codes[30];
+	for( int i = 0; i < count; i++ ){
+		if( tokens[i].distance == 0 ){
+			literal_frequencies[tokens[i].value]++;
+		}else{
+			literal_frequencies[257 + length_symbol( tokens[i].value )]++;
+			distance_frequencies[distance_symbol( tokens[i].distance )]++;
+		}
+	}
+	literal_frequencies[256] = 1;	//End of block
+	huffman_lengths( literal_frequencies, 286, DEFLATE_MAX_BITS, lengths );
+	huffman_lengths( distance_frequencies, 30, DEFLATE_MAX_BITS, lengths + 286 );
+	int literal_count = 286;
+	int distance_count = 30;
+	while( literal_count > 257 && lengths[literal_count - 1] == 0 ){
+		literal_count--;
+	}
+	while( distance_count > 1 && lengths[286 + distance_count - 1] == 0 ){
+		distance_count--;
+	}
+	canonical_codes( lengths, 286, literal_codes );
+	canonical_codes( lengths + 286, 30, distance_codes );
+
+	unsigned char run_lengths[286 + 30];	//The literal and distance lengths back to back, run length coded with 16, 17 and 18
+	int length_count = 0;
+	memcpy( run_lengths, lengths, literal_count );
+	memcpy( run_lengths + literal_count, lengths + 286, distance_count );
+	int total = literal_count + distance_count;
+	unsigned char symbols[286 + 30];
+	unsigned char extras[286 + 30];
+	unsigned int length_frequencies[19] = { 0 };
+	for( int i = 0; i < total; ){
+		int run = 1;
+		while( i + run < total && run_lengths[i + run] == run_lengths[i] ){
+			run++;
+		}
+		if( run_lengths[i] == 0 && run >= 3 ){	//17 repeats a zero 3 to 10 times, 18 11 to 138 times
+			run = run > 138 ? 138 : run;
+			symbols[length_count] = run >= 11 ? 18 : 17;
+			extras[length_count++] = run >= 11 ? run - 11 : run - 3;
+			i += run;
+			continue;
+		}
+		symbols[length_count] = run_lengths[i];
+		extras[length_count++] = 0;
+		i++;
+		if( run_lengths[i - 1] != 0 && run >= 4 ){	//16 repeats the length before 3 to 6 times
+			run = run - 1 > 6 ? 6 : run - 1;
+			symbols[length_count] = 16;
+			extras[length_count++] = run - 3;
+			i += run;
+		}
+	}
+	for( int i = 0; i < length_count; i++ ){
+		length_frequencies[symbols[i]]++;
+	}
+	unsigned char code_lengths[19];
+	unsigned short length_codes[19];
+	huffman_lengths( length_frequencies, 19, DEFLATE_MAX_LENGTH_BITS, code_lengths );
+	canonical_codes( code_lengths, 19, length_codes );
+	int order_count = 19;
+	while( order_count > 4 && code_lengths[length_code_order[order_count - 1]] == 0 ){
+		order_count--;
+	}
+
+	write_bits( writer, 0, 1 );	//Not the final block
+	write_bits( writer, 2, 2 );	//Dynamic Huffman codes
+	write_bits( writer, literal_count - 257, 5 );
+	write_bits( writer, distance_count - 1, 5 );
+	write_bits( writer, order_count - 4, 4 );
+	for( int i = 0; i < order_count; i++ ){
+		write_bits( writer, code_lengths[length_code_order[i]], 3 );
+	}
+	for( int i = 0; i < length_count; i++ ){
+		write_bits( writer, length_codes[symbols[i]], code_lengths[symbols[i]] );
+		if( symbols[i] >= 16 ){
+			write_bits( writer, extras[i], symbols[i] == 16 ? 2 : symbols[i] == 17 ? 3 : 7 );
+		}
+	}
+	for( int i = 0; i < count; i++ ){
+		if( tokens[i].distance == 0 ){
+			write_bits( writer, literal_codes[tokens[i].value], lengths[tokens[i].value] );
+			continue;
+		}
+		int length = length_symbol( tokens[i].value );
+		int distance = distance_symbol( tokens[i].distance );
+		write_bits( writer, literal_codes[257 + length], lengths[257 + length] );
+		write_bits( writer, tokens[i].value - length_base[length], length_extra[length] );
+		write_bits( writer, distance_codes[distance], lengths[286 + distance] );
+		write_bits( writer, tokens[i].distance - distance_base[distance], distance_extra[distance] );
+	}
+	write_bits( writer, literal_codes[256], lengths[256] );
+}
+
+static inline unsigned int hash3( unsigned char* data ){
+	return ( ( data[0] | data[1] << 8 | data[2] << 16 ) * 2654435761u ) >> ( 32 - DEFLATE_HASH_BITS );
+}
+
+// Deflates data as non-final blocks, greedy matches over hash chains. 0 if out of memory
+int deflate_blocks( BitWriter* writer, unsigned char* data, int size ){
+	int* head = malloc( sizeof(int) * ( 1 << DEFLATE_HASH_BITS ) );
+	int* previous = malloc( sizeof(int) * DEFLATE_WINDOW );
+	DeflateToken* tokens = malloc( sizeof(DeflateToken) * DEFLATE_BLOCK_TOKENS );
+	if( head == NULL || previous == NULL || tokens == NULL ){
+		free( head );
+		free( previous );
+		free( tokens );
+		return 0;
+	}
+	for( int i = 0; i < ( 1 << DEFLATE_HASH_BITS ); i++ ){
+		head[i] = -1;
+	}
+	int count = 0;
+	for( int position = 0; position < size; ){
+		int best_length = 0;
+		int best_distance = 0;
+		int limit = size - position < DEFLATE_MAX_MATCH ? size - position : DEFLATE_MAX_MATCH;
+		if( limit >= DEFLATE_MIN_MATCH ){
+			int candidate = head[hash3( data + position )];
+			for( int chain = 0; candidate >= 0 && position - candidate < DEFLATE_WINDOW && chain < DEFLATE_MAX_CHAIN; chain++ ){
+				if( data[candidate + best_length] == data[position + best_length] ){	//Can't beat the best without this byte
+					int length = 0;
+					while( length < limit && data[candidate + length] == data[position + length] ){
+						length++;
+					}
+					if( length > best_length ){
+						best_length = length;
+						best_distance = position - candidate;
+						if( length == limit ){
+							break;
+						}
+					}
+				}
+				int next = previous[candidate & ( DEFLATE_WINDOW - 1 )];
+				candidate = next < candidate ? next : -1;
+			}
+		}
+		int advance = best_length >= DEFLATE_MIN_MATCH ? best_length : 1;
+		if( advance > 1 ){
+			tokens[count++] = (DeflateToken){ best_length, best_distance };
+		}else{
+			tokens[count++] = (DeflateToken){ data[position], 0 };
+		}
+		for( int end = position + advance; position < end; position++ ){	//Every position a match covers can start a later one
+			if( position + DEFLATE_MIN_MATCH <= size ){
+				unsigned int hash = hash3( data + position );
+				previous[position & ( DEFLATE_WINDOW - 1 )] = head[hash];
+				head[hash] = position;
+			}
+		}
+		if( count == DEFLATE_BLOCK_TOKENS ){
+			write_block( writer, tokens, count );
+			count = 0;
+		}
+	}
+	if( count > 0 ){
+		write_block( writer, tokens, count );
+	}
+	free( head );
+	free( previous );
+	free( tokens );
+	return 1;
+}
+
+unsigned int adler32( unsigned char* data, size_t size ){
+	unsigned int a = 1;
+	unsigned int b = 0;
+	while( size > 0 ){
+		size_t chunk = size < 5552 ? size : 5552;	//Longest run whose sums can't overflow before the modulo
+		size -= chunk;
+		while( chunk-- > 0 ){
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return b << 16 | a;
+}
+
+unsigned int adler32_combine( unsigned int first, unsigned int second, size_t second_size ){	//Adler-32 of two runs of bytes back to back
+	unsigned long long remainder = second_size % 65521;
+	unsigned long long a = ( ( first & 0xFFFF ) + ( second & 0xFFFF ) + 65521 - 1 ) % 65521;
+	unsigned long long b = ( remainder * ( first & 0xFFFF ) + ( first >> 16 ) + ( second >> 16 ) + 65521 - remainder ) % 65521;
+	return (unsigned int)( b << 16 | a );
+}
+
+static inline int paeth( int left, int up, int up_left ){	//Whichever neighbour is closest to left + up - up_left
+	int to_left = abs( up - up_left );
+	int to_up = abs( left - up_left );
+	int to_up_left = abs( left + up - 2 * up_left );
+	int nearer = to_up <= to_up_left ? up : up_left;
+	return to_left <= to_up && to_left <= to_up_left ? left : nearer;
+}
+
+// Filters row y into filtered, a filter type byte and the filtered bytes, with whichever filter leaves
+// the smallest sum of magnitudes. scratch holds two rows, the first all zeros
+void filter_row( unsigned char* rgb, int width, int y, unsigned char* filtered, unsigned char* scratch ){
+	int stride = width * 3;
+	unsigned char* row = rgb + (size_t)y * stride;
+	unsigned char* above = y > 0 ? row - stride : scratch;	//Rows above the image are zeros
+	unsigned char* candidate = scratch + stride;
+	long best_sum = -1;
+	for( int filter = 0; filter < 5 && best_sum != 0; filter++ ){	//Nothing beats a row of zeros, like the background's
+		for( int i = 0; i < 3 && i < stride; i++ ){	//The first pixel has nothing to its left
+			int predicted = filter == 2 || filter == 4 ? above[i] : filter == 3 ? above[i] / 2 : 0;
+			candidate[i] = row[i] - predicted;
+		}
+		if( filter == 0 ){
+			memcpy( candidate + 3, row + 3, stride - 3 );
+		}else if( filter == 1 ){
+			for( int i = 3; i < stride; i++ ){
+				candidate[i] = row[i] - row[i - 3];
+			}
+		}else if( filter == 2 ){
+			for( int i = 3; i < stride; i++ ){
+				candidate[i] = row[i] - above[i];
+			}
+		}else if( filter == 3 ){
+			for( int i = 3; i < stride; i++ ){
+				candidate[i] = row[i] - ( row[i - 3] + above[i] ) / 2;
+			}
+		}else{
+			for( int i = 3; i < stride; i++ ){
+				candidate[i] = row[i] - paeth( row[i - 3], above[i], above[i - 3] );
+			}
+		}
+		long sum = 0;
+		for( int i = 0; i < stride; i++ ){
+			sum += abs( (signed char)candidate[i] );
+		}
+		if( best_sum < 0 || sum < best_sum ){
+			best_sum = sum;
+			filtered[0] = filter;
+			memcpy( filtered + 1, candidate, stride );
+		}
+	}
+}
+
+void encode_band( int band, void* data ){	//Task for one band of PNG_BAND_ROWS rows
+	PngJob* job = data;
+	int first_row = band * PNG_BAND_ROWS;
+	int rows = job->height - first_row < PNG_BAND_ROWS ? job->height - first_row : PNG_BAND_ROWS;
+	size_t row_size = 1 + (size_t)job->width * 3;
+	BitWriter* writer = &job->streams[band];
+	trace_begin( "png band", band );
+	unsigned char* filtered = malloc( row_size * rows );
+	unsigned char* scratch = calloc( 2, (size_t)job->width * 3 );	//Off the stack, pool threads' stacks are small
+	if( filtered == NULL || scratch == NULL ){
+		free( filtered );
+		free( scratch );
+		writer->failed = 1;
+		trace_end( "png band" );
+		return;
+	}
+	for( int y = 0; y < rows; y++ ){
+		filter_row( job->rgb, job->width, first_row + y, filtered + row_size * y, scratch );
+	}
+	free( scratch );
+	job->lengths[band] = row_size * rows;
+	job->adlers[band] = adler32( filtered, row_size * rows );
+	if( !deflate_blocks( writer, filtered, row_size * rows ) ){
+		writer->failed = 1;
+	}
+	write_bits( writer, 0, 3 );	//An empty stored block ends the band on a byte boundary
+	align_bits( writer );
+	write_bits( writer, 0x0000, 16 );
+	write_bits( writer, 0xFFFF, 16 );
+	free( filtered );
+	trace_end( "png band" );
+}
+
+void write_u32( unsigned char* bytes, unsigned int value ){	//Big endian, as PNG and QOI store them
+	bytes[0] = value >> 24;
+	bytes[1] = value >> 16;
+	bytes[2] = value >> 8;
+	bytes[3] = value;
+}
+
+unsigned int crc32_update( unsigned int* table, unsigned int crc, unsigned char* data, size_t size ){
+	for( size_t i = 0; i < size; i++ ){
+		crc = table[( crc ^ data[i] ) & 0xFF] ^ ( crc >> 8 );
+	}
+	return crc;
+}
+
+// Writes a chunk whose data is the parts back to back, so the IDAT doesn't have to be copied into one buffer
+void write_chunk( FILE* output, unsigned int* crc_table, const char* type, unsigned char** parts, size_t* sizes, int count ){
+	unsigned char word[4];
+	size_t length = 0;
+	for( int i = 0; i < count; i++ ){
+		length += sizes[i];
+	}
+	write_u32( word, length );
+	fwrite( word, 1, 4, output );
+	fwrite( type, 1, 4, output );
+	unsigned int crc = crc32_update( crc_table, 0xFFFFFFFF, (unsigned char*)type, 4 );
+	for( int i = 0; i < count; i++ ){
+		fwrite( parts[i], 1, sizes[i], output );
+		crc = crc32_update( crc_table, crc, parts[i], sizes[i] );
+	}
+	write_u32( word, crc ^ 0xFFFFFFFF );
+	fwrite( word, 1, 4, output );
+}
+
+RenderStatus encode_png( RenderContext* context, unsigned char* rgb, int width, int height, FILE* output, char* file_name ){
+	int bands = ( height + PNG_BAND_ROWS - 1 ) / PNG_BAND_ROWS;
+	PngJob job = { rgb, width, height, calloc( bands, sizeof(BitWriter) ), malloc( sizeof(unsigned int) * bands ), malloc( sizeof(size_t) * bands ) };
+	unsigned char** parts = malloc( sizeof(unsigned char*) * ( bands + 3 ) );	//zlib header, every band's stream, final block, Adler-32
+	size_t* sizes = malloc( sizeof(size_t) * ( bands + 3 ) );
+	RenderStatus status = RENDER_OK;
+	if( job.streams == NULL || job.adlers == NULL || job.lengths == NULL || parts == NULL || sizes == NULL ){
+		status = render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while writing \"%s\"", file_name );
+	}else{
+		parallel_for( bands, context->options.threads, encode_band, &job );
+	}
+	for( int band = 0; status == RENDER_OK && band < bands; band++ ){
+		if( job.streams[band].failed ){
+			status = render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while writing \"%s\"", file_name );
+		}
+	}
+	if( status == RENDER_OK ){
+		unsigned int crc_table[256];
+		for( unsigned int i = 0; i < 256; i++ ){
+			unsigned int crc = i;
+			for( int bit = 0; bit < 8; bit++ ){
+				crc = crc & 1 ? 0xEDB88320 ^ ( crc >> 1 ) : crc >> 1;
+			}
+			crc_table[i] = crc;
+		}
+		unsigned char header[13];
+		write_u32( header, width );
+		write_u32( header + 4, height );
+		header[8] = 8;	//Bits per channel
+		header[9] = 2;	//RGB
+		header[10] = 0;	//Deflate
+		header[11] = 0;	//Per row filters
+		header[12] = 0;	//Not interlaced
+		unsigned char zlib_header[2] = { 0x78, 0x01 };	//32K window, no dictionary
+		unsigned char last_block[2] = { 0x03, 0x00 };	//Empty final block with fixed codes, its end of block code is 7 zero bits
+		unsigned char checksum[4];
+		unsigned int adler = job.adlers[0];
+		for( int band = 1; band < bands; band++ ){
+			adler = adler32_combine( adler, job.adlers[band], job.lengths[band] );
+		}
+		write_u32( checksum, adler );
+
+		fwrite( "\x89PNG\r\n\x1a\n", 1, 8, output );
+		write_chunk( output, crc_table, "IHDR", (unsigned char*[]){ header }, (size_t[]){ 13 }, 1 );
+		parts[0] = zlib_header;
+		sizes[0] = 2;
+		for( int band = 0; band < bands; band++ ){
+			parts[band + 1] = job.streams[band].bytes;
+			sizes[band + 1] = job.streams[band].size;
+		}
+		parts[bands + 1] = last_block;
+		sizes[bands + 1] = 2;
+		parts[bands + 2] = checksum;
+		sizes[bands + 2] = 4;
+		write_chunk( output, crc_table, "IDAT", parts, sizes, bands + 3 );
+		write_chunk( output, crc_table, "IEND", NULL, NULL, 0 );
+	}
+	for( int band = 0; job.streams != NULL && band < bands; band++ ){
+		free( job.streams[band].bytes );
+	}
+	free( job.streams );
+	free( job.adlers );
+	free( job.lengths );
+	free( parts );
+	free( sizes );
+	return status;
+}
+
+RenderStatus encode_qoi( RenderContext* context, unsigned char* rgb, int width, int height, FILE* output, char* file_name ){
+	size_t pixels = (size_t)width * height;
+	unsigned char* bytes = malloc( 14 + pixels * 4 + 8 );	//Every pixel as a 4 byte QOI_OP_RGB at worst
+	if( bytes == NULL ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while writing \"%s\"", file_name );
+	}
+	memcpy( bytes, "qoif", 4 );
+	write_u32( bytes + 4, width );
+	write_u32( bytes + 8, height );
+	bytes[12] = 3;	//RGB
+	bytes[13] = 0;	//sRGB
+	size_t size = 14;
+	unsigned char index[QOI_INDEX_SIZE][3];
+	unsigned char indexed[QOI_INDEX_SIZE] = { 0 };	//The index starts out as transparent black, which an opaque pixel never matches
+	unsigned char previous[3] = { 0, 0, 0 };
+	int run = 0;
+	for( size_t i = 0; i < pixels; i++ ){
+		unsigned char* pixel = rgb + i * 3;
+		if( pixel[0] == previous[0] && pixel[1] == previous[1] && pixel[2] == previous[2] ){
+			run++;
+			if( run == QOI_MAX_RUN || i == pixels - 1 ){
+				bytes[size++] = 0xC0 | ( run - 1 );
+				run = 0;
+			}
+			continue;
+		}
+		if( run > 0 ){
+			bytes[size++] = 0xC0 | ( run - 1 );
+			run = 0;
+		}
+		int slot = ( pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + 255 * 11 ) % QOI_INDEX_SIZE;
+		if( indexed[slot] && memcmp( index[slot], pixel, 3 ) == 0 ){
+			bytes[size++] = slot;
+		}else{
+			indexed[slot] = 1;
+			memcpy( index[slot], pixel, 3 );
+			signed char red = pixel[0] - previous[0];
+			signed char green = pixel[1] - previous[1];
+			signed char blue = pixel[2] - previous[2];
+			signed char red_green = red - green;
+			signed char blue_green = blue - green;
+			if( red >= -2 && red <= 1 && green >= -2 && green <= 1 && blue >= -2 && blue <= 1 ){
+				bytes[size++] = 0x40 | ( red + 2 ) << 4 | ( green + 2 ) << 2 | ( blue + 2 );
+			}else if( green >= -32 && green <= 31 && red_green >= -8 && red_green <= 7 && blue_green >= -8 && blue_green <= 7 ){
+				bytes[size++] = 0x80 | ( green + 32 );
+				bytes[size++] = ( red_green + 8 ) << 4 | ( blue_green + 8 );
+			}else{
+				bytes[size++] = 0xFE;
+				bytes[size++] = pixel[0];
+				bytes[size++] = pixel[1];
+				bytes[size++] = pixel[2];
+			}
+		}
+		memcpy( previous, pixel, 3 );
+	}
+	memcpy( bytes + size, "\0\0\0\0\0\0\0\1", 8 );	//End marker
+	size += 8;
+	fwrite( bytes, 1, size, output );
+	free( bytes );
+	return RENDER_OK;
+}
@@ -0,0 +1,47 @@
+#ifndef ENCODE
+#define ENCODE
+
+#include <stdio.h>
+
+#include "../raymarch.h"
+
+#define PNG_BAND_ROWS 64	//Rows deflated as one stream of their own, the bands of an image compress in parallel
+#define DEFLATE_WINDOW 32768	//Furthest back a match can start
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 64	//Earlier positions with the same hash tried for every match
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_BLOCK_TOKENS 65536	//Literals and matches per block, every block gets Huffman codes of its own
+#define DEFLATE_MAX_BITS 15	//Longest literal/length and distance code
+#define DEFLATE_MAX_LENGTH_BITS 7	//Longest code of the code lengths
+#define QOI_INDEX_SIZE 64
+#define QOI_MAX_RUN 62
+
+typedef struct{	//Bytes of a deflate stream and the bits not yet a whole byte
+	unsigned char* bytes;
+	size_t size;
+	size_t capacity;
+	unsigned long long bits;
+	int bit_count;
+	int failed;	//Ran out of memory, the bytes are incomplete
+} BitWriter;
+
+typedef struct{	//One literal (distance 0) or match of the LZ77 pass
+	unsigned short value;	//The literal byte or the match length
+	unsigned short distance;
+} DeflateToken;
+
+typedef struct{	//Shared by every band task of one encode_png() call
+	unsigned char* rgb;
+	int width;
+	int height;
+	BitWriter* streams;	//One per band, each ends on a byte boundary so they can be written back to back
+	unsigned int* adlers;	//Adler-32 of every band's filtered rows
+	size_t* lengths;	//Filtered bytes of every band
+} PngJob;
+
+ImageFormat image_format( char* file_name );	//By extension, .png, .qoi or anything else as PPM
+RenderStatus encode_png( RenderContext* context, unsigned char* rgb, int width, int height, FILE* output, char* file_name );
+RenderStatus encode_qoi( RenderContext* context, unsigned char* rgb, int width, int height, FILE* output, char* file_name );
+
+#endif
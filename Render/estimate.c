@@ -0,0 +1,171 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "estimate.h"
+#include "progressive.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// render_estimate() splits the crop window into stride x stride strata and traces a run of ESTIMATE_RUN
+// pixels along a row of each, at a spot inside it that's the same every run, through trace_pixel() like the
+// tiled renderer. A stratum's total is its pixels' average cost times its area, and the image's the sum of
+// those. One run per stratum leaves no spread within a stratum to measure, so neighbouring strata are grouped
+// in pairs and the spread within the pairs stands in for it, which overstates the variance where costs change
+// from one stratum to the next. The sample runs on options.threads threads at once, so its times include how
+// much they slow each other down.
+
+void estimate_row( int row, void* data ){	//Task for one row of strata
+	EstimateSample* sample = data;
+	RenderContext* context = sample->context;
+	if( render_cancelled( context ) ){
+		return;
+	}
+	trace_begin( "estimate row", row );
+	double trace_start = trace_clock();
+	int y0 = sample->crop[1] + row * sample->stride;
+	int height = y0 + sample->stride < sample->crop[3] ? sample->stride : sample->crop[3] - y0;
+	for( int column = 0; column < sample->strata_x; column++ ){
+		int stratum = row * sample->strata_x + column;
+		int x0 = sample->crop[0] + column * sample->stride;
+		int width = x0 + sample->stride < sample->crop[2] ? sample->stride : sample->crop[2] - x0;
+		int run = width < ESTIMATE_RUN ? width : ESTIMATE_RUN;
+		unsigned long long jitter = fnv1a( FNV_OFFSET_BASIS, &stratum, sizeof(int) );
+		int x = x0 + (int)( jitter % ( width - run + 1 ) );
+		int y = y0 + (int)( ( jitter >> 32 ) % height );
+		double color[3];
+		long long evaluations = render_stats.sdf_evaluations;
+		long long steps = render_stats.camera_steps + render_stats.shadow_steps;
+		double start = wall_clock();
+		for( int i = 0; i < run; i++ ){
+			trace_pixel( context, color, 0, x + i, sample->M - 1 - y, sample->N, sample->M );	//trace_pixel() counts rows from the bottom
+		}
+		sample->seconds[stratum] = wall_clock() - start;
+		sample->evaluations[stratum] = render_stats.sdf_evaluations - evaluations;
+		sample->steps[stratum] = render_stats.camera_steps + render_stats.shadow_steps - steps;
+		sample->area[stratum] = width * height;
+		sample->run[stratum] = run;
+	}
+	trace_phase_spans( trace_start );
+	merge_render_stats( context );
+	trace_end( "estimate row" );
+}
+
+// Sum of every stratum's total, and the interval around it from the spread within pairs of neighbouring
+// strata. An odd count leaves the last three as one group
+RenderInterval extrapolate( double* totals, int count ){
+	RenderInterval interval = { 0.0, 0.0, 0.0 };
+	double variance = 0.0;
+	for( int i = 0; i < count; i++ ){
+		interval.estimate += totals[i];
+	}
+	for( int first = 0; first + 1 < count; first += 2 ){
+		int size = count - first == 3 ? 3 : 2;
+		double mean = 0.0;
+		double squares = 0.0;
+		for( int i = first; i < first + size; i++ ){
+			mean += totals[i] / size;
+		}
+		for( int i = first; i < first + size; i++ ){
+			squares += ( totals[i] - mean ) * ( totals[i] - mean );
+		}
+		variance += size * squares / ( size - 1 );
+		first += size - 2;
+	}
+	double margin = ESTIMATE_Z * sqrt( variance );
+	interval.low = interval.estimate > margin ? interval.estimate - margin : 0.0;
+	interval.high = interval.estimate + margin;
+	return interval;
+}
+
+void add_setup( RenderInterval* interval, double setup ){	//What setting up cost is measured, not sampled, so it's certain
+	interval->estimate += setup;
+	interval->low += setup;
+	interval->high += setup;
+}
+
+RenderStatus estimate_render( RenderContext* context, int width, int height, RenderEstimate* estimate ){
+	RenderOptions* options = &context->options;
+	double start = wall_clock();
+	RenderStats before = render_get_stats( context );
+	RenderStatus status = prepare_render( context, width, height );
+	if( status != RENDER_OK ){
+		return status;
+	}
+	RenderStats stats = render_get_stats( context );	//Building the shadow cache is part of the render, the sample isn't
+	EstimateSample sample = { context, width, height, { 0, 0, width, height } };
+	if( options->cropped ){
+		for( int i = 0; i < 4; i++ ){
+			sample.crop[i] = options->crop[i];
+		}
+	}
+	int crop_width = sample.crop[2] - sample.crop[0];
+	int crop_height = sample.crop[3] - sample.crop[1];
+	int pixels = crop_width * crop_height;
+	int target = pixels / ESTIMATE_FRACTION;
+	target = target < ESTIMATE_MIN_SAMPLES ? ESTIMATE_MIN_SAMPLES : target > ESTIMATE_MAX_SAMPLES ? ESTIMATE_MAX_SAMPLES : target;
+	sample.stride = (int)sqrt( (double)pixels * ESTIMATE_RUN / target );
+	sample.stride = sample.stride > 1 ? sample.stride : 1;
+	sample.strata_x = ( crop_width + sample.stride - 1 ) / sample.stride;
+	sample.strata_y = ( crop_height + sample.stride - 1 ) / sample.stride;
+	int count = sample.strata_x * sample.strata_y;
+	sample.seconds = malloc( sizeof(double) * count );
+	sample.evaluations = malloc( sizeof(long long) * count );
+	sample.steps = malloc( sizeof(long long) * count );
+	sample.area = malloc( sizeof(int) * count );
+	sample.run = malloc( sizeof(int) * count );
+	double* totals = malloc( sizeof(double) * count );
+	if( sample.seconds == NULL || sample.evaluations == NULL || sample.steps == NULL || sample.area == NULL || sample.run == NULL || totals == NULL ){
+		free( sample.seconds );
+		free( sample.evaluations );
+		free( sample.steps );
+		free( sample.area );
+		free( sample.run );
+		free( totals );
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory for %d samples", count );
+	}
+
+	int aovs = options->aovs;
+	options->aovs = 0;	//Nobody sees the sampled pixels
+	estimate->setup_seconds = wall_clock() - start;
+	trace_begin( "estimate", TRACE_NO_INDEX );
+	parallel_for( sample.strata_y, options->threads, estimate_row, &sample );
+	trace_end( "estimate" );
+	options->aovs = aovs;
+	pthread_mutex_lock( &context->stats_lock );	//The sample's rays aren't part of any render
+	context->stats = stats;
+	pthread_mutex_unlock( &context->stats_lock );
+
+	if( render_cancelled( context ) ){
+		status = render_fail( context, RENDER_CANCELLED, "Cancelled" );
+	}else{
+		int tiles = ( ( crop_width + TILE_SIZE - 1 ) / TILE_SIZE ) * ( ( crop_height + TILE_SIZE - 1 ) / TILE_SIZE );
+		int busy_threads = options->threads < tiles ? options->threads : tiles;	//Threads beyond the tile count have nothing to trace
+		estimate->pixels = pixels;
+		estimate->samples = 0;
+		estimate->confidence = ESTIMATE_CONFIDENCE;
+		for( int i = 0; i < count; i++ ){
+			estimate->samples += sample.run[i];
+			totals[i] = (double)sample.evaluations[i] * sample.area[i] / sample.run[i];
+		}
+		estimate->sdf_evaluations = extrapolate( totals, count );
+		add_setup( &estimate->sdf_evaluations, stats.sdf_evaluations - before.sdf_evaluations );
+		for( int i = 0; i < count; i++ ){
+			totals[i] = (double)sample.steps[i] * sample.area[i] / sample.run[i];
+		}
+		estimate->march_steps = extrapolate( totals, count );
+		add_setup( &estimate->march_steps, stats.camera_steps + stats.shadow_steps - before.camera_steps - before.shadow_steps );
+		for( int i = 0; i < count; i++ ){
+			totals[i] = sample.seconds[i] * sample.area[i] / sample.run[i] / busy_threads;
+		}
+		estimate->seconds = extrapolate( totals, count );
+		add_setup( &estimate->seconds, estimate->setup_seconds );
+		estimate->estimate_seconds = wall_clock() - start;
+	}
+	free( sample.seconds );
+	free( sample.evaluations );
+	free( sample.steps );
+	free( sample.area );
+	free( sample.run );
+	free( totals );
+	return status;
+}
@@ -0,0 +1,30 @@
+#ifndef ESTIMATE
+#define ESTIMATE
+
+#include "tiles.h"
+
+#define ESTIMATE_FRACTION 64	//One pixel in this many is sampled
+#define ESTIMATE_MIN_SAMPLES 1024	//unless that's fewer than this, or more than ESTIMATE_MAX_SAMPLES
+#define ESTIMATE_MAX_SAMPLES 65536
+#define ESTIMATE_RUN 8	//Neighbouring pixels along a row traced per stratum, alone they'd miss the coherence of a tile
+#define ESTIMATE_CONFIDENCE 0.95
+#define ESTIMATE_Z 1.96	//Standard errors either side of the estimate that hold ESTIMATE_CONFIDENCE of a normal distribution
+
+typedef struct{	//Shared by every row of strata, the sample is one pixel per stride x stride stratum of the crop window
+	RenderContext* context;
+	int N;	//Size of the full image the rays are traced for
+	int M;
+	int crop[4];	//x0 y0 x1 y1, the whole image without a crop window
+	int stride;
+	int strata_x;
+	int strata_y;
+	double* seconds;	//Per stratum, what its pixel cost
+	long long* evaluations;
+	long long* steps;
+	int* area;	//Pixels in the stratum, fewer along the right and bottom edges
+	int* run;	//Pixels traced in the stratum, ESTIMATE_RUN unless it's narrower
+} EstimateSample;
+
+RenderStatus estimate_render( RenderContext* context, int width, int height, RenderEstimate* estimate );
+
+#endif
@@ -0,0 +1,360 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../Math/simple_math.h"
+#include "../Math/vec3.h"
+#include "incremental.h"
+#include "progressive.h"
+#include "thread_pool.h"
+#include "tiles.h"
+#include "trace.h"
+
+// --incremental keeps, next to the image, what every pixel's rays depended on: the objects that bounded
+// one of their march steps from within DEPENDENCY_REACH hit thresholds (everything they hit or nearly hit),
+// the lights they marched shadow rays to, and how far the camera ray went. After a scene edit only pixels
+// that depended on a changed object, or whose rays pass through the changed object's new bounds, are
+// traced again. Objects further from a ray only set the size of its early steps, moving them shifts where
+// the ray stops by less than the hit threshold, which can change a color by one step at most.
+
+typedef struct{	//Shared by every task of one render_dirty_pixels() call
+	RenderContext* context;
+	double** pixel_buffer;
+	PixelDeps* deps;
+	int* pixels;	//Indices of the pixels to trace
+	int count;
+	int N;
+	int M;
+	atomic_int finished;	//Chunks done so far, for progress reports
+} DirtyJob;
+
+unsigned long long scene_settings_hash( RenderContext* context, int N, int M ){	//Everything that isn't an object but changes pixels
+	unsigned long long hash = FNV_OFFSET_BASIS;
+	int settings[] = { N, M, context->options.hybrid, FAST_MATH_TIER, context->light_counter };
+	hash = fnv1a( hash, settings, sizeof(settings) );
+	hash = fnv1a( hash, context->object_array[0], sizeof(Object) );
+	for( int i = 0; i < context->light_counter; i++ ){
+		hash = fnv1a( hash, context->light_array[i], sizeof(Object) );
+	}
+	return hash;
+}
+
+unsigned char color_byte( double value ){	//What create_image() writes for a color component
+	return (unsigned char)(int)( 255 * value );
+}
+
+unsigned long long image_hash( double** pixel_buffer, int N, int M ){
+	unsigned long long hash = FNV_OFFSET_BASIS;
+	for( int i = 0; i < N*M; i++ ){
+		unsigned char bytes[3] = { color_byte( pixel_buffer[i][0] ), color_byte( pixel_buffer[i][1] ), color_byte( pixel_buffer[i][2] ) };
+		hash = fnv1a( hash, bytes, 3 );
+	}
+	return hash;
+}
+
+int load_image( double** pixel_buffer, char* output, int N, int M ){	//Read our own P6 output back, 0 if it isn't there or doesn't fit
+	int width, height;
+	FILE* input = fopen( output, "rb" );
+	if( input == NULL ){
+		return 0;
+	}
+	if( fscanf( input, "P6\n%d %d\n255", &width, &height ) != 2 || width != N || height != M || fgetc( input ) != '\n' ){
+		fclose( input );
+		return 0;
+	}
+	unsigned char* bytes = malloc( N*M*3 );
+	int complete = bytes != NULL && fread( bytes, 1, N*M*3, input ) == (size_t)( N*M*3 );
+	for( int i = 0; complete && i < N*M; i++ ){
+		for( int k = 0; k < 3; k++ ){
+			pixel_buffer[i][k] = ( bytes[i*3 + k] + 0.5 ) / 255;	//Writes back out as the same byte
+		}
+	}
+	free( bytes );
+	fclose( input );
+	return complete;
+}
+
+void deps_file_name( char* file_name, char* output ){
+	sprintf( file_name, "%s.deps", output );
+}
+
+// Fill incremental in from the .deps file of an earlier render, 0 if there is none or it doesn't match the image
+int load_dependencies( Incremental* incremental, double** pixel_buffer, char* output, int N, int M ){
+	char file_name[strlen( output ) + 6];
+	DepsHeader header;
+	deps_file_name( file_name, output );
+	FILE* input = fopen( file_name, "rb" );
+	if( input == NULL ){
+		return 0;
+	}
+	if( fread( &header, sizeof(DepsHeader), 1, input ) != 1 || memcmp( header.magic, DEPS_MAGIC, 8 ) != 0 ||
+		header.version != DEPS_VERSION || header.N != N || header.M != M ||
+		header.object_count < 0 || header.object_count > MAX_OBJECTS ){
+		fclose( input );
+		return 0;
+	}
+	Object* objects = realloc( incremental->objects, sizeof(Object) * ( header.object_count + 1 ) );
+	if( objects == NULL ){	//Renders everything, and remember_scene() runs out of memory too
+		fclose( input );
+		return 0;
+	}
+	incremental->objects = objects;
+	int complete = fread( incremental->objects, sizeof(Object), header.object_count, input ) == (size_t)header.object_count &&
+					fread( incremental->deps, sizeof(PixelDeps), N*M, input ) == (size_t)( N*M );
+	fclose( input );
+	if( !complete || !load_image( pixel_buffer, output, N, M ) || image_hash( pixel_buffer, N, M ) != header.image_hash ){
+		return 0;	//Cut short, or the image was overwritten by a render that didn't keep dependencies
+	}
+	incremental->object_count = header.object_count;
+	incremental->hash = header.hash;
+	incremental->valid = 1;
+	return 1;
+}
+
+RenderStatus save_dependencies( RenderContext* context, Incremental* incremental, double** pixel_buffer, char* output, int N, int M ){
+	char file_name[strlen( output ) + 6];
+	char temp_file[strlen( output ) + 10];
+	DepsHeader header;
+	deps_file_name( file_name, output );
+	sprintf( temp_file, "%s.tmp", file_name );
+	memset( &header, 0, sizeof(DepsHeader) );
+	memcpy( header.magic, DEPS_MAGIC, 8 );
+	header.version = DEPS_VERSION;
+	header.N = N;
+	header.M = M;
+	header.object_count = incremental->object_count;
+	header.hash = incremental->hash;
+	header.image_hash = image_hash( pixel_buffer, N, M );
+
+	FILE* deps_file = fopen( temp_file, "wb" );
+	if( deps_file == NULL ){
+		return render_fail( context, RENDER_ERROR_FILE, "Could not write \"%s\"", temp_file );
+	}
+	fwrite( &header, sizeof(DepsHeader), 1, deps_file );
+	fwrite( incremental->objects, sizeof(Object), incremental->object_count, deps_file );
+	fwrite( incremental->deps, sizeof(PixelDeps), N*M, deps_file );
+	fclose( deps_file );
+	rename( temp_file, file_name );
+	return RENDER_OK;
+}
+
+// Keep the scene we just rendered to diff the next one against
+RenderStatus remember_scene( RenderContext* context, Incremental* incremental, int N, int M ){
+	Object* objects = realloc( incremental->objects, sizeof(Object) * ( context->object_counter + 1 ) );
+	if( objects == NULL ){
+		incremental->valid = 0;
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while keeping the scene" );
+	}
+	incremental->objects = objects;
+	for( int i = 0; i < context->object_counter; i++ ){
+		memcpy( &incremental->objects[i], context->object_array[i + 1], sizeof(Object) );
+	}
+	incremental->object_count = context->object_counter;
+	incremental->hash = scene_settings_hash( context, N, M );
+	incremental->valid = 1;
+	return RENDER_OK;
+}
+
+int depends_on( PixelDeps* deps, int object_index ){
+	return ( deps->objects[( object_index / 64 ) % DEPENDENCY_WORDS] >> ( object_index % 64 ) ) & 1;
+}
+
+int segment_near_sphere( Vec3 start, Vec3 end, Vec3 center, double radius ){	//Does the segment come within radius of center
+	Vec3 segment = vec3_sub( end, start );
+	double length_squared = vec3_dot( segment, segment );
+	double t = length_squared > 0 ? vec3_dot( vec3_sub( center, start ), segment ) / length_squared : 0;
+	t = t < 0 ? 0 : ( t > 1 ? 1 : t );
+	return vec3_length( vec3_sub( center, vec3_add( start, vec3_scale( segment, t ) ) ) ) <= radius;
+}
+
+// Could an object inside this sphere change the pixel: does the camera ray, or a shadow ray from one of the
+// lights it marched to, pass within the hit threshold of it. A camera ray that escaped only stopped at the
+// far plane of the scene it was traced in, an object added past that is still in its way
+int rays_touch_sphere( RenderContext* context, PixelDeps* deps, int pixel, int N, int M, Vec3 center, double radius ){
+	double Rd[3];
+	double distance = deps->distance;
+	double threshold = deps->threshold;
+	if( deps->hit_object == 0 ){	//Follow it on past the far side of the sphere, where its threshold is widest
+		distance = fmax( distance, vec3_length( center ) + radius + threshold );
+		threshold = hit_threshold( &context->camera_limits, distance );
+		distance += threshold;
+	}
+	camera_ray_direction( context, Rd, pixel % N, M - 1 - pixel / N, N, M );
+	Vec3 hit = vec3_scale( vec3_load( Rd ), distance );
+	if( segment_near_sphere( vec3( 0, 0, 0 ), hit, center, radius + threshold ) ){
+		return 1;
+	}
+	for( int i = 0; i < context->light_counter && deps->lights != 0; i++ ){
+		if( ( deps->lights >> ( i % 64 ) ) & 1 ){
+			if( segment_near_sphere( vec3_load( context->light_array[i]->position ), hit, center, radius + threshold + SHADOW_TOLERANCE ) ){
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int only_material_changed( Object* before, Object* after ){	//Same shape in the same place, so no ray's path changed
+	Object reshaped;
+	memcpy( &reshaped, after, sizeof(Object) );
+	memcpy( reshaped.diffuse_color, before->diffuse_color, sizeof(reshaped.diffuse_color) );
+	memcpy( reshaped.specular_color, before->specular_color, sizeof(reshaped.specular_color) );
+	reshaped.shininess = before->shininess;
+	reshaped.ior = before->ior;
+	return memcmp( &reshaped, before, sizeof(Object) ) == 0;
+}
+
+// Diff the scene that's loaded now against the one incremental was rendered from, and set dirty for
+// every pixel that has to be traced again. Returns how many objects changed, -1 if everything has to go
+int mark_dirty_pixels( RenderContext* context, Incremental* incremental, char* dirty, int N, int M ){
+	int object_counter = context->object_counter;
+	if( !incremental->valid || incremental->hash != scene_settings_hash( context, N, M ) ){
+		memset( dirty, 1, N*M );
+		return -1;
+	}
+	memset( dirty, 0, N*M );
+	int changed = 0;
+	int count = incremental->object_count > object_counter ? incremental->object_count : object_counter;
+	for( int i = 1; i <= count; i++ ){
+		Object* before = i <= incremental->object_count ? &incremental->objects[i - 1] : NULL;
+		Object* after = i <= object_counter ? context->object_array[i] : NULL;
+		if( before != NULL && after != NULL && memcmp( before, after, sizeof(Object) ) == 0 ){
+			continue;
+		}
+		changed++;
+		double radius = after != NULL ? object_bounds_radius( after ) : 0;
+		if( after != NULL && isinf( radius ) ){	//A plane can move into any pixel
+			memset( dirty, 1, N*M );
+			return changed;
+		}
+		int moved = before == NULL || after == NULL || !only_material_changed( before, after );
+		for( int pixel = 0; pixel < N*M; pixel++ ){
+			if( dirty[pixel] ){
+				continue;
+			}
+			if( !moved ){	//A new color only shows where the camera ray landed
+				dirty[pixel] = incremental->deps[pixel].hit_object == i;
+			}else if( before != NULL && depends_on( &incremental->deps[pixel], i ) ){
+				dirty[pixel] = 1;
+			}else if( after != NULL && rays_touch_sphere( context, &incremental->deps[pixel], pixel, N, M, vec3_load( after->position ), radius ) ){
+				dirty[pixel] = 1;
+			}
+		}
+	}
+	return changed;
+}
+
+void render_dirty_chunk( int index, void* data ){	//Task for DEPS_CHUNK dirty pixels
+	DirtyJob* job = data;
+	int end = ( index + 1 ) * DEPS_CHUNK < job->count ? ( index + 1 ) * DEPS_CHUNK : job->count;
+	if( render_cancelled( job->context ) ){
+		return;
+	}
+	trace_begin( "pixels", index );
+	double start = trace_clock();
+	for( int i = index * DEPS_CHUNK; i < end; i++ ){
+		int pixel = job->pixels[i];
+		memset( &job->deps[pixel], 0, sizeof(PixelDeps) );
+		recorded_deps = &job->deps[pixel];
+		trace_pixel( job->context, job->pixel_buffer[pixel], pixel, pixel % job->N, job->M - 1 - pixel / job->N, job->N, job->M );
+		recorded_deps = NULL;
+	}
+	trace_phase_spans( start );
+	trace_end( "pixels" );
+	merge_render_stats( job->context );
+	report_progress( job->context, (long long)min( ( atomic_fetch_add( &job->finished, 1 ) + 1 ) * DEPS_CHUNK, job->count ), job->count );
+}
+
+// Returns how many were traced, -1 if there's no memory to list them
+int render_dirty_pixels( RenderContext* context, Incremental* incremental, double** pixel_buffer, int N, int M ){
+	DirtyJob job;
+	job.context = context;
+	job.pixel_buffer = pixel_buffer;
+	job.deps = incremental->deps;
+	job.pixels = malloc( sizeof(int) * N*M );
+	job.count = 0;
+	job.N = N;
+	job.M = M;
+	atomic_init( &job.finished, 0 );
+	if( job.pixels == NULL ){
+		return -1;
+	}
+	for( int pixel = 0; pixel < N*M; pixel++ ){
+		if( incremental->dirty[pixel] ){
+			job.pixels[job.count++] = pixel;
+		}
+	}
+	parallel_for( ( job.count + DEPS_CHUNK - 1 ) / DEPS_CHUNK, context->options.threads, render_dirty_chunk, &job );
+	free( job.pixels );
+	return job.count;
+}
+
+// Bring the image and its .deps file up to date with the scene that's loaded now
+RenderStatus incremental_update( RenderContext* context, Incremental* incremental, double** pixel_buffer, int N, int M, char* output ){
+	trace_begin( "diff scene", TRACE_NO_INDEX );
+	int changed = mark_dirty_pixels( context, incremental, incremental->dirty, N, M );
+	trace_end( "diff scene" );
+	int traced = render_dirty_pixels( context, incremental, pixel_buffer, N, M );
+	if( traced < 0 ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while collecting pixels to re-render" );
+	}
+	trace_counter( "re-rendered pixels", traced );
+	if( render_cancelled( context ) ){	//Some dirty pixels are stale, the next call starts over
+		incremental->valid = 0;
+		return render_fail( context, RENDER_CANCELLED, "Cancelled" );
+	}
+	RenderStatus status = remember_scene( context, incremental, N, M );
+	if( status == RENDER_OK ){
+		status = write_image_atomically( context, pixel_buffer, output, N, M );	//--watch viewers never see half an image
+	}
+	if( status == RENDER_OK ){
+		trace_begin( "save dependencies", TRACE_NO_INDEX );
+		status = save_dependencies( context, incremental, pixel_buffer, output, N, M );
+		trace_end( "save dependencies" );
+	}
+	if( status == RENDER_OK && context->options.stats ){
+		if( changed < 0 ){
+			fprintf(stderr, "incremental: rendered all %d pixels\n", N*M);
+		}else{
+			fprintf(stderr, "incremental: %d objects changed, re-rendered %d of %d pixels\n", changed, traced, N*M);
+		}
+	}
+	return status;
+}
+
+void free_incremental( RenderContext* context ){
+	if( context->incremental != NULL ){
+		free( context->incremental->deps );
+		free( context->incremental->dirty );
+		free( context->incremental->objects );
+		free( context->incremental );
+	}
+	context->incremental = NULL;
+}
+
+// Renders what changed since the last call, or on the first call since the render that wrote output's
+// .deps file. pixel_buffer has to hold the image the last call left in it
+RenderStatus incremental_render_scene( RenderContext* context, double** pixel_buffer, int N, int M, char* output ){
+	Incremental* incremental = context->incremental;
+	if( incremental == NULL || incremental->N != N || incremental->M != M ){
+		free_incremental( context );
+		incremental = calloc( 1, sizeof(Incremental) );
+		context->incremental = incremental;
+		if( incremental == NULL ){
+			return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while setting up the incremental render" );
+		}
+		incremental->deps = calloc( N*M, sizeof(PixelDeps) );
+		incremental->dirty = malloc( N*M );
+		incremental->N = N;
+		incremental->M = M;
+		if( incremental->deps == NULL || incremental->dirty == NULL ){
+			free_incremental( context );
+			return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while setting up the incremental render" );
+		}
+		trace_begin( "load dependencies", TRACE_NO_INDEX );
+		load_dependencies( incremental, pixel_buffer, output, N, M );
+		trace_end( "load dependencies" );
+	}
+	return incremental_update( context, incremental, pixel_buffer, N, M, output );
+}
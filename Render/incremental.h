@@ -0,0 +1,34 @@
+#ifndef INCREMENTAL
+#define INCREMENTAL
+
+#include "../raymarch.h"
+
+#define DEPS_MAGIC "RMDEPEND"
+#define DEPS_VERSION 2	//Objects are stored as they are in memory, bump it whenever Object changes
+#define DEPS_CHUNK 256	//Pixels per parallel_for() task when re-rendering
+
+typedef struct{	//Start of <output>.deps, followed by the objects it was rendered with and one PixelDeps per pixel
+	char magic[8];
+	int version;
+	int N;
+	int M;
+	int object_count;
+	unsigned long long hash;	//Camera, lights and settings, any change to these re-renders everything
+	unsigned long long image_hash;	//The image the dependencies belong to
+} DepsHeader;
+
+typedef struct Incremental{	//What the last render was made from, to diff the next scene against
+	int N;
+	int M;
+	PixelDeps* deps;	//Top row first, like the pixel buffer
+	char* dirty;	//Pixels the next update traces, see mark_dirty_pixels()
+	Object* objects;	//Copies of object_array[1..object_count]
+	int object_count;
+	unsigned long long hash;	//See scene_settings_hash()
+	int valid;	//0 until a render (or a matching .deps file) filled this in
+} Incremental;
+
+RenderStatus incremental_render_scene( RenderContext* context, double** pixel_buffer, int N, int M, char* output );
+void free_incremental( RenderContext* context );
+
+#endif
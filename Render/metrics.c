@@ -0,0 +1,265 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+// --metrics keeps a file in Prometheus' text exposition format up to date while the render runs, for
+// node_exporter's textfile collector or anything else that scrapes files. Workers count into the slot of
+// their parallel_for() worker index with relaxed atomic adds, rays and steps once per tile or chunk from
+// merge_render_stats() and busy time once per task, so nothing is added to the march loop. A writer
+// thread sums the slots every interval and replaces the file through a rename, so a scrape never reads
+// half of it. Rates and mean steps are over the last interval, which shows a render that is stuck on
+// MAX_STEPS rays right now rather than averaged away over hours.
+
+int metrics_running;
+MetricsSlot metrics_slots[METRICS_SLOTS];
+_Thread_local int metrics_worker;
+_Thread_local int metrics_in_task;	//Nested parallel_for() calls on this thread are inside a task that's timed already
+atomic_llong metrics_done;	//Progress last passed to report_progress() by any context
+atomic_llong metrics_total;
+
+char* metrics_file;
+double metrics_interval;
+double metrics_epoch;	//Seconds on CLOCK_MONOTONIC at metrics_start()
+MetricsSample metrics_last;
+pthread_t metrics_thread;
+pthread_mutex_t metrics_lock;
+pthread_cond_t metrics_wake;	//Signalled by metrics_stop()
+int metrics_stopping;
+
+long long clock_ns( clockid_t clock ){
+	struct timespec now;
+	clock_gettime( clock, &now );
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void metrics_publish( RenderStats* stats ){	//Called from merge_render_stats() with the counts it's about to add
+	if( !metrics_running ){
+		return;
+	}
+	MetricsSlot* slot = metrics_slot();
+	metrics_add( &slot->camera_rays, stats->camera_rays );
+	metrics_add( &slot->camera_steps, stats->camera_steps );
+	metrics_add( &slot->shadow_rays, stats->shadow_rays );
+	metrics_add( &slot->shadow_steps, stats->shadow_steps );
+	metrics_add( &slot->cached_shadows, stats->cached_shadows );
+	metrics_add( &slot->sdf_evaluations, stats->sdf_evaluations );
+}
+
+void metrics_progress( long long done, long long total ){
+	if( metrics_running ){
+		atomic_store_explicit( &metrics_total, total, memory_order_relaxed );
+		atomic_store_explicit( &metrics_done, done, memory_order_relaxed );
+	}
+}
+
+void metrics_task_begin( long long* wall, long long* cpu ){	//Times the task about to run on this thread, unless it's nested in one
+	*wall = -1;
+	if( !metrics_running || metrics_in_task ){
+		return;
+	}
+	metrics_in_task = 1;
+	atomic_store_explicit( &metrics_slot()->used, 1, memory_order_relaxed );
+	*wall = clock_ns( CLOCK_MONOTONIC );
+	*cpu = clock_ns( CLOCK_THREAD_CPUTIME_ID );
+}
+
+void metrics_task_end( long long wall, long long cpu ){
+	if( wall < 0 ){
+		return;
+	}
+	MetricsSlot* slot = metrics_slot();
+	metrics_add( &slot->busy_ns, clock_ns( CLOCK_MONOTONIC ) - wall );
+	metrics_add( &slot->cpu_ns, clock_ns( CLOCK_THREAD_CPUTIME_ID ) - cpu );
+	metrics_in_task = 0;
+}
+
+void write_value( FILE* output, double value ){	//Prometheus spells it NaN
+	if( isnan( value ) ){
+		fprintf( output, "NaN\n" );
+	}else{
+		fprintf( output, "%.9g\n", value );
+	}
+}
+
+void write_header( FILE* output, const char* name, const char* type, const char* help ){
+	fprintf( output, "# HELP raymarcher_%s %s\n# TYPE raymarcher_%s %s\n", name, help, name, type );
+}
+
+void write_counter( FILE* output, const char* name, const char* help, long long value ){
+	write_header( output, name, "counter", help );
+	fprintf( output, "raymarcher_%s %lld\n", name, value );
+}
+
+void write_gauge( FILE* output, const char* name, const char* help, double value ){
+	write_header( output, name, "gauge", help );
+	fprintf( output, "raymarcher_%s ", name );
+	write_value( output, value );
+}
+
+double ratio( long long numerator, long long denominator ){	//NaN when there's nothing to divide
+	return denominator > 0 ? (double)numerator / denominator : NAN;
+}
+
+// Sums the slots and replaces the file with them. Only the writer thread, and metrics_start() and
+// metrics_stop() while it isn't running, call this
+RenderStatus write_metrics(){
+	long long sums[7] = { 0 };	//Every slot's counters, in the order MetricsSlot has them
+	for( int i = 0; i < METRICS_SLOTS; i++ ){
+		MetricsSlot* slot = &metrics_slots[i];
+		sums[0] += atomic_load_explicit( &slot->camera_rays, memory_order_relaxed );
+		sums[1] += atomic_load_explicit( &slot->camera_steps, memory_order_relaxed );
+		sums[2] += atomic_load_explicit( &slot->shadow_rays, memory_order_relaxed );
+		sums[3] += atomic_load_explicit( &slot->shadow_steps, memory_order_relaxed );
+		sums[4] += atomic_load_explicit( &slot->cached_shadows, memory_order_relaxed );
+		sums[5] += atomic_load_explicit( &slot->sdf_evaluations, memory_order_relaxed );
+		sums[6] += atomic_load_explicit( &slot->tiles, memory_order_relaxed );
+	}
+	double now = clock_ns( CLOCK_MONOTONIC ) * 1e-9;
+	double seconds = now - metrics_last.time;
+	long long done = atomic_load_explicit( &metrics_done, memory_order_relaxed );
+	long long total = atomic_load_explicit( &metrics_total, memory_order_relaxed );
+	done = done < total ? done : total;
+	if( total != metrics_last.progress_total || done < metrics_last.progress_done ){	//Another render started since the last write
+		metrics_last.eta_done = done;
+		metrics_last.eta_time = now;
+	}
+	double eta = NAN;
+	if( total > 0 && done == total ){
+		eta = 0.0;
+	}else if( done > metrics_last.eta_done ){	//At the pace this render has kept since it was first seen
+		eta = ( total - done ) * ( now - metrics_last.eta_time ) / ( done - metrics_last.eta_done );
+	}
+
+	char temp_file[strlen( metrics_file ) + 5];
+	sprintf( temp_file, "%s.tmp", metrics_file );
+	FILE* output = fopen( temp_file, "w" );
+	if( output == NULL ){
+		return RENDER_ERROR_FILE;
+	}
+	write_gauge( output, "elapsed_seconds", "Seconds since metrics started.", now - metrics_epoch );
+	write_counter( output, "tiles_completed_total", "Tiles the tiled and batch renderers finished.", sums[6] );
+	write_gauge( output, "progress_ratio", "Finished fraction of the current render.", total > 0 ? (double)done / total : 0.0 );
+	write_gauge( output, "eta_seconds", "Seconds the current render has left at its pace so far, NaN until it makes progress.", eta );
+	write_counter( output, "camera_rays_total", "Camera rays marched.", sums[0] );
+	write_counter( output, "camera_steps_total", "March steps of camera rays.", sums[1] );
+	write_counter( output, "shadow_rays_total", "Shadow rays marched.", sums[2] );
+	write_counter( output, "shadow_steps_total", "March steps of shadow rays.", sums[3] );
+	write_counter( output, "cached_shadows_total", "Shadows answered by the shadow cache without marching.", sums[4] );
+	write_counter( output, "sdf_evaluations_total", "Object SDFs evaluated.", sums[5] );
+	write_header( output, "rays_per_second", "gauge", "Rays marched per second since the last write." );
+	fprintf( output, "raymarcher_rays_per_second{ray=\"camera\"} " );
+	write_value( output, seconds > 0 ? ( sums[0] - metrics_last.camera_rays ) / seconds : 0.0 );
+	fprintf( output, "raymarcher_rays_per_second{ray=\"shadow\"} " );
+	write_value( output, seconds > 0 ? ( sums[2] - metrics_last.shadow_rays ) / seconds : 0.0 );
+	write_header( output, "mean_steps_per_ray", "gauge", "March steps per ray since the last write, NaN without rays." );
+	fprintf( output, "raymarcher_mean_steps_per_ray{ray=\"camera\"} " );
+	write_value( output, ratio( sums[1] - metrics_last.camera_steps, sums[0] - metrics_last.camera_rays ) );
+	fprintf( output, "raymarcher_mean_steps_per_ray{ray=\"shadow\"} " );
+	write_value( output, ratio( sums[3] - metrics_last.shadow_steps, sums[2] - metrics_last.shadow_rays ) );
+	write_header( output, "thread_busy_seconds_total", "counter", "Wall time each worker spent running tasks." );
+	for( int i = 0; i < METRICS_SLOTS; i++ ){
+		if( atomic_load_explicit( &metrics_slots[i].used, memory_order_relaxed ) ){
+			fprintf( output, "raymarcher_thread_busy_seconds_total{worker=\"%d\"} %.6f\n", i,
+					atomic_load_explicit( &metrics_slots[i].busy_ns, memory_order_relaxed ) * 1e-9 );
+		}
+	}
+	write_header( output, "thread_cpu_seconds_total", "counter", "CPU time each worker got while running tasks, below its busy time when it's starved." );
+	for( int i = 0; i < METRICS_SLOTS; i++ ){
+		if( atomic_load_explicit( &metrics_slots[i].used, memory_order_relaxed ) ){
+			fprintf( output, "raymarcher_thread_cpu_seconds_total{worker=\"%d\"} %.6f\n", i,
+					atomic_load_explicit( &metrics_slots[i].cpu_ns, memory_order_relaxed ) * 1e-9 );
+		}
+	}
+	int failed = ferror( output );
+	if( fclose( output ) != 0 || failed || rename( temp_file, metrics_file ) != 0 ){
+		remove( temp_file );
+		return RENDER_ERROR_FILE;
+	}
+
+	metrics_last.time = now;
+	metrics_last.camera_rays = sums[0];
+	metrics_last.camera_steps = sums[1];
+	metrics_last.shadow_rays = sums[2];
+	metrics_last.shadow_steps = sums[3];
+	metrics_last.progress_total = total;
+	metrics_last.progress_done = done;
+	return RENDER_OK;
+}
+
+void* metrics_writer( void* arg ){	//Rewrites the file every interval until metrics_stop(), a failed write is tried again next time
+	(void)arg;
+	pthread_mutex_lock( &metrics_lock );
+	while( !metrics_stopping ){
+		long long wake = clock_ns( CLOCK_MONOTONIC ) + (long long)( metrics_interval * 1e9 );
+		struct timespec deadline = { wake / 1000000000LL, wake % 1000000000LL };
+		while( !metrics_stopping && pthread_cond_timedwait( &metrics_wake, &metrics_lock, &deadline ) != ETIMEDOUT ){
+			//Woken early, keep waiting for the deadline or the stop
+		}
+		if( !metrics_stopping ){
+			write_metrics();
+		}
+	}
+	pthread_mutex_unlock( &metrics_lock );
+	return NULL;
+}
+
+// Writes the file once, so a path that can't be written fails here rather than silently, then starts the writer
+RenderStatus metrics_start( char* file, double interval ){
+	if( metrics_running || interval <= 0 ){
+		return RENDER_ERROR_OPTIONS;
+	}
+	metrics_file = strdup( file );
+	if( metrics_file == NULL ){
+		return RENDER_ERROR_MEMORY;
+	}
+	memset( metrics_slots, 0, sizeof(metrics_slots) );
+	memset( &metrics_last, 0, sizeof(MetricsSample) );
+	atomic_store( &metrics_done, 0 );
+	atomic_store( &metrics_total, 0 );
+	metrics_interval = interval;
+	metrics_epoch = clock_ns( CLOCK_MONOTONIC ) * 1e-9;
+	metrics_last.time = metrics_epoch;
+	RenderStatus status = write_metrics();
+	if( status != RENDER_OK ){
+		free( metrics_file );
+		return status;
+	}
+	pthread_condattr_t attributes;	//Deadlines on the clock the intervals are measured on
+	pthread_condattr_init( &attributes );
+	pthread_condattr_setclock( &attributes, CLOCK_MONOTONIC );
+	pthread_cond_init( &metrics_wake, &attributes );
+	pthread_condattr_destroy( &attributes );
+	pthread_mutex_init( &metrics_lock, NULL );
+	metrics_stopping = 0;
+	if( pthread_create( &metrics_thread, NULL, metrics_writer, NULL ) != 0 ){
+		pthread_cond_destroy( &metrics_wake );
+		pthread_mutex_destroy( &metrics_lock );
+		free( metrics_file );
+		return RENDER_ERROR_MEMORY;
+	}
+	metrics_running = 1;
+	return RENDER_OK;
+}
+
+// Stops the writer and writes the final numbers
+RenderStatus metrics_stop(){
+	if( !metrics_running ){
+		return RENDER_ERROR_OPTIONS;
+	}
+	pthread_mutex_lock( &metrics_lock );
+	metrics_stopping = 1;
+	pthread_cond_signal( &metrics_wake );
+	pthread_mutex_unlock( &metrics_lock );
+	pthread_join( metrics_thread, NULL );
+	RenderStatus status = write_metrics();
+	metrics_running = 0;
+	pthread_cond_destroy( &metrics_wake );
+	pthread_mutex_destroy( &metrics_lock );
+	free( metrics_file );
+	return status;
+}
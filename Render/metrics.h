@@ -0,0 +1,63 @@
+#ifndef METRICS
+#define METRICS
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../render.h"
+
+#define METRICS_SLOTS 256	//Workers counted apart, higher worker indexes share slots
+
+typedef struct{	//Counters of one worker index, written with relaxed atomics and summed by the writer thread
+	_Alignas(64) atomic_llong camera_rays;	//Each slot on cache lines of its own, workers never contend for one
+	atomic_llong camera_steps;
+	atomic_llong shadow_rays;
+	atomic_llong shadow_steps;
+	atomic_llong cached_shadows;
+	atomic_llong sdf_evaluations;
+	atomic_llong tiles;
+	atomic_llong busy_ns;	//Wall time inside parallel_for() tasks
+	atomic_llong cpu_ns;	//CPU time the thread got for them, far below busy_ns when it's starved
+	atomic_int used;	//Ran a task since metrics_start(), only those are written
+} MetricsSlot;
+
+typedef struct{	//What the writer thread last wrote, for the rates and the ETA
+	double time;
+	long long camera_rays;
+	long long camera_steps;
+	long long shadow_rays;
+	long long shadow_steps;
+	long long progress_total;	//The render the ETA is counted for, a new total or done going back starts another
+	long long progress_done;
+	long long eta_done;	//Progress when that render was first seen
+	double eta_time;
+} MetricsSample;
+
+extern int metrics_running;
+extern MetricsSlot metrics_slots[METRICS_SLOTS];
+extern _Thread_local int metrics_worker;	//Slot this thread counts into, its parallel_for() worker index
+
+RenderStatus metrics_start( char* metrics_file, double interval );
+RenderStatus metrics_stop();
+void metrics_publish( RenderStats* stats );
+void metrics_progress( long long done, long long total );
+void metrics_task_begin( long long* wall, long long* cpu );
+void metrics_task_end( long long wall, long long cpu );
+
+// Everything below costs one branch without --metrics
+
+static inline MetricsSlot* metrics_slot(){
+	return &metrics_slots[metrics_worker % METRICS_SLOTS];
+}
+
+static inline void metrics_add( atomic_llong* counter, long long amount ){	//Relaxed, the counters only have to add up, they order nothing
+	atomic_fetch_add_explicit( counter, amount, memory_order_relaxed );
+}
+
+static inline void metrics_tile_done(){
+	if( metrics_running ){
+		metrics_add( &metrics_slot()->tiles, 1 );
+	}
+}
+
+#endif
@@ -0,0 +1,193 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "encode.h"
+#include "progressive.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Progressive rendering traces the image in interleaved passes: first every 16th pixel in both directions,
+// then the pixels halfway between those, and so on down to every pixel. Pixels a pass hasn't reached yet
+// copy the nearest traced pixel, so the image is complete (if blocky) after the first pass and only gets
+// sharper from there. With --time-budget the render stops wherever it is once the budget is spent.
+// Each pass hands its rows to options.threads threads. When a snapshot is due the rows stop where they are,
+// the calling thread writes it once every thread is out, and the rows carry on from the first pixel of
+// theirs the pass hasn't traced yet.
+
+double wall_clock(){	//Seconds on a clock that never jumps
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Viewers watching the output file never see half an image
+RenderStatus write_image_atomically( RenderContext* context, double** pixel_buffer, char* output, int width, int height ){
+	char temp_file[strlen( output ) + 5];
+	sprintf( temp_file, "%s.tmp", output );
+	RenderStatus status = write_image( context, pixel_buffer, temp_file, image_format( output ), width, height );
+	if( status == RENDER_OK ){
+		rename( temp_file, output );
+	}
+	return status;
+}
+
+int pass_owns_pixel( int x, int y, int stride ){	//Pixels first traced by the pass with this stride
+	if( x % stride != 0 || y % stride != 0 ){
+		return 0;
+	}
+	return stride == PROGRESSIVE_FIRST_STRIDE || x % ( stride * 2 ) != 0 || y % ( stride * 2 ) != 0;
+}
+
+int nearest_grid_point( int coordinate, int stride, int size ){	//Closest multiple of stride inside the image
+	int point = ( coordinate + stride / 2 ) / stride * stride;
+	return point < size ? point : point - stride;
+}
+
+void fill_gaps( Progressive* progressive ){	//Give every pixel that hasn't been traced the color of its nearest traced one
+	int N = progressive->N;
+	int M = progressive->M;
+	for( int y = 0; y < M; y++ ){
+		for( int x = 0; x < N; x++ ){
+			int pixel = (M - 1 - y)*N + x;
+			if( progressive->traced[pixel] ){
+				continue;
+			}
+			double* color = progressive->pixel_buffer[pixel];
+			color[0] = 0;
+			color[1] = 0;
+			color[2] = 0;
+			for( int stride = 2; stride <= PROGRESSIVE_FIRST_STRIDE; stride *= 2 ){	//Finer passes are closer, try them first
+				int source = (M - 1 - nearest_grid_point( y, stride, M ))*N + nearest_grid_point( x, stride, N );
+				if( progressive->traced[source] ){
+					color[0] = progressive->pixel_buffer[source][0];
+					color[1] = progressive->pixel_buffer[source][1];
+					color[2] = progressive->pixel_buffer[source][2];
+					break;
+				}
+			}
+		}
+	}
+}
+
+void progressive_row( int index, void* data ){	//Task for one row of a pass, stops early if it's time to stop or snapshot
+	Progressive* progressive = data;
+	RenderContext* context = progressive->context;
+	int N = progressive->N;
+	int M = progressive->M;
+	int stride = progressive->stride;
+	int y = progressive->rows[index];
+	long long traced = 0;
+	trace_begin( "pass row", y );
+	double start = trace_clock();
+	for( int x = 0; x < N; x += stride ){
+		int pixel = (M - 1 - y)*N + x;
+		if( !pass_owns_pixel( x, y, stride ) || progressive->traced[pixel] == stride ){	//Traced before a snapshot stopped the row
+			continue;
+		}
+		double now = wall_clock();
+		if( now >= progressive->deadline || now >= progressive->next_snapshot || render_cancelled( context ) ){
+			progressive->rows[index] = -1 - y;	//Not done, the next round picks it up again
+			break;
+		}
+		trace_pixel( context, progressive->pixel_buffer[pixel], pixel, x, y, N, M );
+		progressive->traced[pixel] = stride;
+		traced++;
+	}
+	trace_phase_spans( start );
+	merge_render_stats( context );	//Row by row, so --metrics sees the rays as they go
+	trace_end( "pass row" );
+	report_progress( context, atomic_fetch_add( &progressive->traced_count, traced ) + traced, (long long)N*M );
+}
+
+// Returns 0 if the deadline hit first or the render was cancelled, a failed snapshot also sets progressive->status
+int progressive_pass( Progressive* progressive, int stride ){
+	RenderContext* context = progressive->context;
+	int N = progressive->N;
+	int M = progressive->M;
+	int count = 0;
+	progressive->stride = stride;
+	for( int y = 0; y < M; y += stride ){
+		progressive->rows[count++] = y;
+	}
+	while( count > 0 ){
+		parallel_for( count, context->options.threads, progressive_row, progressive );
+		int left = 0;
+		for( int i = 0; i < count; i++ ){	//Rows that stopped early are stored as -1 - y
+			if( progressive->rows[i] < 0 ){
+				progressive->rows[left++] = -1 - progressive->rows[i];
+			}
+		}
+		count = left;
+		double now = wall_clock();
+		if( count > 0 && ( now >= progressive->deadline || render_cancelled( context ) ) ){
+			return 0;
+		}
+		if( now >= progressive->next_snapshot ){	//Every thread is out, nothing writes the pixels while they're copied
+			trace_begin( "snapshot", TRACE_NO_INDEX );
+			fill_gaps( progressive );
+			progressive->status = write_image_atomically( context, progressive->pixel_buffer, progressive->output, N, M );
+			trace_end( "snapshot" );
+			if( progressive->status != RENDER_OK ){
+				return 0;
+			}
+			progressive->next_snapshot = now + context->options.snapshot_interval;
+		}
+	}
+	return 1;
+}
+
+// The time budget counts from start_time. The output file gets snapshots and the final image
+RenderStatus progressive_render_scene( RenderContext* context, double** pixel_buffer, int N, int M, char* output, double start_time ){
+	Progressive progressive;
+	RenderOptions* options = &context->options;
+	int finished_stride = 0;	//Stride of the last pass that completed
+	progressive.context = context;
+	progressive.status = RENDER_OK;
+	progressive.pixel_buffer = pixel_buffer;
+	progressive.traced = calloc( N*M, sizeof(unsigned char) );
+	progressive.rows = malloc( sizeof(int) * M );
+	atomic_init( &progressive.traced_count, 0 );
+	progressive.N = N;
+	progressive.M = M;
+	progressive.output = output;
+	progressive.deadline = options->time_budget > 0 ? start_time + options->time_budget : INFINITY;
+	progressive.next_snapshot = options->snapshot_interval > 0 ? wall_clock() + options->snapshot_interval : INFINITY;
+	if( progressive.traced == NULL || progressive.rows == NULL ){
+		free( progressive.traced );
+		free( progressive.rows );
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while setting up the progressive render" );
+	}
+
+	for( int stride = PROGRESSIVE_FIRST_STRIDE; stride >= 1; stride /= 2 ){
+		trace_begin( "pass", stride );
+		int finished = progressive_pass( &progressive, stride );
+		trace_end( "pass" );
+		trace_counter( "traced pixels", atomic_load( &progressive.traced_count ) );
+		if( !finished ){
+			break;
+		}
+		finished_stride = stride;
+	}
+
+	fill_gaps( &progressive );
+	free( progressive.traced );
+	free( progressive.rows );
+	if( progressive.status != RENDER_OK ){
+		return progressive.status;
+	}
+	if( render_cancelled( context ) ){
+		return render_fail( context, RENDER_CANCELLED, "Cancelled" );
+	}
+	if( options->stats ){
+		fprintf(stderr, "progressive: traced %lld of %d pixels", atomic_load( &progressive.traced_count ), N*M);
+		if( finished_stride > 0 ){
+			fprintf(stderr, ", every %d pixels fully refined\n", finished_stride);
+		}else{
+			fprintf(stderr, ", the first pass did not finish\n");
+		}
+	}
+	return write_image_atomically( context, pixel_buffer, output, N, M );	//A viewer may be watching the snapshots
+}
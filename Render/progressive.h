@@ -0,0 +1,29 @@
+#ifndef PROGRESSIVE
+#define PROGRESSIVE
+
+#include <stdatomic.h>
+
+#include "../raymarch.h"
+
+#define PROGRESSIVE_FIRST_STRIDE 16	//Pixel spacing of the first pass, every pass after it halves the spacing
+
+typedef struct{	//State of a progressive render, see progressive_render_scene()
+	RenderContext* context;
+	RenderStatus status;	//Set if writing a snapshot failed
+	double** pixel_buffer;
+	unsigned char* traced;	//Stride of the pass that traced each pixel, 0 while it hasn't been
+	atomic_llong traced_count;
+	int stride;	//Of the pass being traced
+	int* rows;	//Rows the pass has left, the ones its tasks stopped early on come back as -1 - y
+	int N;
+	int M;
+	char* output;	//Snapshots are written here
+	double deadline;	//wall_clock() time to stop at, INFINITY without --time-budget
+	double next_snapshot;	//INFINITY without --snapshot-interval
+} Progressive;
+
+double wall_clock();
+RenderStatus write_image_atomically( RenderContext* context, double** pixel_buffer, char* output, int width, int height );
+RenderStatus progressive_render_scene( RenderContext* context, double** pixel_buffer, int N, int M, char* output, double start_time );
+
+#endif
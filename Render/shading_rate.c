@@ -0,0 +1,140 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../Math/vector_math.h"
+#include "../sdf.h"
+#include "aov.h"
+#include "shading_rate.h"
+
+// With --shading-rate R every pixel still marches its own camera ray, but normals, lights and shadow rays
+// are only worked out on a grid of every R-th pixel in both directions (plus the last row and column).
+// A pixel between grid points blends the colors of the four around it if they hit the same object it did,
+// its hit lies on their plane, they face the same way and came out nearly the same color. Silhouettes,
+// creases, shadow edges and highlights fail one of those and get shaded at full rate, and so does every
+// pixel of a fractal. The grid is laid out in image coordinates, so tiles, crops and checkpoints all agree on it.
+
+int grid_line( int first, int k, int rate, int size ){	//k-th grid row or column from first, the last row and column are grid lines too
+	int coordinate = first + k * rate;
+	return coordinate < size - 1 ? coordinate : size - 1;
+}
+
+double bilinear( double top_left, double top_right, double bottom_left, double bottom_right, double tx, double ty ){
+	return ( 1 - ty ) * ( ( 1 - tx ) * top_left + tx * top_right ) + ty * ( ( 1 - tx ) * bottom_left + tx * bottom_right );
+}
+
+// y counts down from the top row. Grid points inside the tile are pixels of it, those go into the framebuffer too
+void shade_grid_point( TileJob* job, ShadingSample* sample, int x, int y, int in_tile ){
+	double Rd[3];
+	Intersect* intersection = march_camera_ray( job->context, Rd, x, job->M - 1 - y, job->N, job->M );
+	sample->object = isinf( intersection->min_distance ) ? 0 : intersection->best_index;
+	sample->distance = intersection->distance;
+	sample->light_share = shade_camera_hit( job->context, Rd, sample->color, sample->normal, intersection );
+	if( in_tile ){
+		memcpy( crop_pixel( job, x, y ), sample->color, sizeof(double) * 3 );
+		if( job->context->options.aovs ){
+			record_camera_aovs( job->context, crop_index( job, x, y ), intersection );
+			record_shading_aovs( job->context, crop_index( job, x, y ), sample->normal, sample->light_share );
+		}
+	}
+	free( intersection );
+}
+
+int smooth_surface( Object* object ){	//Fractals gain detail down to the pixel footprint, nothing in between grid points is safe to skip
+	return !is_fractal( object->kind );
+}
+
+int smooth_cell( RenderContext* context, ShadingSample** corners, Intersect* pixel, double tx, double ty ){	//Whether the pixel can blend its corners' colors
+	if( !smooth_surface( context->object_array[pixel->best_index] ) ){
+		return 0;
+	}
+	for( int i = 0; i < 4; i++ ){
+		if( corners[i]->object != pixel->best_index ){
+			return 0;
+		}
+	}
+	double planar_distance = bilinear( corners[0]->distance, corners[1]->distance, corners[2]->distance, corners[3]->distance, tx, ty );
+	if( fabs( pixel->distance - planar_distance ) > SHADING_DEPTH_TOLERANCE * pixel->distance ){
+		return 0;
+	}
+	for( int i = 1; i < 4; i++ ){
+		if( dot_product( corners[i]->normal, corners[0]->normal ) < SHADING_NORMAL_TOLERANCE ){
+			return 0;
+		}
+		for( int channel = 0; channel < 3; channel++ ){
+			if( fabs( corners[i]->color[channel] - corners[0]->color[channel] ) > SHADING_COLOR_TOLERANCE ){
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+void cell_position( int coordinate, int first, int rate, int size, int* k0, int* k1, double* t ){	//Grid lines on either side and how far along
+	*k0 = ( coordinate - first ) / rate;
+	int low = grid_line( first, *k0, rate, size );
+	if( coordinate == low ){
+		*k1 = *k0;
+		*t = 0.0;
+		return;
+	}
+	*k1 = *k0 + 1;
+	*t = (double)( coordinate - low ) / ( grid_line( first, *k1, rate, size ) - low );
+}
+
+// Traces pixels x0..x1-1, y0..y1-1 of the image, the top row is y = 0 like in tile_bounds()
+void trace_tile_shading_rate( TileJob* job, int x0, int y0, int x1, int y1 ){
+	int rate = job->context->options.shading_rate;
+	ShadingSample grid[MAX_SHADING_GRID][MAX_SHADING_GRID];
+	int first_x = x0 - x0 % rate;	//Grid lines at or before the tile's first column and row
+	int first_y = y0 - y0 % rate;
+	int columns = ( x1 - 1 - first_x + rate - 1 ) / rate + 1;
+	int rows = ( y1 - 1 - first_y + rate - 1 ) / rate + 1;
+
+	for( int j = 0; j < rows; j++ ){	//Grid points just past the tile are shaded too, the pixels before them need them
+		for( int i = 0; i < columns; i++ ){
+			int x = grid_line( first_x, i, rate, job->N );
+			int y = grid_line( first_y, j, rate, job->M );
+			shade_grid_point( job, &grid[j][i], x, y, x >= x0 && x < x1 && y >= y0 && y < y1 );
+		}
+	}
+
+	for( int y = y0; y < y1; y++ ){
+		int j0, j1;
+		double ty;
+		cell_position( y, first_y, rate, job->M, &j0, &j1, &ty );
+		for( int x = x0; x < x1; x++ ){
+			int i0, i1;
+			double tx;
+			cell_position( x, first_x, rate, job->N, &i0, &i1, &tx );
+			if( ( tx == 0.0 || tx == 1.0 ) && ( ty == 0.0 || ty == 1.0 ) ){
+				continue;	//A grid point, already shaded
+			}
+			double Rd[3];
+			double normal[3];
+			double* color = crop_pixel( job, x, y );
+			ShadingSample* corners[4] = { &grid[j0][i0], &grid[j0][i1], &grid[j1][i0], &grid[j1][i1] };
+			double light_share;
+			Intersect* intersection = march_camera_ray( job->context, Rd, x, job->M - 1 - y, job->N, job->M );
+			if( !isinf( intersection->min_distance ) && smooth_cell( job->context, corners, intersection, tx, ty ) ){
+				for( int channel = 0; channel < 3; channel++ ){
+					color[channel] = bilinear( corners[0]->color[channel], corners[1]->color[channel],
+												corners[2]->color[channel], corners[3]->color[channel], tx, ty );
+					normal[channel] = bilinear( corners[0]->normal[channel], corners[1]->normal[channel],
+												corners[2]->normal[channel], corners[3]->normal[channel], tx, ty );
+				}
+				light_share = bilinear( corners[0]->light_share, corners[1]->light_share,
+										corners[2]->light_share, corners[3]->light_share, tx, ty );
+				normalize( normal );
+				render_stats.interpolated_pixels++;
+			}else{
+				light_share = shade_camera_hit( job->context, Rd, color, normal, intersection );
+			}
+			if( job->context->options.aovs ){
+				record_camera_aovs( job->context, crop_index( job, x, y ), intersection );
+				record_shading_aovs( job->context, crop_index( job, x, y ), normal, light_share );
+			}
+			free( intersection );
+		}
+	}
+}
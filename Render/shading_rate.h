@@ -0,0 +1,21 @@
+#ifndef SHADING_RATE
+#define SHADING_RATE
+
+#include "tiles.h"
+
+#define SHADING_DEPTH_TOLERANCE 0.01	//Hits further than this fraction of their distance off the grid points' plane are an edge
+#define SHADING_NORMAL_TOLERANCE 0.98	//Cosine of the widest angle between grid point normals that still counts as flat
+#define SHADING_COLOR_TOLERANCE ( 8.0 / COLOR_LIMIT )	//Widest gap between grid point colors, past it there's a shadow edge or highlight
+#define MAX_SHADING_GRID ( TILE_SIZE / 2 + 2 )	//Grid points along a tile side at shading rate 2, the densest grid
+
+typedef struct{	//Grid point of --shading-rate, traced and shaded like any pixel
+	int object;	//best_index of the camera hit, 0 if the ray escaped
+	double distance;
+	double normal[3];	//Zero if the ray escaped
+	double color[3];
+	double light_share;	//See calculate_color()
+} ShadingSample;
+
+void trace_tile_shading_rate( TileJob* job, int x0, int y0, int x1, int y1 );
+
+#endif
@@ -0,0 +1,221 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../Math/simple_math.h"
+#include "../Math/vector_math.h"
+#include "thread_pool.h"
+#include "shadow_cache.h"
+#include "trace.h"
+
+// Every shadow ray starts at a light, so for static geometry the same rays get marched over and over.
+// The shadow cache marches a cube of rays around each light once, and shading compares the distance to
+// its intersection against the four nearest cached first hits. If they all agree the answer is known
+// without marching, only texels straddling a shadow edge fall back to the real shadow ray.
+
+void cube_face_direction( double* direction, int face, double u, double v ){	//Direction through (u, v) in [-1, 1] on a cube face
+	int axis = face / 2;
+	direction[axis] = face % 2 ? -1.0 : 1.0;
+	direction[(axis + 1) % 3] = u;
+	direction[(axis + 2) % 3] = v;
+	normalize( direction );
+}
+
+int cube_face_coordinates( double* direction, double* u, double* v ){	//Inverse of cube_face_direction(), returns the face
+	int axis = 0;
+	if( fabs( direction[1] ) > fabs( direction[axis] ) ) axis = 1;
+	if( fabs( direction[2] ) > fabs( direction[axis] ) ) axis = 2;
+	double major = fabs( direction[axis] );
+	*u = direction[(axis + 1) % 3] / major;
+	*v = direction[(axis + 2) % 3] / major;
+	return axis * 2 + ( direction[axis] < 0 ? 1 : 0 );
+}
+
+void build_shadow_cache_row( int index, void* data ){	//Task for one row of one face of one light
+	RenderContext* context = data;
+	int resolution = context->shadow_cache_resolution;
+	int row = index % resolution;
+	int face = ( index / resolution ) % 6;
+	int light_index = index / ( resolution * 6 );
+	Object* light = context->light_array[light_index];
+	float* distances = context->shadow_caches[light_index].distances + ( face * resolution + row ) * resolution;
+	MarchLimits limits;
+	double direction[3];
+
+	if( render_cancelled( context ) ){
+		return;
+	}
+	secondary_ray_limits( context, &limits, light->position, 0.0 );
+	limits.footprint = EPSILON_SCALE * 2.0 / resolution;	//Angular size of a texel near the face center
+
+	for( int column = 0; column < resolution; column++ ){
+		cube_face_direction( direction, face, ( column + 0.5 ) / resolution * 2 - 1, ( row + 0.5 ) / resolution * 2 - 1 );
+		Intersect* intersection = raymarch( light->position, direction, &limits );
+		distances[column] = isinf( intersection->min_distance ) ? INFINITY : (float)intersection->distance;
+		free( intersection );
+	}
+	merge_render_stats( context );	//Its SDF evaluations, before the worker thread exits
+}
+
+unsigned long long shadow_cache_hash( RenderContext* context, int resolution ){	//FNV-1a over everything the cached distances depend on
+	unsigned long long hash = 14695981039346656037ULL;
+	unsigned char* bytes;
+	size_t size;
+	int object_counter = context->object_counter;
+	for( int i = -1; i < object_counter + context->light_counter + 1; i++ ){
+		if( i == -1 ){
+			bytes = (unsigned char*)&resolution;
+			size = sizeof(int);
+		}else if( i < object_counter + 1 ){	//Camera and geometry, the camera holds the march settings
+			bytes = (unsigned char*)context->object_array[i];
+			size = sizeof(Object);
+		}else{
+			bytes = (unsigned char*)context->light_array[i - object_counter - 1]->position;
+			size = sizeof(double) * 3;
+		}
+		for( size_t j = 0; j < size; j++ ){
+			hash = ( hash ^ bytes[j] ) * 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+int load_shadow_caches( RenderContext* context, char* cache_file, unsigned long long hash, size_t face_size ){	//Returns 1 if cache_file matched this scene
+	FILE* input = fopen( cache_file, "rb" );
+	char magic[8];
+	int version;
+	unsigned long long file_hash;
+	int loaded = 0;
+
+	if( input == NULL ){
+		return 0;
+	}
+	if( fread( magic, 1, 8, input ) == 8 && memcmp( magic, SHADOW_CACHE_MAGIC, 8 ) == 0 &&
+		fread( &version, sizeof(int), 1, input ) == 1 && version == SHADOW_CACHE_VERSION &&
+		fread( &file_hash, sizeof(file_hash), 1, input ) == 1 && file_hash == hash ){
+		loaded = 1;
+		for( int i = 0; i < context->light_counter && loaded; i++ ){
+			loaded = fread( context->shadow_caches[i].distances, sizeof(float), face_size * 6, input ) == face_size * 6;
+		}
+	}
+	fclose( input );
+	return loaded;
+}
+
+// Written to a temporary file first so readers never see half a cache
+RenderStatus save_shadow_caches( RenderContext* context, char* cache_file, unsigned long long hash, size_t face_size ){
+	char temp_file[strlen( cache_file ) + 5];
+	int version = SHADOW_CACHE_VERSION;
+	sprintf( temp_file, "%s.tmp", cache_file );
+	FILE* output = fopen( temp_file, "wb" );
+	if( output == NULL ){
+		return render_fail( context, RENDER_ERROR_FILE, "Could not write shadow cache \"%s\"", temp_file );
+	}
+	fwrite( SHADOW_CACHE_MAGIC, 1, 8, output );
+	fwrite( &version, sizeof(int), 1, output );
+	fwrite( &hash, sizeof(hash), 1, output );
+	for( int i = 0; i < context->light_counter; i++ ){
+		fwrite( context->shadow_caches[i].distances, sizeof(float), face_size * 6, output );
+	}
+	fclose( output );
+	rename( temp_file, cache_file );
+	return RENDER_OK;
+}
+
+// Builds a cube map of first-hit distances for every light, spread over options.threads threads.
+// With a cache_file, a cache left by an earlier render of the same geometry is reused instead.
+RenderStatus build_shadow_caches( RenderContext* context, int resolution, char* cache_file ){
+	size_t face_size = (size_t)resolution * resolution;
+	unsigned long long hash = shadow_cache_hash( context, resolution );
+
+	free_shadow_caches( context );
+	context->shadow_caches = calloc( context->light_counter + 1, sizeof(ShadowCache) );
+	if( context->shadow_caches == NULL ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Not enough memory for a %d texel shadow cache", resolution );
+	}
+	for( int i = 0; i < context->light_counter; i++ ){
+		context->shadow_caches[i].resolution = resolution;
+		context->shadow_caches[i].distances = malloc( sizeof(float) * face_size * 6 );
+		if( context->shadow_caches[i].distances == NULL ){
+			free_shadow_caches( context );
+			return render_fail( context, RENDER_ERROR_MEMORY, "Not enough memory for a %d texel shadow cache", resolution );
+		}
+	}
+
+	if( cache_file != NULL ){
+		trace_begin( "shadow cache load", TRACE_NO_INDEX );
+		int loaded = load_shadow_caches( context, cache_file, hash, face_size );
+		trace_end( "shadow cache load" );
+		if( loaded ){
+			context->shadow_cache_resolution = resolution;
+			return RENDER_OK;
+		}
+	}
+	context->shadow_cache_resolution = resolution;	//Before the rows are built, they read it
+	parallel_for( context->light_counter * 6 * resolution, context->options.threads, build_shadow_cache_row, context );
+	if( render_cancelled( context ) ){
+		free_shadow_caches( context );
+		return render_fail( context, RENDER_CANCELLED, "Cancelled while building the shadow cache" );
+	}
+	RenderStatus status = RENDER_OK;
+	if( cache_file != NULL ){
+		trace_begin( "shadow cache save", TRACE_NO_INDEX );
+		status = save_shadow_caches( context, cache_file, hash, face_size );
+		trace_end( "shadow cache save" );
+	}
+	return status;
+}
+
+void free_shadow_caches( RenderContext* context ){	//Turns the cache off until it's built again
+	if( context->shadow_caches != NULL ){
+		for( int i = 0; i < context->light_counter; i++ ){
+			free( context->shadow_caches[i].distances );
+		}
+		free( context->shadow_caches );
+	}
+	context->shadow_caches = NULL;
+	context->shadow_cache_resolution = 0;
+}
+
+int texel_index( double coordinate, int offset, int resolution ){	//Texel at coordinate in [-1, 1], offset texels along, clamped to the face
+	int texel = (int)floor( ( coordinate + 1 ) * 0.5 * resolution - 0.5 ) + offset;
+	if( texel < 0 ) return 0;
+	if( texel >= resolution ) return resolution - 1;
+	return texel;
+}
+
+// Shadow multiplier for intersect_pos from the cache of light_array[light_index]. The four texels around the
+// light's direction to intersect_pos each vote lit or shadowed, SHADOW_UNKNOWN means they disagree or there's no cache.
+double cached_shadow( RenderContext* context, int light_index, double* intersect_pos ){
+	if( context->shadow_cache_resolution == 0 ){
+		return SHADOW_UNKNOWN;
+	}
+	ShadowCache* cache = &context->shadow_caches[light_index];
+	Object* light = context->light_array[light_index];
+	double direction[3];
+	double u;
+	double v;
+	direction[0] = intersect_pos[0] - light->position[0];
+	direction[1] = intersect_pos[1] - light->position[1];
+	direction[2] = intersect_pos[2] - light->position[2];
+	double distance = magnitude( direction );
+	int face = cube_face_coordinates( direction, &u, &v );
+	float* distances = cache->distances + (size_t)face * cache->resolution * cache->resolution;
+
+	int lit = 0;
+	for( int i = 0; i < 4; i++ ){	//Same test as shadow_factor(), did the light's ray get within SHADOW_TOLERANCE of us
+		int column = texel_index( u, i % 2, cache->resolution );
+		int row = texel_index( v, i / 2, cache->resolution );
+		if( distances[row * cache->resolution + column] >= distance - SHADOW_TOLERANCE ){
+			lit++;
+		}
+	}
+	if( lit == 4 ){
+		return 1.0;
+	}
+	if( lit == 0 ){
+		return SHADOW_MULT;
+	}
+	return SHADOW_UNKNOWN;
+}
@@ -0,0 +1,19 @@
+#ifndef SHADOW_CACHE
+#define SHADOW_CACHE
+
+#include "../raymarch.h"
+
+#define SHADOW_CACHE_MAGIC "RMSHADOW"
+#define SHADOW_CACHE_VERSION 1
+#define SHADOW_UNKNOWN -1.0	//The cache can't tell, march the shadow ray instead
+
+typedef struct ShadowCache{	//First-hit distances of rays leaving one light, stored on the six faces of a cube around it
+	int resolution;	//Texels along each side of a face
+	float* distances;	//6 faces * resolution * resolution, INFINITY where the ray escaped
+} ShadowCache;
+
+RenderStatus build_shadow_caches( RenderContext* context, int resolution, char* cache_file );
+void free_shadow_caches( RenderContext* context );
+double cached_shadow( RenderContext* context, int light_index, double* intersect_pos );
+
+#endif
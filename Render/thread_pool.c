@@ -0,0 +1,80 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+typedef struct{	//Shared by every worker of one parallel_for() call
+	atomic_int next_index;
+	atomic_int next_worker;	//Worker index of the next thread to join, the slot it counts into for --metrics
+	int count;
+	ParallelTask task;
+	void* data;
+} ParallelJob;
+
+int available_threads(){	//Number of online processors, at least 1
+	long processors = sysconf( _SC_NPROCESSORS_ONLN );
+	return processors > 0 ? (int)processors : 1;
+}
+
+void run_worker( ParallelJob* job, int worker ){	//Keep claiming the next index until the job runs out
+	int index;
+	int outer_worker = metrics_worker;	//The calling thread may be a worker of an outer parallel_for()
+	long long wall, cpu;
+	metrics_worker = worker;
+	trace_begin( "worker", TRACE_NO_INDEX );	//Gaps between these show idle threads
+	while( ( index = atomic_fetch_add( &job->next_index, 1 ) ) < job->count ){
+		metrics_task_begin( &wall, &cpu );
+		job->task( index, job->data );
+		metrics_task_end( wall, cpu );
+	}
+	trace_end( "worker" );
+	metrics_worker = outer_worker;
+}
+
+void* parallel_worker( void* arg ){	//Threads started by parallel_for(), the calling thread is always worker 0
+	ParallelJob* job = arg;
+	run_worker( job, atomic_fetch_add( &job->next_worker, 1 ) );
+	trace_release();	//The next call's thread with this worker index records on the same row
+	return NULL;
+}
+
+// Runs task(index, data) for every index in [0, count) across up to threads threads, the calling thread
+// included, and returns once all of them are done. Indexes are handed out in order as threads free up.
+void parallel_for( int count, int threads, ParallelTask task, void* data ){
+	ParallelJob job;
+	atomic_init( &job.next_index, 0 );
+	atomic_init( &job.next_worker, 1 );
+	job.count = count;
+	job.task = task;
+	job.data = data;
+
+	if( threads > count ){
+		threads = count;
+	}
+	if( threads <= 1 ){
+		run_worker( &job, 0 );
+		return;
+	}
+
+	pthread_t* workers = malloc( sizeof(pthread_t) * (threads - 1) );
+	int started = 0;
+	if( workers == NULL ){	//Same as failing to start them
+		threads = 1;
+	}
+	while( started < threads - 1 ){
+		if( pthread_create( &workers[started], NULL, parallel_worker, &job ) != 0 ){
+			break;	//Fewer threads just means the rest of us pick up more indexes
+		}
+		started++;
+	}
+	run_worker( &job, 0 );
+	for( int i = 0; i < started; i++ ){
+		pthread_join( workers[i], NULL );
+	}
+	free( workers );
+}
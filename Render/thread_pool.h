@@ -0,0 +1,9 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+typedef void (*ParallelTask)( int index, void* data );
+
+int available_threads();
+void parallel_for( int count, int threads, ParallelTask task, void* data );
+
+#endif
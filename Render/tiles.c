@@ -0,0 +1,266 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "progressive.h"
+#include "shading_rate.h"
+#include "thread_pool.h"
+#include "tiles.h"
+#include "trace.h"
+
+// The default renderer splits the crop window (the whole image without --crop) into TILE_SIZE tiles and
+// traces them on options.threads threads. With --checkpoint every finished tile is appended to a sidecar
+// file as soon as it's done, and a restarted render reads the tiles back instead of tracing them again.
+// Records carry a checksum, so a record cut short by a crash is dropped and its tile traced again.
+
+void tile_bounds( TileJob* job, int tile, int* x0, int* y0, int* x1, int* y1 ){	//Pixels of a tile, clipped to the crop window
+	*x0 = job->crop[0] + ( tile % job->tiles_x ) * TILE_SIZE;
+	*y0 = job->crop[1] + ( tile / job->tiles_x ) * TILE_SIZE;
+	*x1 = *x0 + TILE_SIZE < job->crop[2] ? *x0 + TILE_SIZE : job->crop[2];
+	*y1 = *y0 + TILE_SIZE < job->crop[3] ? *y0 + TILE_SIZE : job->crop[3];
+}
+
+int crop_index( TileJob* job, int x, int y ){	//Where output pixel (x, y) is in the framebuffer, y counts down from the top row
+	return ( y - job->crop[1] ) * ( job->crop[2] - job->crop[0] ) + x - job->crop[0];
+}
+
+double* crop_pixel( TileJob* job, int x, int y ){	//Color of output pixel (x, y)
+	return job->pixel_buffer[crop_index( job, x, y )];
+}
+
+unsigned long long fnv1a( unsigned long long hash, void* data, size_t size ){	//Start from FNV_OFFSET_BASIS
+	unsigned char* bytes = data;
+	for( size_t i = 0; i < size; i++ ){
+		hash = ( hash ^ bytes[i] ) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+unsigned long long checkpoint_hash( RenderContext* context, int N, int M ){	//Everything a tile's pixels depend on
+	unsigned long long hash = FNV_OFFSET_BASIS;
+	int settings[] = { N, M, context->options.hybrid, context->options.binning, context->options.shadow_cache_resolution, FAST_MATH_TIER };
+	hash = fnv1a( hash, settings, sizeof(settings) );
+	if( context->options.shading_rate > 1 ){	//Checkpoints of full rate renders stay valid
+		hash = fnv1a( hash, &context->options.shading_rate, sizeof(int) );
+	}
+	for( int i = 0; i < context->object_counter + 1; i++ ){
+		hash = fnv1a( hash, context->object_array[i], sizeof(Object) );
+	}
+	for( int i = 0; i < context->light_counter; i++ ){
+		hash = fnv1a( hash, context->light_array[i], sizeof(Object) );
+	}
+	return hash;
+}
+
+// Records are the tile index, a checksum, then the tile's colors row by row
+unsigned long long tile_checksum( int tile, double* colors, int count ){
+	unsigned long long hash = fnv1a( FNV_OFFSET_BASIS, &tile, sizeof(int) );
+	return fnv1a( hash, colors, sizeof(double) * 3 * count );
+}
+
+void save_tile( TileJob* job, int tile ){	//Append a finished tile to the checkpoint
+	int x0, y0, x1, y1;
+	tile_bounds( job, tile, &x0, &y0, &x1, &y1 );
+	int count = ( x1 - x0 ) * ( y1 - y0 );
+	double colors[TILE_SIZE * TILE_SIZE * 3];
+	int i = 0;
+	for( int y = y0; y < y1; y++ ){
+		for( int x = x0; x < x1; x++ ){
+			double* color = crop_pixel( job, x, y );
+			colors[i++] = color[0];
+			colors[i++] = color[1];
+			colors[i++] = color[2];
+		}
+	}
+	unsigned long long checksum = tile_checksum( tile, colors, count );
+
+	trace_begin( "checkpoint write", tile );	//Includes waiting for the lock
+	pthread_mutex_lock( &job->checkpoint_lock );
+	fwrite( &tile, sizeof(int), 1, job->checkpoint );
+	fwrite( &checksum, sizeof(checksum), 1, job->checkpoint );
+	fwrite( colors, sizeof(double), count * 3, job->checkpoint );
+	fflush( job->checkpoint );	//Survives the process dying
+	if( wall_clock() >= job->next_sync ){	//Survives the machine dying, every few seconds
+		fsync( fileno( job->checkpoint ) );
+		job->next_sync = wall_clock() + CHECKPOINT_SYNC_INTERVAL;
+	}
+	pthread_mutex_unlock( &job->checkpoint_lock );
+	trace_end( "checkpoint write" );
+}
+
+void fill_checkpoint_header( CheckpointHeader* header, TileJob* job ){
+	memset( header, 0, sizeof(CheckpointHeader) );
+	memcpy( header->magic, CHECKPOINT_MAGIC, 8 );
+	header->version = CHECKPOINT_VERSION;
+	header->tile_size = TILE_SIZE;
+	memcpy( header->crop, job->crop, sizeof(header->crop) );
+	header->hash = checkpoint_hash( job->context, job->N, job->M );
+}
+
+// Reads the tiles an earlier run finished into the pixel buffer, marks them in done and counts them in
+// loaded, then leaves the file open for appending after the last intact record. A missing file starts a new checkpoint
+RenderStatus load_checkpoint( TileJob* job, char* checkpoint_file, char* done, int* loaded ){
+	CheckpointHeader expected;
+	CheckpointHeader header;
+	*loaded = 0;
+	fill_checkpoint_header( &expected, job );
+
+	FILE* input = fopen( checkpoint_file, "rb" );
+	if( input == NULL ){
+		job->checkpoint = fopen( checkpoint_file, "wb" );
+		if( job->checkpoint == NULL ){
+			return render_fail( job->context, RENDER_ERROR_FILE, "Could not create checkpoint \"%s\"", checkpoint_file );
+		}
+		fwrite( &expected, sizeof(CheckpointHeader), 1, job->checkpoint );
+		fflush( job->checkpoint );
+		return RENDER_OK;
+	}
+	if( fread( &header, sizeof(CheckpointHeader), 1, input ) != 1 || memcmp( &header, &expected, sizeof(CheckpointHeader) ) != 0 ){
+		fclose( input );
+		return render_fail( job->context, RENDER_ERROR_FILE,
+							"Checkpoint \"%s\" belongs to a different scene, image size or crop, delete it to start over", checkpoint_file );
+	}
+
+	long valid_end = ftell( input );
+	int tile;
+	unsigned long long checksum;
+	double colors[TILE_SIZE * TILE_SIZE * 3];
+	while( fread( &tile, sizeof(int), 1, input ) == 1 && fread( &checksum, sizeof(checksum), 1, input ) == 1 ){
+		if( tile < 0 || tile >= job->tiles_x * job->tiles_y ){
+			break;
+		}
+		int x0, y0, x1, y1;
+		tile_bounds( job, tile, &x0, &y0, &x1, &y1 );
+		int count = ( x1 - x0 ) * ( y1 - y0 );
+		if( fread( colors, sizeof(double), count * 3, input ) != (size_t)( count * 3 ) || tile_checksum( tile, colors, count ) != checksum ){
+			break;	//Cut short by a crash
+		}
+		int i = 0;
+		for( int y = y0; y < y1; y++ ){
+			for( int x = x0; x < x1; x++ ){
+				double* color = crop_pixel( job, x, y );
+				color[0] = colors[i++];
+				color[1] = colors[i++];
+				color[2] = colors[i++];
+			}
+		}
+		*loaded += !done[tile];
+		done[tile] = 1;
+		valid_end = ftell( input );
+	}
+	fclose( input );
+
+	if( truncate( checkpoint_file, valid_end ) != 0 ){	//Drop a torn record so new ones don't land behind it
+		return render_fail( job->context, RENDER_ERROR_FILE, "Could not repair checkpoint \"%s\"", checkpoint_file );
+	}
+	job->checkpoint = fopen( checkpoint_file, "ab" );
+	if( job->checkpoint == NULL ){
+		return render_fail( job->context, RENDER_ERROR_FILE, "Could not append to checkpoint \"%s\"", checkpoint_file );
+	}
+	return RENDER_OK;
+}
+
+void render_tile( int index, void* data ){	//Task for one pending tile
+	TileJob* job = data;
+	int tile = job->pending[index];
+	int x0, y0, x1, y1;
+	if( render_cancelled( job->context ) ){
+		return;
+	}
+	trace_begin( "tile", tile );
+	double start = trace_clock();
+	tile_bounds( job, tile, &x0, &y0, &x1, &y1 );
+	if( job->context->options.shading_rate > 1 ){
+		trace_tile_shading_rate( job, x0, y0, x1, y1 );
+	}else{
+		for( int y = y0; y < y1; y++ ){
+			for( int x = x0; x < x1; x++ ){
+				trace_pixel( job->context, crop_pixel( job, x, y ), crop_index( job, x, y ), x, job->M - 1 - y, job->N, job->M );	//trace_pixel() counts rows from the bottom
+			}
+		}
+	}
+	trace_phase_spans( start );
+	merge_render_stats( job->context );
+	metrics_tile_done();
+	if( job->checkpoint != NULL ){
+		save_tile( job, tile );
+	}
+	trace_end( "tile" );
+	int finished = atomic_fetch_add( &job->finished, 1 ) + 1;
+	trace_counter( "tiles done", finished );
+	report_progress( job->context, finished, job->pending_count );
+}
+
+// Splits the crop window of an N x M image into tiles, pending is left to the caller
+void init_tile_job( TileJob* job, RenderContext* context, double** pixel_buffer, int N, int M ){
+	job->context = context;
+	job->pixel_buffer = pixel_buffer;
+	job->N = N;
+	job->M = M;
+	if( context->options.cropped ){
+		memcpy( job->crop, context->options.crop, sizeof(job->crop) );
+	}else{
+		job->crop[0] = 0;
+		job->crop[1] = 0;
+		job->crop[2] = N;
+		job->crop[3] = M;
+	}
+	job->tiles_x = ( job->crop[2] - job->crop[0] + TILE_SIZE - 1 ) / TILE_SIZE;
+	job->tiles_y = ( job->crop[3] - job->crop[1] + TILE_SIZE - 1 ) / TILE_SIZE;
+	job->pending = NULL;
+	job->pending_count = 0;
+	job->checkpoint = NULL;
+	atomic_init( &job->finished, 0 );
+	job->next_sync = wall_clock() + CHECKPOINT_SYNC_INTERVAL;
+}
+
+// Renders the crop window of an N x M image into pixel_buffer, which holds just the window
+RenderStatus tiled_render_scene( RenderContext* context, double** pixel_buffer, int N, int M ){
+	TileJob job;
+	RenderOptions* options = &context->options;
+	RenderStatus status = RENDER_OK;
+	init_tile_job( &job, context, pixel_buffer, N, M );
+
+	int tile_count = job.tiles_x * job.tiles_y;
+	char* done = calloc( tile_count, sizeof(char) );
+	job.pending = malloc( sizeof(int) * tile_count );
+	if( done == NULL || job.pending == NULL ){
+		free( done );
+		free( job.pending );
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while splitting the image into tiles" );
+	}
+	pthread_mutex_init( &job.checkpoint_lock, NULL );
+	if( options->checkpoint_file != NULL ){
+		int resumed;
+		trace_begin( "checkpoint load", TRACE_NO_INDEX );
+		status = load_checkpoint( &job, options->checkpoint_file, done, &resumed );
+		trace_end( "checkpoint load" );
+		if( status == RENDER_OK && options->stats ){
+			fprintf(stderr, "checkpoint: resumed %d of %d tiles\n", resumed, tile_count);
+		}
+	}
+
+	if( status == RENDER_OK ){
+		job.pending_count = 0;
+		for( int tile = 0; tile < tile_count; tile++ ){
+			if( !done[tile] ){
+				job.pending[job.pending_count++] = tile;
+			}
+		}
+		parallel_for( job.pending_count, options->threads, render_tile, &job );
+		if( render_cancelled( context ) ){	//Finished tiles are in the checkpoint, a later call picks up from there
+			status = render_fail( context, RENDER_CANCELLED, "Cancelled" );
+		}
+	}
+
+	if( job.checkpoint != NULL ){
+		fclose( job.checkpoint );
+	}
+	pthread_mutex_destroy( &job.checkpoint_lock );
+	free( done );
+	free( job.pending );
+	return status;
+}
@@ -0,0 +1,47 @@
+#ifndef TILES
+#define TILES
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "../raymarch.h"
+
+#define TILE_SIZE 32	//Pixels along each side of a tile
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define CHECKPOINT_MAGIC "RMCHECKP"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_SYNC_INTERVAL 5.0	//Seconds between fsyncs of the checkpoint file, every tile is flushed
+
+typedef struct{	//Start of a checkpoint file, followed by one record per finished tile
+	char magic[8];
+	int version;
+	int tile_size;
+	int crop[4];
+	unsigned long long hash;	//Scene, image size and options the pixels depend on, see checkpoint_hash()
+} CheckpointHeader;
+
+typedef struct{	//Shared by every tile task of one tiled_render_scene() call
+	RenderContext* context;
+	double** pixel_buffer;	//Holds only the crop window
+	int N;	//Size of the full image the rays are traced for
+	int M;
+	int crop[4];	//x0 y0 x1 y1 in output image coordinates, the top row is y = 0 and x1, y1 are exclusive
+	int tiles_x;
+	int tiles_y;
+	int* pending;	//Tiles left to render
+	int pending_count;
+	atomic_int finished;	//Pending tiles done so far, for the --trace counter
+	FILE* checkpoint;	//NULL without --checkpoint
+	pthread_mutex_t checkpoint_lock;
+	double next_sync;
+} TileJob;
+
+int crop_index( TileJob* job, int x, int y );
+double* crop_pixel( TileJob* job, int x, int y );
+unsigned long long fnv1a( unsigned long long hash, void* data, size_t size );
+void init_tile_job( TileJob* job, RenderContext* context, double** pixel_buffer, int N, int M );
+void render_tile( int index, void* data );
+RenderStatus tiled_render_scene( RenderContext* context, double** pixel_buffer, int N, int M );
+
+#endif
@@ -0,0 +1,164 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "trace.h"
+
+// --trace records spans and counters into one buffer per parallel_for() worker index, so recording never
+// takes a lock and every parallel_for() call's worker N lands on the same row however many threads it
+// started. A thread takes the free buffer of its worker index the first time it records anything and gives
+// it back when it finishes, only a nested parallel_for() whose indexes are held by the outer workers makes
+// extra rows. write_trace() walks trace_buffers once every worker has been joined, writing Chrome's JSON
+// trace event format (chrome://tracing, Perfetto).
+// Per-pixel work is too fine to record span by span, trace_pixel() sums its phases per thread and the
+// tile that ran them lays the sums out back to back inside its own span, see trace_phase_spans().
+
+int tracing;
+_Thread_local double trace_phase_time[TRACE_PHASES];
+_Thread_local TraceBuffer* trace_buffer;	//The buffer this thread holds, NULL until it records something
+TraceBuffer* trace_buffers;
+int trace_extra_rows;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;	//Guards trace_buffers, held and trace_extra_rows
+double trace_epoch;	//Seconds on CLOCK_MONOTONIC at trace_start()
+
+const char* trace_phase_names[TRACE_PHASES] = { "primary march", "normals", "shading", "shadows" };
+
+double monotonic_seconds(){
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void trace_start(){	//The thread that calls this shows up as main
+	trace_epoch = monotonic_seconds();
+	tracing = 1;
+	trace_begin( "render", TRACE_NO_INDEX );
+}
+
+double trace_now(){	//Microseconds since trace_start()
+	return ( monotonic_seconds() - trace_epoch ) * 1e6;
+}
+
+// This thread's buffer, on first use the free one of its worker index or a new one, NULL without memory
+TraceBuffer* trace_buffer_for_thread(){
+	if( trace_buffer == NULL ){
+		int taken = 0;	//Buffers of this worker index that other threads hold
+		pthread_mutex_lock( &trace_lock );
+		for( TraceBuffer* buffer = trace_buffers; buffer != NULL && trace_buffer == NULL; buffer = buffer->next ){
+			if( buffer->worker == metrics_worker ){
+				if( buffer->held ){
+					taken++;
+				}else{
+					trace_buffer = buffer;
+				}
+			}
+		}
+		if( trace_buffer == NULL ){
+			trace_buffer = calloc( 1, sizeof(TraceBuffer) );
+			if( trace_buffer != NULL ){
+				trace_buffer->worker = metrics_worker;
+				trace_buffer->thread_id = taken == 0 ? metrics_worker : TRACE_EXTRA_ROWS + trace_extra_rows++;
+				trace_buffer->next = trace_buffers;
+				trace_buffers = trace_buffer;
+			}
+		}
+		if( trace_buffer != NULL ){
+			trace_buffer->held = 1;
+		}
+		pthread_mutex_unlock( &trace_lock );
+	}
+	return trace_buffer;
+}
+
+void trace_release(){	//Give this thread's buffer back for the next thread with its worker index, parallel_for() workers call this before they exit
+	if( trace_buffer != NULL ){
+		pthread_mutex_lock( &trace_lock );
+		trace_buffer->held = 0;
+		pthread_mutex_unlock( &trace_lock );
+		trace_buffer = NULL;
+	}
+}
+
+// Out of memory the event is dropped, the trace is a diagnostic and mustn't take the render down with it
+void trace_event( const char* name, char phase, double timestamp, double duration, long long value ){
+	TraceBuffer* buffer = trace_buffer_for_thread();
+	if( buffer == NULL ){
+		return;
+	}
+	if( buffer->count == buffer->capacity ){
+		int capacity = buffer->capacity > 0 ? buffer->capacity * 2 : TRACE_FIRST_CAPACITY;
+		TraceEvent* events = realloc( buffer->events, sizeof(TraceEvent) * capacity );
+		if( events == NULL ){
+			return;
+		}
+		buffer->events = events;
+		buffer->capacity = capacity;
+	}
+	TraceEvent* event = &buffer->events[buffer->count++];
+	event->name = name;
+	event->phase = phase;
+	event->timestamp = timestamp;
+	event->duration = duration;
+	event->value = value;
+}
+
+// Lay this thread's per-phase sums out back to back from start, then start summing again. Called at the
+// end of a span that covers the pixels, so the phases show up nested inside it
+void trace_phase_spans( double start ){
+	if( !tracing ){
+		return;
+	}
+	for( int phase = 0; phase < TRACE_PHASES; phase++ ){
+		if( trace_phase_time[phase] > 0 ){
+			trace_event( trace_phase_names[phase], 'X', start, trace_phase_time[phase], TRACE_NO_INDEX );
+			start += trace_phase_time[phase];
+		}
+		trace_phase_time[phase] = 0.0;
+	}
+}
+
+void write_trace_event( FILE* output, TraceEvent* event, int thread_id, int* first ){
+	fprintf( output, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+			*first ? "" : ",", event->name, event->phase, event->timestamp, thread_id );
+	if( event->phase == 'X' ){
+		fprintf( output, ",\"dur\":%.3f", event->duration );
+	}
+	if( event->phase == 'C' ){
+		fprintf( output, ",\"args\":{\"%s\":%lld}", event->name, event->value );
+	}else if( event->value != TRACE_NO_INDEX ){
+		fprintf( output, ",\"args\":{\"index\":%lld}", event->value );
+	}
+	fprintf( output, "}" );
+	*first = 0;
+}
+
+// Only call this while no other thread is recording. The render span is closed here, so it can be called
+// again later (--watch does after every update) and the file keeps every event so far
+RenderStatus write_trace( char* trace_file ){
+	char temp_file[strlen( trace_file ) + 5];
+	int first = 1;
+	sprintf( temp_file, "%s.tmp", trace_file );
+	FILE* output = fopen( temp_file, "w" );
+	if( output == NULL ){
+		return RENDER_ERROR_FILE;
+	}
+	trace_end( "render" );
+	fprintf( output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+	for( TraceBuffer* buffer = trace_buffers; buffer != NULL; buffer = buffer->next ){
+		fprintf( output, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d%s\"}}",
+				first ? "" : ",", buffer->thread_id, buffer->thread_id == 0 ? "main" : "worker", buffer->worker,
+				buffer->thread_id >= TRACE_EXTRA_ROWS ? " (nested)" : "" );
+		first = 0;
+		for( int i = 0; i < buffer->count; i++ ){
+			write_trace_event( output, &buffer->events[i], buffer->thread_id, &first );
+		}
+	}
+	fprintf( output, "\n]}\n" );
+	fclose( output );
+	rename( temp_file, trace_file );
+	trace_begin( "render", TRACE_NO_INDEX );	//Reopened in case there is more to come
+	return RENDER_OK;
+}
@@ -0,0 +1,79 @@
+#ifndef TRACE
+#define TRACE
+
+#include "../render.h"
+
+#define TRACE_NO_INDEX -1	//Span without an index argument
+#define TRACE_FIRST_CAPACITY 4096	//Events per worker buffer before it first grows
+#define TRACE_EXTRA_ROWS 1000	//Row of the first extra buffer, for worker indexes taken twice by nested parallel_for() calls
+
+typedef enum{	//Phases of trace_pixel() that are timed per pixel and reported summed per tile
+	TRACE_MARCH,
+	TRACE_NORMALS,
+	TRACE_SHADING,
+	TRACE_SHADOWS,
+	TRACE_PHASES
+} TracePhase;
+
+typedef struct{	//One event in Chrome's trace event format
+	const char* name;	//Has to outlive the trace, these are all string literals
+	char phase;	//'B'egin, 'E'nd, 'X' (complete, has a duration) or 'C'ounter
+	double timestamp;	//Microseconds since trace_start()
+	double duration;	//Microseconds, 'X' only
+	long long value;	//Counter value, or the span's index argument, TRACE_NO_INDEX for none
+} TraceEvent;
+
+typedef struct TraceBuffer{	//Events of one worker index, only the thread that holds it ever writes to it
+	TraceEvent* events;
+	int count;
+	int capacity;
+	int worker;	//parallel_for() worker index it records for, 0 is the main thread
+	int thread_id;	//Row in the trace, the worker index unless it's an extra row for a nested parallel_for()
+	int held;	//A thread is recording into it, guarded by trace_lock
+	struct TraceBuffer* next;	//Every buffer is kept on one list until write_trace()
+} TraceBuffer;
+
+extern int tracing;
+extern _Thread_local double trace_phase_time[TRACE_PHASES];
+
+void trace_start();
+double trace_now();
+void trace_event( const char* name, char phase, double timestamp, double duration, long long value );
+void trace_phase_spans( double start );
+void trace_release();
+RenderStatus write_trace( char* trace_file );
+
+// Everything below costs one branch when --trace is off
+
+static inline void trace_begin( const char* name, long long index ){
+	if( tracing ){
+		trace_event( name, 'B', trace_now(), 0.0, index );
+	}
+}
+
+static inline void trace_end( const char* name ){
+	if( tracing ){
+		trace_event( name, 'E', trace_now(), 0.0, TRACE_NO_INDEX );
+	}
+}
+
+static inline void trace_counter( const char* name, long long value ){
+	if( tracing ){
+		trace_event( name, 'C', trace_now(), 0.0, value );
+	}
+}
+
+static inline double trace_clock(){	//Start of a lap for trace_lap()
+	return tracing ? trace_now() : 0.0;
+}
+
+static inline double trace_lap( TracePhase phase, double start ){	//Add the time since start to phase, returns the start of the next lap
+	if( !tracing ){
+		return 0.0;
+	}
+	double now = trace_now();
+	trace_phase_time[phase] += now - start;
+	return now;
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include <math.h>
+
+#include "../Math/vector_math.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "validate_sdf.h"
+
+// A march step is only safe if the SDF, divided by the object's lipschitz, never claims more empty space
+// around a point than there is. Exact distances never do, bounds like the Mandelbulb estimate or a
+// repeated object too big for its tile can. From points sampled around every object this takes the step
+// the march would take, in a random direction or towards the object, and checks it stays out of the
+// surface. Sampling can't prove the bound holds, but it finds where it's broken and how much it's off by
+
+typedef struct{	//Shared by every object's task
+	RenderContext* context;
+	SdfValidation* results;
+} ValidationJob;
+
+double validation_random( unsigned long long* state ){	//xorshift64*, uniform in [0, 1), state must not be 0
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return ( ( *state * 0x2545F4914F6CDD1DULL ) >> 11 ) * 0x1.0p-53;
+}
+
+double object_distance( RenderContext* context, ObjectList* single, double* position, double* direction, double t ){
+	double point[3] = { position[0] + direction[0]*t, position[1] + direction[1]*t, position[2] + direction[2]*t };
+	return all_intersections( context, point, NULL, INTERSECTION_LIMIT, single );
+}
+
+double surface_crossing( RenderContext* context, ObjectList* single, double* position, double* direction, double outside, double inside ){
+	for( int i = 0; i < VALIDATION_BISECTIONS; i++ ){	//How far along direction the surface is, outside and inside are distances along it
+		double middle = 0.5 * ( outside + inside );
+		if( object_distance( context, single, position, direction, middle ) < 0 ){
+			inside = middle;
+		}else{
+			outside = middle;
+		}
+	}
+	return outside;
+}
+
+void validate_object( int index, void* data ){
+	ValidationJob* job = data;
+	RenderContext* context = job->context;
+	int object_index = context->scene_objects.indices[index];
+	Object* object = context->object_array[object_index];
+	SdfValidation* result = &job->results[index];
+	ObjectList single = { .count = 1 };	//Marched on its own, the other objects would hide its SDF
+	single.indices[0] = object_index;
+	double reach = fmin( object_bounds_radius( object ) * VALIDATION_MARGIN, VALIDATION_REACH );
+	unsigned long long state = VALIDATION_SEED + object_index;	//The same points every run
+
+	result->object = object_index;
+	result->kind = primitive_name( object->kind );
+	result->lipschitz = object->lipschitz;
+	result->needed = 0.0;
+	result->samples = 0;
+	result->violations = 0;
+	for( int i = 0; i < VALIDATION_SAMPLES; i++ ){
+		if( i % 1024 == 0 && render_cancelled( context ) ){
+			return;
+		}
+		double position[3];
+		double direction[3];
+		for( int axis = 0; axis < 3; axis++ ){
+			position[axis] = object->position[axis] + reach * ( 2 * validation_random( &state ) - 1 );
+			direction[axis] = 2 * validation_random( &state ) - 1;
+			if( i % 2 ){	//Head on approaches take the longest steps towards the surface
+				direction[axis] += object->position[axis] - position[axis];
+			}
+		}
+		double step = all_intersections( context, position, NULL, INTERSECTION_LIMIT, &single );	//Already divided by the lipschitz
+		if( step <= INTERSECTION_LIMIT || magnitude( direction ) < 1e-3 ){	//Inside or on the surface, the march stops here
+			continue;
+		}
+		normalize( direction );
+		result->samples++;
+		for( int k = 1; k <= VALIDATION_STEP_POINTS; k++ ){	//Points along the step, a thin part could be skipped over entirely
+			double t = step * k / VALIDATION_STEP_POINTS;
+			if( object_distance( context, &single, position, direction, t ) < -INTERSECTION_LIMIT ){
+				double needed = step * object->lipschitz / surface_crossing( context, &single, position, direction, 0.0, t );
+				if( needed > result->needed ){
+					result->needed = needed;
+					result->position[0] = position[0];
+					result->position[1] = position[1];
+					result->position[2] = position[2];
+				}
+				result->violations++;
+				break;
+			}
+		}
+	}
+}
+
+RenderStatus validate_sdf( RenderContext* context, SdfValidation* results ){	//One result per object of scene_objects
+	ValidationJob job = { context, results };
+	atomic_store( &context->cancelled, 0 );
+	trace_begin( "validate sdf", TRACE_NO_INDEX );
+	parallel_for( context->scene_objects.count, context->options.threads, validate_object, &job );
+	trace_end( "validate sdf" );
+	if( render_cancelled( context ) ){
+		return render_fail( context, RENDER_CANCELLED, "Cancelled" );
+	}
+	return RENDER_OK;
+}
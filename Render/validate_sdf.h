@@ -0,0 +1,15 @@
+#ifndef VALIDATE_SDF
+#define VALIDATE_SDF
+
+#include "../raymarch.h"
+
+#define VALIDATION_SAMPLES 20000	//Points per object
+#define VALIDATION_MARGIN 2.0	//Points are sampled this many bounds radii around the object
+#define VALIDATION_REACH 10.0	//and no further, which also covers a couple of tiles of repeated objects
+#define VALIDATION_STEP_POINTS 4	//Points along every step checked for being inside the surface
+#define VALIDATION_BISECTIONS 32	//Halvings that find where a step entered the surface
+#define VALIDATION_SEED 0x9E3779B97F4A7C15ULL
+
+RenderStatus validate_sdf( RenderContext* context, SdfValidation* results );
+
+#endif
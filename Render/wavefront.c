@@ -0,0 +1,400 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../Math/simple_math.h"
+#include "../Math/vector_math.h"
+#include "aov.h"
+#include "shadow_cache.h"
+#include "thread_pool.h"
+#include "wavefront.h"
+#include "trace.h"
+
+// The wavefront pipeline renders the same image as raymarch_scene(), but instead of running every pixel
+// through march -> normal -> shade -> shadow before moving on, it collects a wave of rays into queues and
+// runs each stage as one batched loop over its queue. Rays that finish are compacted out between steps
+// so the loops stay full, and reflection/refraction rays are queued for the next bounce instead of recursing.
+// Waves own disjoint pixels and queues, so they run side by side as parallel_for() tasks.
+
+// Grow a queue so it can hold needed items. Returns 0 and flags the wave if there's no memory for that,
+// the queue keeps what it held and the caller drops what didn't fit
+int reserve_queue( Wavefront* wave, void** items, int* capacity, int needed, size_t item_size ){
+	if( needed <= *capacity ){
+		return 1;
+	}
+	int new_capacity = *capacity > 0 ? *capacity : 1024;
+	while( new_capacity < needed ){
+		new_capacity *= 2;
+	}
+	void* grown = realloc( *items, item_size * new_capacity );
+	if( grown == NULL ){
+		wave->out_of_memory = 1;
+		return 0;
+	}
+	*items = grown;
+	*capacity = new_capacity;
+	return 1;
+}
+
+void start_march( MarchState* march, double* origin, double* direction, MarchLimits* limits, int inside ){
+	march->intersection.min_distance = INFINITY;
+	march->intersection.distance = 0;
+	march->intersection.steps = 0;
+	march->intersection.best_index = 0;
+	march->intersection.position[0] = origin[0];
+	march->intersection.position[1] = origin[1];
+	march->intersection.position[2] = origin[2];
+	march->direction[0] = direction[0];
+	march->direction[1] = direction[1];
+	march->direction[2] = direction[2];
+	march->limits = *limits;
+	march->inside = inside;
+	march->hybrid.distance = INFINITY;
+	if( limits->context->options.hybrid && !inside ){	//Inside rays march against the object they are in, which may be analytic
+		start_hybrid_march( &march->hybrid, origin, direction, &march->limits );
+	}
+}
+
+int wavefront_step( MarchState* march ){	//Same step as raymarch(), returns 1 once the ray is finished
+	int finished;
+	if( march->limits.objects->count == 0 ){	//--hybrid took every object out, straight on to the handover
+		return 1;
+	}
+	if( march->inside ){	//Inside an object the distances are negative, march towards the surface we will exit through
+		Intersect* intersection = &march->intersection;
+		all_intersections( march->limits.context, intersection->position, intersection, hit_threshold( &march->limits, intersection->distance ), march->limits.objects );
+		intersection->min_distance = fabs( intersection->min_distance );
+		finished = advance_ray( intersection, march->direction, &march->limits );
+	}else{
+		finished = march_step( &march->intersection, march->direction, &march->limits );
+	}
+	return finished || march->intersection.steps >= march->limits.max_steps;
+}
+
+void march_kernel( Wavefront* wave, int count ){	//Step every ray in wave->active once per pass until all have finished
+	while( count > 0 ){
+		int remaining = 0;
+		for( int i = 0; i < count; i++ ){
+			MarchState* march = wave->active[i];
+			if( !wavefront_step( march ) || resume_hybrid_march( &march->intersection, march->direction, &march->hybrid, &march->limits ) ){
+				wave->active[remaining++] = march;	//Compact so the next pass only visits live rays
+			}
+		}
+		count = remaining;
+	}
+}
+
+void generate_primary_rays( Wavefront* wave, int first_pixel, int count, int N, int M ){
+	RenderContext* context = wave->context;
+	double Rd[3];
+
+	wave->ray_count = 0;
+	if( !reserve_queue( wave, (void**)&wave->rays, &wave->ray_capacity, count, sizeof(WavefrontRay) ) ){
+		return;
+	}
+	for( int i = 0; i < count; i++ ){
+		int pixel_count = first_pixel + i;
+		int x = pixel_count % N;
+		int y = pixel_count / N;
+		WavefrontRay* ray = &wave->rays[i];
+
+		camera_ray_direction( context, Rd, x, y, N, M );	//Same rays as march_camera_ray()
+		start_march( &ray->march, context->view.eye, Rd, &context->camera_limits, 0 );
+		ray->throughput[0] = 1.0;
+		ray->throughput[1] = 1.0;
+		ray->throughput[2] = 1.0;
+		ray->pixel = (M - 1 - y)*N + x;	//The pixel buffer stores the top row first
+		ray->depth = 0;
+	}
+	wave->ray_count = count;
+}
+
+void ray_march_stage( Wavefront* wave ){	//March every queued ray, then compact the ones that hit into wave->hits
+	wave->hit_count = 0;
+	if( !reserve_queue( wave, (void**)&wave->active, &wave->active_capacity, wave->ray_count, sizeof(MarchState*) ) ||
+		!reserve_queue( wave, (void**)&wave->hits, &wave->hit_capacity, wave->ray_count, sizeof(WavefrontHit) ) ){
+		return;
+	}
+	for( int i = 0; i < wave->ray_count; i++ ){
+		wave->active[i] = &wave->rays[i].march;
+	}
+	march_kernel( wave, wave->ray_count );
+
+	for( int i = 0; i < wave->ray_count; i++ ){
+		WavefrontRay* ray = &wave->rays[i];
+		if( ray->depth == 0 ){
+			render_stats.camera_rays++;
+			render_stats.camera_steps += ray->march.intersection.steps;
+			if( wave->context->options.aovs ){
+				record_camera_aovs( wave->context, ray->pixel, &ray->march.intersection );
+			}
+		}
+		if( isinf( ray->march.intersection.min_distance ) ){	//Escaped, nothing to shade
+			if( ray->depth == 0 && wave->context->options.aovs ){
+				record_shading_aovs( wave->context, ray->pixel, (double[3]){ 0.0, 0.0, 0.0 }, 1.0 );
+			}
+			continue;
+		}
+		WavefrontHit* hit = &wave->hits[wave->hit_count++];
+		hit->position[0] = ray->march.intersection.position[0];
+		hit->position[1] = ray->march.intersection.position[1];
+		hit->position[2] = ray->march.intersection.position[2];
+		hit->direction[0] = ray->march.direction[0];
+		hit->direction[1] = ray->march.direction[1];
+		hit->direction[2] = ray->march.direction[2];
+		hit->throughput[0] = ray->throughput[0];
+		hit->throughput[1] = ray->throughput[1];
+		hit->throughput[2] = ray->throughput[2];
+		hit->best_index = ray->march.intersection.best_index;
+		hit->pixel = ray->pixel;
+		hit->depth = ray->depth;
+		hit->inside = ray->march.inside;
+		hit->epsilon = hit_threshold( &ray->march.limits, ray->march.intersection.distance );
+	}
+}
+
+void normal_stage( Wavefront* wave ){
+	for( int i = 0; i < wave->hit_count; i++ ){
+		wave->hits[i].normal[0] = 0.0;
+		wave->hits[i].normal[1] = 0.0;
+		wave->hits[i].normal[2] = 0.0;
+		intersect_normal( wave->context, wave->hits[i].normal, wave->hits[i].position, wave->hits[i].epsilon );
+	}
+}
+
+void queue_secondary_ray( Wavefront* wave, WavefrontHit* hit, double* origin, double* direction, double* weight, int inside ){
+	double throughput[3];
+	throughput[0] = hit->throughput[0] * weight[0];
+	throughput[1] = hit->throughput[1] * weight[1];
+	throughput[2] = hit->throughput[2] * weight[2];
+	if( max( throughput[0], max( throughput[1], throughput[2] ) ) < LIGHT_CULL_THRESHOLD ){	//Would never show up in the image
+		return;
+	}
+
+	MarchLimits limits;
+	secondary_ray_limits( wave->context, &limits, origin, hit->epsilon );
+	if( !reserve_queue( wave, (void**)&wave->next_rays, &wave->next_ray_capacity, wave->next_ray_count + 1, sizeof(WavefrontRay) ) ){
+		return;
+	}
+	WavefrontRay* ray = &wave->next_rays[wave->next_ray_count++];
+	start_march( &ray->march, origin, direction, &limits, inside );
+	ray->throughput[0] = throughput[0];
+	ray->throughput[1] = throughput[1];
+	ray->throughput[2] = throughput[2];
+	ray->pixel = hit->pixel;
+	ray->depth = hit->depth + 1;
+}
+
+// Reflections are weighted by the object's specular_color and a Schlick fresnel term from its ior,
+// objects with an ior above 1 also let the rest of the light refract through them
+void spawn_secondary_rays( Wavefront* wave, WavefrontHit* hit ){
+	Object* object = wave->context->object_array[ hit->best_index ];
+	double ior = object->ior;
+	double facing_normal[3] = { hit->normal[0], hit->normal[1], hit->normal[2] };
+	double eta = 1.0 / ior;
+	if( hit->inside ){	//Leaving the object, the normal has to face back inside against the ray
+		vector_mult( facing_normal, -1.0 );
+		eta = ior;
+	}
+
+	double cos_incident = -dot_product( hit->direction, facing_normal );
+	double reflectance = sqr( ( ior - 1.0 ) / ( ior + 1.0 ) );
+	double refracted[3];
+	int refracts = ior > 1.0 && refract( hit->direction, facing_normal, eta, refracted );
+	double fresnel = 1.0;	//Total internal reflection unless the ray refracts
+	if( refracts || ior <= 1.0 ){
+		double cosine = refracts && hit->inside ? -dot_product( refracted, facing_normal ) : cos_incident;
+		fresnel = reflectance + ( 1.0 - reflectance ) * pow( 1.0 - clamp( cosine ), 5.0 );
+	}
+
+	double origin[3];
+	double weight[3];
+	double reflected[3];
+	reflect( hit->direction, facing_normal, reflected );
+	vector_mult_sp( facing_normal, SECONDARY_RAY_OFFSET, origin );
+	origin[0] += hit->position[0];
+	origin[1] += hit->position[1];
+	origin[2] += hit->position[2];
+	vector_mult_sp( object->specular_color, fresnel, weight );
+	queue_secondary_ray( wave, hit, origin, reflected, weight, hit->inside );
+
+	if( refracts ){
+		vector_mult_sp( facing_normal, -SECONDARY_RAY_OFFSET, origin );
+		origin[0] += hit->position[0];
+		origin[1] += hit->position[1];
+		origin[2] += hit->position[2];
+		vector_mult_sp( object->specular_color, 1.0 - fresnel, weight );
+		queue_secondary_ray( wave, hit, origin, refracted, weight, !hit->inside );
+	}
+}
+
+void shade_stage( Wavefront* wave ){	//Rank the lights of every hit and queue their shadow rays and secondary rays
+	RenderContext* context = wave->context;
+	LightSample ranked[MAX_SHADOW_RAYS];
+	wave->shadow_ray_count = 0;
+	wave->next_ray_count = 0;
+
+	for( int i = 0; i < wave->hit_count; i++ ){
+		WavefrontHit* hit = &wave->hits[i];
+		hit->color[0] = 0.0;
+		hit->color[1] = 0.0;
+		hit->color[2] = 0.0;
+		hit->visibility = 0.0;
+		hit->num_ranked = 0;
+
+		if( !hit->inside ){	//No light reaches the inner side of a surface
+			hit->num_ranked = gather_light_samples( context, hit->direction, hit->normal, hit->position,
+													context->object_array[ hit->best_index ], ranked, hit->unranked_color );
+			if( !reserve_queue( wave, (void**)&wave->shadow_rays, &wave->shadow_ray_capacity,
+								wave->shadow_ray_count + hit->num_ranked, sizeof(ShadowRay) ) ){
+				return;
+			}
+			for( int j = 0; j < hit->num_ranked; j++ ){
+				double shadow_mult = cached_shadow( context, ranked[j].light_index, hit->position );
+				if( shadow_mult != SHADOW_UNKNOWN ){	//Answered by the shadow cache, nothing to march
+					render_stats.cached_shadows++;
+					hit->visibility += shadow_mult;
+					hit->color[0] += ranked[j].color[0] * shadow_mult;
+					hit->color[1] += ranked[j].color[1] * shadow_mult;
+					hit->color[2] += ranked[j].color[2] * shadow_mult;
+					continue;
+				}
+				ShadowRay* shadow_ray = &wave->shadow_rays[wave->shadow_ray_count++];
+				double light_to_intersect[3];
+				MarchLimits limits;
+				shadow_ray_direction( light_to_intersect, ranked[j].light, hit->position );
+				shadow_ray_limits( context, &limits, ranked[j].light, hit->position, hit->epsilon );
+				start_march( &shadow_ray->march, ranked[j].light->position, light_to_intersect, &limits, 0 );
+				shadow_ray->color[0] = ranked[j].color[0];
+				shadow_ray->color[1] = ranked[j].color[1];
+				shadow_ray->color[2] = ranked[j].color[2];
+				shadow_ray->hit = i;
+			}
+		}
+
+		if( hit->depth < context->options.bounces ){
+			spawn_secondary_rays( wave, hit );
+		}
+	}
+}
+
+void shadow_stage( Wavefront* wave ){	//March every shadow ray of the wave together, then fold the results into their hits
+	if( !reserve_queue( wave, (void**)&wave->active, &wave->active_capacity, wave->shadow_ray_count, sizeof(MarchState*) ) ){
+		return;
+	}
+	for( int i = 0; i < wave->shadow_ray_count; i++ ){
+		wave->active[i] = &wave->shadow_rays[i].march;
+	}
+	march_kernel( wave, wave->shadow_ray_count );
+
+	for( int i = 0; i < wave->shadow_ray_count; i++ ){
+		ShadowRay* shadow_ray = &wave->shadow_rays[i];
+		WavefrontHit* hit = &wave->hits[shadow_ray->hit];
+		render_stats.shadow_rays++;
+		render_stats.shadow_steps += shadow_ray->march.intersection.steps;
+		double shadow_mult = shadow_factor( shadow_ray->march.intersection.position, hit->position );
+		hit->visibility += shadow_mult;
+		hit->color[0] += shadow_ray->color[0] * shadow_mult;
+		hit->color[1] += shadow_ray->color[1] * shadow_mult;
+		hit->color[2] += shadow_ray->color[2] * shadow_mult;
+	}
+}
+
+void resolve_stage( Wavefront* wave, double** pixel_buffer ){	//Add every shaded hit into its pixel
+	for( int i = 0; i < wave->hit_count; i++ ){
+		WavefrontHit* hit = &wave->hits[i];
+		if( hit->inside ){
+			continue;
+		}
+		if( hit->depth == 0 && wave->context->options.aovs ){
+			record_shading_aovs( wave->context, hit->pixel, hit->normal, hit->num_ranked > 0 ? hit->visibility / hit->num_ranked : 1.0 );
+		}
+		resolve_unranked_lights( hit->color, hit->unranked_color, hit->visibility, hit->num_ranked );
+		pixel_buffer[hit->pixel][0] += hit->throughput[0] * hit->color[0];
+		pixel_buffer[hit->pixel][1] += hit->throughput[1] * hit->color[1];
+		pixel_buffer[hit->pixel][2] += hit->throughput[2] * hit->color[2];
+	}
+}
+
+void render_wave( int index, void* data ){	//parallel_for() task for wave index, its pixels are no other wave's
+	WavefrontJob* job = data;
+	RenderContext* context = job->context;
+	int N = job->N;
+	int M = job->M;
+	int first_pixel = index * job->wave_size;
+	int count = (int)min( job->wave_size, N*M - first_pixel );
+	Wavefront wave = {0};
+	WavefrontRay* swap_rays;
+	int swap_capacity;
+	wave.context = context;
+	if( atomic_load( &job->out_of_memory ) || render_cancelled( context ) ){
+		return;
+	}
+
+	trace_begin( "wave", index );
+	generate_primary_rays( &wave, first_pixel, count, N, M );
+	while( wave.ray_count > 0 && !wave.out_of_memory ){	//One iteration per bounce
+		trace_counter( "rays in wave", wave.ray_count );
+		trace_begin( "primary march", TRACE_NO_INDEX );	//Secondary rays too past the first bounce
+		ray_march_stage( &wave );
+		trace_end( "primary march" );
+		trace_begin( "normals", TRACE_NO_INDEX );
+		normal_stage( &wave );
+		trace_end( "normals" );
+		trace_begin( "shading", TRACE_NO_INDEX );
+		shade_stage( &wave );
+		trace_end( "shading" );
+		trace_begin( "shadows", TRACE_NO_INDEX );
+		shadow_stage( &wave );
+		trace_end( "shadows" );
+		trace_begin( "resolve", TRACE_NO_INDEX );
+		resolve_stage( &wave, job->pixel_buffer );
+		trace_end( "resolve" );
+
+		swap_rays = wave.rays;	//Secondary rays become the next bounce's queue
+		swap_capacity = wave.ray_capacity;
+		wave.rays = wave.next_rays;
+		wave.ray_capacity = wave.next_ray_capacity;
+		wave.ray_count = wave.next_ray_count;
+		wave.next_rays = swap_rays;
+		wave.next_ray_capacity = swap_capacity;
+		wave.next_ray_count = 0;
+	}
+	for( int i = first_pixel; i < first_pixel + count; i++ ){	//Bounces can add up past full brightness
+		double* pixel = job->pixel_buffer[(M - 1 - i / N)*N + i % N];
+		pixel[0] = clamp( pixel[0] );
+		pixel[1] = clamp( pixel[1] );
+		pixel[2] = clamp( pixel[2] );
+	}
+	trace_end( "wave" );
+
+	free( wave.rays );
+	free( wave.next_rays );
+	free( wave.hits );
+	free( wave.shadow_rays );
+	free( wave.active );
+	if( wave.out_of_memory ){
+		atomic_store( &job->out_of_memory, 1 );
+	}
+	merge_render_stats( context );	//Wave by wave, so --metrics sees the rays as they go
+	int finished = atomic_fetch_add( &job->finished, 1 ) + 1;
+	report_progress( context, finished, job->wave_count );
+}
+
+RenderStatus wavefront_render_scene(RenderContext* context, double** pixel_buffer, int N, int M){	//Raymarches our object_array one wave of pixels at a time
+	WavefrontJob job = { .context = context, .pixel_buffer = pixel_buffer, .N = N, .M = M };
+	int threads = context->options.threads;
+	job.wave_size = (int)min( WAVEFRONT_SIZE, ( (long long)N*M + threads - 1 ) / threads );
+	job.wave_count = ( N*M + job.wave_size - 1 ) / job.wave_size;
+	atomic_init( &job.finished, 0 );
+	atomic_init( &job.out_of_memory, 0 );
+
+	parallel_for( job.wave_count, threads, render_wave, &job );
+	if( atomic_load( &job.out_of_memory ) ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while growing a wavefront queue" );
+	}
+	if( render_cancelled( context ) ){
+		return render_fail( context, RENDER_CANCELLED, "Cancelled" );
+	}
+	return RENDER_OK;
+}
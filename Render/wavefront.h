@@ -0,0 +1,80 @@
+#ifndef WAVEFRONT
+#define WAVEFRONT
+
+#include <stdatomic.h>
+
+#include "../raymarch.h"
+
+#define WAVEFRONT_SIZE 65536	//Camera rays per wave, every stage runs over the whole wave before the next one starts
+#define SECONDARY_RAY_OFFSET (10 * INTERSECTION_LIMIT)	//How far reflected and refracted rays start from their surface
+
+typedef struct{	//Marching state shared by every kind of ray a stage can march
+	Intersect intersection;	//Current position, last distance and closest object
+	double direction[3];
+	MarchLimits limits;
+	HybridMarch hybrid;	//Where --hybrid hands over to every object, see start_hybrid_march()
+	int inside;	//Marching through the inside of a refractive object, distances are mirrored
+} MarchState;
+
+typedef struct{	//A camera, reflection or refraction ray waiting to be marched
+	MarchState march;
+	double throughput[3];	//How much of this ray's color reaches its pixel
+	int pixel;	//Index into the pixel buffer
+	int depth;	//Number of bounces that led to this ray
+} WavefrontRay;
+
+typedef struct{	//A ray that stopped on a surface, waiting for its normal and shading
+	double position[3];
+	double direction[3];
+	double normal[3];
+	double throughput[3];
+	double color[3];	//Shadowed light contributions gathered so far
+	double unranked_color[3];	//Lights past the shadow ray budget
+	double visibility;	//Sum of shadow multipliers of the lights we did march
+	double epsilon;	//Hit threshold where the ray stopped, shadow and secondary rays march this precisely
+	int num_ranked;
+	int best_index;
+	int pixel;
+	int depth;
+	int inside;
+} WavefrontHit;
+
+typedef struct{	//A ray from a light towards a hit, waiting to be marched
+	MarchState march;
+	double color[3];	//Unshadowed contribution of the light
+	int hit;	//Index of the WavefrontHit this ray is shading
+} ShadowRay;
+
+typedef struct{	//Queues handed from one stage to the next
+	WavefrontRay* rays;
+	int ray_count;
+	int ray_capacity;
+	WavefrontRay* next_rays;	//Secondary rays spawned while shading, marched on the next bounce
+	int next_ray_count;
+	int next_ray_capacity;
+	WavefrontHit* hits;
+	int hit_count;
+	int hit_capacity;
+	ShadowRay* shadow_rays;
+	int shadow_ray_count;
+	int shadow_ray_capacity;
+	MarchState** active;	//Compacted list of rays still marching
+	int active_capacity;
+	RenderContext* context;
+	int out_of_memory;	//A queue couldn't grow, see reserve_queue()
+} Wavefront;
+
+typedef struct{	//One wavefront render, every wave is a parallel_for() task with queues of its own
+	RenderContext* context;
+	double** pixel_buffer;
+	int N;
+	int M;
+	int wave_size;	//Pixels per wave, WAVEFRONT_SIZE or less so every thread gets a wave
+	int wave_count;
+	atomic_int finished;	//Waves done, for report_progress()
+	atomic_int out_of_memory;	//Some wave's queue couldn't grow, the waves after it are skipped
+} WavefrontJob;
+
+RenderStatus wavefront_render_scene(RenderContext* context, double** pixel_buffer, int N, int M);
+
+#endif
@@ -0,0 +1,636 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "render.h"
+
+// raymarcher, the command line front end of librender. Everything here is argument parsing, --watch and
+// printing, the rendering itself only goes through render.h
+
+#define WATCH_POLL_INTERVAL 0.25	//Seconds between checks of the scene file
+
+typedef struct{	//Flags that only mean something to the command line, see parse_options()
+	int incremental;	//Render with render_incremental()
+	int watch;	//Re-render incrementally whenever the scene file changes, until killed
+	char* trace_file;	//Write a Chrome trace of where the render spent its time here
+	int validate_sdf;	//Check every object's SDF against its lipschitz instead of rendering
+	char* manifest_file;	//Render every job of this manifest instead of one image, see render_batch()
+	int autotune;	//Tune the settings on a sample of the image first, or reuse the tuning in <scene>.tune
+	double autotune_tolerance;
+	int estimate;	//Print a JSON estimate of what the render costs instead of rendering, see render_estimate()
+	char* views;	//Comma separated render_view_set() names, render every view of them instead of one image
+	double eye_separation;
+	char* metrics_file;	//Keep Prometheus metrics of the render up to date here, see render_metrics_start()
+	double metrics_interval;
+} CommandLine;
+
+void argument_checker(int c, char** argv){	//Check input arguments for validity
+	int i = 0;
+	int j = 0;
+	char* periodPointer;
+	if(c < 5){	//Ensure that at least five arguments are passed in through command line
+		fprintf(stderr, "Error: Incorrect amount of arguments\n");
+		exit(1);
+	}
+	
+	while(1){	//Ensure that both the width and height arguments are numbers
+		if(*(argv[1] + i) == '\0' && *(argv[2] + j) == '\0'){
+			break;
+		}
+		else if(*(argv[1] + i) == '\0'){
+			i--;
+		}
+		else if(*(argv[2] + j) == '\0'){
+			j--;
+		}
+		
+		if(!isdigit(*(argv[1] + i)) || !isdigit(*(argv[2] + j))){
+			fprintf(stderr, "Error: Width or Height field is not a number\n");
+			exit(1);
+		}
+		i++;
+		j++;
+	}
+	
+	periodPointer = strrchr(argv[3], '.');	//Ensure that the input scene file has an extension .json
+	if(periodPointer == NULL){
+		fprintf(stderr, "Error: Input scene file does not have a file extension\n");
+		exit(1);
+	}
+	if(strcmp(periodPointer, ".json") != 0){
+		fprintf(stderr, "Error: Input scene file is not of type JSON\n");
+		exit(1);
+	}
+	
+	periodPointer = strrchr(argv[4], '.');	//Ensure that the output picture file has an extension .ppm, .png or .qoi
+	if(periodPointer == NULL){
+		fprintf(stderr, "Error: Output picture file does not have a file extension\n");
+		exit(1);
+	}
+	if(strcmp(periodPointer, ".ppm") != 0 && strcmp(periodPointer, ".png") != 0 && strcmp(periodPointer, ".qoi") != 0){
+		fprintf(stderr, "Error: Output picture file is not of type PPM, PNG or QOI\n");
+		exit(1);
+	}
+}
+
+int valid_views(char* list){	//1 if every name of the comma separated list is a render_view_set()
+	RenderView views[RENDER_MAX_VIEWS];
+	const char* names[RENDER_MAX_VIEWS];
+	char sets[strlen(list) + 1];
+	strcpy(sets, list);
+	for(char* name = strtok(sets, ","); name != NULL; name = strtok(NULL, ",")){
+		if(render_view_set(name, DEFAULT_EYE_SEPARATION, views, names) == 0){
+			return 0;
+		}
+	}
+	return sets[0] != '\0';
+}
+
+int parse_aovs(char* list){	//Comma separated AOV names or "all" to options.aovs bits, -1 on an unknown name
+	int aovs = 0;
+	char names[strlen(list) + 1];
+	strcpy(names, list);
+	for(char* name = strtok(names, ","); name != NULL; name = strtok(NULL, ",")){
+		int found = strcmp(name, "all") == 0 ? (1 << AOV_COUNT) - 1 : 0;
+		for(int aov = 0; aov < AOV_COUNT; aov++){
+			if(strcmp(name, render_aov_name(aov)) == 0){
+				found = 1 << aov;
+			}
+		}
+		if(!found){
+			return -1;
+		}
+		aovs |= found;
+	}
+	return aovs;
+}
+
+void parse_options(int c, char** argv, RenderOptions* options, CommandLine* command_line){	//Parse the optional flags that follow the output file, or the manifest
+	int i = command_line->manifest_file != NULL ? 3 : 5;
+	while(i < c){
+		if(strcmp(argv[i], "--wavefront") == 0){
+			options->wavefront = 1;
+		}else if(strcmp(argv[i], "--bounces") == 0){
+			if(i + 1 >= c || !isdigit(*argv[i + 1])){
+				fprintf(stderr, "Error: --bounces expects a number\n");
+				exit(1);
+			}
+			options->bounces = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--stats") == 0){
+			options->stats = 1;
+		}else if(strcmp(argv[i], "--threads") == 0){
+			if(i + 1 >= c || atoi(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --threads expects a number greater than 0\n");
+				exit(1);
+			}
+			options->threads = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--shadow-cache") == 0){
+			if(i + 1 >= c || atoi(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --shadow-cache expects a resolution greater than 0\n");
+				exit(1);
+			}
+			options->shadow_cache_resolution = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--shadow-cache-file") == 0){
+			if(i + 1 >= c){
+				fprintf(stderr, "Error: --shadow-cache-file expects a file name\n");
+				exit(1);
+			}
+			options->shadow_cache_file = argv[++i];
+		}else if(strcmp(argv[i], "--hybrid") == 0){
+			options->hybrid = 1;
+		}else if(strcmp(argv[i], "--binning") == 0){
+			options->binning = 1;
+		}else if(strcmp(argv[i], "--time-budget") == 0){
+			if(i + 1 >= c || atof(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --time-budget expects a number of seconds greater than 0\n");
+				exit(1);
+			}
+			options->time_budget = atof(argv[++i]);
+		}else if(strcmp(argv[i], "--snapshot-interval") == 0){
+			if(i + 1 >= c || atof(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --snapshot-interval expects a number of seconds greater than 0\n");
+				exit(1);
+			}
+			options->snapshot_interval = atof(argv[++i]);
+		}else if(strcmp(argv[i], "--crop") == 0){
+			if(i + 4 >= c){
+				fprintf(stderr, "Error: --crop expects x0 y0 x1 y1\n");
+				exit(1);
+			}
+			for(int j = 0; j < 4; j++){
+				if(!isdigit(*argv[i + 1])){
+					fprintf(stderr, "Error: --crop expects x0 y0 x1 y1\n");
+					exit(1);
+				}
+				options->crop[j] = atoi(argv[++i]);
+			}
+			options->cropped = 1;
+		}else if(strcmp(argv[i], "--checkpoint") == 0){
+			if(i + 1 >= c){
+				fprintf(stderr, "Error: --checkpoint expects a file name\n");
+				exit(1);
+			}
+			options->checkpoint_file = argv[++i];
+		}else if(strcmp(argv[i], "--shading-rate") == 0){
+			if(i + 1 >= c || (strcmp(argv[i + 1], "1") != 0 && strcmp(argv[i + 1], "2") != 0 && strcmp(argv[i + 1], "4") != 0)){
+				fprintf(stderr, "Error: --shading-rate expects 1, 2 or 4\n");
+				exit(1);
+			}
+			options->shading_rate = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--aov") == 0){
+			if(i + 1 >= c || parse_aovs(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --aov expects a comma separated list of depth, normal, object, steps and shadow, or all\n");
+				exit(1);
+			}
+			options->aovs = parse_aovs(argv[++i]);
+		}else if(strcmp(argv[i], "--trace") == 0){
+			if(i + 1 >= c){
+				fprintf(stderr, "Error: --trace expects a file name\n");
+				exit(1);
+			}
+			command_line->trace_file = argv[++i];
+		}else if(strcmp(argv[i], "--metrics") == 0){
+			if(i + 1 >= c){
+				fprintf(stderr, "Error: --metrics expects a file name\n");
+				exit(1);
+			}
+			command_line->metrics_file = argv[++i];
+		}else if(strcmp(argv[i], "--metrics-interval") == 0){
+			if(i + 1 >= c || atof(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --metrics-interval expects a number of seconds greater than 0\n");
+				exit(1);
+			}
+			command_line->metrics_interval = atof(argv[++i]);
+		}else if(strcmp(argv[i], "--autotune") == 0){
+			command_line->autotune = 1;
+		}else if(strcmp(argv[i], "--autotune-tolerance") == 0){
+			if(i + 1 >= c || atof(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --autotune-tolerance expects an RMS color difference greater than 0\n");
+				exit(1);
+			}
+			command_line->autotune = 1;
+			command_line->autotune_tolerance = atof(argv[++i]);
+		}else if(strcmp(argv[i], "--views") == 0){
+			if(i + 1 >= c || !valid_views(argv[i + 1])){
+				fprintf(stderr, "Error: --views expects a comma separated list of stereo, cubemap and equirect\n");
+				exit(1);
+			}
+			command_line->views = argv[++i];
+		}else if(strcmp(argv[i], "--eye-separation") == 0){
+			if(i + 1 >= c || atof(argv[i + 1]) <= 0){
+				fprintf(stderr, "Error: --eye-separation expects a distance greater than 0\n");
+				exit(1);
+			}
+			command_line->eye_separation = atof(argv[++i]);
+		}else if(strcmp(argv[i], "--estimate") == 0){
+			command_line->estimate = 1;
+		}else if(strcmp(argv[i], "--validate-sdf") == 0){
+			command_line->validate_sdf = 1;
+		}else if(strcmp(argv[i], "--incremental") == 0){
+			command_line->incremental = 1;
+		}else if(strcmp(argv[i], "--watch") == 0){
+			command_line->incremental = 1;
+			command_line->watch = 1;
+		}else{
+			fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[i]);
+			exit(1);
+		}
+		i++;
+	}
+	if(command_line->manifest_file != NULL && (options->wavefront || options->time_budget > 0 || options->snapshot_interval > 0 ||
+								options->cropped || options->checkpoint_file != NULL || options->shadow_cache_file != NULL || options->aovs ||
+								command_line->incremental || command_line->validate_sdf)){
+		fprintf(stderr, "Error: --manifest only takes --threads, --stats, --trace, --metrics, --hybrid, --binning, --shadow-cache and --shading-rate\n");
+		exit(1);
+	}
+	if(command_line->views != NULL && (options->wavefront || options->time_budget > 0 || options->snapshot_interval > 0 ||
+								options->cropped || options->checkpoint_file != NULL || options->shadow_cache_file != NULL || options->aovs ||
+								command_line->incremental || command_line->validate_sdf || command_line->autotune || command_line->estimate)){
+		fprintf(stderr, "Error: --views only takes --threads, --stats, --trace, --metrics, --hybrid, --binning, --shadow-cache, --shading-rate and --eye-separation\n");
+		exit(1);
+	}
+	if(command_line->autotune && (options->wavefront || options->time_budget > 0 || options->snapshot_interval > 0 || options->cropped ||
+								options->checkpoint_file != NULL || command_line->incremental || command_line->validate_sdf ||
+								command_line->manifest_file != NULL)){
+		fprintf(stderr, "Error: --autotune only tunes the default tiled renderer on the whole image\n");
+		exit(1);
+	}
+	if(command_line->estimate && (options->wavefront || options->time_budget > 0 || options->snapshot_interval > 0 || options->shading_rate > 1 ||
+								command_line->incremental || command_line->validate_sdf || command_line->autotune || command_line->manifest_file != NULL)){
+		fprintf(stderr, "Error: --estimate only predicts the default tiled renderer at full shading rate\n");
+		exit(1);
+	}
+	if(options->shadow_cache_file != NULL && options->shadow_cache_resolution == 0){
+		options->shadow_cache_resolution = DEFAULT_SHADOW_CACHE_RESOLUTION;
+	}
+	if(options->bounces > 0 && !options->wavefront){
+		fprintf(stderr, "Error: --bounces requires --wavefront\n");
+		exit(1);
+	}
+	if(options->wavefront && (options->time_budget > 0 || options->snapshot_interval > 0)){
+		fprintf(stderr, "Error: --time-budget and --snapshot-interval can't be combined with --wavefront\n");
+		exit(1);
+	}
+	if((options->cropped || options->checkpoint_file != NULL) && (options->wavefront || options->time_budget > 0 || options->snapshot_interval > 0)){
+		fprintf(stderr, "Error: --crop and --checkpoint only work with the default tiled renderer\n");
+		exit(1);
+	}
+	if(options->shading_rate > 1 && (options->wavefront || options->time_budget > 0 || options->snapshot_interval > 0)){
+		fprintf(stderr, "Error: --shading-rate only works with the default tiled renderer\n");
+		exit(1);
+	}
+	if(options->binning && options->wavefront){
+		fprintf(stderr, "Error: --binning can't be combined with --wavefront\n");
+		exit(1);
+	}
+	if(options->aovs && (options->time_budget > 0 || options->snapshot_interval > 0 || options->checkpoint_file != NULL)){
+		fprintf(stderr, "Error: --aov can't be combined with --time-budget, --snapshot-interval or --checkpoint\n");
+		exit(1);
+	}
+	if(command_line->incremental && (options->wavefront || options->time_budget > 0 || options->snapshot_interval > 0 ||
+								options->cropped || options->checkpoint_file != NULL || options->shading_rate > 1 || options->aovs || options->binning)){
+		fprintf(stderr, "Error: --incremental and --watch only work with the default renderer on the whole image\n");
+		exit(1);
+	}
+	if(command_line->incremental && strcmp(strrchr(argv[4], '.'), ".ppm") != 0){	//The last image is read back to see what changed
+		fprintf(stderr, "Error: --incremental and --watch need a .ppm output\n");
+		exit(1);
+	}
+	if(command_line->incremental && options->shadow_cache_resolution > 0){	//The cache's shadows depend on every object around the light
+		fprintf(stderr, "Error: --incremental and --watch can't be combined with --shadow-cache\n");
+		exit(1);
+	}
+	if(options->cropped && (options->crop[0] >= options->crop[2] || options->crop[1] >= options->crop[3] ||
+							options->crop[2] > atoi(argv[1]) || options->crop[3] > atoi(argv[2]))){
+		fprintf(stderr, "Error: --crop window must be non-empty and lie inside the %sx%s image\n", argv[1], argv[2]);
+		exit(1);
+	}
+}
+
+double seconds_now(){	//On a clock that never jumps
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+struct timespec modification_time(char* file_name){	//Zero if the file is missing, editors briefly delete it while saving
+	struct stat info;
+	struct timespec missing = { 0, 0 };
+	return stat(file_name, &info) == 0 ? info.st_mtim : missing;
+}
+
+int same_time(struct timespec a, struct timespec b){
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+void sleep_seconds(double seconds){
+	struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+	nanosleep(&duration, NULL);
+}
+
+void wait_for_change(char* scene_file, struct timespec* last_change){	//Returns once the file changed and has stopped changing
+	struct timespec now = *last_change;
+	while(same_time(now, *last_change) || now.tv_sec == 0){
+		sleep_seconds(WATCH_POLL_INTERVAL);
+		now = modification_time(scene_file);
+	}
+	struct timespec settled;
+	do{	//Let the editor finish writing
+		settled = now;
+		sleep_seconds(WATCH_POLL_INTERVAL);
+		now = modification_time(scene_file);
+	}while(!same_time(now, settled));
+	*last_change = now;
+}
+
+void print_stats(RenderContext* context){
+	RenderStats stats = render_get_stats(context);
+	fprintf(stderr, "camera rays: %lld, steps: %lld (%.2f per ray)\n", stats.camera_rays, stats.camera_steps,
+			stats.camera_rays ? (double)stats.camera_steps / stats.camera_rays : 0.0);
+	fprintf(stderr, "shadow rays: %lld, steps: %lld (%.2f per ray)\n", stats.shadow_rays, stats.shadow_steps,
+			stats.shadow_rays ? (double)stats.shadow_steps / stats.shadow_rays : 0.0);
+	if(render_options(context)->shadow_cache_resolution > 0){
+		fprintf(stderr, "shadows answered by the shadow cache: %lld\n", stats.cached_shadows);
+	}
+	if(render_options(context)->shading_rate > 1){
+		fprintf(stderr, "pixels interpolated by the shading rate: %lld\n", stats.interpolated_pixels);
+	}
+	fprintf(stderr, "SDF evaluations: %lld\n", stats.sdf_evaluations);
+	if(stats.oversteps > 0){
+		fprintf(stderr, "steps that went through a surface: %lld, see --validate-sdf\n", stats.oversteps);
+	}
+}
+
+// Prints how many of every object's sampled march steps ended up inside it, and the lipschitz that would have
+// kept them out. broken counts the objects the march can step through
+RenderStatus validate_scene(RenderContext* context, int* broken){
+	int count = render_object_count(context);
+	SdfValidation* results = malloc(sizeof(SdfValidation) * (count > 0 ? count : 1));
+	if(results == NULL){
+		fprintf(stderr, "Error: Out of memory for %d objects\n", count);
+		return RENDER_ERROR_MEMORY;
+	}
+	RenderStatus status = render_validate_sdf(context, results);
+	*broken = 0;
+	if(status == RENDER_OK){
+		printf("%-6s %-16s %9s %14s\n", "object", "kind", "lipschitz", "steps inside");
+		for(int i = 0; i < count; i++){
+			SdfValidation* result = &results[i];
+			printf("%-6d %-16s %9.3f %6d/%-7d\n", result->object, result->kind, result->lipschitz, result->violations, result->samples);
+			if(result->violations > 0){
+				printf("       steps from around %.3f %.3f %.3f go through it, it needs a \"lipschitz\" of at least %.3f\n",
+						result->position[0], result->position[1], result->position[2], result->needed);
+				(*broken)++;
+			}
+		}
+	}
+	free(results);
+	return status;
+}
+
+// Switches the context to the settings that render the scene fastest within the tolerance, kept in
+// <scene>.tune for the next render of the same scene, size and options
+RenderStatus autotune_scene(RenderContext* context, int width, int height, char* scene_file, CommandLine* command_line){
+	RenderTuning tuning;
+	char tune_file[strlen(scene_file) + sizeof(".tune")];
+	sprintf(tune_file, "%s.tune", scene_file);
+	RenderStatus status = render_autotune(context, width, height, command_line->autotune_tolerance, tune_file, &tuning);
+	if(status == RENDER_OK){
+		fprintf(stderr, "autotune%s: hybrid %s, shading rate %d, shadow cache %d, epsilon scale %g, %.2f s instead of %.2f s, error %.4f\n",
+				tuning.cached ? " (from the tune file)" : "", tuning.hybrid ? "on" : "off", tuning.shading_rate, tuning.shadow_cache_resolution,
+				tuning.epsilon_scale, tuning.seconds, tuning.untuned_seconds, tuning.error);
+	}
+	return status;
+}
+
+void print_interval(char* name, RenderInterval* interval, char* format){	//One member of the --estimate JSON
+	printf("\t\"%s\": { \"estimate\": ", name);
+	printf(format, interval->estimate);
+	printf(", \"low\": ");
+	printf(format, interval->low);
+	printf(", \"high\": ");
+	printf(format, interval->high);
+	printf(" },\n");
+}
+
+// Prints what rendering the scene would cost as JSON on stdout, for schedulers to read
+RenderStatus estimate_scene(RenderContext* context, int width, int height){
+	RenderEstimate estimate;
+	RenderStatus status = render_estimate(context, width, height, &estimate);
+	if(status == RENDER_OK){
+		printf("{\n");
+		printf("\t\"width\": %d,\n\t\"height\": %d,\n\t\"threads\": %d,\n", width, height, render_options(context)->threads);
+		printf("\t\"pixels\": %d,\n\t\"samples\": %d,\n\t\"confidence\": %g,\n", estimate.pixels, estimate.samples, estimate.confidence);
+		print_interval("sdf_evaluations", &estimate.sdf_evaluations, "%.0f");
+		print_interval("march_steps", &estimate.march_steps, "%.0f");
+		print_interval("seconds", &estimate.seconds, "%.4f");
+		printf("\t\"setup_seconds\": %.4f,\n\t\"estimate_seconds\": %.4f\n}\n", estimate.setup_seconds, estimate.estimate_seconds);
+	}
+	return status;
+}
+
+int report_failed_jobs(RenderJob* jobs, int count){	//Prints why every job that failed did, returns how many
+	int failed = 0;
+	for(int i = 0; i < count; i++){
+		if(jobs[i].status != RENDER_OK && jobs[i].status != RENDER_CANCELLED){
+			fprintf(stderr, "Error: %s -> %s: %s\n", jobs[i].scene_file, jobs[i].output, jobs[i].error);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+// Renders every job of the manifest on one pool of threads and reports the ones that failed, which don't
+// stop the others
+RenderStatus render_manifest(RenderContext* context, char* manifest_file, int* failed_jobs){
+	RenderJob* jobs;
+	int count;
+	RenderStatus status = render_read_manifest(context, manifest_file, &jobs, &count);
+	*failed_jobs = 0;
+	if(status != RENDER_OK){
+		return status;
+	}
+	status = render_batch(context, jobs, count);
+	*failed_jobs = report_failed_jobs(jobs, count);
+	if(render_options(context)->stats){
+		fprintf(stderr, "jobs: %d rendered, %d failed\n", count - *failed_jobs, *failed_jobs);
+	}
+	render_free_jobs(jobs, count);
+	return status;
+}
+
+// Jobs of one batch for every view of the --views sets, so they share the parsed scene, its shadow cache
+// and one pool of threads. out.png becomes out_left.png, out_px.png, out_equirect.png and so on. NULL if
+// out of memory
+RenderJob* view_jobs(int width, int height, char* scene_file, char* output, CommandLine* command_line, int* count){
+	RenderView views[RENDER_MAX_VIEWS];
+	const char* names[RENDER_MAX_VIEWS];
+	char sets[strlen(command_line->views) + 1];
+	strcpy(sets, command_line->views);
+	RenderJob* jobs = calloc((strlen(sets) / 2 + 1) * RENDER_MAX_VIEWS, sizeof(RenderJob));	//Set names are at least a letter and a comma
+	char* extension = strrchr(output, '.');
+	*count = 0;
+	for(char* set = strtok(sets, ","); jobs != NULL && set != NULL; set = strtok(NULL, ",")){
+		int view_count = render_view_set(set, command_line->eye_separation, views, names);
+		for(int i = 0; i < view_count; i++){
+			RenderJob* job = &jobs[(*count)++];
+			job->scene_file = strdup(scene_file);
+			job->output = malloc(strlen(output) + strlen(names[i]) + 2);
+			if(job->scene_file == NULL || job->output == NULL){
+				render_free_jobs(jobs, *count);
+				return NULL;
+			}
+			sprintf(job->output, "%.*s_%s%s", (int)(extension - output), output, names[i], extension);
+			job->width = width;
+			job->height = height;
+			job->view = views[i];
+		}
+	}
+	return jobs;
+}
+
+// Renders the scene once, then with --watch again after every save of it. A save that doesn't parse is
+// reported and the next one tried, the image keeps showing the last scene that did
+RenderStatus watch_scene(RenderContext* context, double* framebuffer, int width, int height, char* scene_file, char* output,
+							CommandLine* command_line){
+	struct timespec last_change = modification_time(scene_file);
+	RenderStatus status = render_incremental(context, framebuffer, width, height, output);
+	while(command_line->watch){
+		if(status != RENDER_OK){
+			fprintf(stderr, "Error: %s\n", render_error(context));
+		}
+		wait_for_change(scene_file, &last_change);
+		status = render_load_scene(context, scene_file);
+		if(status == RENDER_OK){
+			status = render_incremental(context, framebuffer, width, height, output);
+		}
+		if(command_line->trace_file != NULL){	//There is no exit to write it at
+			render_trace_write(command_line->trace_file);
+		}
+	}
+	return status;
+}
+
+// Reports the run's error or --stats, writes the --trace file, stops --metrics and destroys the context.
+// reported is 1 if the caller already printed why it failed. Returns status, or RENDER_ERROR_FILE if the
+// trace or metrics couldn't be written
+RenderStatus finish_run(RenderContext* context, RenderStatus status, int reported, CommandLine* command_line){
+	if(status != RENDER_OK && !reported){
+		fprintf(stderr, "Error: %s\n", render_error(context));
+	}else if(status == RENDER_OK && render_options(context)->stats){
+		print_stats(context);
+	}
+	if(command_line->trace_file != NULL && render_trace_write(command_line->trace_file) != RENDER_OK){
+		fprintf(stderr, "Error: Could not write trace \"%s\"\n", command_line->trace_file);
+		status = RENDER_ERROR_FILE;
+	}
+	if(command_line->metrics_file != NULL && render_metrics_stop() != RENDER_OK){
+		fprintf(stderr, "Error: Could not write metrics \"%s\"\n", command_line->metrics_file);
+		status = RENDER_ERROR_FILE;
+	}
+	render_destroy(context);
+	return status;
+}
+
+int main(int c, char** argv){
+	int width;
+	int height;
+	int image_width;	//Size of the output image, the crop window with --crop
+	int image_height;
+	double start_time = seconds_now();	//--time-budget counts from here
+	CommandLine command_line = { 0, 0, NULL, 0, NULL, 0, DEFAULT_AUTOTUNE_TOLERANCE, 0, NULL, DEFAULT_EYE_SEPARATION, NULL, DEFAULT_METRICS_INTERVAL };
+	int broken_sdfs = 0;
+	RenderContext* context = render_create();
+	if(context == NULL){
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+	RenderOptions* options = render_options(context);
+	
+	if(c >= 3 && strcmp(argv[1], "--manifest") == 0){	//raymarcher --manifest jobs.json [options]
+		command_line.manifest_file = argv[2];
+	}else{
+		argument_checker(c, argv);	//Check our arguments to make sure they written correctly
+	}
+	parse_options(c, argv, options, &command_line);
+	if(command_line.trace_file != NULL){
+		render_trace_start();
+	}
+	if(command_line.metrics_file != NULL && render_metrics_start(command_line.metrics_file, command_line.metrics_interval) != RENDER_OK){
+		fprintf(stderr, "Error: Could not write metrics \"%s\"\n", command_line.metrics_file);
+		command_line.metrics_file = NULL;	//Nothing to stop
+		finish_run(context, RENDER_ERROR_FILE, 1, &command_line);
+		return 1;
+	}
+	if(command_line.manifest_file != NULL){
+		int failed_jobs;
+		RenderStatus status = render_manifest(context, command_line.manifest_file, &failed_jobs);
+		status = finish_run(context, status, 0, &command_line);
+		return status == RENDER_OK && failed_jobs == 0 ? 0 : 1;
+	}
+	
+	width = atoi(argv[1]);
+	height = atoi(argv[2]);
+	if(command_line.views != NULL){	//Every view is a job of one batch, the scene is loaded there
+		int count;
+		RenderJob* jobs = view_jobs(width, height, argv[3], argv[4], &command_line, &count);
+		if(jobs == NULL){
+			fprintf(stderr, "Error: Out of memory for the views\n");
+			finish_run(context, RENDER_ERROR_MEMORY, 1, &command_line);
+			return 1;
+		}
+		RenderStatus status = render_batch(context, jobs, count);
+		report_failed_jobs(jobs, count);
+		render_free_jobs(jobs, count);
+		status = finish_run(context, status, 0, &command_line);
+		return status == RENDER_OK ? 0 : 1;
+	}
+	image_width = options->cropped ? options->crop[2] - options->crop[0] : width;
+	image_height = options->cropped ? options->crop[3] - options->crop[1] : height;
+	
+	double* framebuffer = calloc((size_t)image_width*image_height*3, sizeof(double));	//Create our pixel array to hold color values
+	if(framebuffer == NULL){
+		fprintf(stderr, "Error: Out of memory for a %dx%d image\n", image_width, image_height);
+		finish_run(context, RENDER_ERROR_MEMORY, 1, &command_line);
+		return 1;
+	}
+	RenderStatus status = render_load_scene(context, argv[3]);
+	if(status == RENDER_OK && command_line.validate_sdf){	//Nothing is rendered or written
+		status = validate_scene(context, &broken_sdfs);
+	}else if(status == RENDER_OK && command_line.estimate){	//Nor here
+		status = estimate_scene(context, width, height);
+	}else if(status == RENDER_OK && (options->time_budget > 0 || options->snapshot_interval > 0)){	//Raycast our scene into the pixel array
+		if(options->time_budget > 0){	//The budget covers parsing and setup too, render_progressive() counts from its call
+			options->time_budget = start_time + options->time_budget - seconds_now();
+			options->time_budget = options->time_budget > 0 ? options->time_budget : 1e-9;
+		}
+		status = render_progressive(context, framebuffer, width, height, argv[4]);
+	}else if(status == RENDER_OK && command_line.incremental){
+		status = watch_scene(context, framebuffer, width, height, argv[3], argv[4], &command_line);	//Only returns without --watch
+	}else if(status == RENDER_OK){
+		if(command_line.autotune){
+			status = autotune_scene(context, width, height, argv[3], &command_line);
+		}
+		if(status == RENDER_OK){
+			status = render_image(context, framebuffer, width, height);
+		}
+		if(status == RENDER_OK){
+			status = render_write_image(context, framebuffer, image_width, image_height, argv[4]);	//Put info from pixel array into a P6 PPM, PNG or QOI file
+		}
+		if(status == RENDER_OK && options->aovs){	//Next to the image, scene.ppm gets scene.depth.pfm and so on
+			char prefix[strlen(argv[4]) + 1];
+			strcpy(prefix, argv[4]);
+			*strrchr(prefix, '.') = '\0';
+			status = render_write_aovs(context, image_width, image_height, prefix);
+		}
+		if(status == RENDER_OK && options->checkpoint_file != NULL){	//The image is written, nothing left to resume
+			remove(options->checkpoint_file);
+		}
+	}
+	status = finish_run(context, status, 0, &command_line);
+	free(framebuffer);
+	return status == RENDER_OK && broken_sdfs == 0 ? 0 : 1;
+}
@@ -2,147 +2,157 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdarg.h>
 
 #include "Math/simple_math.h"
 #include "Math/vector_math.h"
 #include "Math/matrix_math.h"
+#include "Math/fast_math.h"
+#include "Math/vec3.h"
 #include "Parser/parse_json.h"
 #include "raymarch.h"
-
-//These variables should NOT be changed after parsing the json file
-Object* object_array[130];
-int object_counter;
-
-void argument_checker(int c, char** argv){	//Check input arguments for validity
-	int i = 0;
-	int j = 0;
-	char* periodPointer;
-	if(c != 5){	//Ensure that five arguments are passed in through command line
-		fprintf(stderr, "Error: Incorrect amount of arguments\n");
-		exit(1);
-	}
-	
-	while(1){	//Ensure that both the width and height arguments are numbers
-		if(*(argv[1] + i) == '\0' && *(argv[2] + j) == '\0'){
-			break;
-		}
-		else if(*(argv[1] + i) == '\0'){
-			i--;
-		}
-		else if(*(argv[2] + j) == '\0'){
-			j--;
-		}
-		
-		if(!isdigit(*(argv[1] + i)) || !isdigit(*(argv[2] + j))){
-			fprintf(stderr, "Error: Width or Height field is not a number\n");
-			exit(1);
-		}
-		i++;
-		j++;
-	}
-	
-	periodPointer = strrchr(argv[3], '.');	//Ensure that the input scene file has an extension .json
-	if(periodPointer == NULL){
-		fprintf(stderr, "Error: Input scene file does not have a file extension\n");
-		exit(1);
-	}
-	if(strcmp(periodPointer, ".json") != 0){
-		fprintf(stderr, "Error: Input scene file is not of type JSON\n");
-		exit(1);
-	}
-	
-	periodPointer = strrchr(argv[4], '.');	//Ensure that the output picture file has an extension .ppm
-	if(periodPointer == NULL){
-		fprintf(stderr, "Error: Output picture file does not have a file extension\n");
-		exit(1);
+#include "sdf.h"
+#include "Render/aov.h"
+#include "Render/binning.h"
+#include "Render/encode.h"
+#include "Render/metrics.h"
+#include "Render/shadow_cache.h"
+#include "Render/trace.h"
+
+_Thread_local RenderStats render_stats;
+_Thread_local PixelDeps* recorded_deps;
+
+// Fractals only need as many iterations as the detail the current sample can resolve. Every iteration
+// resolves detail halvings' worth of finer detail, one for the Mandelbulb, before the estimate settles
+int lod_iterations( double detail, double halvings, int min_iterations, int max_iterations, double lod_bias ){	//lod_bias is the camera's
+	int iterations = (int)ceil( log2( 1.0 / detail ) / halvings ) + LOD_BIAS + (int)lod_bias;
+	if( iterations < min_iterations ){
+		return min_iterations;
 	}
-	if(strcmp(periodPointer, ".ppm") != 0){
-		fprintf(stderr, "Error: Output picture file is not of type PPM\n");
-		exit(1);
+	if( iterations > max_iterations ){
+		return max_iterations;
 	}
+	return iterations;
 }
 
-double apply_transformations(double* position, double* object_position, double* object_rotation ){
-	position[0] -= object_position[0];
-	position[1] -= object_position[1];
-	position[2] -= object_position[2];
-	apply_xyz_rotation( position, object_rotation );
-}
+double mandelbulb_sdf( Vec3 position, int iterations ){
+	Vec3 temp_pos = position;
 
-double sphere_sdf(double* position, double radius){ //Calculate how far our ray position is from the sphere
-	return magnitude(position) - radius;
-}
+	double dr = 1.0;
+	double r = vec3_length( temp_pos );	//What the log sees if there are no iterations
+	double power = 8.0;
+	for( int i = 0; i < iterations; i++ ) {
+		r = vec3_length( temp_pos );
+		if( r > 2.0 ){ break; }
 
-double plane_sdf( double* position, double* plane_normal ){
-	return dot_product( position, plane_normal );
-}
+		double theta = fast_acos( temp_pos.z / r ) * power;
+		double phi = fast_atan2(temp_pos.y, temp_pos.x) * power;
+		double r2 = r * r;	//r^(power - 1) and r^power by multiplying, power is 8
+		double r7 = r2 * r2 * r2 * r;
+		dr = r7 * power * dr + 1.0;
 
-double box_sdf( double* position, double* dimensions ){
-	double distance_vect[3];
-	distance_vect[0] = fabs( position[0] ) - dimensions[0];
-	distance_vect[1] = fabs( position[1] ) - dimensions[1];
-	distance_vect[2] = fabs( position[2] ) - dimensions[2];
+		double zr = r7 * r;
+		double sin_theta = fast_sin(theta);
 
-	double pos_distance_vect[3];
-	pos_distance_vect[0] = max( distance_vect[0], 0.0 );
-	pos_distance_vect[1] = max( distance_vect[1], 0.0 );
-	pos_distance_vect[2] = max( distance_vect[2], 0.0 );
-	double temp_distance = magnitude( pos_distance_vect );
-	return temp_distance + min( max( distance_vect[0], max( distance_vect[0], max( distance_vect[1], distance_vect[2] ) ) ), 0.0 );
+		temp_pos.x = position.x + zr * sin_theta * fast_cos(phi);
+		temp_pos.y = position.y + zr * sin_theta * fast_sin(phi);
+		temp_pos.z = position.z + zr * fast_cos(theta);
+	}
+	return 0.5 * fast_log(r)*r/dr;
 }
 
-double donut_sdf( double* position, double radius, double thickness ){
-	double xz[2] = {position[0], position[2]};
-	double diameter = radius * 2;
-	double donut_bounds[2] = { magnitude_2D(xz) - diameter, position[1] };
-	return magnitude_2D( donut_bounds ) - thickness;
+double menger_sdf( Vec3 position, int iterations ){	//Sponge carved out of the cube from -1 to 1
+	double distance = box_sdf( position, vec3( 1.0, 1.0, 1.0 ) );
+	double scale = 1.0;
+	for( int i = 0; i < iterations; i++ ){	//Every iteration cuts the cross out of each of the 27 subcubes
+		Vec3 folded = vec3_scale( position, scale );
+		folded = vec3( folded.x - 2.0 * floor( folded.x / 2.0 ) - 1.0, folded.y - 2.0 * floor( folded.y / 2.0 ) - 1.0,
+						folded.z - 2.0 * floor( folded.z / 2.0 ) - 1.0 );
+		scale *= 3.0;
+		Vec3 cross = vec3_abs( vec3_sub( vec3( 1.0, 1.0, 1.0 ), vec3_scale( vec3_abs( folded ), 3.0 ) ) );
+		double xy = cross.x > cross.y ? cross.x : cross.y;
+		double yz = cross.y > cross.z ? cross.y : cross.z;
+		double zx = cross.z > cross.x ? cross.z : cross.x;
+		double hole = ( min( xy, min( yz, zx ) ) - 1.0 ) / scale;
+		distance = distance > hole ? distance : hole;
+	}
+	return distance;
 }
 
-double cone_sdf( double* position, double angle, double height ){
-	double cos_sin[2] = { cos(angle), sin(angle) };
-	double xz[2] = { position[0], position[2] };
-	double q = magnitude_2D( xz );
-	return max( dot_product( cos_sin, (double[2]){ q, position[1] } ), -height - position[1] );
+double mandelbox_sdf( Vec3 position, double scale, int iterations ){
+	Vec3 z = position;
+	double dr = 1.0;
+	for( int i = 0; i < iterations; i++ ){
+		z = vec3( z.x > 1.0 ? 2.0 - z.x : z.x < -1.0 ? -2.0 - z.x : z.x,	//Box fold
+				z.y > 1.0 ? 2.0 - z.y : z.y < -1.0 ? -2.0 - z.y : z.y,
+				z.z > 1.0 ? 2.0 - z.z : z.z < -1.0 ? -2.0 - z.z : z.z );
+		double r2 = vec3_dot( z, z );
+		double fold = r2 < MANDELBOX_MIN_RADIUS2 ? MANDELBOX_FIXED_RADIUS2 / MANDELBOX_MIN_RADIUS2 :	//Sphere fold
+						r2 < MANDELBOX_FIXED_RADIUS2 ? MANDELBOX_FIXED_RADIUS2 / r2 : 1.0;
+		z = vec3_add( vec3_scale( z, fold * scale ), position );
+		dr = dr * fold * fabs( scale ) + 1.0;
+		if( vec3_dot( z, z ) > MANDELBOX_BAILOUT ){
+			break;
+		}
+	}
+	return vec3_length( z ) / dr;
 }
 
-double eternal_cylinder_sdf( double* position, double radius ){
-	double xz[2] = { position[0], position[2] };
-	return magnitude_2D( xz ) - radius;
+double mandelbox_extent( double scale ){	//Half the edge of the cube that holds the box at this scale
+	return 2.0 * ( fabs( scale ) + 1.0 ) / ( fabs( scale ) - 1.0 );
 }
 
-double mandelbulb_sdf( double* position ){
-	double temp_pos[3] = {position[0], position[1], position[2]};
-
-	double dr = 1.0;
-	double r;
-	double power = 8.0;
-	for( int i = 0; i < 20; i++ ) {
-		r = sqrt( dot_product(temp_pos, temp_pos) );
-		if( r > 2.0 ){ break; }
-
-		double theta = acos( temp_pos[2] / r ) * power;
-		double phi = atan2(temp_pos[1], temp_pos[0]) * power;
-		dr = pow( r, power - 1.0 ) * power * dr + 1.0;
-
-		double zr = pow( r, power );
+double julia_sdf( Vec3 position, const double* constant, int iterations ){	//Slice w = 0 of the quaternion Julia set of z^2 + c
+	double z[4] = { position.x, position.y, position.z, 0.0 };
+	double z2 = vec3_dot( position, position );
+	double dz2 = 1.0;	//|z'|^2, z' = 2 z z' grows by 4 |z|^2 an iteration
+	for( int i = 0; i < iterations; i++ ){
+		dz2 *= 4.0 * z2;
+		double w = z[0];
+		z[0] = w*w - z[1]*z[1] - z[2]*z[2] - z[3]*z[3] + constant[0];
+		z[1] = 2.0 * w * z[1] + constant[1];
+		z[2] = 2.0 * w * z[2] + constant[2];
+		z[3] = 2.0 * w * z[3] + constant[3];
+		z2 = z[0]*z[0] + z[1]*z[1] + z[2]*z[2] + z[3]*z[3];
+		if( z2 > JULIA_BAILOUT ){
+			break;
+		}
+	}
+	return 0.25 * sqrt( z2 / dz2 ) * fast_log( z2 );
+}
 
-		temp_pos[0] = position[0] + zr * sin(theta) * cos(phi);
-		temp_pos[1] = position[1] + zr * sin(theta) * sin(phi);
-		temp_pos[2] = position[2] + zr * cos(theta);
+double fractal_shell_radius( Object* object ){	//Radius around the position that holds all of the fractal
+	if( object->kind == Menger ){
+		return object->menger.size * sqrt( 3.0 );
+	}else if( object->kind == Mandelbox ){
+		return object->mandelbox.size * sqrt( 3.0 );
+	}else if( object->kind == Julia ){	//Points further out than the escape radius of c never come back
+		double* c = object->julia.constant;
+		return 0.5 * ( 1.0 + sqrt( 1.0 + 4.0 * sqrt( c[0]*c[0] + c[1]*c[1] + c[2]*c[2] + c[3]*c[3] ) ) );
 	}
-	return 0.5 * log(r)*r/dr;
+	return MANDELBULB_SHELL_RADIUS;
 }
 
-double infinite_shape( double* position, double tile_size ){
-	int unit_pos[3] = { 
-		(int) round(position[0] / tile_size),
-		(int) round(position[1] / tile_size),
-		(int) round(position[2] / tile_size)
-	};
-	position[0] -= tile_size * unit_pos[0];
-	position[1] -= tile_size * unit_pos[1];
-	position[2] -= tile_size * unit_pos[2];
+// Every fractal sits inside its shell, a sphere of shell_radius, so outside of it the distance to the shell is
+// a safe step that costs one square root. Most samples of a fractal scene are out there, only the ones within
+// FRACTAL_SHELL_MARGIN of the shell pay for the iterations
+double fractal_sdf( Vec3 position, Object* object, double detail, double lod_bias ){
+	double shell = vec3_length( position ) - object->shell_radius;
+	if( shell > FRACTAL_SHELL_MARGIN * object->shell_radius ){
+		return shell;
+	}
+	if( object->kind == Mandelbulb ){
+		return mandelbulb_sdf( position, lod_iterations( detail, 1.0, MANDELBULB_MIN_ITERATIONS, MANDELBULB_MAX_ITERATIONS, lod_bias ) );
+	}else if( object->kind == Menger ){
+		double size = object->menger.size;
+		return size * menger_sdf( vec3_scale( position, 1.0 / size ),
+									lod_iterations( detail / size, MENGER_HALVINGS, MENGER_MIN_ITERATIONS, MENGER_MAX_ITERATIONS, lod_bias ) );
+	}else if( object->kind == Mandelbox ){	//Iterated in the units where the box spans mandelbox_extent()
+		double units = mandelbox_extent( object->mandelbox.scale ) / object->mandelbox.size;
+		return mandelbox_sdf( vec3_scale( position, units ), object->mandelbox.scale,
+								lod_iterations( detail * units, 1.0, MANDELBOX_MIN_ITERATIONS, MANDELBOX_MAX_ITERATIONS, lod_bias ) ) / units;
+	}
+	return julia_sdf( position, object->julia.constant, lod_iterations( detail, 1.0, JULIA_MIN_ITERATIONS, JULIA_MAX_ITERATIONS, lod_bias ) );
 }
 
 void store_obj_data( double temp_distance, double temp_min_distance, int obj_index, Intersect* intersect ){
@@ -155,92 +165,223 @@ void store_obj_data( double temp_distance, double temp_min_distance, int obj_ind
 }
 
 // There are TWO ways to get results from this function, the double using normal return logic, and the Intersect* arg for extra object data
-double all_intersections( double* position, Intersect* intersect ){
+// detail is the size of the smallest feature the sample can show, fractals use it to pick their iteration count
+double all_intersections( RenderContext* context, double* position, Intersect* intersect, double detail, ObjectList* objects ){
+	Object** object_array = context->object_array;
     double temp_distance;
 	double temp_min_distance = INFINITY;
-	int parse_count = 1;
-	while( parse_count < object_counter + 1 ){	//do the raymarching with a ray
-		double temp_position[3] = {position[0], position[1], position[2]};
+	Vec3 world_position = vec3_load( position );
+	int list_count = 0;
+	render_stats.sdf_evaluations += objects->count;
+	while( list_count < objects->count ){	//do the raymarching with a ray
+		int parse_count = objects->indices[list_count];
+		Vec3 temp_position = world_position;
 		if( object_array[parse_count]->infinite_interval > 0 ){
-			infinite_shape( temp_position, object_array[parse_count]->infinite_interval );
+			temp_position = infinite_shape( temp_position, vec3_load( object_array[parse_count]->position ), object_array[parse_count]->infinite_interval );
 		}
-		apply_transformations( temp_position, object_array[parse_count]->position, object_array[parse_count]->rotation );
+		temp_position = apply_transformations( temp_position, object_array[parse_count] );
 
 		if( object_array[parse_count]->kind == Sphere ){
 			temp_distance = sphere_sdf( temp_position, object_array[parse_count]->sphere.radius );
-
-			store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
-			temp_min_distance = min( temp_distance, temp_min_distance );
-
 		}else if( object_array[parse_count]->kind == Plane ){ //See if a plane overshadows our point of intersection
-			temp_distance = plane_sdf( temp_position, object_array[parse_count]->plane.normal );
-
-			store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
-			temp_min_distance = min( temp_distance, temp_min_distance );
-
+			temp_distance = plane_sdf( temp_position, vec3_load( object_array[parse_count]->plane.normal ) );
 		}else if( object_array[parse_count]->kind == Donut ){
 			temp_distance = donut_sdf( temp_position, object_array[parse_count]->donut.radius,
 										object_array[parse_count]->donut.thickness );
-
-			store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
-			temp_min_distance = min( temp_distance, temp_min_distance );
-
 		}else if( object_array[parse_count]->kind == Box ){
-			temp_distance = box_sdf( temp_position, object_array[parse_count]->box.dimensions );
-			
-			store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
-			temp_min_distance = min( temp_distance, temp_min_distance );
-
+			temp_distance = box_sdf( temp_position, vec3_load( object_array[parse_count]->box.dimensions ) );
 		}else if( object_array[parse_count]->kind == Cone ){
-			temp_distance = cone_sdf( temp_position, object_array[parse_count]->cone.angle,
+			temp_distance = cone_sdf( temp_position, object_array[parse_count]->cone.cos_sin,
 										object_array[parse_count]->cone.height );
-			
-			store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
-			temp_min_distance = min( temp_distance, temp_min_distance );
-
 		}else if( object_array[parse_count]->kind == EternalCylinder ){
 			temp_distance = eternal_cylinder_sdf( temp_position, object_array[parse_count]->eternal_cylinder.radius );
-			
-			store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
-			temp_min_distance = min( temp_distance, temp_min_distance );
-
-		}else if( object_array[parse_count]->kind == Mandelbulb ){
-			temp_distance = mandelbulb_sdf( temp_position );
-			
-			store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
-			temp_min_distance = min( temp_distance, temp_min_distance );
-
+		}else if( is_fractal( object_array[parse_count]->kind ) ){
+			temp_distance = fractal_sdf( temp_position, object_array[parse_count], detail, object_array[0]->camera.lod_bias );
 		}else{	//If a light was found, skip it
-			//do nothing
+			list_count++;
+			continue;
 		}
-		parse_count++;
+		temp_distance *= object_array[parse_count]->step_scale;	//A bound that changes faster than the distance overshoots unless scaled down
+
+		store_obj_data( temp_distance, temp_min_distance, parse_count, intersect );
+		temp_min_distance = min( temp_distance, temp_min_distance );
+		list_count++;
 	}
 	return temp_min_distance;
 }
 
-Intersect* raymarch(double* Ro, double* Rd){	//Find object intersections
+double hit_threshold( MarchLimits* limits, double distance ){	//Surfaces closer than this are hit, grows with the pixel footprint
+	return max( INTERSECTION_LIMIT, limits->epsilon + limits->footprint * distance );
+}
+
+int advance_ray( Intersect* intersection, double* Rd, MarchLimits* limits ){	//Move along Rd by min_distance, returns 1 once the ray hit something or escaped
+	double threshold = hit_threshold( limits, intersection->distance );
+	intersection->position[0] += Rd[0]*intersection->min_distance;
+	intersection->position[1] += Rd[1]*intersection->min_distance;
+	intersection->position[2] += Rd[2]*intersection->min_distance;
+	intersection->distance += intersection->min_distance;
+	intersection->steps++;
+	if( intersection->min_distance < threshold ){
+		return 1;
+	}
+	if( intersection->distance > limits->far_plane ){	//Nothing left to hit out here
+		intersection->min_distance = INFINITY;
+		return 1;
+	}
+	return 0;
+}
+
+static inline void record_dependency( int object_index ){
+	recorded_deps->objects[( object_index / 64 ) % DEPENDENCY_WORDS] |= 1ULL << ( object_index % 64 );
+}
+
+int march_step( Intersect* intersection, double* Rd, MarchLimits* limits ){	//Take one step along Rd, returns 1 once the ray hit something or escaped
+	double threshold = hit_threshold( limits, intersection->distance );
+	all_intersections( limits->context, intersection->position, intersection, threshold, limits->objects );
+	if( limits->unbinned != NULL && intersection->min_distance >= limits->bin_margin ){	//An object left out of the bin could be nearer
+		unbinned_step( intersection, threshold, limits );
+	}
+	if( intersection->min_distance < -threshold && intersection->steps > 0 ){	//The last step went through a surface, some bound is too optimistic
+		render_stats.oversteps++;
+	}
+	return advance_ray( intersection, Rd, limits );
+}
+
+// Distance along Rd to the surface grown by margin, 0 if Ro is already inside it, INFINITY on a miss. The grown
+// box keeps sharp corners, so it holds every point within margin of the box
+double analytic_intersection( Object* object, double* Ro, double* Rd, double margin ){
+	Vec3 origin = apply_transformations( vec3_load( Ro ), object );
+	Vec3 direction = mat3_apply( &object->rotation_matrix, vec3_load( Rd ) );	//Rotations keep lengths, so distances along the ray carry over
+
+	if( object->kind == Sphere ){
+		double b = vec3_dot( origin, direction );
+		double c = vec3_dot( origin, origin ) - sqr( object->sphere.radius + margin );
+		if( c <= 0 ){
+			return 0.0;
+		}
+		double discriminant = sqr( b ) - c;
+		if( b >= 0 || discriminant < 0 ){
+			return INFINITY;
+		}
+		return -b - sqrt( discriminant );
+	}else if( object->kind == Plane ){
+		double height = plane_sdf( origin, vec3_load( object->plane.normal ) ) - margin;
+		double approach = plane_sdf( direction, vec3_load( object->plane.normal ) );
+		if( height <= 0 ){
+			return 0.0;
+		}
+		if( approach >= 0 ){
+			return INFINITY;
+		}
+		return -height / approach;
+	}else if( object->kind == Box ){	//Slab test against the half extents box_sdf() uses
+		double entry = -INFINITY;
+		double exit = INFINITY;
+		double slab_origin[3];
+		double slab_direction[3];
+		vec3_store( origin, slab_origin );
+		vec3_store( direction, slab_direction );
+		for( int i = 0; i < 3; i++ ){
+			if( slab_direction[i] == 0.0 ){
+				if( fabs( slab_origin[i] ) > object->box.dimensions[i] + margin ){
+					return INFINITY;
+				}
+				continue;
+			}
+			double t1 = ( -object->box.dimensions[i] - margin - slab_origin[i] ) / slab_direction[i];
+			double t2 = ( object->box.dimensions[i] + margin - slab_origin[i] ) / slab_direction[i];
+			entry = max( entry, min( t1, t2 ) );
+			exit = min( exit, max( t1, t2 ) );
+		}
+		if( exit < max( entry, 0.0 ) ){
+			return INFINITY;
+		}
+		return max( entry, 0.0 );
+	}
+	return INFINITY;
+}
+
+double nearest_analytic( RenderContext* context, double* Ro, double* Rd, double margin ){	//Nearest analytic_intersection() of any analytic object
+	ObjectList* analytic_objects = &context->analytic_objects;
+	double nearest = INFINITY;
+	for( int i = 0; i < analytic_objects->count; i++ ){
+		nearest = min( nearest, analytic_intersection( context->object_array[ analytic_objects->indices[i] ], Ro, Rd, margin ) );
+	}
+	return nearest;
+}
+
+// --hybrid: only march the SDF-only objects up to where the ray could first come within its hit threshold
+// of an analytic object, then resume_hybrid_march() hands the rest of the ray to the full march, so hits and
+// grazing rays follow the same rule as without --hybrid. The threshold grows along the ray, so the handover
+// is found against the analytic objects grown by the threshold where they are first reached, at the least
+// growth, or at the far plane if even that misses them all
+void start_hybrid_march( HybridMarch* hybrid, double* Ro, double* Rd, MarchLimits* limits ){
+	RenderContext* context = limits->context;
+	double nearest_margin = hit_threshold( limits, 0.0 );
+	double reached = nearest_analytic( context, Ro, Rd, nearest_margin );
+	double margin = hit_threshold( limits, min( reached, limits->far_plane ) );
+	hybrid->distance = margin > nearest_margin ? nearest_analytic( context, Ro, Rd, margin ) : reached;
+	hybrid->far_plane = limits->far_plane;
+	if( hybrid->distance > limits->far_plane ){	//The full march would escape before it gets there
+		hybrid->distance = INFINITY;
+	}else{
+		limits->far_plane = hybrid->distance;
+	}
+	if( limits->objects == &context->scene_objects ){	//The objects of a bin are marched ones already
+		limits->objects = &context->marched_objects;
+	}
+}
+
+// Call once the march has finished. If it stopped at the handover, moves the ray there and widens limits
+// back to every object, returns 1 if the march has to go on
+int resume_hybrid_march( Intersect* intersection, double* Rd, HybridMarch* hybrid, MarchLimits* limits ){
+	if( !isinf( intersection->min_distance ) || isinf( hybrid->distance ) ){
+		return 0;
+	}
+	double skip = hybrid->distance - intersection->distance;	//The last step's distance bound already cleared the SDF-only objects up to here
+	intersection->position[0] += Rd[0]*skip;
+	intersection->position[1] += Rd[1]*skip;
+	intersection->position[2] += Rd[2]*skip;
+	intersection->distance = hybrid->distance;
+	limits->far_plane = hybrid->far_plane;
+	limits->objects = &limits->context->scene_objects;
+	limits->unbinned = NULL;
+	hybrid->distance = INFINITY;
+	return 1;
+}
+
+Intersect* raymarch(double* Ro, double* Rd, MarchLimits* limits){	//Find object intersections
 	Intersect* intersection = malloc(sizeof(Intersect));
-	int num_steps = 0;
+	HybridMarch hybrid;
+	MarchLimits hybrid_limits;
+	if( limits->context->options.hybrid ){
+		hybrid_limits = *limits;
+		start_hybrid_march( &hybrid, Ro, Rd, &hybrid_limits );
+		limits = &hybrid_limits;
+	}
 
 	intersection->min_distance = INFINITY;
 	intersection->position[0] = Ro[0];
 	intersection->position[1] = Ro[1];
 	intersection->position[2] = Ro[2];
+	intersection->distance = 0;
+	intersection->steps = 0;
 	
-    while(num_steps++ < MAX_STEPS){
-		all_intersections( intersection->position, intersection );
-        intersection->position[0] += Rd[0]*intersection->min_distance;
-        intersection->position[1] += Rd[1]*intersection->min_distance;
-        intersection->position[2] += Rd[2]*intersection->min_distance;
-        if( intersection->min_distance < INTERSECTION_LIMIT || intersection->min_distance > OUTER_BOUNDS ) {
-            break;
-        }
-    }
-
+	do{
+		while(intersection->steps < limits->max_steps && limits->objects->count > 0){
+			int finished = march_step( intersection, Rd, limits );
+			if( recorded_deps != NULL && intersection->min_distance < DEPENDENCY_REACH * hit_threshold( limits, intersection->distance ) ){
+				record_dependency( intersection->best_index );	//Far off objects only change step sizes, not what the ray hits
+			}
+			if( finished ) {
+				break;
+			}
+		}
+	}while( limits->context->options.hybrid && resume_hybrid_march( intersection, Rd, &hybrid, limits ) );
 	return intersection;
 }
 
-void intersect_normal( double* normal, double* intersect_pos ){
+void intersect_normal( RenderContext* context, double* normal, double* intersect_pos, double detail ){	//Use the same detail the ray was marched at, or fractal shading breaks up
 	double sampling_interval = .0001;
 
 	//Intersect coordinates to make things easier to read
@@ -248,33 +389,114 @@ void intersect_normal( double* normal, double* intersect_pos ){
 	double y = intersect_pos[1];
 	double z = intersect_pos[2];
 
-	normal[0] = all_intersections((double[3]){x + sampling_interval, y, z}, NULL) -
-				all_intersections((double[3]){x - sampling_interval, y, z}, NULL);
-	normal[1] = all_intersections((double[3]){x, y + sampling_interval, z}, NULL) -
-				all_intersections((double[3]){x, y - sampling_interval, z}, NULL);
-	normal[2] = all_intersections((double[3]){x, y, z + sampling_interval}, NULL) -
-				all_intersections((double[3]){x, y, z - sampling_interval}, NULL);
+	normal[0] = all_intersections(context, (double[3]){x + sampling_interval, y, z}, NULL, detail, &context->scene_objects) -
+				all_intersections(context, (double[3]){x - sampling_interval, y, z}, NULL, detail, &context->scene_objects);
+	normal[1] = all_intersections(context, (double[3]){x, y + sampling_interval, z}, NULL, detail, &context->scene_objects) -
+				all_intersections(context, (double[3]){x, y - sampling_interval, z}, NULL, detail, &context->scene_objects);
+	normal[2] = all_intersections(context, (double[3]){x, y, z + sampling_interval}, NULL, detail, &context->scene_objects) -
+				all_intersections(context, (double[3]){x, y, z - sampling_interval}, NULL, detail, &context->scene_objects);
 
 	normalize(normal);
 }
 
-Object* find_light(){ // Just find 1 light for now
+double radial_attenuation( Object* light, double distance ){	//1 / (a2*d^2 + a1*d + a0)
+	double denominator = light->light.radial_a2 * sqr( distance ) + light->light.radial_a1 * distance + light->light.radial_a0;
+	if( denominator <= 0 ){
+		return 1.0;
+	}
+	return 1.0 / denominator;
+}
+
+double angular_attenuation( Object* light, double* light_to_intersect ){	//Spotlight falloff, lights without a theta shine everywhere
+	if( light->light.theta <= 0 ){
+		return 1.0;
+	}
+	double cos_alpha = dot_product( light->light.direction, light_to_intersect );
+	if( cos_alpha < fast_cos( light->light.theta ) ){
+		return 0.0;
+	}
+	return fast_pow( cos_alpha, light->light.angular_a0 );
+}
+
+double influence_radius( Object* light ){	//Distance past which the light can no longer change a pixel
+	//Diffuse and specular together can reach twice the light color, cull once that falls below LIGHT_CULL_THRESHOLD
+	double brightest = 2 * max( light->light.color[0], max( light->light.color[1], light->light.color[2] ) );
+	double a2 = light->light.radial_a2;
+	double a1 = light->light.radial_a1;
+	double a0 = light->light.radial_a0;
+	double limit = brightest / LIGHT_CULL_THRESHOLD;	//Attenuation denominator at which the light becomes invisible
+
+	if( brightest <= 0 || a0 >= limit ){
+		return 0.0;
+	}
+	if( a2 > 0 ){
+		return ( -a1 + sqrt( sqr( a1 ) - 4 * a2 * ( a0 - limit ) ) ) / ( 2 * a2 );
+	}
+	if( a1 > 0 ){
+		return ( limit - a0 ) / a1;
+	}
+	return INFINITY;
+}
+
+void extract_lights( RenderContext* context ){	//Move every light from object_array into light_array
+	Object** object_array = context->object_array;
 	int parse_count = 1;
-	while(parse_count++ < object_counter + 1){
-		if(object_array[parse_count]->kind == Light) {
-			return object_array[parse_count];
+	int kept = 1;
+	context->light_counter = 0;
+	while( parse_count < context->object_counter + 1 ){
+		if( object_array[parse_count]->kind == Light ){
+			object_array[parse_count]->light.influence_radius = influence_radius( object_array[parse_count] );
+			context->light_array[context->light_counter++] = object_array[parse_count];
+		}else{
+			object_array[kept++] = object_array[parse_count];
 		}
+		parse_count++;
 	}
+	context->object_counter = kept - 1;
 }
 
-double calculate_shadow( double* light_pos, double* light_direction, double* intersect_pos ){
-	Intersect* light_collision = raymarch(light_pos, light_direction);
-	if( distance_between( light_collision->position, intersect_pos ) <= 1 ){
-		free(light_collision);
+double shadow_factor( double* light_collision, double* intersect_pos ){	//Lit if the ray from the light got all the way to our intersection
+	if( distance_between( light_collision, intersect_pos ) <= SHADOW_TOLERANCE ){
 		return 1.0;
 	}
+	return SHADOW_MULT;
+}
+
+// Shadow rays only need to be as precise as the pixel they shade, and are decided once they pass it
+void shadow_ray_limits( RenderContext* context, MarchLimits* limits, Object* light, double* intersect_pos, double epsilon ){
+	limits->objects = &context->scene_objects;
+	limits->unbinned = NULL;
+	limits->epsilon = epsilon;
+	limits->footprint = 0.0;
+	limits->far_plane = distance_between( light->position, intersect_pos ) + SHADOW_TOLERANCE;
+	limits->max_steps = context->camera_limits.max_steps;
+	limits->context = context;
+}
+
+// Reflection and refraction rays keep the pixel cone of the ray that spawned them, and can't travel
+// further than it takes to leave the sphere around the camera that holds every bounded object
+void secondary_ray_limits( RenderContext* context, MarchLimits* limits, double* origin, double epsilon ){
+	limits->objects = &context->scene_objects;
+	limits->unbinned = NULL;
+	limits->epsilon = epsilon;
+	limits->footprint = context->camera_limits.footprint;
+	limits->far_plane = context->camera_limits.far_plane;
+	if( context->object_array[0]->camera.far_plane <= 0 && !isinf( context->scene_radius ) ){
+		limits->far_plane = magnitude( origin ) + context->scene_radius;
+	}
+	limits->max_steps = context->camera_limits.max_steps;
+	limits->context = context;
+}
+
+double calculate_shadow( RenderContext* context, Object* light, double* light_direction, double* intersect_pos, double epsilon ){
+	MarchLimits limits;
+	shadow_ray_limits( context, &limits, light, intersect_pos, epsilon );
+	Intersect* light_collision = raymarch(light->position, light_direction, &limits);
+	double shadow_mult = shadow_factor( light_collision->position, intersect_pos );
+	render_stats.shadow_rays++;
+	render_stats.shadow_steps += light_collision->steps;
 	free(light_collision);
-	return 0.25; //Reduce color to 25% brightness
+	return shadow_mult;
 }
 
 void diffuse_color( double* color, double* normal, double* intersect_to_light, Object* light, Object* object ){
@@ -289,100 +511,245 @@ void specular_color( double* color, double* camera_direction, double* normal, do
 	double reflected_vector[3];
 	reflect( intersect_to_light, normal, reflected_vector );
 
-	double specular_intensity = pow( max( 0,dot_product( reflected_vector, camera_direction ) ), object->shininess );
+	double specular_intensity = fast_pow( max( 0,dot_product( reflected_vector, camera_direction ) ), object->shininess );
 
 	color[0] += specular_intensity * light->light.color[0] * min(1, object->shininess / 10.0);
 	color[1] += specular_intensity * light->light.color[1] * min(1, object->shininess / 10.0);
 	color[2] += specular_intensity * light->light.color[2] * min(1, object->shininess / 10.0);
 }
 
-void calculate_color( double* camera_direction, double* color, Intersect* intersection ){
-	double normal[3] = {0.0, 0.0, 0.0};
-	intersect_normal(normal, intersection->position);
-
-	Object* light = find_light();
+void rank_light_sample( LightSample* ranked, int* num_ranked, LightSample* sample, double* unranked_color ){
+	//Keep the MAX_SHADOW_RAYS most important samples sorted, anything pushed out is summed into unranked_color
+	LightSample evicted;
+	int i;
+	if( *num_ranked == MAX_SHADOW_RAYS ){
+		if( sample->importance <= ranked[MAX_SHADOW_RAYS - 1].importance ){
+			unranked_color[0] += sample->color[0];
+			unranked_color[1] += sample->color[1];
+			unranked_color[2] += sample->color[2];
+			return;
+		}
+		evicted = ranked[MAX_SHADOW_RAYS - 1];
+		unranked_color[0] += evicted.color[0];
+		unranked_color[1] += evicted.color[1];
+		unranked_color[2] += evicted.color[2];
+		(*num_ranked)--;
+	}
+	i = (*num_ranked)++;
+	while( i > 0 && ranked[i - 1].importance < sample->importance ){
+		ranked[i] = ranked[i - 1];
+		i--;
+	}
+	ranked[i] = *sample;
+}
 
-	double intersect_to_light[3];
-	intersect_to_light[0] = light->position[0] - intersection->position[0];
-	intersect_to_light[1] = light->position[1] - intersection->position[1];
-	intersect_to_light[2] = light->position[2] - intersection->position[2];
-	normalize( intersect_to_light );
+// Fills ranked with up to MAX_SHADOW_RAYS unshadowed light samples, most important first, and returns how many there are.
+// Lights that made it past culling but not into the shadow ray budget are summed into unranked_color.
+int gather_light_samples( RenderContext* context, double* camera_direction, double* normal, double* position,
+							Object* object, LightSample* ranked, double* unranked_color ){
+	LightSample sample;
+	int num_ranked = 0;
+
+	unranked_color[0] = 0.0;
+	unranked_color[1] = 0.0;
+	unranked_color[2] = 0.0;
+
+	for( int i = 0; i < context->light_counter; i++ ){	//Gather the unshadowed contribution of every light in range
+		Object* light = context->light_array[i];
+		double intersect_to_light[3];
+		intersect_to_light[0] = light->position[0] - position[0];
+		intersect_to_light[1] = light->position[1] - position[1];
+		intersect_to_light[2] = light->position[2] - position[2];
+		double light_distance = magnitude( intersect_to_light );
+		if( light_distance > light->light.influence_radius ){	//Too far away to matter, skip before any shading
+			continue;
+		}
+		normalize( intersect_to_light );
 
-	double light_to_intersect[3] = {-intersect_to_light[0], -intersect_to_light[1], -intersect_to_light[2]};
+		double light_to_intersect[3] = {-intersect_to_light[0], -intersect_to_light[1], -intersect_to_light[2]};
+		double attenuation = radial_attenuation( light, light_distance ) * angular_attenuation( light, light_to_intersect );
+		if( attenuation <= 0 ){
+			continue;
+		}
 
-	diffuse_color( color, normal, intersect_to_light, light, object_array[ intersection->best_index ] );
-	specular_color( color, camera_direction, normal, intersect_to_light, light, object_array[ intersection->best_index ] );
+		diffuse_color( sample.color, normal, intersect_to_light, light, object );
+		specular_color( sample.color, camera_direction, normal, intersect_to_light, light, object );
+		vector_mult( sample.color, attenuation );
+		sample.importance = max( sample.color[0], max( sample.color[1], sample.color[2] ) );
+		if( sample.importance < LIGHT_CULL_THRESHOLD ){	//Invisible even when fully lit, don't march its shadow
+			continue;
+		}
+		sample.light = light;
+		sample.light_index = i;
+		rank_light_sample( ranked, &num_ranked, &sample, unranked_color );
+	}
+	return num_ranked;
+}
 
-	double shadow_mult = calculate_shadow( light->position, light_to_intersect, intersection->position );
-	vector_mult( color, shadow_mult );
+void shadow_ray_direction( double* direction, Object* light, double* position ){	//Normalized direction from the light to position
+	direction[0] = position[0] - light->position[0];
+	direction[1] = position[1] - light->position[1];
+	direction[2] = position[2] - light->position[2];
+	normalize( direction );
+}
 
+void resolve_unranked_lights( double* color, double* unranked_color, double visibility, int num_ranked ){
+	if( num_ranked > 0 ){	//Lights over budget are assumed to be as visible as the ones we did test
+		color[0] += unranked_color[0] * visibility / num_ranked;
+		color[1] += unranked_color[1] * visibility / num_ranked;
+		color[2] += unranked_color[2] * visibility / num_ranked;
+	}
 	color[0] = clamp( color[0] );
 	color[1] = clamp( color[1] );
 	color[2] = clamp( color[2] );
 }
 
-void raymarch_scene(double** pixel_buffer, int N, int M){	//This raymarches our object_array
-	int parse_count = 0;
-	int pixel_count = 0;
-	int i;
-	double Ro[3];
-	double Rd[3];
-	double color[3] = {0,0,0};
-	double cx = 0;
-	double cy = 0;
-	double w;
-	double h;
-	double pixwidth;
-	double pixheight;
-	Intersect* intersection;
-	
-	if(object_array[parse_count]->kind != Camera){	//If camera is not present, throw an error
-		fprintf(stderr, "Error: You must have one object of type camera\n");
-		exit(1);
-	}
-	
-	//Grab camera width and height, and calculate our pixel widths and pixel heights
-	w = object_array[parse_count]->camera.width;
-	pixwidth = w/N;
-	h = object_array[parse_count]->camera.height;
-	pixheight = h/M;
-	parse_count++;
-	
-	//Create origin point for our vector
-	Ro[0] = 0;
-	Ro[1] = 0;
-	Ro[2] = 0;
-	
-	for(int y = 0; y < M; y += 1){	//Raymarch for every pixel
-		for(int x = 0; x < N; x += 1){
-			Rd[0] = cx - (w/2) + pixwidth * (x + .5);	//Create direction vector
-			Rd[1] = cy - (h/2) + pixheight * (y + .5);
-			Rd[2] = 1;
-			normalize(Rd);
-			intersection = raymarch(Ro, Rd);
-
-			
-			if(intersection->min_distance <= OUTER_BOUNDS){	//If our closest intersection is valid...
-				calculate_color(Rd, color, intersection);
-
-				pixel_buffer[(int)((N*M) - (floor(pixel_count/N) + 1)*N)+ pixel_count%N][0] = color[0];
-				pixel_buffer[(int)((N*M) - (floor(pixel_count/N) + 1)*N)+ pixel_count%N][1] = color[1];
-				pixel_buffer[(int)((N*M) - (floor(pixel_count/N) + 1)*N)+ pixel_count%N][2] = color[2];
-				
-				parse_count = 1;
-			}else{
-				parse_count = 1;
+// Also hands back the normal, returns the share of the shadow-tested lights' light that got through
+double calculate_color( RenderContext* context, double* camera_direction, double* color, double* normal, Intersect* intersection ){
+	double epsilon = hit_threshold( &context->camera_limits, intersection->distance );
+	double lap = trace_clock();
+	intersect_normal(context, normal, intersection->position, epsilon);
+	lap = trace_lap( TRACE_NORMALS, lap );
+
+	LightSample ranked[MAX_SHADOW_RAYS];
+	double unranked_color[3];	//Lights past the shadow ray budget
+	double visibility = 0.0;
+	int num_ranked = gather_light_samples( context, camera_direction, normal, intersection->position,
+											context->object_array[ intersection->best_index ], ranked, unranked_color );
+
+	color[0] = 0.0;
+	color[1] = 0.0;
+	color[2] = 0.0;
+
+	for( int i = 0; i < num_ranked; i++ ){	//March shadow rays only for the most important lights
+		double shadow_mult = cached_shadow( context, ranked[i].light_index, intersection->position );
+		if( shadow_mult == SHADOW_UNKNOWN ){	//No cache, or we're on the edge of a shadow
+			double light_to_intersect[3];
+			shadow_ray_direction( light_to_intersect, ranked[i].light, intersection->position );
+			lap = trace_lap( TRACE_SHADING, lap );
+			shadow_mult = calculate_shadow( context, ranked[i].light, light_to_intersect, intersection->position, epsilon );
+			lap = trace_lap( TRACE_SHADOWS, lap );
+			if( recorded_deps != NULL ){
+				recorded_deps->lights |= 1ULL << ( ranked[i].light_index % 64 );
 			}
-			pixel_count++;
-			free(intersection);
+		}else{
+			render_stats.cached_shadows++;
 		}
+		visibility += shadow_mult;
+		color[0] += ranked[i].color[0] * shadow_mult;
+		color[1] += ranked[i].color[1] * shadow_mult;
+		color[2] += ranked[i].color[2] * shadow_mult;
 	}
+
+	resolve_unranked_lights( color, unranked_color, visibility, num_ranked );
+	trace_lap( TRACE_SHADING, lap );
+	return num_ranked > 0 ? visibility / num_ranked : 1.0;
 }
 
-void create_image(double** pixel_buffer, char* output, int width, int height){	//Stores pixel array info into a .ppm file
-	FILE *output_pointer = fopen(output, "wb");	/*Open the output file*/
-	char buffer[width*height*3];
+static const double cube_face_axes[6][3][3] = {	//Forward, right and up of every cube face, the order of RenderView.face
+	{ {  1, 0, 0 }, { 0, 0, -1 }, { 0, 1,  0 } },
+	{ { -1, 0, 0 }, { 0, 0,  1 }, { 0, 1,  0 } },
+	{ { 0,  1, 0 }, { 1, 0,  0 }, { 0, 0, -1 } },
+	{ { 0, -1, 0 }, { 1, 0,  0 }, { 0, 0,  1 } },
+	{ { 0, 0,  1 }, {  1, 0, 0 }, { 0, 1,  0 } },
+	{ { 0, 0, -1 }, { -1, 0, 0 }, { 0, 1,  0 } }
+};
+
+void camera_ray_direction( RenderContext* context, double* Rd, int x, int y, int N, int M ){	//Through the center of pixel (x, y), y counts up from the bottom row
+	if( context->view.projection == PROJECTION_EQUIRECTANGULAR ){	//Longitude from -pi on the left edge, latitude from -pi/2 on the bottom row
+		double longitude = ( ( x + .5 ) / N * 2 - 1 ) * M_PI;
+		double latitude = ( ( y + .5 ) / M - .5 ) * M_PI;
+		Rd[0] = cos( latitude ) * sin( longitude );
+		Rd[1] = sin( latitude );
+		Rd[2] = cos( latitude ) * cos( longitude );
+		return;
+	}
+	if( context->view.projection == PROJECTION_CUBE_FACE ){	//The face spans -1 to 1 across at distance 1, a square image covers all of it
+		const double (*axes)[3] = cube_face_axes[context->view.face];
+		double u = ( x + .5 ) / N * 2 - 1;
+		double v = ( y + .5 - M / 2.0 ) * 2 / N;
+		for( int i = 0; i < 3; i++ ){
+			Rd[i] = axes[0][i] + u * axes[1][i] + v * axes[2][i];
+		}
+		normalize( Rd );
+		return;
+	}
+	double w = context->object_array[0]->camera.width;
+	double h = context->object_array[0]->camera.height;
+	double pixwidth = w/N;
+	double pixheight = h/M;
+
+	Rd[0] = -(w/2) + pixwidth * (x + .5);	//Create direction vector
+	Rd[1] = -(h/2) + pixheight * (y + .5);
+	Rd[2] = 1;
+	normalize(Rd);
+}
+
+Intersect* march_camera_ray( RenderContext* context, double* Rd, int x, int y, int N, int M ){	//Camera ray through pixel (x, y), y counts up from the bottom row
+	double Ro[3] = {context->view.eye[0], context->view.eye[1], context->view.eye[2]};
+	Intersect* intersection;
+	MarchLimits limits = context->camera_limits;
+	if(context->options.binning){
+		limits.objects = binned_objects(context, x, M - 1 - y, &limits.unbinned);
+		limits.bin_margin = context->bin_margin;
+	}
+
+	camera_ray_direction(context, Rd, x, y, N, M);
+	double lap = trace_clock();
+	intersection = raymarch(Ro, Rd, &limits);
+	trace_lap(TRACE_MARCH, lap);
+	render_stats.camera_rays++;
+	render_stats.camera_steps += intersection->steps;
+	if(recorded_deps != NULL){
+		recorded_deps->hit_object = isinf(intersection->min_distance) ? 0 : intersection->best_index;
+		recorded_deps->distance = intersection->distance;
+		recorded_deps->threshold = hit_threshold(&context->camera_limits, intersection->distance);
+	}
+	return intersection;
+}
+
+double shade_camera_hit( RenderContext* context, double* Rd, double* color, double* normal, Intersect* intersection ){	//Black with a zero normal if the ray escaped, returns calculate_color()'s light share
+	if(!isinf(intersection->min_distance)){	//If our closest intersection is valid...
+		return calculate_color(context, Rd, color, normal, intersection);
+	}
+	color[0] = 0;
+	color[1] = 0;
+	color[2] = 0;
+	normal[0] = 0;
+	normal[1] = 0;
+	normal[2] = 0;
+	return 1.0;
+}
+
+// Color of pixel (x, y) of an N x M image, y counts up from the bottom row. pixel is its index in the
+// framebuffer, where its AOVs go
+void trace_pixel( RenderContext* context, double* color, int pixel, int x, int y, int N, int M ){
+	double Rd[3];
+	double normal[3];
+	Intersect* intersection = march_camera_ray(context, Rd, x, y, N, M);
+	double light_share = shade_camera_hit(context, Rd, color, normal, intersection);
+	if(context->options.aovs){
+		record_camera_aovs(context, pixel, intersection);
+		record_shading_aovs(context, pixel, normal, light_share);
+	}
+	free(intersection);
+}
+
+// Writes the image to file_name as a P6 PPM, PNG or QOI. The format is passed in so temporary files can
+// be written in the format of the file they replace
+RenderStatus write_image(RenderContext* context, double** pixel_buffer, char* file_name, ImageFormat format, int width, int height){
+	FILE *output_pointer = fopen(file_name, "wb");	/*Open the output file*/
+	if(output_pointer == NULL){
+		return render_fail(context, RENDER_ERROR_FILE, "Could not write image \"%s\"", file_name);
+	}
+	unsigned char* buffer = malloc((size_t)width*height*3);	//Too big for the stack of a library caller's thread
+	if(buffer == NULL){
+		fclose(output_pointer);
+		return render_fail(context, RENDER_ERROR_MEMORY, "Out of memory while writing \"%s\"", file_name);
+	}
 	int counter = 0;
+	RenderStatus status = RENDER_OK;
+	trace_begin("create_image", TRACE_NO_INDEX);
 	
 	while(counter < width*height){	//Iterate through pixel array, and store values into a character buffer
 		buffer[counter*3] = (int)(255*pixel_buffer[counter][0]);
@@ -390,23 +757,188 @@ void create_image(double** pixel_buffer, char* output, int width, int height){	/
 		buffer[counter*3 + 2] = (int)(255*pixel_buffer[counter][2]);
 		counter++;
 	}
-	fprintf(output_pointer, "P6\n%d %d\n255\n", width, height);	//Write P6 header to output.ppm
-	fwrite(buffer, sizeof(char), width*height*3, output_pointer);	//Write buffer to output.ppm
+	if(format == IMAGE_PNG){
+		status = encode_png(context, buffer, width, height, output_pointer, file_name);
+	}else if(format == IMAGE_QOI){
+		status = encode_qoi(context, buffer, width, height, output_pointer, file_name);
+	}else{
+		fprintf(output_pointer, "P6\n%d %d\n255\n", width, height);	//Write P6 header to output.ppm
+		fwrite(buffer, sizeof(char), width*height*3, output_pointer);	//Write buffer to output.ppm
+	}
 	
-	fclose(output_pointer);
+	free(buffer);
+	trace_end("create_image");
+	if(fclose(output_pointer) != 0 && status == RENDER_OK){
+		return render_fail(context, RENDER_ERROR_FILE, "Could not write image \"%s\"", file_name);
+	}
+	return status;
+}
+
+RenderStatus create_image(RenderContext* context, double** pixel_buffer, char* output, int width, int height){	//Stores pixel array info into a .ppm, .png or .qoi file, by output's extension
+	return write_image(context, pixel_buffer, output, image_format(output), width, height);
+}
+
+double object_bounds_radius( Object* object ){	//Radius around the object's position that holds all of it, INFINITY if unbounded
+	if( object->infinite_interval > 0 ){
+		return INFINITY;
+	}
+	if( object->kind == Sphere ){
+		return object->sphere.radius;
+	}else if( object->kind == Box ){
+		return magnitude( object->box.dimensions );
+	}else if( object->kind == Donut ){
+		return 2 * object->donut.radius + object->donut.thickness;	//donut_sdf() uses the radius as half the ring size
+	}else if( object->kind == Cone ){
+		return object->cone.height / cos( object->cone.angle );
+	}else if( is_fractal( object->kind ) ){
+		return object->shell_radius;
+	}
+	return INFINITY;	//Planes and eternal cylinders go on forever
+}
+
+// Radius around the object's position past which its SDF is no less than the distance to that sphere, so
+// --binning can leave the object out wherever that distance is large enough. INFINITY if there isn't one
+double object_cull_radius( Object* object ){
+	if( object->kind == Cone ){	//Past the tip the bound of the side falls well below the distance
+		return INFINITY;
+	}else if( is_fractal( object->kind ) ){	//Past the margin fractal_sdf() is the shell's exact distance
+		return object->shell_radius * ( 1 + FRACTAL_SHELL_MARGIN );
+	}
+	return object_bounds_radius( object );	//Exact distances everywhere
+}
+
+double default_lipschitz( Object* object ){	//See Object.lipschitz, scenes can override it per object
+	if( object->kind == Mandelbulb ){
+		return MANDELBULB_LIPSCHITZ;
+	}
+	return 1.0;	//Exact distances, the cone's bound and rotations and repetition of them don't change faster than the distance
+}
+
+int is_analytic( Object* object ){	//Objects analytic_intersection() can handle
+	return object->infinite_interval <= 0 && ( object->kind == Sphere || object->kind == Plane || object->kind == Box );
+}
+
+// Split the objects into the ones --hybrid intersects analytically and the ones it marches, fold every
+// object's rotation into the matrix the SDFs apply and work out how far each may step
+void setup_object_lists( RenderContext* context ){
+	Object** object_array = context->object_array;
+	ObjectList* scene_objects = &context->scene_objects;
+	ObjectList* analytic_objects = &context->analytic_objects;
+	ObjectList* marched_objects = &context->marched_objects;
+	scene_objects->count = 0;
+	analytic_objects->count = 0;
+	marched_objects->count = 0;
+	for( int i = 1; i < context->object_counter + 1; i++ ){
+		object_array[i]->rotation_matrix = mat3_rotation_xyz( vec3_load( object_array[i]->rotation ) );
+		if( is_fractal( object_array[i]->kind ) ){
+			object_array[i]->shell_radius = fractal_shell_radius( object_array[i] );
+		}
+		object_array[i]->cull_radius = object_cull_radius( object_array[i] );
+		if( object_array[i]->lipschitz <= 0 ){
+			object_array[i]->lipschitz = default_lipschitz( object_array[i] );
+		}
+		object_array[i]->step_scale = 1.0 / object_array[i]->lipschitz;
+		scene_objects->indices[scene_objects->count++] = i;
+		if( is_analytic( object_array[i] ) ){
+			analytic_objects->indices[analytic_objects->count++] = i;
+		}else{
+			marched_objects->indices[marched_objects->count++] = i;
+		}
+	}
+}
+
+// The camera's own epsilon_scale, else EPSILON_SCALE for scenes with a fractal, which gain detail down to the
+// pixel footprint, and 0 for the rest. Exact distances reach INTERSECTION_LIMIT in a few steps, and stopping
+// them short of the surface moves their shading and shadow edges
+double camera_epsilon_scale( RenderContext* context ){
+	double epsilon_scale = context->object_array[0]->camera.epsilon_scale;
+	if( epsilon_scale > 0 ){
+		return epsilon_scale;
+	}
+	for( int i = 1; i < context->object_counter + 1; i++ ){
+		if( is_fractal( context->object_array[i]->kind ) ){
+			return EPSILON_SCALE;
+		}
+	}
+	return 0.0;
+}
+
+void setup_march_limits( RenderContext* context, int N, int M ){	//Derive the pixel cone and far plane for this image and scene
+	Object** object_array = context->object_array;
+	Object* camera = object_array[0];
+	MarchLimits* camera_limits = &context->camera_limits;
+	double pixel_size = min( camera->camera.width / N, camera->camera.height / M );	//Image plane sits at z = 1
+	if( context->view.projection == PROJECTION_CUBE_FACE ){
+		pixel_size = 2.0 / N;
+	}else if( context->view.projection == PROJECTION_EQUIRECTANGULAR ){	//Angle across a pixel on the equator
+		pixel_size = min( 2 * M_PI / N, M_PI / M );
+	}
+	double scene_radius = 0.0;
+
+	for( int i = 1; i < context->object_counter + 1; i++ ){
+		scene_radius = max( scene_radius, magnitude( object_array[i]->position ) + object_bounds_radius( object_array[i] ) );
+	}
+	context->scene_radius = scene_radius;
+
+	camera_limits->objects = &context->scene_objects;
+	camera_limits->unbinned = NULL;
+	camera_limits->epsilon = 0.0;
+	camera_limits->footprint = pixel_size * camera_epsilon_scale( context );
+	camera_limits->far_plane = isinf( scene_radius ) ? OUTER_BOUNDS : scene_radius + magnitude( context->view.eye );	//The eye can sit off the camera
+	if( camera->camera.far_plane > 0 ){
+		camera_limits->far_plane = camera->camera.far_plane;
+	}
+	camera_limits->max_steps = camera->camera.max_steps > 0 ? camera->camera.max_steps : MAX_STEPS;
+	camera_limits->context = context;
 }
 
-void move_camera_to_front(){	//Moves camera object to the front of object_array
+void merge_render_stats(RenderContext* context){	//Add this thread's counts to the context's totals and start counting from zero
+	pthread_mutex_lock(&context->stats_lock);
+	context->stats.camera_rays += render_stats.camera_rays;
+	context->stats.camera_steps += render_stats.camera_steps;
+	context->stats.shadow_rays += render_stats.shadow_rays;
+	context->stats.shadow_steps += render_stats.shadow_steps;
+	context->stats.cached_shadows += render_stats.cached_shadows;
+	context->stats.interpolated_pixels += render_stats.interpolated_pixels;
+	context->stats.oversteps += render_stats.oversteps;
+	context->stats.sdf_evaluations += render_stats.sdf_evaluations;
+	pthread_mutex_unlock(&context->stats_lock);
+	metrics_publish(&render_stats);
+	memset(&render_stats, 0, sizeof(RenderStats));
+}
+
+// Keeps the reason for render_error() and hands the status back, so failures read return render_fail( ... )
+RenderStatus render_fail(RenderContext* context, RenderStatus status, const char* format, ...){
+	va_list arguments;
+	va_start(arguments, format);
+	vsnprintf(context->error, RENDER_ERROR_SIZE, format, arguments);
+	va_end(arguments);
+	return status;
+}
+
+void report_progress(RenderContext* context, long long done, long long total){	//A nonzero answer from the callback cancels the render
+	metrics_progress(done, total);
+	if(context->progress == NULL){
+		return;
+	}
+	pthread_mutex_lock(&context->progress_lock);
+	if(context->progress(total > 0 ? (double)done / total : 1.0, context->progress_data) != 0){
+		atomic_store(&context->cancelled, 1);
+	}
+	pthread_mutex_unlock(&context->progress_lock);
+}
+
+RenderStatus move_camera_to_front(RenderContext* context){	//Moves camera object to the front of object_array
+	Object** object_array = context->object_array;
 	Object* temp_object;
 	int counter = 0;
 	int num_cameras = 0;
-	while(counter < object_counter + 1){	//Iterate through all objects in object_array
+	while(counter < context->object_counter + 1){	//Iterate through all objects in object_array
 		if(object_array[counter]->kind == Camera && counter == 0){	//If first object is a camera, do nothing
 			num_cameras++;
 		}else if(object_array[counter]->kind == Camera){		//If a camera is found further in the array, switch first object with it
 			if((++num_cameras) > 1){	//But, if two cameras are ever found, throw an error
-				fprintf(stderr, "Error: You may only have one camera in your .json file\n");
-				exit(1);
+				return render_fail(context, RENDER_ERROR_SCENE, "You may only have one camera in your .json file");
 			}
 			temp_object = object_array[0];
 			object_array[0] = object_array[counter];
@@ -414,34 +946,72 @@ void move_camera_to_front(){	//Moves camera object to the front of object_array
 		}
 		counter++;
 	}
+	if(object_array[0]->kind != Camera){	//If camera is not present, throw an error
+		return render_fail(context, RENDER_ERROR_SCENE, "You must have one object of type camera");
+	}
+	return RENDER_OK;
 }
 
-void main(int c, char** argv){
-	int width;
-	int height;
-	double** pixel_buffer;
-	int counter = 0;
-	
-	argument_checker(c, argv);	//Check our arguments to make sure they written correctly
-	
-	width = atoi(argv[1]);
-	height = atoi(argv[2]);
-	
-	pixel_buffer = malloc(sizeof(double*)*(width*height + 1));	//Create our pixel array to hold color values
-	pixel_buffer[width*height] = NULL;
-	
-	while(counter < width*height){	//Reserve space for each pixel in our pixel array
-		pixel_buffer[counter] = malloc(sizeof(double)*3);
-		pixel_buffer[counter][0] = 0;
-		pixel_buffer[counter][1] = 0;
-		pixel_buffer[counter][2] = 0;
-		counter++;
+void free_scene(RenderContext* context){	//Drop the objects, lights and everything derived from them
+	free_shadow_caches(context);	//Walks light_array, so it goes first
+	for(int i = 0; i < context->object_counter + 1; i++){
+		free(context->object_array[i]);
 	}
-	object_counter = read_scene(argv[3], object_array);	//Parse .json scene file
-	move_camera_to_front();	//Make camera the first object in our object array
-	raymarch_scene(pixel_buffer, width, height);	//Raycast our scene into the pixel array
-	create_image(pixel_buffer, argv[4], width, height);	//Put info from pixel array into a P6 PPM file
+	for(int i = 0; i < context->light_counter; i++){
+		free(context->light_array[i]);
+	}
+	context->object_counter = -1;
+	context->light_counter = 0;
+}
 
-	// I would free pixel_buffer here, but we're not creating any more of it, and the main function is ending anyways
-    return;
-}
\ No newline at end of file
+// Give context its own copy of the scene loaded into source, set up like load_scene() leaves it, without
+// parsing the file again. Nothing derived from the image size or the shadow cache comes along
+RenderStatus copy_scene(RenderContext* context, RenderContext* source){
+	free_scene(context);
+	for(int i = 0; i < source->object_counter + 1; i++){
+		context->object_array[i] = malloc(sizeof(Object));
+		if(context->object_array[i] == NULL){
+			context->object_counter = i - 1;
+			free_scene(context);
+			return render_fail(context, RENDER_ERROR_MEMORY, "Out of memory while copying the scene");
+		}
+		memcpy(context->object_array[i], source->object_array[i], sizeof(Object));
+	}
+	context->object_counter = source->object_counter;
+	for(int i = 0; i < source->light_counter; i++){
+		context->light_array[i] = malloc(sizeof(Object));
+		if(context->light_array[i] == NULL){
+			context->light_counter = i;
+			free_scene(context);
+			return render_fail(context, RENDER_ERROR_MEMORY, "Out of memory while copying the scene");
+		}
+		memcpy(context->light_array[i], source->light_array[i], sizeof(Object));
+	}
+	context->light_counter = source->light_counter;
+	setup_object_lists(context);
+	return RENDER_OK;
+}
+
+// Parse the scene and get it ready to render, dropping whatever scene was loaded before. A scene that
+// fails to load leaves the context without one
+RenderStatus load_scene(RenderContext* context, char* scene_file){
+	char error[PARSE_ERROR_SIZE];
+	free_scene(context);
+	trace_begin("read_scene", TRACE_NO_INDEX);
+	int object_counter = read_scene(scene_file, context->object_array, error);	//Parse .json scene file
+	trace_end("read_scene");
+	if(object_counter < 0){
+		return render_fail(context, object_counter == SCENE_UNREADABLE ? RENDER_ERROR_FILE : RENDER_ERROR_SCENE, "%s", error);
+	}
+	context->object_counter = object_counter;
+	RenderStatus status = move_camera_to_front(context);	//Make camera the first object in our object array
+	if(status != RENDER_OK){
+		free_scene(context);
+		return status;
+	}
+	trace_begin("scene setup", TRACE_NO_INDEX);
+	extract_lights(context);	//Separate lights from the objects we march against
+	setup_object_lists(context);
+	trace_end("scene setup");
+	return RENDER_OK;
+}
@@ -1,15 +1,163 @@
 #ifndef RAYMARCH
 #define RAYMARCH
 
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "Parser/parse_json.h"
+#include "render.h"
+
 typedef struct{	//Holds object intersection information
 	int best_index;
-	double min_distance;
+	double min_distance;	//INFINITY once the ray has escaped the scene
     double position[3];
+	double distance;	//How far the ray has traveled
+	int steps;
 } Intersect;
 
-#define INTERSECTION_LIMIT .001
-#define OUTER_BOUNDS 1000000
+typedef struct{	//Subset of object_array a ray is marched against, see setup_object_lists()
+	int indices[MAX_OBJECTS];
+	int count;
+} ObjectList;
+
+typedef struct{	//How far and how precisely a ray is marched, see setup_march_limits()
+	ObjectList* objects;	//scene_objects, or marched_objects once start_hybrid_march() took the analytic ones out, or a bin's objects
+	ObjectList* unbinned;	//The list a bin's objects came from, NULL for rays that aren't binned
+	double bin_margin;	//Objects left out of the bin are at least this far from its rays, see Render/binning.c
+	double epsilon;	//Hit threshold at the start of the ray
+	double footprint;	//How much the hit threshold grows per unit traveled, from the pixel cone
+	double far_plane;	//Rays that travel further than this have escaped
+	int max_steps;
+	RenderContext* context;	//Whose objects the ray is marched against
+} MarchLimits;
+
+typedef struct{	//Where a --hybrid march hands over to every object, see start_hybrid_march()
+	double distance;	//INFINITY once there is nothing left to hand over
+	double far_plane;	//The full march's own far plane
+} HybridMarch;
+
+#define DEPENDENCY_WORDS 4	//Objects are recorded in DEPENDENCY_WORDS * 64 bits, indices past that share bits
+#define DEPENDENCY_REACH 4.0	//Objects a ray came within this many hit thresholds of are dependencies
+
+typedef struct{	//What one pixel's rays depended on, kept by --incremental, see Render/incremental.c
+	unsigned long long objects[DEPENDENCY_WORDS];	//Objects that bounded a march step within reach, bit index % 256
+	int hit_object;	//What the camera ray hit, 0 if it escaped
+	unsigned long long lights;	//Lights a shadow ray was marched to, bit index % 64
+	double distance;	//How far the camera ray went before it hit or escaped
+	double threshold;	//Hit threshold where the camera ray stopped
+} PixelDeps;
+
+#define INTERSECTION_LIMIT .001	//Smallest hit threshold, used where the pixel footprint is smaller than this
+#define OUTER_BOUNDS 1000000	//Far plane for scenes with unbounded objects
 #define COLOR_LIMIT 256.0
 #define MAX_STEPS 1000
+#define EPSILON_SCALE 0.1	//Default hit threshold as a fraction of the pixel footprint in scenes with a fractal
+#define SHADOW_TOLERANCE 1.0	//Shadow rays that stop this close to their target count as lit
+#define LOD_BIAS 2	//Extra fractal iterations on top of what the sample's detail calls for
+#define MANDELBULB_MIN_ITERATIONS 3
+#define MANDELBULB_MAX_ITERATIONS 20
+#define MANDELBULB_LIPSCHITZ 1.0	//The distance estimate's 0.5 factor already keeps it below the true distance
+#define MANDELBULB_SHELL_RADIUS 1.2	//The power 8 bulb stays within ~1.1 of its center
+#define MENGER_MIN_ITERATIONS 1
+#define MENGER_MAX_ITERATIONS 8
+#define MENGER_HALVINGS 1.585	//Every iteration cuts holes a third the size, log2(3)
+#define MANDELBOX_MIN_ITERATIONS 6
+#define MANDELBOX_MAX_ITERATIONS 20
+#define MANDELBOX_MIN_RADIUS2 0.25	//Squared radii of the sphere fold
+#define MANDELBOX_FIXED_RADIUS2 1.0
+#define MANDELBOX_BAILOUT 1024.0	//Squared
+#define JULIA_MIN_ITERATIONS 4
+#define JULIA_MAX_ITERATIONS 20
+#define JULIA_BAILOUT 256.0	//Squared
+#define FRACTAL_SHELL_MARGIN 0.1	//Fractals only iterate within this fraction of their shell radius outside the shell
+
+#define MAX_SHADOW_RAYS 8	//Per-pixel budget of shadow rays, spent on the most important lights first
+#define LIGHT_CULL_THRESHOLD (1.0 / COLOR_LIMIT)	//Light contributions dimmer than one color step are skipped
+#define SHADOW_MULT 0.25	//Shadowed light contributes 25% of its brightness
+
+typedef enum{	//What create_image() writes, picked by the output's extension, see Render/encode.c
+	IMAGE_PPM,
+	IMAGE_PNG,
+	IMAGE_QOI
+} ImageFormat;
+
+typedef struct{	//Unshadowed contribution of one light at an intersection
+	Object* light;
+	int light_index;	//Index into light_array
+	double color[3];
+	double importance;
+} LightSample;
+
+struct RenderContext{	//Everything a render reads or writes, contexts share nothing so each can render on its own threads
+	RenderOptions options;
+	Object* object_array[MAX_OBJECTS + 2];	//The camera, then the objects, set up by load_scene()
+	int object_counter;	//Index of the last object, -1 until a scene is loaded
+	Object* light_array[MAX_OBJECTS];	//Lights are moved out of object_array so marching never visits them
+	int light_counter;
+	RenderView view;	//How camera rays leave the camera, a render_batch() job's or all zero
+	MarchLimits camera_limits;	//Set up once the image size is known, see setup_march_limits()
+	double scene_radius;	//Every bounded object lies within this distance of the camera, INFINITY if any object is unbounded
+	ObjectList scene_objects;	//Every object we march against
+	ObjectList analytic_objects;	//Objects --hybrid intersects in closed form
+	ObjectList marched_objects;	//Objects --hybrid still has to march
+	int screen_bounds[MAX_OBJECTS + 1][4];	//Pixels each object's camera rays can hit with --binning, see Render/binning.c
+	int binning_id;	//Which project_object_bounds() call screen_bounds is from, 0 before the first
+	double bin_margin;	//How far past each object's bounds screen_bounds reaches
+	int empty_bins_escape;	//Rays of a bin without objects can't hit one or run out of steps, see binned_objects()
+	struct ShadowCache* shadow_caches;	//Parallel to light_array, see Render/shadow_cache.c
+	int shadow_cache_resolution;	//0 while the cache is off
+	RenderStats stats;	//What every thread's render_stats added up to, see merge_render_stats()
+	pthread_mutex_t stats_lock;
+	atomic_int cancelled;	//Checked between tiles, waves, chunks and pixels, see render_cancelled()
+	RenderProgress progress;	//NULL for no progress reports
+	void* progress_data;
+	pthread_mutex_t progress_lock;	//Progress callbacks never run concurrently
+	struct Incremental* incremental;	//What the last incremental render was made from, see Render/incremental.c
+	float* aovs[AOV_COUNT];	//NULL for every AOV the last render_image() didn't record, see Render/aov.c
+	int aov_pixels;
+	char error[RENDER_ERROR_SIZE];	//See render_fail()
+};
+
+extern _Thread_local RenderStats render_stats;	//Each thread counts into its own, see merge_render_stats()
+extern _Thread_local PixelDeps* recorded_deps;	//Where trace_pixel() records dependencies, NULL when nobody is asking
+
+static inline int render_cancelled( RenderContext* context ){
+	return atomic_load_explicit( &context->cancelled, memory_order_relaxed );
+}
+
+//Kernels shared by the per-pixel and wavefront pipelines
+double all_intersections( RenderContext* context, double* position, Intersect* intersect, double detail, ObjectList* objects );
+double hit_threshold( MarchLimits* limits, double distance );
+int advance_ray( Intersect* intersection, double* Rd, MarchLimits* limits );
+Intersect* raymarch( double* Ro, double* Rd, MarchLimits* limits );
+int march_step( Intersect* intersection, double* Rd, MarchLimits* limits );
+void start_hybrid_march( HybridMarch* hybrid, double* Ro, double* Rd, MarchLimits* limits );
+int resume_hybrid_march( Intersect* intersection, double* Rd, HybridMarch* hybrid, MarchLimits* limits );
+void secondary_ray_limits( RenderContext* context, MarchLimits* limits, double* origin, double epsilon );
+void shadow_ray_limits( RenderContext* context, MarchLimits* limits, Object* light, double* intersect_pos, double epsilon );
+void intersect_normal( RenderContext* context, double* normal, double* intersect_pos, double detail );
+double shadow_factor( double* light_collision, double* intersect_pos );
+int gather_light_samples( RenderContext* context, double* camera_direction, double* normal, double* position,
+							Object* object, LightSample* ranked, double* unranked_color );
+void shadow_ray_direction( double* direction, Object* light, double* position );
+void resolve_unranked_lights( double* color, double* unranked_color, double visibility, int num_ranked );
+void camera_ray_direction( RenderContext* context, double* Rd, int x, int y, int N, int M );
+Intersect* march_camera_ray( RenderContext* context, double* Rd, int x, int y, int N, int M );
+double shade_camera_hit( RenderContext* context, double* Rd, double* color, double* normal, Intersect* intersection );
+void trace_pixel( RenderContext* context, double* color, int pixel, int x, int y, int N, int M );
+RenderStatus load_scene( RenderContext* context, char* scene_file );
+RenderStatus copy_scene( RenderContext* context, RenderContext* source );
+void free_scene( RenderContext* context );
+double camera_epsilon_scale( RenderContext* context );
+void setup_march_limits( RenderContext* context, int N, int M );
+double object_bounds_radius( Object* object );
+double object_cull_radius( Object* object );
+void merge_render_stats( RenderContext* context );
+RenderStatus render_fail( RenderContext* context, RenderStatus status, const char* format, ... );
+void report_progress( RenderContext* context, long long done, long long total );
+RenderStatus create_image( RenderContext* context, double** pixel_buffer, char* output, int width, int height );
+RenderStatus write_image( RenderContext* context, double** pixel_buffer, char* file_name, ImageFormat format, int width, int height );
+RenderStatus prepare_render( RenderContext* context, int width, int height );	//See render.c
+double** wrap_framebuffer( double* framebuffer, int pixels );
 
 #endif
\ No newline at end of file
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raymarch.h"
+#include "Render/aov.h"
+#include "Render/autotune.h"
+#include "Render/batch.h"
+#include "Render/binning.h"
+#include "Render/encode.h"
+#include "Render/estimate.h"
+#include "Render/incremental.h"
+#include "Render/metrics.h"
+#include "Render/progressive.h"
+#include "Render/shadow_cache.h"
+#include "Render/thread_pool.h"
+#include "Render/tiles.h"
+#include "Render/trace.h"
+#include "Render/validate_sdf.h"
+#include "Render/wavefront.h"
+
+// The public side of librender, see render.h. These check what they're handed, get the context ready for
+// the image size and hand the framebuffer to the renderers in Render/ as the pixel pointers they work on.
+
+RenderContext* render_create(){
+	RenderContext* context = calloc( 1, sizeof(RenderContext) );
+	if( context == NULL ){
+		return NULL;
+	}
+	context->object_counter = -1;
+	context->options.threads = available_threads();
+	atomic_init( &context->cancelled, 0 );
+	pthread_mutex_init( &context->stats_lock, NULL );
+	pthread_mutex_init( &context->progress_lock, NULL );
+	return context;
+}
+
+void render_destroy( RenderContext* context ){
+	if( context == NULL ){
+		return;
+	}
+	free_scene( context );
+	free_incremental( context );
+	free_aovs( context );
+	pthread_mutex_destroy( &context->stats_lock );
+	pthread_mutex_destroy( &context->progress_lock );
+	free( context );
+}
+
+RenderOptions* render_options( RenderContext* context ){
+	return &context->options;
+}
+
+void render_set_progress( RenderContext* context, RenderProgress progress, void* data ){
+	context->progress = progress;
+	context->progress_data = data;
+}
+
+void render_cancel( RenderContext* context ){
+	atomic_store( &context->cancelled, 1 );
+}
+
+RenderStatus render_load_scene( RenderContext* context, char* scene_file ){
+	return load_scene( context, scene_file );
+}
+
+RenderStatus render_copy_scene( RenderContext* context, RenderContext* source ){
+	if( source->object_counter < 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "No scene is loaded" );
+	}
+	return copy_scene( context, source );
+}
+
+RenderStatus render_validate_sdf( RenderContext* context, SdfValidation* results ){
+	if( context->object_counter < 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "No scene is loaded" );
+	}
+	if( context->options.threads <= 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Threads can't be negative or zero" );
+	}
+	return validate_sdf( context, results );
+}
+
+int render_object_count( RenderContext* context ){
+	return context->object_counter < 0 ? 0 : context->scene_objects.count;
+}
+
+const char* render_error( RenderContext* context ){
+	return context->error;
+}
+
+RenderStats render_get_stats( RenderContext* context ){
+	pthread_mutex_lock( &context->stats_lock );
+	RenderStats stats = context->stats;
+	pthread_mutex_unlock( &context->stats_lock );
+	return stats;
+}
+
+void render_trace_start(){
+	trace_start();
+}
+
+RenderStatus render_trace_write( char* trace_file ){
+	return write_trace( trace_file );
+}
+
+RenderStatus render_metrics_start( char* metrics_file, double interval ){
+	return metrics_start( metrics_file, interval );
+}
+
+RenderStatus render_metrics_stop(){
+	return metrics_stop();
+}
+
+// What every renderer needs: a scene, a sane size and options, march limits for the size and the shadow
+// cache if it's on. The cache only depends on the scene, so it's kept until the next render_load_scene()
+RenderStatus prepare_render( RenderContext* context, int width, int height ){
+	RenderOptions* options = &context->options;
+	if( context->object_counter < 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "No scene is loaded" );
+	}
+	if( width <= 0 || height <= 0 || options->threads <= 0 || options->bounces < 0 || options->shadow_cache_resolution < 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Image size, threads, bounces and shadow cache resolution can't be negative or zero" );
+	}
+	if( options->shading_rate != 0 && options->shading_rate != 1 && options->shading_rate != 2 && options->shading_rate != 4 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "The shading rate must be 1, 2 or 4" );
+	}
+	if( options->bounces > 0 && !options->wavefront ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Bounces are only traced by the wavefront renderer" );
+	}
+	if( options->cropped && ( options->crop[0] < 0 || options->crop[1] < 0 || options->crop[0] >= options->crop[2] ||
+								options->crop[1] >= options->crop[3] || options->crop[2] > width || options->crop[3] > height ) ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "The crop window must be non-empty and lie inside the %dx%d image", width, height );
+	}
+	atomic_store( &context->cancelled, 0 );
+	setup_march_limits( context, width, height );
+	if( options->binning ){
+		project_object_bounds( context, width, height );
+	}
+	if( options->shadow_cache_resolution > 0 && context->shadow_cache_resolution != options->shadow_cache_resolution ){
+		trace_begin( "shadow cache", TRACE_NO_INDEX );	//March every light's cube of shadow rays up front
+		RenderStatus status = build_shadow_caches( context, options->shadow_cache_resolution, options->shadow_cache_file );
+		trace_end( "shadow cache" );
+		return status;
+	}
+	if( options->shadow_cache_resolution == 0 ){
+		free_shadow_caches( context );
+	}
+	return RENDER_OK;
+}
+
+double** wrap_framebuffer( double* framebuffer, int pixels ){	//The pixel pointers the renderers take, NULL without memory
+	double** pixel_buffer = malloc( sizeof(double*) * pixels );
+	for( int i = 0; pixel_buffer != NULL && i < pixels; i++ ){
+		pixel_buffer[i] = framebuffer + i*3;
+	}
+	return pixel_buffer;
+}
+
+RenderStatus render_image( RenderContext* context, double* framebuffer, int width, int height ){
+	RenderOptions* options = &context->options;
+	if( options->wavefront && ( options->cropped || options->checkpoint_file != NULL || options->shading_rate > 1 || options->binning ) ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Crop windows, checkpoints, shading rates and binning don't work with the wavefront renderer" );
+	}
+	if( options->aovs && options->checkpoint_file != NULL ){	//Tiles read back from the checkpoint have colors only
+		return render_fail( context, RENDER_ERROR_OPTIONS, "AOVs can't be recorded with a checkpoint" );
+	}
+	RenderStatus status = prepare_render( context, width, height );
+	if( status != RENDER_OK ){
+		return status;
+	}
+	int pixels = options->cropped ? ( options->crop[2] - options->crop[0] ) * ( options->crop[3] - options->crop[1] ) : width*height;
+	status = prepare_aovs( context, pixels );
+	if( status != RENDER_OK ){
+		return status;
+	}
+	double** pixel_buffer = wrap_framebuffer( framebuffer, pixels );
+	if( pixel_buffer == NULL ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while setting up the framebuffer" );
+	}
+	if( options->wavefront ){
+		memset( framebuffer, 0, sizeof(double) * 3 * pixels );	//Every bounce adds into its pixel
+		status = wavefront_render_scene( context, pixel_buffer, width, height );
+	}else{
+		status = tiled_render_scene( context, pixel_buffer, width, height );
+	}
+	free( pixel_buffer );
+	return status;
+}
+
+// Traces in passes until options.time_budget runs out, counted from this call, and keeps output up to date
+RenderStatus render_progressive( RenderContext* context, double* framebuffer, int width, int height, char* output ){
+	RenderOptions* options = &context->options;
+	double start_time = wall_clock();	//The budget covers building the shadow cache too
+	if( options->wavefront || options->cropped || options->checkpoint_file != NULL || options->shading_rate > 1 || options->aovs ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Progressive renders can't use the wavefront renderer, a crop window, a checkpoint, a shading rate or AOVs" );
+	}
+	RenderStatus status = prepare_render( context, width, height );
+	if( status != RENDER_OK ){
+		return status;
+	}
+	double** pixel_buffer = wrap_framebuffer( framebuffer, width*height );
+	if( pixel_buffer == NULL ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while setting up the framebuffer" );
+	}
+	status = progressive_render_scene( context, pixel_buffer, width, height, output, start_time );
+	free( pixel_buffer );
+	return status;
+}
+
+// Writes output and its .deps file, see Render/incremental.c. Between calls the framebuffer has to keep the
+// image the last call left in it, the first call reads it back from output
+RenderStatus render_incremental( RenderContext* context, double* framebuffer, int width, int height, char* output ){
+	RenderOptions* options = &context->options;
+	if( options->wavefront || options->cropped || options->checkpoint_file != NULL || options->shadow_cache_resolution > 0 || options->shading_rate > 1 ||
+		options->aovs || options->binning ){	//The cache's shadows depend on every object around the light
+		return render_fail( context, RENDER_ERROR_OPTIONS,
+							"Incremental renders only work with the tiled renderer on the whole image, without a shadow cache, shading rate, AOVs or binning" );
+	}
+	if( image_format( output ) != IMAGE_PPM ){	//The last image is read back to see what changed
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Incremental renders need a .ppm output" );
+	}
+	RenderStatus status = prepare_render( context, width, height );
+	if( status != RENDER_OK ){
+		return status;
+	}
+	double** pixel_buffer = wrap_framebuffer( framebuffer, width*height );
+	if( pixel_buffer == NULL ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while setting up the framebuffer" );
+	}
+	status = incremental_render_scene( context, pixel_buffer, width, height, output );
+	free( pixel_buffer );
+	return status;
+}
+
+RenderStatus render_write_image( RenderContext* context, double* framebuffer, int width, int height, char* output ){
+	double** pixel_buffer = wrap_framebuffer( framebuffer, width*height );
+	if( pixel_buffer == NULL ){
+		return render_fail( context, RENDER_ERROR_MEMORY, "Out of memory while writing \"%s\"", output );
+	}
+	RenderStatus status = create_image( context, pixel_buffer, output, width, height );
+	free( pixel_buffer );
+	return status;
+}
+
+RenderStatus render_autotune( RenderContext* context, int width, int height, double tolerance, char* tune_file, RenderTuning* tuning ){
+	if( context->object_counter < 0 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "No scene is loaded" );
+	}
+	return autotune( context, width, height, tolerance, tune_file, tuning );
+}
+
+RenderStatus render_estimate( RenderContext* context, int width, int height, RenderEstimate* estimate ){
+	RenderOptions* options = &context->options;
+	if( options->wavefront || options->shading_rate > 1 ){
+		return render_fail( context, RENDER_ERROR_OPTIONS, "Estimates only predict the tiled renderer at full shading rate" );
+	}
+	return estimate_render( context, width, height, estimate );
+}
+
+RenderStatus render_batch( RenderContext* context, RenderJob* jobs, int count ){
+	return batch_render( context, jobs, count );
+}
+
+RenderStatus render_read_manifest( RenderContext* context, char* manifest_file, RenderJob** jobs, int* count ){
+	return read_manifest( context, manifest_file, jobs, count );
+}
+
+void render_free_jobs( RenderJob* jobs, int count ){
+	free_jobs( jobs, count );
+}
+
+int render_view_set( const char* name, double eye_separation, RenderView* views, const char** names ){
+	return view_set( name, eye_separation, views, names );
+}
+
+const float* render_aov( RenderContext* context, RenderAov aov ){
+	return aov >= 0 && aov < AOV_COUNT ? context->aovs[aov] : NULL;
+}
+
+const char* render_aov_name( RenderAov aov ){
+	return aov >= 0 && aov < AOV_COUNT ? aov_names[aov] : NULL;
+}
+
+RenderStatus render_write_aovs( RenderContext* context, int width, int height, char* prefix ){
+	return write_aovs( context, width, height, prefix );
+}
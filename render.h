@@ -0,0 +1,202 @@
+#ifndef RENDER
+#define RENDER
+
+// librender, the renderer behind raymarcher as a library. Everything a render needs lives in a
+// RenderContext, so a process can hold any number of them and render each on its own threads at the same
+// time. Nothing exits or prints an error, calls return a RenderStatus and render_error() says what went
+// wrong. The process-wide pieces are the --trace timeline and the --metrics file, see render_trace_start()
+// and render_metrics_start().
+//
+//	RenderContext* context = render_create();
+//	if( render_load_scene( context, "scene.json" ) == RENDER_OK &&
+//		render_image( context, framebuffer, width, height ) == RENDER_OK ){
+//		render_write_image( context, framebuffer, width, height, "scene.ppm" );
+//	}
+//	render_destroy( context );
+
+#define DEFAULT_SHADOW_CACHE_RESOLUTION 256
+#define RENDER_ERROR_SIZE 512	//Longest message render_error() returns
+#define DEFAULT_AUTOTUNE_TOLERANCE 0.01	//RMS color difference render_autotune() accepts, colors are in [0, 1]
+#define DEFAULT_EYE_SEPARATION 0.1	//Distance between the eyes of a stereo pair, in scene units
+#define RENDER_MAX_VIEWS 6	//Most views of one render_view_set(), a cubemap's faces
+#define DEFAULT_METRICS_INTERVAL 5.0	//Seconds between rewrites of the metrics file
+
+typedef struct RenderContext RenderContext;
+
+typedef enum{
+	RENDER_OK,
+	RENDER_ERROR_FILE,	//A scene, image, checkpoint, shadow cache or dependency file couldn't be read or written
+	RENDER_ERROR_SCENE,	//The scene file isn't a valid scene, or a manifest isn't a valid list of jobs
+	RENDER_ERROR_OPTIONS,	//RenderOptions that don't go together, or a size that doesn't fit them
+	RENDER_ERROR_MEMORY,
+	RENDER_CANCELLED	//render_cancel() or the progress callback stopped the render
+} RenderStatus;
+
+typedef struct{	//Settings of a render, see render_options()
+	int wavefront;	//Render with the stage-batched pipeline in Render/wavefront.c
+	int bounces;	//Reflection/refraction depth, only traced by the wavefront pipeline
+	int stats;	//Print progressive, checkpoint and incremental summaries to stderr
+	int threads;	//Worker threads for parallel work, every processor by default
+	int shadow_cache_resolution;	//Texels per cube face of each light's shadow cache, 0 turns it off
+	char* shadow_cache_file;	//Reuse the shadow cache of an earlier render of the same geometry
+	int hybrid;	//Intersect planes, spheres and boxes analytically and only march the rest
+	int binning;	//March camera rays against only the objects whose bounds cover their part of the image, see Render/binning.c
+	double time_budget;	//Seconds to stop render_progressive() after, 0 for no limit
+	double snapshot_interval;	//Seconds between render_progressive() snapshots of the output file, 0 for none
+	int cropped;	//Only render the crop window, the framebuffer is the size of the window
+	int crop[4];	//x0 y0 x1 y1, top left origin, x1 and y1 are exclusive
+	char* checkpoint_file;	//Record finished tiles here and skip the ones an earlier run recorded
+	int shading_rate;	//1, 2 or 4, shade one pixel in shading_rate x shading_rate where the surface is smooth, 0 is 1
+	int aovs;	//Bit 1 << RenderAov for every AOV render_image() should record, see render_aov()
+} RenderOptions;
+
+typedef struct{	//Ray and step totals of every render of a context
+	long long camera_rays;
+	long long camera_steps;
+	long long shadow_rays;
+	long long shadow_steps;
+	long long cached_shadows;	//Shadows the shadow cache answered without marching
+	long long interpolated_pixels;	//Camera hits options.shading_rate colored from their neighbours without shading
+	long long oversteps;	//March steps that ended up inside a surface, an object's lipschitz is too low, see render_validate_sdf()
+	long long sdf_evaluations;	//Object SDFs evaluated by march steps and normals
+} RenderStats;
+
+typedef enum{	//Per-pixel auxiliary outputs of the camera rays, for compositing
+	AOV_DEPTH,	//Distance along the view axis to the hit, INFINITY where the camera ray escaped
+	AOV_NORMAL,	//World space normal at the hit, 3 floats per pixel, 0 where the camera ray escaped
+	AOV_OBJECT,	//Index of the object the camera ray hit, 0 where it escaped
+	AOV_STEPS,	//March steps the camera ray took
+	AOV_SHADOW,	//Share of the shadow-tested lights' light that reached the hit, 1 where nothing was tested
+	AOV_COUNT
+} RenderAov;
+
+typedef struct{	//Whether one object's march steps stayed out of it, see render_validate_sdf()
+	int object;	//Index of the object, as in the object AOV
+	const char* kind;	//"sphere", "mandelbulb" and so on, as in scene files
+	double lipschitz;	//What the scene declared, or the kind's default
+	double needed;	//Smallest lipschitz that keeps every sampled step out, 0 if none went in
+	double position[3];	//Where the step that needed it started
+	int samples;	//Steps checked
+	int violations;	//Steps that ended up inside the object, the march would step through the surface there
+} SdfValidation;
+
+typedef enum{	//How camera rays leave the camera
+	PROJECTION_PLANAR,	//Through the camera's width x height image plane at z = 1, as in a single render
+	PROJECTION_CUBE_FACE,	//Through one face of a cube around the camera, 90 degrees across with square pixels
+	PROJECTION_EQUIRECTANGULAR	//Every direction, longitude across the image and latitude up it, +z in the middle
+} RenderProjection;
+
+typedef struct{	//Where a job of render_batch() looks from, all zero for the scene's own camera
+	RenderProjection projection;
+	int face;	//Cube face 0 to 5, +x -x +y -y +z -z. Up is +y, on the +y and -y faces it's -z and +z
+	double eye[3];	//Where rays start, relative to the scene's camera. A stereo pair's eyes sit either side of it
+} RenderView;
+
+typedef struct{	//One image of render_batch()
+	char* scene_file;
+	char* output;	//The image is written as soon as the job's last tile is done, in the format of its extension
+	int width;
+	int height;
+	int priority;	//Tiles of higher priority jobs are traced first, jobs of the same priority in the order given
+	RenderView view;
+	RenderStatus status;	//How the job went, set by render_batch()
+	char error[RENDER_ERROR_SIZE];	//Why, if status isn't RENDER_OK
+} RenderJob;
+
+typedef struct{	//Settings render_autotune() picked
+	int hybrid;	//As in RenderOptions
+	int shading_rate;
+	int shadow_cache_resolution;
+	double epsilon_scale;	//The camera's hit threshold as a fraction of the pixel footprint, as in scene files
+	double seconds;	//Time of the whole render with them, projected from the sample
+	double untuned_seconds;	//and with the settings the context had
+	double error;	//RMS color difference from the untuned render over the sample
+	int cached;	//Read back from the tune file instead of sampled
+} RenderTuning;
+
+typedef struct{	//A total render_estimate() extrapolated, and the interval the true total lies in with the estimate's confidence
+	double estimate;
+	double low;
+	double high;
+} RenderInterval;
+
+typedef struct{	//What render_estimate() predicts a render_image() of the same size and options costs
+	int pixels;	//Traced by the render, the crop window's with options.cropped
+	int samples;	//Pixels traced for the estimate
+	double confidence;	//Chance each interval holds the true total, counting sampling error only
+	RenderInterval sdf_evaluations;
+	RenderInterval march_steps;	//Camera and shadow ray steps
+	RenderInterval seconds;	//Wall time on options.threads threads, setup included
+	double setup_seconds;	//Setting up the render, building the shadow cache if it's on
+	double estimate_seconds;	//What the estimate itself took
+} RenderEstimate;
+
+// Called from the rendering threads with the finished fraction of the render, one call at a time.
+// Returning nonzero cancels the render
+typedef int (*RenderProgress)( double fraction, void* data );
+
+RenderContext* render_create();	//NULL if out of memory
+void render_destroy( RenderContext* context );
+RenderOptions* render_options( RenderContext* context );	//Change these before rendering, not during
+void render_set_progress( RenderContext* context, RenderProgress progress, void* data );
+void render_cancel( RenderContext* context );	//Safe from any thread, the render returns RENDER_CANCELLED
+RenderStatus render_load_scene( RenderContext* context, char* scene_file );	//Replaces the scene loaded before
+RenderStatus render_copy_scene( RenderContext* context, RenderContext* source );	//Same as loading source's scene file again, without parsing it
+
+// Framebuffers hold 3 doubles in [0, 1] per pixel, top row first. width and height are the size of the
+// whole image, with options.cropped the framebuffer only holds the crop window
+RenderStatus render_image( RenderContext* context, double* framebuffer, int width, int height );
+RenderStatus render_progressive( RenderContext* context, double* framebuffer, int width, int height, char* output );
+RenderStatus render_incremental( RenderContext* context, double* framebuffer, int width, int height, char* output );	//output has to be a .ppm
+// Writes a P6 PPM, or a PNG or QOI if output ends in .png or .qoi. PNGs compress on options.threads threads
+RenderStatus render_write_image( RenderContext* context, double* framebuffer, int width, int height, char* output );
+
+// Renders every job with the context's options, on one pool of options.threads threads that traces the
+// tiles of all jobs, highest priority first. Each scene file is parsed once however many jobs render it,
+// and its shadow cache built once for all of them. A job that fails doesn't stop the others, the call fails
+// if any job did. Stats add up every job's
+RenderStatus render_batch( RenderContext* context, RenderJob* jobs, int count );
+// Fills views with the set called name, "stereo" (left and right eye), "cubemap" (faces px nx py ny pz nz)
+// or "equirect", and names with what each view is called. Returns how many, 0 for an unknown set
+int render_view_set( const char* name, double eye_separation, RenderView* views, const char** names );
+// Reads jobs from a .json manifest, an array of { "scene", "width", "height", "output", "priority" }, or a
+// .csv one with a scene,width,height,output[,priority] line per job. Free them with render_free_jobs()
+RenderStatus render_read_manifest( RenderContext* context, char* manifest_file, RenderJob** jobs, int* count );
+void render_free_jobs( RenderJob* jobs, int count );
+
+// AOVs of the last render_image(), laid out like its framebuffer. NULL unless options.aovs asked for it
+const float* render_aov( RenderContext* context, RenderAov aov );
+const char* render_aov_name( RenderAov aov );	//"depth", "normal", "object", "steps" or "shadow", as in the file names, NULL for anything else
+RenderStatus render_write_aovs( RenderContext* context, int width, int height, char* prefix );	//<prefix>.depth.pfm, .normal.pfm, .object.pgm, .steps.pgm, .shadow.pfm
+
+// Times a sparse sample of tiles of a width x height render under other hybrid, shading rate, shadow cache and
+// hit threshold settings, and switches the context to the fastest whose sample is within tolerance of the
+// current settings'. The pick is appended to tune_file (NULL for none) under a hash of the scene, size and
+// options, later calls with the same ones read it back without sampling
+RenderStatus render_autotune( RenderContext* context, int width, int height, double tolerance, char* tune_file, RenderTuning* tuning );
+
+// Traces a sparse stratified sample of the pixels of a width x height render_image() through the same
+// march and shading code and extrapolates its SDF evaluations, steps and wall time, without rendering it.
+// Only predicts the tiled renderer at full shading rate
+RenderStatus render_estimate( RenderContext* context, int width, int height, RenderEstimate* estimate );
+
+// Takes march steps from points sampled around every object and checks none of them ends up inside it,
+// which a lipschitz too low for the object's SDF allows. results holds render_object_count() entries
+RenderStatus render_validate_sdf( RenderContext* context, SdfValidation* results );
+int render_object_count( RenderContext* context );	//Objects of the loaded scene, without the camera and lights
+
+const char* render_error( RenderContext* context );	//Why the last call failed
+RenderStats render_get_stats( RenderContext* context );
+
+void render_trace_start();	//Start recording the timeline of every context's renders
+RenderStatus render_trace_write( char* trace_file );	//Chrome trace-event JSON of everything recorded so far
+
+// Rewrite metrics_file every interval seconds, from a thread of its own, with Prometheus text format totals
+// of every context's renders since this call: tiles, rays, steps, rays per second, mean steps per ray,
+// progress and ETA of the latest render, and each worker's busy and CPU time. The file is written once
+// before this returns, RENDER_ERROR_FILE if it can't be. Rendering threads count with relaxed atomics once
+// per tile, the march loop doesn't change
+RenderStatus render_metrics_start( char* metrics_file, double interval );
+RenderStatus render_metrics_stop();	//Writes the final totals and stops the thread
+
+#endif
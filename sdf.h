@@ -0,0 +1,69 @@
+#ifndef SDF
+#define SDF
+
+#include <math.h>
+
+#include "Math/vec3.h"
+#include "Parser/parse_json.h"
+
+// Distance functions of every primitive in its own frame, shared by all_intersections() and Bench/sdf_bench.c.
+// They are static inline so they fold into all_intersections(), handing a Vec3 through an out-of-line call
+// round trips it through the stack and made the march twice as slow
+
+static inline Vec3 apply_transformations( Vec3 position, Object* object ){	//Move a world position into the object's own frame
+	return mat3_apply( &object->rotation_matrix, vec3_sub( position, vec3_load( object->position ) ) );
+}
+
+static inline double sphere_sdf( Vec3 position, double radius ){ //Calculate how far our ray position is from the sphere
+	return vec3_length( position ) - radius;
+}
+
+static inline double plane_sdf( Vec3 position, Vec3 plane_normal ){
+	return vec3_dot( position, plane_normal );
+}
+
+static inline double box_sdf( Vec3 position, Vec3 dimensions ){
+	Vec3 distance_vect = vec3_sub( vec3_abs( position ), dimensions );
+	double inside_distance = vec3_max_component( distance_vect );
+	return vec3_length( vec3_max( distance_vect, 0.0 ) ) + ( inside_distance < 0.0 ? inside_distance : 0.0 );
+}
+
+static inline double donut_sdf( Vec3 position, double radius, double thickness ){
+	double diameter = radius * 2;
+	double ring_distance = vec3_length_xz( position ) - diameter;
+	return sqrt( ring_distance*ring_distance + position.y*position.y ) - thickness;
+}
+
+static inline double cone_sdf( Vec3 position, double* cos_sin, double height ){	//cos_sin holds the cosine and sine of the cone's angle
+	double side = cos_sin[0] * vec3_length_xz( position ) + cos_sin[1] * position.y;
+	double base = -height - position.y;
+	return side > base ? side : base;
+}
+
+static inline double eternal_cylinder_sdf( Vec3 position, double radius ){
+	return vec3_length_xz( position ) - radius;
+}
+
+// Fold the position into the tile around center, next to the copy of the object nearest to it. Tiles
+// centered on anything but the object cut its copies off at their edges and the SDF jumps there
+static inline Vec3 infinite_shape( Vec3 position, Vec3 center, double tile_size ){
+	Vec3 offset = vec3_sub( position, center );
+	return vec3( center.x + offset.x - tile_size * round( offset.x / tile_size ),
+				center.y + offset.y - tile_size * round( offset.y / tile_size ),
+				center.z + offset.z - tile_size * round( offset.z / tile_size ) );
+}
+
+static inline int is_fractal( Primitive kind ){	//Escape-time fractals, their distances go through fractal_sdf()
+	return kind == Mandelbulb || kind == Menger || kind == Mandelbox || kind == Julia;
+}
+
+int lod_iterations( double detail, double halvings, int min_iterations, int max_iterations, double lod_bias );
+double mandelbulb_sdf( Vec3 position, int iterations );
+double menger_sdf( Vec3 position, int iterations );
+double mandelbox_sdf( Vec3 position, double scale, int iterations );
+double mandelbox_extent( double scale );
+double julia_sdf( Vec3 position, const double* constant, int iterations );
+double fractal_shell_radius( Object* object );
+double fractal_sdf( Vec3 position, Object* object, double detail, double lod_bias );
+
+#endif